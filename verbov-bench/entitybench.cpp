@@ -0,0 +1,627 @@
+// Микробенчмарки слоя сущностей (libentities) на заранее заполненной БД.
+//
+// verbov-entities-bench --rows 1000000
+// Первый запуск заполняет entitybench_<rows>.sqlite3, следующие его
+// переиспользуют. rows -- число участников событий, пользователей,
+// событий и сессий в --per-event раз меньше.
+
+#include <algorithm>
+#include <optional>
+#include <random>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QRegularExpression>
+#include <QSqlError>
+#include <QTextStream>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+#include "DB/event.h"
+#include "DB/eventparticipant.h"
+#include "DB/session.h"
+#include "DB/user.h"
+
+namespace {
+
+struct Dataset {
+    qint64 rows = 0;   // Участников.
+    qint64 users = 0;
+    qint64 events = 0;
+    qint64 sessions = 0;
+    qint64 per_event = 0;
+};
+
+// Детерминированные значения строк, чтобы потом искать по ним.
+QString refer_for(qint64 event_id) {
+    QString refer;
+    for (int i = 0; i < 9; ++i) {
+        refer.prepend(QChar(static_cast<char16_t>('a' + event_id % 26)));
+        event_id /= 26;
+    }
+    return refer;
+}
+
+QString token_for(qint64 session_id) {
+    const QByteArray bytes = QByteArray::number(session_id);
+    return QCryptographicHash::hash(bytes, QCryptographicHash::Algorithm::Sha3_256).toHex();
+}
+
+qint64 participant_user(const Dataset& data, qint64 index) {
+    // Соседние index одного события дают разных пользователей,
+    // если users не кратно 7919, это проверяется при заполнении.
+    const qint64 event_id = index / data.per_event + 1;
+    return (index * 7919 + event_id) % data.users + 1;
+}
+
+bool exec(QSqlQuery& query) {
+    if (!query.exec()) {
+        qCritical() << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool exec(QSqlDatabase& db, const QString& sql) {
+    QSqlQuery query(db);
+    if (!query.exec(sql)) {
+        qCritical() << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool is_seeded(QSqlDatabase& db, const Dataset& data) {
+    QSqlQuery query(db);
+    if (!query.exec("SELECT rows, per_event FROM BenchMeta")) {
+        return false;
+    }
+    return query.first() && query.value(0).toLongLong() == data.rows && query.value(1).toLongLong() == data.per_event;
+}
+
+bool seed(QSqlDatabase& db, const Dataset& data, std::mt19937_64& generator) {
+    // Потерять БД бенчмарка при сбое не страшно.
+    if (!exec(db, "PRAGMA journal_mode = OFF") || !exec(db, "PRAGMA synchronous = OFF")) {
+        return false;
+    }
+
+    if (!User::check_table(db) || !Session::check_table(db) ||
+        !Event::check_table(db) || !EventParticipant::check_table(db)) {
+        return false;
+    }
+
+    if (!db.transaction()) {
+        qCritical() << db.lastError().text();
+        return false;
+    }
+
+    const QString password_hash = QString('0').repeated(64);
+    const quint64 now = QDateTime::currentSecsSinceEpoch();
+
+    QTextStream out(stdout);
+    out << "seeding " << data.users << " users, " << data.events << " events, "
+        << data.rows << " participants, " << data.sessions << " sessions\n";
+    out.flush();
+
+    QSqlQuery users(db);
+    if (!users.prepare("INSERT INTO Users(vk_id, first_name, last_name, reg_confirmed, reg_code, password_hash) "
+                       "VALUES (?, ?, ?, 1, ?, ?)")) {
+        qCritical() << users.lastError().text();
+        return false;
+    }
+    for (qint64 i = 1; i <= data.users; ++i) {
+        users.bindValue(0, i);
+        users.bindValue(1, "Имя" + QString::number(i % 1000));
+        users.bindValue(2, "Фамилия" + QString::number(i));
+        users.bindValue(3, static_cast<qint64>(generator() % 1000000));
+        users.bindValue(4, password_hash);
+        if (!exec(users)) {
+            return false;
+        }
+    }
+
+    QSqlQuery events(db);
+    if (!events.prepare("INSERT INTO Events(id, name, refer_str, creator_user_id, timestamp, last_notification_level) "
+                        "VALUES (?, ?, ?, ?, ?, 0)")) {
+        qCritical() << events.lastError().text();
+        return false;
+    }
+    for (qint64 i = 1; i <= data.events; ++i) {
+        events.bindValue(0, i);
+        events.bindValue(1, "Событие " + QString::number(i));
+        events.bindValue(2, refer_for(i));
+        events.bindValue(3, static_cast<qint64>(generator() % data.users + 1));
+        events.bindValue(4, static_cast<qint64>(now + generator() % (30 * 24 * 60 * 60)));
+        if (!exec(events)) {
+            return false;
+        }
+    }
+
+    QSqlQuery participants(db);
+    if (!participants.prepare("INSERT INTO EventParticipants(event_id, user_id, registered_time) VALUES (?, ?, ?)")) {
+        qCritical() << participants.lastError().text();
+        return false;
+    }
+    for (qint64 i = 0; i < data.rows; ++i) {
+        participants.bindValue(0, i / data.per_event + 1);
+        participants.bindValue(1, participant_user(data, i));
+        participants.bindValue(2, static_cast<qint64>(now));
+        if (!exec(participants)) {
+            return false;
+        }
+    }
+
+    QSqlQuery sessions(db);
+    if (!sessions.prepare("INSERT INTO Sessions(id, user_id, token, start_time) VALUES (?, ?, ?, ?)")) {
+        qCritical() << sessions.lastError().text();
+        return false;
+    }
+    for (qint64 i = 1; i <= data.sessions; ++i) {
+        sessions.bindValue(0, i);
+        sessions.bindValue(1, (i - 1) % data.users + 1);
+        sessions.bindValue(2, token_for(i));
+        sessions.bindValue(3, static_cast<qint64>(now));
+        if (!exec(sessions)) {
+            return false;
+        }
+    }
+
+    if (!exec(db, "CREATE TABLE BenchMeta(rows INTEGER, per_event INTEGER)")) {
+        return false;
+    }
+    QSqlQuery meta(db);
+    if (!meta.prepare("INSERT INTO BenchMeta(rows, per_event) VALUES (?, ?)")) {
+        qCritical() << meta.lastError().text();
+        return false;
+    }
+    meta.bindValue(0, data.rows);
+    meta.bindValue(1, data.per_event);
+    if (!exec(meta)) {
+        return false;
+    }
+
+    if (!db.commit()) {
+        qCritical() << db.lastError().text();
+        return false;
+    }
+
+    return exec(db, "PRAGMA journal_mode = DELETE") && exec(db, "PRAGMA synchronous = FULL");
+}
+
+class Runner {
+public:
+    Runner(const QRegularExpression& filter, int iterations, double max_seconds)
+        : filter_(filter), iterations_(iterations), max_seconds_(max_seconds) {}
+
+    bool enabled(const QString& name) const {
+        return filter_.match(name).hasMatch();
+    }
+
+    // Вызывает body до iterations раз, но не дольше max_seconds. body
+    // получает номер итерации и Sample, в который сам пишет замеры: так
+    // подготовка (например, генерация токена перед create) не попадает
+    // в результат.
+    struct Sample {
+        Runner* runner;
+
+        void record(const QString& name, qint64 ns) {
+            runner->samples_[name].push_back(ns);
+        }
+
+        template <typename F>
+        bool time(const QString& name, F&& f) {
+            QElapsedTimer timer;
+            timer.start();
+            const bool ok = f();
+            record(name, timer.nsecsElapsed());
+            return ok;
+        }
+    };
+
+    template <typename Body>
+    bool run(const QString& name, Body&& body) {
+        if (!enabled(name)) {
+            return true;
+        }
+
+        QElapsedTimer total;
+        total.start();
+        Sample sample{this};
+        for (int i = 0; i < iterations_ && total.elapsed() < max_seconds_ * 1000; ++i) {
+            if (!body(i, sample)) {
+                qCritical() << "benchmark" << name << "failed at iteration" << i;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    QString text_report() const {
+        QString report;
+        report += QString("%1 %2 %3 %4 %5 %6\n")
+                      .arg("benchmark", -40).arg("n", 8).arg("mean us", 10)
+                      .arg("p50 us", 10).arg("p99 us", 10).arg("ops/s", 12);
+        for (auto it = samples_.constBegin(); it != samples_.constEnd(); ++it) {
+            const Summary s = summarize(it.value());
+            report += QString("%1 %2 %3 %4 %5 %6\n")
+                          .arg(it.key(), -40).arg(s.n, 8)
+                          .arg(s.mean_us, 10, 'f', 2).arg(s.p50_us, 10, 'f', 2)
+                          .arg(s.p99_us, 10, 'f', 2).arg(s.ops_per_sec, 12, 'f', 0);
+        }
+        return report;
+    }
+
+    QJsonObject json_report() const {
+        QJsonObject result;
+        for (auto it = samples_.constBegin(); it != samples_.constEnd(); ++it) {
+            const Summary s = summarize(it.value());
+            result[it.key()] = QJsonObject{
+                {"n", s.n},
+                {"mean_us", s.mean_us},
+                {"p50_us", s.p50_us},
+                {"p99_us", s.p99_us},
+                {"ops_per_sec", s.ops_per_sec},
+            };
+        }
+        return result;
+    }
+
+private:
+    struct Summary {
+        qint64 n = 0;
+        double mean_us = 0;
+        double p50_us = 0;
+        double p99_us = 0;
+        double ops_per_sec = 0;
+    };
+
+    static Summary summarize(QVector<qint64> samples) {
+        Summary s;
+        s.n = samples.size();
+        if (samples.isEmpty()) {
+            return s;
+        }
+        std::sort(samples.begin(), samples.end());
+
+        double sum = 0;
+        for (qint64 ns: samples) {
+            sum += ns;
+        }
+        s.mean_us = sum / samples.size() / 1000.0;
+        s.p50_us = samples[(samples.size() - 1) / 2] / 1000.0;
+        s.p99_us = samples[std::min<qsizetype>(samples.size() - 1, samples.size() * 99 / 100)] / 1000.0;
+        s.ops_per_sec = s.mean_us > 0 ? 1e6 / s.mean_us : 0;
+        return s;
+    }
+
+    QRegularExpression filter_;
+    int iterations_;
+    double max_seconds_;
+    QMap<QString, QVector<qint64>> samples_;
+};
+
+// Строки таблицы пачками по batch, время на одну строку.
+template <typename Entity>
+bool bench_unpack(Runner& runner, QSqlDatabase& db, const QString& name, const QString& key,
+                  qint64 num_rows, int batch, std::mt19937_64& generator, Entity prototype) {
+    return runner.run(name, [&](int, Runner::Sample& sample) {
+        QSqlQuery query(db);
+        query.setForwardOnly(true);
+        if (!query.prepare(QString(schema::select<Entity>.data) + " WHERE " + key + " >= ? LIMIT ?")) {
+            qCritical() << query.lastError().text();
+            return false;
+        }
+        query.bindValue(0, static_cast<qint64>(generator() % std::max<qint64>(num_rows - batch, 1) + 1));
+        query.bindValue(1, batch);
+        if (!exec(query)) {
+            return false;
+        }
+
+        // Время только самого разбора, без шагов по результату.
+        Entity entity = prototype;
+        qint64 unpacked = 0;
+        qint64 elapsed_ns = 0;
+        QElapsedTimer timer;
+        while (query.next()) {
+            timer.start();
+            if (!entity.unpack_from_query(query)) {
+                return false;
+            }
+            elapsed_ns += timer.nsecsElapsed();
+            ++unpacked;
+        }
+        if (unpacked > 0) {
+            sample.record(name, elapsed_ns / unpacked);
+        }
+        return true;
+    });
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("verbov-entities-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Microbenchmarks of the entity layer on a seeded SQLite database.");
+    parser.addHelpOption();
+
+    QCommandLineOption rows_option("rows", "Number of event participant rows (10000 .. 10000000).", "n", "10000");
+    QCommandLineOption per_event_option("per-event", "Participants per event; users, events and sessions are rows / per-event.", "n", "10");
+    QCommandLineOption db_option("db", "Database file, default entitybench_<rows>.sqlite3.", "path");
+    QCommandLineOption iterations_option("iterations", "Max iterations per benchmark.", "n", "2000");
+    QCommandLineOption seconds_option("max-seconds", "Max time per benchmark.", "sec", "5");
+    QCommandLineOption batch_option("batch", "Rows per unpack batch and vector size for serialization.", "n", "1000");
+    QCommandLineOption filter_option("filter", "Run only benchmarks whose name matches this regex.", "regex", ".");
+    QCommandLineOption seed_option("seed", "Random seed.", "n", "1");
+    QCommandLineOption json_option("json", "Also write the report as JSON to this file.", "file");
+
+    parser.addOptions({rows_option, per_event_option, db_option, iterations_option, seconds_option,
+                       batch_option, filter_option, seed_option, json_option});
+    parser.process(app);
+
+    Dataset data;
+    data.rows = parser.value(rows_option).toLongLong();
+    data.per_event = parser.value(per_event_option).toLongLong();
+    if (data.rows <= 0 || data.per_event <= 0 || data.per_event > 1000) {
+        qCritical() << "Bad rows or per-event";
+        return 1;
+    }
+    data.events = std::max<qint64>(data.rows / data.per_event, 1);
+    data.users = std::max<qint64>(data.rows / data.per_event, 1000);
+    if (data.users % 7919 == 0) {
+        data.users += 1;
+    }
+    data.sessions = data.users;
+
+    const int iterations = parser.value(iterations_option).toInt();
+    const double max_seconds = parser.value(seconds_option).toDouble();
+    const int batch = parser.value(batch_option).toInt();
+    const QRegularExpression filter(parser.value(filter_option));
+    if (iterations <= 0 || max_seconds <= 0 || batch <= 0 || !filter.isValid()) {
+        qCritical() << "Bad iterations, max-seconds, batch or filter";
+        return 1;
+    }
+
+    std::mt19937_64 generator(parser.value(seed_option).toULongLong());
+
+    const QString db_path = parser.isSet(db_option)
+        ? parser.value(db_option)
+        : "entitybench_" + QString::number(data.rows) + ".sqlite3";
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
+    db.setDatabaseName(db_path);
+    if (!db.open()) {
+        qCritical() << db.lastError().text();
+        return 1;
+    }
+    if (!is_seeded(db, data)) {
+        db.close();
+        QFile::remove(db_path);
+        if (!db.open() || !seed(db, data, generator)) {
+            return 1;
+        }
+    }
+
+    Runner runner(filter, iterations, max_seconds);
+    auto random_user = [&]() { return static_cast<quint64>(generator() % data.users + 1); };
+    auto random_event = [&]() { return static_cast<quint64>(generator() % data.events + 1); };
+    auto random_session = [&]() { return static_cast<qint64>(generator() % data.sessions + 1); };
+
+    bool ok = true;
+
+    // Разбор строк.
+    ok = ok && bench_unpack(runner, db, "User::unpack_from_query", "vk_id", data.users, batch, generator, User());
+    ok = ok && bench_unpack(runner, db, "Event::unpack_from_query", "id", data.events, batch, generator, Event());
+    ok = ok && bench_unpack(runner, db, "Session::unpack_from_query", "id", data.sessions, batch, generator, Session());
+    ok = ok && bench_unpack(runner, db, "EventParticipant::unpack_from_query", "event_id",
+                            data.events, batch, generator, EventParticipant(0, 0));
+
+    // Чтение.
+    ok = ok && runner.run("User::fetch_by_vk_id", [&](int, Runner::Sample& sample) {
+        std::optional<User> user;
+        const quint64 vk_id = random_user();
+        return sample.time("User::fetch_by_vk_id", [&] { return User::fetch_by_vk_id(db, vk_id, user); }) && user.has_value();
+    });
+    ok = ok && runner.run("User::fetch_by_event_id", [&](int, Runner::Sample& sample) {
+        QVector<User> users;
+        const quint64 event_id = random_event();
+        return sample.time("User::fetch_by_event_id", [&] { return User::fetch_by_event_id(db, event_id, users); });
+    });
+    ok = ok && runner.run("User::fetch_page_by_event_id", [&](int, Runner::Sample& sample) {
+        QVector<UserBrief> users;
+        const quint64 event_id = random_event();
+        return sample.time("User::fetch_page_by_event_id", [&] { return User::fetch_page_by_event_id(db, event_id, 0, 200, users); });
+    });
+    ok = ok && runner.run("Session::fetch_by_id", [&](int, Runner::Sample& sample) {
+        std::optional<Session> session;
+        const qint64 id = random_session();
+        return sample.time("Session::fetch_by_id", [&] { return Session::fetch_by_id(db, id, session); }) && session.has_value();
+    });
+    ok = ok && runner.run("Session::fetch_by_token", [&](int, Runner::Sample& sample) {
+        std::optional<Session> session;
+        const QString token = token_for(random_session());
+        return sample.time("Session::fetch_by_token", [&] { return Session::fetch_by_token(db, token, session); }) && session.has_value();
+    });
+    ok = ok && runner.run("Event::fetch_by_id", [&](int, Runner::Sample& sample) {
+        std::optional<Event> event;
+        const quint64 id = random_event();
+        return sample.time("Event::fetch_by_id", [&] { return Event::fetch_by_id(db, id, event); }) && event.has_value();
+    });
+    ok = ok && runner.run("Event::fetch_by_refer", [&](int, Runner::Sample& sample) {
+        std::optional<Event> event;
+        const QString refer = refer_for(random_event());
+        return sample.time("Event::fetch_by_refer", [&] { return Event::fetch_by_refer(db, refer, event); }) && event.has_value();
+    });
+    ok = ok && runner.run("Event::fetch_all_for_user", [&](int, Runner::Sample& sample) {
+        QVector<Event> events;
+        const quint64 user_id = random_user();
+        return sample.time("Event::fetch_all_for_user", [&] { return Event::fetch_all_for_user(db, user_id, events); });
+    });
+    ok = ok && runner.run("EventParticipant::fetch", [&](int, Runner::Sample& sample) {
+        std::optional<EventParticipant> participant;
+        const qint64 index = static_cast<qint64>(generator() % data.rows);
+        const quint64 event_id = index / data.per_event + 1;
+        const quint64 user_id = participant_user(data, index);
+        return sample.time("EventParticipant::fetch", [&] { return EventParticipant::fetch(db, event_id, user_id, participant); })
+            && participant.has_value();
+    });
+    ok = ok && runner.run("EventParticipant::fetch_all_for_event", [&](int, Runner::Sample& sample) {
+        QVector<EventParticipant> participants;
+        const quint64 event_id = random_event();
+        return sample.time("EventParticipant::fetch_all_for_event", [&] {
+            return EventParticipant::fetch_all_for_event(db, event_id, participants);
+        });
+    });
+    ok = ok && runner.run("EventParticipant::fetch_all_for_user", [&](int, Runner::Sample& sample) {
+        QVector<EventParticipant> participants;
+        const quint64 user_id = random_user();
+        return sample.time("EventParticipant::fetch_all_for_user", [&] {
+            return EventParticipant::fetch_all_for_user(db, user_id, participants);
+        });
+    });
+
+    // Запись. Созданные строки тут же удаляются, БД возвращается в исходное состояние.
+    // Новые пользователи получают vk_id за пределами заполненного диапазона.
+    const quint64 first_new_user = data.users + 1;
+
+    ok = ok && runner.run("User::create/update/drop", [&](int i, Runner::Sample& sample) {
+        User user(first_new_user + i);
+        user.first_name = "Бенч";
+        user.last_name = "Марк";
+        user.set_password(QString("password"));
+        if (!sample.time("User::create", [&] { return user.create(db); })) {
+            return false;
+        }
+        user.reg_confirmed = true;
+        return sample.time("User::update", [&] { return user.update(db); })
+            && sample.time("User::drop", [&] { return user.drop(db); });
+    });
+    ok = ok && runner.run("Session::create/update/drop", [&](int, Runner::Sample& sample) {
+        Session session;
+        session.user_id = random_user();
+        if (!session.generate_token(db)) {
+            return false;
+        }
+        session.set_time_started();
+        if (!sample.time("Session::create", [&] { return session.create(db); })) {
+            return false;
+        }
+        session.start_time += 1;
+        return sample.time("Session::update", [&] { return session.update(db); })
+            && sample.time("Session::drop", [&] { return session.drop(db); });
+    });
+    ok = ok && runner.run("Event::create/update/drop", [&](int, Runner::Sample& sample) {
+        Event event;
+        event.name = "Бенчмарк";
+        event.creator_user_id = random_user();
+        event.timestamp = QDateTime::currentSecsSinceEpoch() + 24 * 60 * 60;
+        if (!event.generate_refer(db)) {
+            return false;
+        }
+        if (!sample.time("Event::create", [&] { return event.create(db); })) {
+            return false;
+        }
+        event.last_notification_level = 1;
+        return sample.time("Event::update", [&] { return event.update(db); })
+            && sample.time("Event::drop", [&] { return event.drop(db); });
+    });
+    ok = ok && runner.run("EventParticipant::create/update/drop", [&](int i, Runner::Sample& sample) {
+        EventParticipant participant(random_event(), first_new_user + i);
+        participant.registered_time = QDateTime::currentSecsSinceEpoch();
+        if (!sample.time("EventParticipant::create", [&] { return participant.create(db); })) {
+            return false;
+        }
+        participant.registered_time += 1;
+        return sample.time("EventParticipant::update", [&] { return participant.update(db); })
+            && sample.time("EventParticipant::drop", [&] { return participant.drop(db); });
+    });
+
+    // Генерация уникальных строк, включая проверку по БД.
+    ok = ok && runner.run("Session::generate_token", [&](int, Runner::Sample& sample) {
+        Session session;
+        return sample.time("Session::generate_token", [&] { return session.generate_token(db); });
+    });
+    ok = ok && runner.run("Event::generate_refer", [&](int, Runner::Sample& sample) {
+        Event event;
+        return sample.time("Event::generate_refer", [&] { return event.generate_refer(db); });
+    });
+
+    // Сериализация ответов, время на весь вектор из batch элементов.
+    if (runner.enabled("QDataStream QVector<Event>") || runner.enabled("QDataStream QVector<User>")) {
+        QVector<Event> events;
+        QVector<User> users;
+        for (int i = 0; ok && i < batch; ++i) {
+            std::optional<Event> event;
+            std::optional<User> user;
+            ok = Event::fetch_by_id(db, i % data.events + 1, event) && event.has_value()
+                && User::fetch_by_vk_id(db, i % data.users + 1, user) && user.has_value();
+            if (ok) {
+                events.push_back(std::move(*event));
+                users.push_back(std::move(*user));
+            }
+        }
+
+        ok = ok && runner.run("QDataStream QVector<Event>", [&](int, Runner::Sample& sample) {
+            QByteArray bytes;
+            QVector<Event> decoded;
+            return sample.time("QDataStream QVector<Event> write", [&] {
+                       QDataStream stream(&bytes, QDataStream::OpenModeFlag::WriteOnly);
+                       stream << events;
+                       return stream.status() == QDataStream::Status::Ok;
+                   })
+                && sample.time("QDataStream QVector<Event> read", [&] {
+                       QDataStream stream(bytes);
+                       stream >> decoded;
+                       return stream.status() == QDataStream::Status::Ok;
+                   })
+                && decoded.size() == events.size();
+        });
+        ok = ok && runner.run("QDataStream QVector<User>", [&](int, Runner::Sample& sample) {
+            QByteArray bytes;
+            QVector<User> decoded;
+            return sample.time("QDataStream QVector<User> write", [&] {
+                       QDataStream stream(&bytes, QDataStream::OpenModeFlag::WriteOnly);
+                       stream << users;
+                       return stream.status() == QDataStream::Status::Ok;
+                   })
+                && sample.time("QDataStream QVector<User> read", [&] {
+                       QDataStream stream(bytes);
+                       stream >> decoded;
+                       return stream.status() == QDataStream::Status::Ok;
+                   });
+        });
+    }
+
+    QTextStream(stdout) << "rows " << data.rows << ", users " << data.users << ", events " << data.events
+                        << ", sessions " << data.sessions << "\n" << runner.text_report();
+
+    if (parser.isSet(json_option)) {
+        QJsonObject root;
+        root["rows"] = data.rows;
+        root["users"] = data.users;
+        root["events"] = data.events;
+        root["sessions"] = data.sessions;
+        root["batch"] = batch;
+        root["benchmarks"] = runner.json_report();
+
+        QFile file(parser.value(json_option));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCritical() << "Failed to write" << file.fileName() << file.errorString();
+            return 1;
+        }
+        file.write(QJsonDocument(root).toJson(QJsonDocument::JsonFormat::Indented));
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,370 @@
+#include "loadgen.h"
+
+#include <algorithm>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimer>
+#include <QUrlQuery>
+
+#include "DB/event.h"
+#include "DB/user.h"
+
+using namespace loadgen;
+
+static const Scenario all_scenarios[] = {
+    Scenario::Register,
+    Scenario::Confirm,
+    Scenario::Login,
+    Scenario::List,
+    Scenario::Create,
+    Scenario::Patch,
+    Scenario::Delete,
+    Scenario::Join,
+};
+
+const char* loadgen::scenario_name(Scenario scenario) {
+    switch (scenario) {
+    case Scenario::Register: return "register";
+    case Scenario::Confirm:  return "confirm";
+    case Scenario::Login:    return "login";
+    case Scenario::List:     return "list";
+    case Scenario::Create:   return "create";
+    case Scenario::Patch:    return "patch";
+    case Scenario::Delete:   return "delete";
+    case Scenario::Join:     return "join";
+    }
+    return "unknown";
+}
+
+bool loadgen::scenario_from_name(const QString& name, Scenario& scenario) {
+    for (Scenario candidate: all_scenarios) {
+        if (name == scenario_name(candidate)) {
+            scenario = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Перцентиль по отсортированному массиву, метод ближайшего ранга.
+static double percentile_ms(const QVector<qint64>& sorted_us, double fraction) {
+    if (sorted_us.isEmpty()) {
+        return 0;
+    }
+    qsizetype rank = static_cast<qsizetype>(fraction * sorted_us.size() + 0.999999);
+    rank = std::clamp<qsizetype>(rank, 1, sorted_us.size());
+    return sorted_us[rank - 1] / 1000.0;
+}
+
+LoadGenerator::LoadGenerator(Options options, QObject* parent)
+    : QObject(parent)
+    , options_(std::move(options))
+    , generator_(std::random_device()())
+{
+    users_.resize(options_.concurrency);
+    for (int i = 0; i < users_.size(); ++i) {
+        users_[i].netmanager = new QNetworkAccessManager(this);
+        if (!options_.accounts.isEmpty()) {
+            users_[i].account = i % options_.accounts.size();
+        }
+    }
+}
+
+void LoadGenerator::start() {
+    // Сначала входим всеми пользователями, чтобы у них были токены.
+    // Время входа в результаты не попадает.
+    auto remaining = std::make_shared<int>(users_.size());
+    for (int i = 0; i < users_.size(); ++i) {
+        login(i, [this, remaining]() {
+            *remaining -= 1;
+            if (*remaining == 0) {
+                stats_.clear();
+                run();
+            }
+        });
+    }
+}
+
+void LoadGenerator::login(int vu_index, std::function<void()> done) {
+    const VirtualUser& vu = users_[vu_index];
+    if (vu.account < 0) {
+        // Аккаунтов нет, будут доступны только сценарии без токена.
+        QTimer::singleShot(0, this, done);
+        return;
+    }
+
+    const Account& account = options_.accounts[vu.account];
+    send(vu_index, Scenario::Login, "login",
+         {{"vk_profile", account.vk_profile}, {"password", account.password}}, "GET",
+         [this, vu_index, done](QNetworkReply* reply, int status) {
+             if (status == 200) {
+                 QDataStream stream(reply->readAll());
+                 User user(0);
+                 QString token;
+                 stream >> user;
+                 stream >> token;
+                 users_[vu_index].token = token;
+             } else {
+                 qWarning() << "login failed for virtual user" << vu_index << "status" << status;
+             }
+             done();
+         });
+}
+
+void LoadGenerator::run() {
+    run_timer_.start();
+
+    QTimer::singleShot(options_.duration_sec * 1000, this, [this]() {
+        stopping_ = true;
+        run_elapsed_ms_ = run_timer_.elapsed();
+        if (in_flight_ == 0) {
+            emit finished();
+        }
+    });
+
+    for (int i = 0; i < users_.size(); ++i) {
+        next(i);
+    }
+}
+
+bool LoadGenerator::applicable(const VirtualUser& vu, Scenario scenario) const {
+    switch (scenario) {
+    case Scenario::Register: return !options_.register_profiles.isEmpty();
+    case Scenario::Confirm:  return !options_.confirm_links.isEmpty();
+    case Scenario::Login:    return vu.account >= 0;
+    case Scenario::List:     return !vu.token.isEmpty();
+    case Scenario::Create:   return !vu.token.isEmpty();
+    case Scenario::Patch:    return !vu.token.isEmpty() && !vu.own_events.isEmpty();
+    case Scenario::Delete:   return !vu.token.isEmpty() && !vu.own_events.isEmpty();
+    case Scenario::Join:     return !vu.token.isEmpty() && !refers_.isEmpty();
+    }
+    return false;
+}
+
+void LoadGenerator::next(int vu_index) {
+    if (stopping_) {
+        return;
+    }
+
+    // Выбираем сценарий по весам среди тех, что сейчас возможны
+    // (например, нечего удалять, пока пользователь ничего не создал).
+    const VirtualUser& vu = users_[vu_index];
+    QVector<Scenario> candidates;
+    QVector<int> weights;
+    for (auto it = options_.weights.constBegin(); it != options_.weights.constEnd(); ++it) {
+        if (it.value() > 0 && applicable(vu, it.key())) {
+            candidates.push_back(it.key());
+            weights.push_back(it.value());
+        }
+    }
+
+    if (candidates.isEmpty()) {
+        // Этому пользователю делать нечего.
+        return;
+    }
+
+    std::discrete_distribution<int> pick(weights.begin(), weights.end());
+    issue(vu_index, candidates[pick(generator_)]);
+}
+
+void LoadGenerator::issue(int vu_index, Scenario scenario) {
+    VirtualUser& vu = users_[vu_index];
+
+    auto then_next = [this, vu_index]() {
+        next(vu_index);
+    };
+
+    switch (scenario) {
+    case Scenario::Register: {
+        const QString& profile = options_.register_profiles[generator_() % options_.register_profiles.size()];
+        send(vu_index, scenario, "register", {{"vk_profile", profile}}, "GET",
+             [then_next](QNetworkReply*, int) { then_next(); });
+        break;
+    }
+
+    case Scenario::Confirm: {
+        // Ссылка целиком, вместе с параметрами.
+        const QUrl link(options_.confirm_links[generator_() % options_.confirm_links.size()]);
+        const QUrlQuery link_query(link);
+        send(vu_index, scenario, "reg_confirm",
+             {{"vk_id", link_query.queryItemValue("vk_id")}, {"reg_code", link_query.queryItemValue("reg_code")}}, "GET",
+             [then_next](QNetworkReply*, int) { then_next(); });
+        break;
+    }
+
+    case Scenario::Login: {
+        const Account& account = options_.accounts[vu.account];
+        send(vu_index, scenario, "login",
+             {{"vk_profile", account.vk_profile}, {"password", account.password}}, "GET",
+             [then_next](QNetworkReply*, int) { then_next(); });
+        break;
+    }
+
+    case Scenario::List:
+        send(vu_index, scenario, "event", {{"token", vu.token}}, "GET",
+             [then_next](QNetworkReply*, int) { then_next(); });
+        break;
+
+    case Scenario::Create: {
+        // Событие в ближайший месяц.
+        const quint64 timestamp = QDateTime::currentSecsSinceEpoch() + 60 * 60 + generator_() % (30 * 24 * 60 * 60);
+        send(vu_index, scenario, "event",
+             {{"token", vu.token}, {"name", "bench " + QString::number(generator_() % 100000)}, {"timestamp", QString::number(timestamp)}},
+             "POST",
+             [this, vu_index, then_next](QNetworkReply* reply, int status) {
+                 if (status == 200) {
+                     Event event;
+                     QDataStream stream(reply->readAll());
+                     stream >> event;
+                     users_[vu_index].own_events.push_back({event.get_id(), event.refer_str});
+                     refers_.push_back(event.refer_str);
+                 }
+                 then_next();
+             });
+        break;
+    }
+
+    case Scenario::Patch: {
+        const quint64 event_id = vu.own_events[generator_() % vu.own_events.size()].first;
+        send(vu_index, scenario, "event",
+             {{"token", vu.token}, {"event_id", QString::number(event_id)}, {"name", "patched " + QString::number(generator_() % 100000)}},
+             "PATCH",
+             [then_next](QNetworkReply*, int) { then_next(); });
+        break;
+    }
+
+    case Scenario::Delete: {
+        const auto [event_id, refer] = vu.own_events.takeLast();
+        // Записываться на удаленное событие незачем: такие Join считались бы ошибками.
+        refers_.removeOne(refer);
+        send(vu_index, scenario, "event", {{"token", vu.token}, {"event_id", QString::number(event_id)}}, "DELETE",
+             [then_next](QNetworkReply*, int) { then_next(); });
+        break;
+    }
+
+    case Scenario::Join: {
+        const QString& refer = refers_[generator_() % refers_.size()];
+        send(vu_index, scenario, "event_register", {{"token", vu.token}, {"refer", refer}}, "POST",
+             [then_next](QNetworkReply*, int) { then_next(); });
+        break;
+    }
+    }
+}
+
+void LoadGenerator::send(int vu_index, Scenario scenario, const QString& path,
+                         const QVector<std::pair<QString, QString>>& args, const QByteArray& verb, Handler handler) {
+    QUrl url = options_.base_url;
+    url.setPath("/" + path);
+
+    QUrlQuery query;
+    for (const auto& [name, value]: args) {
+        query.addQueryItem(name, value);
+    }
+    url.setQuery(query);
+
+    QNetworkRequest request(url);
+    if (verb == "POST") {
+        request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+    }
+
+    QNetworkReply* reply = users_[vu_index].netmanager->sendCustomRequest(request, verb);
+    in_flight_ += 1;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    connect(reply, &QNetworkReply::finished, this, [this, reply, scenario, timer, handler]() {
+        const qint64 elapsed_us = timer.nsecsElapsed() / 1000;
+
+        const QVariant status_attribute = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+        const int status = status_attribute.isValid() ? status_attribute.toInt() : 0;
+
+        // Запросы, завершившиеся после окончания замера, не считаем.
+        if (!stopping_) {
+            EndpointStats& stats = stats_[scenario];
+            stats.latencies_us.push_back(elapsed_us);
+            stats.statuses[status] += 1;
+            if (status < 200 || status >= 300) {
+                stats.errors += 1;
+            }
+        }
+
+        handler(reply, status);
+        reply->deleteLater();
+
+        request_done();
+    });
+}
+
+void LoadGenerator::request_done() {
+    in_flight_ -= 1;
+    if (stopping_ && in_flight_ == 0) {
+        emit finished();
+    }
+}
+
+QString LoadGenerator::text_report() const {
+    const double elapsed_sec = std::max<qint64>(run_elapsed_ms_, 1) / 1000.0;
+
+    QString report;
+    report += QString("%1 virtual users, %2 s\n").arg(options_.concurrency).arg(elapsed_sec, 0, 'f', 1);
+    report += QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+                  .arg("endpoint", -10).arg("requests", 9).arg("errors", 8).arg("rps", 9)
+                  .arg("p50 ms", 9).arg("p99 ms", 9).arg("p999 ms", 9).arg("max ms", 9);
+
+    for (auto it = stats_.constBegin(); it != stats_.constEnd(); ++it) {
+        QVector<qint64> sorted = it.value().latencies_us;
+        std::sort(sorted.begin(), sorted.end());
+
+        report += QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+                      .arg(scenario_name(it.key()), -10)
+                      .arg(sorted.size(), 9)
+                      .arg(it.value().errors, 8)
+                      .arg(sorted.size() / elapsed_sec, 9, 'f', 1)
+                      .arg(percentile_ms(sorted, 0.50), 9, 'f', 2)
+                      .arg(percentile_ms(sorted, 0.99), 9, 'f', 2)
+                      .arg(percentile_ms(sorted, 0.999), 9, 'f', 2)
+                      .arg(sorted.isEmpty() ? 0.0 : sorted.back() / 1000.0, 9, 'f', 2);
+    }
+
+    return report;
+}
+
+QByteArray LoadGenerator::json_report() const {
+    const double elapsed_sec = std::max<qint64>(run_elapsed_ms_, 1) / 1000.0;
+
+    QJsonObject endpoints;
+    for (auto it = stats_.constBegin(); it != stats_.constEnd(); ++it) {
+        QVector<qint64> sorted = it.value().latencies_us;
+        std::sort(sorted.begin(), sorted.end());
+
+        QJsonObject statuses;
+        for (auto status = it.value().statuses.constBegin(); status != it.value().statuses.constEnd(); ++status) {
+            statuses[QString::number(status.key())] = status.value();
+        }
+
+        QJsonObject endpoint;
+        endpoint["requests"] = sorted.size();
+        endpoint["errors"] = it.value().errors;
+        endpoint["rps"] = sorted.size() / elapsed_sec;
+        endpoint["p50_ms"] = percentile_ms(sorted, 0.50);
+        endpoint["p99_ms"] = percentile_ms(sorted, 0.99);
+        endpoint["p999_ms"] = percentile_ms(sorted, 0.999);
+        endpoint["max_ms"] = sorted.isEmpty() ? 0.0 : sorted.back() / 1000.0;
+        endpoint["statuses"] = statuses;
+
+        endpoints[scenario_name(it.key())] = endpoint;
+    }
+
+    QJsonObject root;
+    root["concurrency"] = options_.concurrency;
+    root["duration_sec"] = elapsed_sec;
+    root["endpoints"] = endpoints;
+
+    return QJsonDocument(root).toJson(QJsonDocument::JsonFormat::Indented);
+}
@@ -0,0 +1,119 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <functional>
+#include <random>
+#include <utility>
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QNetworkAccessManager>
+#include <QObject>
+#include <QString>
+#include <QUrl>
+#include <QVector>
+
+class QNetworkReply;
+
+namespace loadgen {
+    enum class Scenario {
+        Register,
+        Confirm,
+        Login,
+        List,
+        Create,
+        Patch,
+        Delete,
+        Join,
+    };
+
+    const char* scenario_name(Scenario scenario);
+    bool scenario_from_name(const QString& name, Scenario& scenario);
+
+    struct Account {
+        QString vk_profile;
+        QString password;
+    };
+
+    struct Options {
+        QUrl base_url = QUrl("http://127.0.0.1:8080");
+        int concurrency = 16;
+        int duration_sec = 30;
+
+        // Относительные веса сценариев. Сценарий без веса не запускается.
+        QMap<Scenario, int> weights;
+
+        // Аккаунты для входа, по одному на виртуального пользователя (по кругу).
+        QVector<Account> accounts;
+        // Профили для /register.
+        QVector<QString> register_profiles;
+        // Готовые ссылки подтверждения регистрации для /reg_confirm.
+        QVector<QString> confirm_links;
+
+        QString json_path;
+    };
+
+    // Статистика одного эндпоинта (сценария).
+    struct EndpointStats {
+        QVector<qint64> latencies_us;
+        QMap<int, qint64> statuses; // 0 -- ответа не было.
+        qint64 errors = 0;
+    };
+
+    class LoadGenerator : public QObject
+    {
+        Q_OBJECT
+
+    public:
+        explicit LoadGenerator(Options options, QObject* parent = nullptr);
+
+        // Входит во все аккаунты, затем гоняет нагрузку duration_sec секунд.
+        void start();
+
+        QString text_report() const;
+        QByteArray json_report() const;
+
+    signals:
+        void finished();
+
+    private:
+        struct VirtualUser {
+            // У каждого пользователя свой менеджер: QNetworkAccessManager
+            // держит не больше 6 соединений на хост, общий менеджер
+            // ограничил бы конкурентность.
+            QNetworkAccessManager* netmanager = nullptr;
+            int account = -1;
+            QString token;
+            // id и ссылка-приглашение созданных этим пользователем событий.
+            QVector<std::pair<quint64, QString>> own_events;
+        };
+
+        using Handler = std::function<void(QNetworkReply* reply, int status)>;
+
+        void login(int vu_index, std::function<void()> done);
+        void run();
+        void next(int vu_index);
+        bool applicable(const VirtualUser& vu, Scenario scenario) const;
+        void issue(int vu_index, Scenario scenario);
+        void send(int vu_index, Scenario scenario, const QString& path,
+                  const QVector<std::pair<QString, QString>>& args, const QByteArray& verb, Handler handler);
+        void request_done();
+
+    private:
+        Options options_;
+
+        QVector<VirtualUser> users_;
+        // Ссылки-приглашения созданных событий, по ним другие пользователи записываются.
+        QVector<QString> refers_;
+
+        QMap<Scenario, EndpointStats> stats_;
+
+        std::mt19937 generator_;
+        QElapsedTimer run_timer_;
+        qint64 run_elapsed_ms_ = 0;
+        bool stopping_ = false;
+        int in_flight_ = 0;
+    };
+}
+
+#endif // LOADGEN_H
@@ -0,0 +1,139 @@
+// Нагрузка на verbov-server.
+//
+// Запросы с loopback сервер по IP не ограничивает, но ведра по токену и
+// vk_profile действуют. Чтобы мерить сервер, а не ответы 429, запускайте его
+// с выключенными ведрами:
+//
+// VERBOV_RATELIMIT_TOKEN_RATE=0 VERBOV_RATELIMIT_PROFILE_RATE=0 verbov-server &
+// verbov-bench --url http://127.0.0.1:8080 ...
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QTextStream>
+#include <QTimer>
+
+#include "loadgen.h"
+
+// Строки файла без пустых и комментариев (#).
+static bool read_lines(const QString& path, QVector<QString>& lines) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qCritical() << "Failed to open" << path << file.errorString();
+        return false;
+    }
+
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        lines.push_back(line);
+    }
+    return true;
+}
+
+// "list=50,create=10,join=5"
+static bool parse_mix(const QString& mix, QMap<loadgen::Scenario, int>& weights) {
+    for (const QString& item: mix.split(',', Qt::SkipEmptyParts)) {
+        const QStringList parts = item.split('=');
+        loadgen::Scenario scenario;
+        bool is_integer = false;
+        const int weight = parts.size() == 2 ? parts[1].trimmed().toInt(&is_integer) : 0;
+
+        if (parts.size() != 2 || !loadgen::scenario_from_name(parts[0].trimmed(), scenario) || !is_integer || weight < 0) {
+            qCritical() << "Bad mix entry" << item;
+            return false;
+        }
+        weights[scenario] = weight;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("verbov-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("HTTP load generator for verbov-server.");
+    parser.addHelpOption();
+
+    QCommandLineOption url_option("url", "Server base URL.", "url", "http://127.0.0.1:8080");
+    QCommandLineOption concurrency_option("concurrency", "Number of virtual users.", "n", "16");
+    QCommandLineOption duration_option("duration", "Measurement duration, seconds.", "sec", "30");
+    QCommandLineOption mix_option("mix", "Scenario weights: register,confirm,login,list,create,patch,delete,join.",
+                                  "mix", "list=50,create=10,patch=10,delete=5,join=10,login=5");
+    QCommandLineOption accounts_option("accounts", "File with \"vk_profile password\" lines of confirmed users.", "file");
+    QCommandLineOption register_option("register-profiles", "File with VK profiles for the register scenario.", "file");
+    QCommandLineOption confirm_option("confirm-links", "File with confirmation links for the confirm scenario.", "file");
+    QCommandLineOption json_option("json", "Also write the report as JSON to this file.", "file");
+
+    parser.addOptions({url_option, concurrency_option, duration_option, mix_option,
+                       accounts_option, register_option, confirm_option, json_option});
+    parser.process(app);
+
+    loadgen::Options options;
+    options.base_url = QUrl(parser.value(url_option));
+
+    bool is_integer = false;
+    options.concurrency = parser.value(concurrency_option).toInt(&is_integer);
+    if (!is_integer || options.concurrency <= 0) {
+        qCritical() << "Bad concurrency" << parser.value(concurrency_option);
+        return 1;
+    }
+    options.duration_sec = parser.value(duration_option).toInt(&is_integer);
+    if (!is_integer || options.duration_sec <= 0) {
+        qCritical() << "Bad duration" << parser.value(duration_option);
+        return 1;
+    }
+
+    if (!parse_mix(parser.value(mix_option), options.weights)) {
+        return 1;
+    }
+
+    if (parser.isSet(accounts_option)) {
+        QVector<QString> lines;
+        if (!read_lines(parser.value(accounts_option), lines)) {
+            return 1;
+        }
+        for (const QString& line: lines) {
+            const QStringList parts = line.split(' ', Qt::SkipEmptyParts);
+            if (parts.size() != 2) {
+                qCritical() << "Bad account line" << line;
+                return 1;
+            }
+            options.accounts.push_back({parts[0], parts[1]});
+        }
+    }
+    if (parser.isSet(register_option) && !read_lines(parser.value(register_option), options.register_profiles)) {
+        return 1;
+    }
+    if (parser.isSet(confirm_option) && !read_lines(parser.value(confirm_option), options.confirm_links)) {
+        return 1;
+    }
+    options.json_path = parser.value(json_option);
+
+    loadgen::LoadGenerator generator(options);
+
+    QObject::connect(&generator, &loadgen::LoadGenerator::finished, &app, [&]() {
+        QTextStream(stdout) << generator.text_report();
+
+        if (!options.json_path.isEmpty()) {
+            QFile file(options.json_path);
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                qCritical() << "Failed to write" << options.json_path << file.errorString();
+                app.exit(1);
+                return;
+            }
+            file.write(generator.json_report());
+        }
+
+        app.quit();
+    });
+
+    QTimer::singleShot(0, &generator, &loadgen::LoadGenerator::start);
+
+    return app.exec();
+}
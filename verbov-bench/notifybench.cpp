@@ -0,0 +1,371 @@
+// Уведомления в ускоренном времени.
+//
+// verbov-vksim --port 8090 &
+// verbov-notify-bench --events 100000 --per-event 10 --days 7
+//
+// Заполняет хранилище событиями на ближайшие days дней и участниками,
+// подменяет часы (timesource::Manual) и гонит их вперед шагами по step
+// секунд. На каждом шаге -- тик уведомлений (Event::send_notifications),
+// затем отправка очереди в VK (Event::deliver_notifications) до тех пор,
+// пока готовых сообщений не останется. VK -- локальный verbov-vksim.
+//
+// Отчет: длительность тиков, время разбора очереди после тика (задержка
+// доставки последнего сообщения шага) и сообщения по уровням.
+
+#include <algorithm>
+#include <memory>
+#include <random>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QRegularExpression>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTextStream>
+#include <QTimer>
+#include <QtSql/QSqlDatabase>
+
+#include "DB/event.h"
+#include "DB/eventparticipant.h"
+#include "DB/memorystorage.h"
+#include "DB/notification.h"
+#include "DB/session.h"
+#include "DB/sqlitestorage.h"
+#include "DB/user.h"
+#include "metrics.h"
+#include "timesource.h"
+
+namespace {
+
+struct Dataset {
+    qint64 events = 0;
+    qint64 per_event = 0;
+    qint64 users = 0;
+    qint64 days = 0;
+};
+
+bool seed(storage::Storage& storage, const Dataset& data, quint64 start, std::mt19937_64& generator) {
+    QTextStream out(stdout);
+    out << "seeding " << data.users << " users, " << data.events << " events, "
+        << data.events * data.per_event << " participants\n";
+    out.flush();
+
+    for (qint64 i = 1; i <= data.users; ++i) {
+        User user(i);
+        user.first_name = "Имя" + QString::number(i % 1000);
+        user.last_name = "Фамилия" + QString::number(i);
+        user.reg_confirmed = true;
+        if (!storage.create_user(user)) {
+            return false;
+        }
+    }
+
+    const quint64 span = data.days * 24 * 60 * 60;
+    for (qint64 i = 1; i <= data.events; ++i) {
+        Event event;
+        event.name = "Событие " + QString::number(i);
+        event.creator_user_id = generator() % data.users + 1;
+        event.timestamp = start + 1 + generator() % span;
+        if (!storage.create_event(event)) {
+            return false;
+        }
+
+        // Соседние j дают разных пользователей, если users не кратно 7919.
+        for (qint64 j = 0; j < data.per_event; ++j) {
+            EventParticipant participant(event.get_id(), ((i * data.per_event + j) * 7919 + i) % data.users + 1);
+            participant.registered_time = start;
+            if (!storage.create_participant(participant)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Значения счетчика из текста /metrics: набор меток -> значение.
+QMap<QString, qint64> read_counter(const QByteArray& text, const QString& family) {
+    QMap<QString, qint64> values;
+    const QRegularExpression line("^" + QRegularExpression::escape(family) + "(\\{[^}]*\\})? (\\d+)$",
+                                  QRegularExpression::MultilineOption);
+    auto it = line.globalMatch(QString::fromUtf8(text));
+    while (it.hasNext()) {
+        const QRegularExpressionMatch match = it.next();
+        values[match.captured(1)] = match.captured(2).toLongLong();
+    }
+    return values;
+}
+
+QString label(const QString& labels, const QString& name) {
+    const QRegularExpression value(name + "=\"([^\"]*)\"");
+    return value.match(labels).captured(1);
+}
+
+struct Summary {
+    qint64 n = 0;
+    double mean_ms = 0;
+    double p50_ms = 0;
+    double p99_ms = 0;
+    double max_ms = 0;
+};
+
+Summary summarize(QVector<qint64> samples_ns) {
+    Summary s;
+    s.n = samples_ns.size();
+    if (samples_ns.isEmpty()) {
+        return s;
+    }
+    std::sort(samples_ns.begin(), samples_ns.end());
+
+    double sum = 0;
+    for (qint64 ns: samples_ns) {
+        sum += ns;
+    }
+    s.mean_ms = sum / samples_ns.size() / 1e6;
+    s.p50_ms = samples_ns[(samples_ns.size() - 1) / 2] / 1e6;
+    s.p99_ms = samples_ns[std::min<qsizetype>(samples_ns.size() - 1, samples_ns.size() * 99 / 100)] / 1e6;
+    s.max_ms = samples_ns.last() / 1e6;
+    return s;
+}
+
+QJsonObject to_json(const Summary& s) {
+    return QJsonObject{
+        {"n", s.n},
+        {"mean_ms", s.mean_ms},
+        {"p50_ms", s.p50_ms},
+        {"p99_ms", s.p99_ms},
+        {"max_ms", s.max_ms},
+    };
+}
+
+// Дает циклу событий поработать: ответы VK приходят через него.
+void spin(int ms) {
+    QEventLoop loop;
+    QTimer::singleShot(ms, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("verbov-notify-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Notification pipeline in simulated time against verbov-vksim.");
+    parser.addHelpOption();
+
+    QCommandLineOption events_option("events", "Number of events.", "n", "100000");
+    QCommandLineOption per_event_option("per-event", "Participants per event.", "n", "10");
+    QCommandLineOption users_option("users", "Number of users, default events * per-event / 20.", "n");
+    QCommandLineOption days_option("days", "Simulated days; events are spread over them.", "n", "7");
+    QCommandLineOption step_option("step", "Simulated seconds per notification tick.", "sec", "60");
+    QCommandLineOption engine_option("engine", "Storage engine: memory or sqlite.", "name", "memory");
+    QCommandLineOption db_option("db", "Database file for the sqlite engine.", "path", "notifybench.sqlite3");
+    QCommandLineOption vk_option("vk-url", "VK API base URL (verbov-vksim).", "url", "http://127.0.0.1:8090/method/");
+    QCommandLineOption rate_option("rate", "notifications/rate_per_second, 0 -- unlimited.", "n", "0");
+    QCommandLineOption in_flight_option("max-in-flight", "notifications/max_in_flight.", "n", "64");
+    QCommandLineOption drain_option("max-drain-seconds", "Give up draining one step after this long.", "sec", "60");
+    QCommandLineOption seed_option("seed", "Random seed.", "n", "1");
+    QCommandLineOption json_option("json", "Also write the report as JSON to this file.", "file");
+
+    parser.addOptions({events_option, per_event_option, users_option, days_option, step_option, engine_option,
+                       db_option, vk_option, rate_option, in_flight_option, drain_option, seed_option, json_option});
+    parser.process(app);
+
+    Dataset data;
+    data.events = parser.value(events_option).toLongLong();
+    data.per_event = parser.value(per_event_option).toLongLong();
+    data.days = parser.value(days_option).toLongLong();
+    data.users = parser.isSet(users_option)
+        ? parser.value(users_option).toLongLong()
+        : std::max<qint64>(data.events * data.per_event / 20, 1000);
+    if (data.users % 7919 == 0) {
+        data.users += 1;
+    }
+    const quint64 step = parser.value(step_option).toULongLong();
+    const qint64 max_drain_ms = parser.value(drain_option).toLongLong() * 1000;
+    if (data.events <= 0 || data.per_event < 0 || data.per_event >= data.users || data.days <= 0 || step == 0 || max_drain_ms <= 0) {
+        qCritical() << "Bad events, per-event, users, days, step or max-drain-seconds";
+        return 1;
+    }
+
+    // Настройки читаются при первом обращении, так что до любого вызова
+    // уведомлений. Окружение важнее файла.
+    qputenv("VERBOV_VK_API_URL", parser.value(vk_option).toUtf8());
+    qputenv("VERBOV_NOTIFICATIONS_RATE_PER_SECOND", parser.value(rate_option).toUtf8());
+    qputenv("VERBOV_NOTIFICATIONS_MAX_IN_FLIGHT", parser.value(in_flight_option).toUtf8());
+    qputenv("VERBOV_NOTIFICATIONS_BATCH", "1000");
+
+    // Время фиксированное, чтобы прогоны с одним seed совпадали.
+    const quint64 start = 1767225600; // 2026-01-01 00:00 UTC
+    timesource::Manual clock(start);
+    std::mt19937_64 generator(parser.value(seed_option).toULongLong());
+
+    std::unique_ptr<storage::Storage> storage;
+    QSqlDatabase db;
+    if (parser.value(engine_option) == "memory") {
+        storage = std::make_unique<storage::MemoryStorage>();
+    } else if (parser.value(engine_option) == "sqlite") {
+        const QString db_path = parser.value(db_option);
+        QFile::remove(db_path);
+        db = QSqlDatabase::addDatabase("QSQLITE");
+        db.setDatabaseName(db_path);
+        if (!db.open()) {
+            qCritical() << db.lastError().text();
+            return 1;
+        }
+        // Потерять БД бенчмарка при сбое не страшно.
+        QSqlQuery pragma(db);
+        pragma.exec("PRAGMA journal_mode = WAL");
+        pragma.exec("PRAGMA synchronous = NORMAL");
+        if (!User::check_table(db) || !Session::check_table(db) || !Event::check_table(db) ||
+            !EventParticipant::check_table(db) || !Notification::check_table(db) ||
+            !storage::attach_archive(db, storage::sibling_path(db_path, "archive"))) {
+            return 1;
+        }
+        storage = std::make_unique<storage::SqliteStorage>(db);
+    } else {
+        qCritical() << "Unknown engine" << parser.value(engine_option);
+        return 1;
+    }
+
+    QElapsedTimer seed_timer;
+    seed_timer.start();
+    if (db.isOpen() && !db.transaction()) {
+        qCritical() << db.lastError().text();
+        return 1;
+    }
+    if (!seed(*storage, data, start, generator)) {
+        qCritical() << "Seeding failed";
+        return 1;
+    }
+    if (db.isOpen() && !db.commit()) {
+        qCritical() << db.lastError().text();
+        return 1;
+    }
+    const qint64 seed_ms = seed_timer.elapsed();
+
+    QTextStream out(stdout);
+    out << "seeded in " << seed_ms << " ms, simulating " << data.days << " days in steps of " << step << " s\n";
+    out.flush();
+
+    // Тики идут, пока не пройдут все события.
+    const quint64 end = start + data.days * 24 * 60 * 60;
+    QVector<qint64> tick_ns;
+    QVector<qint64> drain_ns;
+    qint64 num_stuck_steps = 0;
+    QElapsedTimer wall;
+    wall.start();
+    while (clock.current() < end) {
+        clock.advance(step);
+
+        QElapsedTimer tick_timer;
+        tick_timer.start();
+        Event::send_notifications(*storage);
+        tick_ns.push_back(tick_timer.nsecsElapsed());
+
+        // Разбираем очередь, пока в ней есть готовые. Повторы после
+        // временных ошибок VK отложены в симулированное время и дождутся
+        // своих шагов.
+        QElapsedTimer drain_timer;
+        drain_timer.start();
+        bool had_messages = false;
+        while (true) {
+            QVector<Notification> ready;
+            if (!storage->fetch_ready_notifications(clock.current(), 1, ready)) {
+                return 1;
+            }
+            if (ready.isEmpty()) {
+                break;
+            }
+            had_messages = true;
+            if (drain_timer.elapsed() > max_drain_ms) {
+                ++num_stuck_steps;
+                break;
+            }
+            Event::deliver_notifications(*storage);
+            spin(1);
+        }
+        if (had_messages) {
+            drain_ns.push_back(drain_timer.nsecsElapsed());
+        }
+    }
+    // Ответы на последние отправки.
+    spin(100);
+    const qint64 wall_ms = wall.elapsed();
+
+    const QByteArray metrics_text = metrics::render();
+    QMap<QString, QMap<QString, qint64>> messages_by_level;
+    const QMap<QString, qint64> messages = read_counter(metrics_text, "verbov_notification_messages_total");
+    for (auto it = messages.constBegin(); it != messages.constEnd(); ++it) {
+        messages_by_level[label(it.key(), "level")][label(it.key(), "result")] = it.value();
+    }
+    const QMap<QString, qint64> enqueued = read_counter(metrics_text, "verbov_notification_enqueued_total");
+    for (auto it = enqueued.constBegin(); it != enqueued.constEnd(); ++it) {
+        messages_by_level[label(it.key(), "level")]["enqueued"] = it.value();
+    }
+    const qint64 num_digests = read_counter(metrics_text, "verbov_notification_digests_total").value("");
+
+    const Summary ticks = summarize(tick_ns);
+    const Summary drains = summarize(drain_ns);
+
+    out << QString("%1 %2 %3 %4 %5 %6\n")
+               .arg("stage", -24).arg("n", 8).arg("mean ms", 10)
+               .arg("p50 ms", 10).arg("p99 ms", 10).arg("max ms", 10);
+    for (const auto& [name, s]: {std::pair<QString, Summary>{"tick", ticks}, std::pair<QString, Summary>{"delivery lag", drains}}) {
+        out << QString("%1 %2 %3 %4 %5 %6\n")
+                   .arg(name, -24).arg(s.n, 8)
+                   .arg(s.mean_ms, 10, 'f', 2).arg(s.p50_ms, 10, 'f', 2)
+                   .arg(s.p99_ms, 10, 'f', 2).arg(s.max_ms, 10, 'f', 2);
+    }
+    out << "\n" << QString("%1 %2 %3 %4 %5 %6\n")
+                       .arg("level", -6).arg("enqueued", 10).arg("sent", 10)
+                       .arg("retried", 10).arg("failed", 10).arg("dropped", 10);
+    QJsonObject levels_json;
+    for (auto it = messages_by_level.constBegin(); it != messages_by_level.constEnd(); ++it) {
+        const QMap<QString, qint64>& counts = it.value();
+        out << QString("%1 %2 %3 %4 %5 %6\n")
+                   .arg(it.key(), -6).arg(counts.value("enqueued"), 10).arg(counts.value("sent"), 10)
+                   .arg(counts.value("retried"), 10).arg(counts.value("failed"), 10).arg(counts.value("dropped"), 10);
+        QJsonObject level_json;
+        for (auto count = counts.constBegin(); count != counts.constEnd(); ++count) {
+            level_json[count.key()] = count.value();
+        }
+        levels_json[it.key()] = level_json;
+    }
+    out << "\nVK messages (digests): " << num_digests << ", steps not drained in time: " << num_stuck_steps
+        << ", wall time: " << wall_ms << " ms\n";
+    out.flush();
+
+    if (parser.isSet(json_option)) {
+        const QJsonObject report{
+            {"events", data.events},
+            {"participants", data.events * data.per_event},
+            {"users", data.users},
+            {"days", data.days},
+            {"step_s", static_cast<qint64>(step)},
+            {"engine", parser.value(engine_option)},
+            {"seed_ms", seed_ms},
+            {"wall_ms", wall_ms},
+            {"tick", to_json(ticks)},
+            {"delivery_lag", to_json(drains)},
+            {"levels", levels_json},
+            {"vk_messages", num_digests},
+            {"stuck_steps", num_stuck_steps},
+        };
+        QFile file(parser.value(json_option));
+        if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(report).toJson()) < 0) {
+            qCritical() << "Failed to write" << file.fileName();
+            return 1;
+        }
+    }
+
+    return num_stuck_steps == 0 ? 0 : 2;
+}
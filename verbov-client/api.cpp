@@ -36,6 +36,14 @@ api::Result api::request(const QString& method, const QVector<QString>& args, co
 
     request.setUrl(url);
 
+    // Accept-Encoding сами не ставим: тогда Qt сам просит gzip/deflate (и zstd,
+    // если собран с ним) и сам распаковывает ответ, content ниже уже распакован.
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    // Списки событий и участников сжимаются сильнее, чем ждет защита Qt от
+    // "zip-бомб" (от 10 МБ распакованного и 40:1). Сервер наш, поднимем порог.
+    request.setDecompressedSafetyCheckThreshold(64 * 1024 * 1024);
+#endif
+
     // Родителем этого объекта должен быть QNetworkManager, по идее, потому
     // с ним освободиться. Не мы выделяли, не мы освобождаем.
     QNetworkReply* reply = [&]() {
@@ -68,9 +76,22 @@ api::Result api::request(const QString& method, const QVector<QString>& args, co
     // https://stackoverflow.com/a/35853741
     QVariant status_code = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
     if (status_code.isValid()) {
-        result.success = status_code.toString() == "200";
+        result.status_code = status_code.toInt();
+        result.success = result.status_code == 200;
     } else {
         result.success = false;
+        switch (reply->error()) {
+        case QNetworkReply::NetworkError::ConnectionRefusedError:
+        case QNetworkReply::NetworkError::HostNotFoundError:
+        case QNetworkReply::NetworkError::TemporaryNetworkFailureError:
+        case QNetworkReply::NetworkError::NetworkSessionFailedError:
+        case QNetworkReply::NetworkError::ProxyConnectionRefusedError:
+        case QNetworkReply::NetworkError::ProxyNotFoundError:
+            result.not_sent = true;
+            break;
+        default:
+            break;
+        }
     }
 
     result.content = reply->readAll();
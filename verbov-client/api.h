@@ -6,6 +6,12 @@
 namespace api {
     struct Result {
         bool success = false;
+        // 0 -- ответа от сервера не было совсем (нет сети, сервер недоступен).
+        int status_code = 0;
+        // Соединиться не удалось, так что сервер запроса точно не видел.
+        // При status_code 0 без этого ответ мог потеряться уже после
+        // выполнения запроса.
+        bool not_sent = false;
         QByteArray content;
     };
 
@@ -0,0 +1,54 @@
+#include "eventstore.h"
+
+#include "EventListItem.h"
+
+Event* EventStore::find(quint64 event_id) {
+    auto it = entries_.find(event_id);
+    if (it == entries_.end()) {
+        return nullptr;
+    }
+    return &it->second.event;
+}
+
+const Event* EventStore::find(quint64 event_id) const {
+    auto it = entries_.find(event_id);
+    if (it == entries_.end()) {
+        return nullptr;
+    }
+    return &it->second.event;
+}
+
+Event& EventStore::insert(Event event) {
+    const quint64 event_id = event.get_id();
+
+    Entry& entry = entries_[event_id];
+    entry.event = std::move(event);
+
+    return entry.event;
+}
+
+bool EventStore::remove(quint64 event_id) {
+    return entries_.erase(event_id) != 0;
+}
+
+EventListItem* EventStore::item(quint64 event_id) const {
+    auto it = entries_.find(event_id);
+    if (it == entries_.end()) {
+        return nullptr;
+    }
+    return it->second.item;
+}
+
+void EventStore::set_item(quint64 event_id, EventListItem* item) {
+    auto it = entries_.find(event_id);
+    if (it == entries_.end()) {
+        return;
+    }
+    it->second.item = item;
+}
+
+void EventStore::forget_items() {
+    for (auto& [event_id, entry]: entries_) {
+        entry.item = nullptr;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef EVENTSTORE_H
+#define EVENTSTORE_H
+
+#include <unordered_map>
+
+#include "DB/event.h"
+
+class EventListItem;
+
+// Хранилище событий клиента.
+// Поиск по id за O(1). Указатели и ссылки на события остаются валидными,
+// пока событие не удалено: узлы std::unordered_map не перемещаются при
+// рехешировании (в отличие от элементов QVector и QHash).
+// Заодно помним элемент списка, который отображает событие, чтобы не
+// искать его в QListWidget перебором.
+class EventStore
+{
+public:
+    Event* find(quint64 event_id);
+    const Event* find(quint64 event_id) const;
+
+    // Если событие с таким id уже есть, оно заменяется.
+    Event& insert(Event event);
+    bool remove(quint64 event_id);
+
+    size_t size() const { return entries_.size(); }
+
+    // Элемент списка, который сейчас показывает событие,
+    // или nullptr, если событие в списке не показано.
+    EventListItem* item(quint64 event_id) const;
+    void set_item(quint64 event_id, EventListItem* item);
+    // Надо вызывать перед очисткой списка, элементы
+    // списком удаляются, указатели станут висячими.
+    void forget_items();
+
+    template <typename Func>
+    void for_each(Func&& func) const {
+        for (const auto& [event_id, entry]: entries_) {
+            func(entry.event);
+        }
+    }
+
+private:
+    struct Entry {
+        Event event;
+        EventListItem* item = nullptr;
+    };
+
+    std::unordered_map<quint64, Entry> entries_;
+};
+
+#endif // EVENTSTORE_H
@@ -5,6 +5,7 @@
 #include <QMessageBox>
 #include <QToolTip>
 #include <QListWidgetItem>
+#include <QSet>
 
 #include "api.h"
 #include "enrolldialog.h"
@@ -16,6 +17,7 @@ MainWindow::MainWindow(User user, QString token, QWidget *parent)
     , ui(new Ui::MainWindow)
     , user_(std::move(user))
     , token_(std::move(token))
+    , outbox_("outbox_" + QString::number(user_.get_vk_id()) + ".dat", token_)
 {
     ui->setupUi(this);
 
@@ -23,63 +25,36 @@ MainWindow::MainWindow(User user, QString token, QWidget *parent)
     if (!result.success) {
         QToolTip::showText(QCursor::pos(), QString(result.content));
     } else {
+        QVector<Event> fetched_events;
         QDataStream stream(result.content);
-        stream >> events;
+        stream >> fetched_events;
+        for (Event& event: fetched_events) {
+            events.insert(std::move(event));
+        }
+        // Правки, не дошедшие до сервера в прошлый раз, еще в очереди.
+        // Покажем события такими, какими их оставил пользователь.
+        outbox_.apply_to(events);
         // Обновим список в графическом интерфейсе.
         on_calendarWidget_selectionChanged();
     }
 
-    server_commit_timer.setInterval(2500);
-    connect(&server_commit_timer, &QTimer::timeout, [this]() {
-        // Удалим повторые изменения событий.
-        // В самом событии записана актуальная информация.
-        // Благодаря обработчикам слотов виджетов. Они, по
-        // моему представлению, все запускаются в event-loop-е
-        // внутри QApplication::exec().
-        std::sort(dirty_events.begin(), dirty_events.end());
-        dirty_events.erase(std::unique(dirty_events.begin(), dirty_events.end()), dirty_events.end());
-        size_t num_done = 0;
-        for (const quint64 event_id: dirty_events) {
-            auto event_it = std::find_if(
-                events.begin(),
-                events.end(),
-                [event_id](const auto& event) { return event.get_id() == event_id; }
-                );
-            if (event_it == events.end()) {
-                // Уже удалили событие. Тогда обновлять не надо.
-                continue;
-            }
-            const Event& event = *event_it;
-
-            api::Result result = api::request(
-                "event",
-                {"event_id", "name", "timestamp"},
-                {QString::number(event.get_id()), event.name, QString::number(event.timestamp)},
-                token_,
-                api::HttpMethod::Patch
-                );
-
-            if (result.success) {
-                num_done += 1;
-
-                // Обновляем вид в списке
-                for (int i = 0; i < ui->eventList->count(); ++i) {
-                    QListWidgetItem* item = ui->eventList->item(i);
-                    auto event_item = dynamic_cast<EventListItem*>(item);
-                    assert(event_item != 0);
-                    if (event_item->event_id == event.get_id()) {
-                        event_item->setText(event.name);
-                        break;
-                    }
-                }
-            } else {
-                QToolTip::showText(QCursor::pos(), QString(result.content));
-                break;
-            }
-        }
-        dirty_events.erase(dirty_events.begin(), dirty_events.begin() + num_done);
+    // Изменения уходят на сервер через очередь. Сервер подтвердил
+    // создание события -- показываем его в списке.
+    connect(&outbox_, &Outbox::created, this, [this](const Event& event) {
+        const Event& stored_event = events.insert(event);
+
+        // Добавляем в конец, не сортируем.
+        // Ничего страшного.
+        add_list_item(stored_event);
+        ui->eventList->update();
+    });
+    connect(&outbox_, &Outbox::error, this, [](const QString& message) {
+        QToolTip::showText(QCursor::pos(), message);
     });
-    server_commit_timer.start();
+
+    // Только теперь: список уже загружен и поправлен по очереди, а ответы
+    // на отправленное из нее есть кому принять.
+    outbox_.start();
 }
 
 MainWindow::~MainWindow()
@@ -87,20 +62,25 @@ MainWindow::~MainWindow()
     delete ui;
 }
 
+void MainWindow::add_list_item(const Event& event)
+{
+    // https://doc.qt.io/qt-6/qlistwidgetitem.html
+    events.set_item(event.get_id(), new EventListItem(event, ui->eventList));
+}
+
 void MainWindow::on_newEventBtn_clicked()
 {
+    // Соберем имена один раз, а не перебираем все события
+    // для каждого варианта имени.
+    QSet<QString> taken_names;
+    events.for_each([&taken_names](const Event& event) {
+        taken_names.insert(event.name);
+    });
+
     for (size_t i = 0; i < events.size() + 1; ++i) {
         QString name = "Событие #" + QString::number(events.size() + i);
 
-        bool found_event = false;
-        for (const Event& event: events) {
-            if (event.name == name) {
-                found_event = true;
-                break;
-            }
-        }
-
-        if (found_event) {
+        if (taken_names.contains(name)) {
             continue;
         }
 
@@ -114,32 +94,8 @@ void MainWindow::on_newEventBtn_clicked()
 
         qint64 timestamp = datetime.toSecsSinceEpoch();
 
-        api::Result result = api::request(
-            "event",
-            {"name", "timestamp"},
-            {std::move(name), QString::number(timestamp)},
-            token_,
-            api::HttpMethod::Post
-        );
-
-        if (result.success) {
-            Event event;
-            QDataStream stream(result.content);
-            stream >> event;
-            events.push_back(event);
-
-            // Добавляем в конец, не сортируем.
-            // Ничего страшного.
-            new EventListItem(event, ui->eventList);
-            // Не будем ждать несколько секунд, пока список обновится.
-            // Хотя это хорошо, что обновления накапливаются, иначе
-            // работать будет медленно. Например, насколько помню,
-            // для виждета список в документации wxWidgets все элементы
-            // сразу рекомендуют устанавливать.
-            ui->eventList->update();
-        } else {
-            QToolTip::showText(QCursor::pos(), QString(result.content));
-        }
+        // Событие появится в списке, когда сервер его создаст.
+        outbox_.create(name, timestamp);
 
         break;
     }
@@ -156,20 +112,22 @@ void MainWindow::on_calendarWidget_selectionChanged()
     qint64 start_timestamp = date.startOfDay().toSecsSinceEpoch();
     qint64 end_timestamp   = date.endOfDay().toSecsSinceEpoch();
 
-    QVector<Event> date_events;
-    for (const Event& event: events) {
+    // Указатели из хранилища не инвалидируются, копировать события не надо.
+    QVector<const Event*> date_events;
+    events.for_each([&](const Event& event) {
         if (event.timestamp >= start_timestamp && event.timestamp <= end_timestamp) {
-            date_events.push_back(event);
+            date_events.push_back(&event);
         }
-    }
-    std::sort(date_events.begin(), date_events.end(), [](const Event& lhs, const Event& rhs) {
-        return lhs.timestamp < rhs.timestamp;
+    });
+    std::sort(date_events.begin(), date_events.end(), [](const Event* lhs, const Event* rhs) {
+        return lhs->timestamp < rhs->timestamp;
     });
 
+    // Элементы списка удаляются вместе с ним.
+    events.forget_items();
     ui->eventList->clear();
-    for (const auto& event: date_events) {
-        // https://doc.qt.io/qt-6/qlistwidgetitem.html
-        new EventListItem(event, ui->eventList);
+    for (const Event* event: date_events) {
+        add_list_item(*event);
     }
     // Не будем ждать несколько секунд, пока список обновится..
     ui->eventList->update();
@@ -238,25 +196,17 @@ void MainWindow::on_eventList_currentItemChanged(QListWidgetItem *current, QList
     EventListItem* event_item = dynamic_cast<EventListItem*>(current);
     assert(event_item != nullptr);
 
-    // Надо заново искать событие в массиве, т.к.
-    // могли быть перевыделения памяти, нельзя
-    // было хранить указатель. Хотя можно хранить
-    // номер в массиве, но мы стираем события. Потому
-    // это тоже не подходит так сразу.
-
-    for (const auto& event: events) {
-        if (event.get_id() == event_item->event_id) {
-            show_event(event);
-            selected_event_id = event.get_id();
-            break;
-        }
-    }    
+    // Поиск по id в хранилище за O(1).
+    const Event* event = events.find(event_item->event_id);
+    if (event != nullptr) {
+        show_event(*event);
+        selected_event_id = event->get_id();
+    }
 }
 
 void MainWindow::update_selected_event() {
-    // При пользовательском вводе помечаем событие как "грязное",
-    // требующее обновления на сервере.
-    // Обновлением на сервере будет заниматься QTimer. Он будет
+    // При пользовательском вводе кладем изменившиеся поля в очередь
+    // на отправку. Отправкой занимается Outbox по QTimer-у. Он будет
     // работать в нашем же потоке, т.к. у нас есть event loop
     // внутри QApplication::exec() (было по другой ссылке
     // документации, об обработке событий).
@@ -266,17 +216,35 @@ void MainWindow::update_selected_event() {
         return;
     }
 
-    for (auto& event: events) {
-        if (event.get_id() == selected_event_id.value()) {
-            event.name = ui->eventName->text();
-            event.timestamp = QDateTime(
+    Event* event = events.find(selected_event_id.value());
+    if (event == nullptr) {
+        return;
+    }
+
+    const QString name = ui->eventName->text();
+    const quint64 timestamp = QDateTime(
                                   ui->eventDate->date(),
                                   ui->eventTime->time()
                                 ).toSecsSinceEpoch();
-            dirty_events.push_back(selected_event_id.value());
-            break;
+
+    std::optional<QString> changed_name;
+    std::optional<quint64> changed_timestamp;
+    if (event->name != name) {
+        event->name = name;
+        changed_name = name;
+
+        if (EventListItem* event_item = events.item(event->get_id())) {
+            event_item->setText(name);
         }
     }
+    if (event->timestamp != timestamp) {
+        event->timestamp = timestamp;
+        changed_timestamp = timestamp;
+    }
+
+    if (changed_name.has_value() || changed_timestamp.has_value()) {
+        outbox_.patch(event->get_id(), std::move(changed_name), changed_timestamp);
+    }
 }
 
 void MainWindow::on_eventName_textEdited(const QString &new_value)
@@ -291,14 +259,11 @@ void MainWindow::on_deleteEventBtn_clicked()
         return;
     }
 
-    Event* found_event = nullptr;
-    for (auto& event: events) {
-        if (event.get_id() == selected_event_id.value()) {
-            found_event = &event;
-            break;
-        }
-    }
+    // Запомним id: при удалении элемента из списка выделение перейдет
+    // на соседний элемент, и selected_event_id поменяется.
+    const quint64 event_id = selected_event_id.value();
 
+    const Event* found_event = events.find(event_id);
     if (found_event == nullptr) {
         return;
     }
@@ -315,41 +280,14 @@ void MainWindow::on_deleteEventBtn_clicked()
             return;
         }
 
-        api::Result result = api::request(
-            "event",
-            {"event_id"},
-            {QString::number(*selected_event_id)},
-            token_,
-            api::HttpMethod::Delete
-            );
-
-        if (result.success) {
-            ui->eventList->takeItem(ui->eventList->currentRow());
-            events.erase(std::find_if(events.begin(), events.end(), [this](const auto& event) {
-                return event.get_id() == *selected_event_id;
-            }));
-        } else {
-            QToolTip::showText(QCursor::pos(), QString(result.content));
-        }
+        outbox_.drop(event_id);
     } else {
-        api::Result result = api::request(
-            "event_register",
-            {"event_id"},
-            {QString::number(*selected_event_id)},
-            token_,
-            api::HttpMethod::Delete
-            );
-
-        if (result.success) {
-            ui->eventList->takeItem(ui->eventList->currentRow());
-            events.erase(std::find_if(events.begin(), events.end(), [this](const auto& event) {
-                return event.get_id() == *selected_event_id;
-            }));
-        } else {
-            QToolTip::showText(QCursor::pos(), QString(result.content));
-        }
-
+        outbox_.unregister(event_id);
     }
+
+    // Удаление элемента убирает его из списка.
+    delete events.item(event_id);
+    events.remove(event_id);
 }
 
 
@@ -393,17 +331,16 @@ void MainWindow::on_viewReferLbl_linkActivated(const QString &link)
     // https://www.google.com/search?q=qt+put+string+into+clibpboard
     // https://doc.qt.io/qt-6/qclipboard.html#setText
 
-    for (auto& event: events) {
-        if (event.get_id() == selected_event_id.value()) {
-            // https://doc.qt.io/qt-6/qclipboard.html#details
-            assert(QGuiApplication::clipboard() != nullptr);
-            QGuiApplication::clipboard()->setText(event.refer_str);
+    const Event* event = events.find(selected_event_id.value());
+    if (event == nullptr) {
+        return;
+    }
 
-            QToolTip::showText(QCursor::pos(), "Код скопирован в буфер обмена!");
+    // https://doc.qt.io/qt-6/qclipboard.html#details
+    assert(QGuiApplication::clipboard() != nullptr);
+    QGuiApplication::clipboard()->setText(event->refer_str);
 
-            break;
-        }
-    }
+    QToolTip::showText(QCursor::pos(), "Код скопирован в буфер обмена!");
 }
 
 void MainWindow::on_enrollByReferLbl_linkActivated(const QString &link)
@@ -414,11 +351,11 @@ void MainWindow::on_enrollByReferLbl_linkActivated(const QString &link)
 
     if (dlg.exec() == QDialog::DialogCode::Accepted) {
         // Событие должно быть, добавим к себе в список.
-        events.append(dlg.maybe_event.value());
+        const Event& stored_event = events.insert(std::move(dlg.maybe_event.value()));
 
         // Добавляем в конец ListWidget, не сортируем.
         // Ничего страшного.
-        new EventListItem(events.back(), ui->eventList);
+        add_list_item(stored_event);
         // Не будем ждать несколько секунд, пока список обновится.
         // Хотя это хорошо, что обновления накапливаются, иначе
         // работать будет медленно. Например, насколько помню,
@@ -434,12 +371,11 @@ void MainWindow::on_viewParticipantsLbl_linkActivated(const QString &link)
         return;
     }
 
-    for (auto& event: events) {
-        if (event.get_id() == selected_event_id.value()) {
-            ParticipantsDialog dlg(token_, event, this);
-            dlg.exec();
-
-            break;
-        }
+    Event* event = events.find(selected_event_id.value());
+    if (event == nullptr) {
+        return;
     }
+
+    ParticipantsDialog dlg(token_, *event, this);
+    dlg.exec();
 }
@@ -3,11 +3,13 @@
 
 #include <QMainWindow>
 #include <QListWidgetItem>
-#include <QTimer>
 
 #include "DB/event.h"
 #include "DB/user.h"
 
+#include "eventstore.h"
+#include "outbox.h"
+
 QT_BEGIN_NAMESPACE
 namespace Ui {
 class MainWindow;
@@ -50,17 +52,16 @@ private slots:
 
 private:
     void update_selected_event();
+    void add_list_item(const Event& event);
 private:
     Ui::MainWindow *ui;
     User user_;
     QString token_;
     std::optional<quint64> selected_event_id;
 
-    QVector<quint64> dirty_events;
-    QTimer server_commit_timer;
-
     bool switching_events = false;
 
-    QVector<Event> events;
+    EventStore events;
+    Outbox outbox_;
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,413 @@
+#include "outbox.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+#include "api.h"
+#include "eventstore.h"
+
+static const quint32 file_magic = 0x76624F42; // "vbOB"
+static const quint32 file_version = 2; // 1 -- без attempts.
+
+// Правки имени приходят на каждое нажатие клавиши, подождем,
+// пока пользователь допечатает. Так их склеится больше.
+static const int patch_delay_ms = 2500;
+static const int min_backoff_ms = 1000;
+static const int max_backoff_ms = 5 * 60 * 1000;
+// После стольких временных ошибок подряд изменение выбрасываем, иначе
+// оно навсегда загородит собой очередь. Отсутствие связи не считается:
+// очередь для того и нужна, чтобы дождаться сети.
+static const quint32 max_attempts = 10;
+
+static void write_mutation(QDataStream& out, const Outbox::Mutation& mutation) {
+    out << static_cast<quint8>(mutation.kind);
+    out << mutation.event_id;
+    out << mutation.name.has_value();
+    out << mutation.name.value_or(QString());
+    out << mutation.timestamp.has_value();
+    out << mutation.timestamp.value_or(0);
+    out << mutation.attempts;
+}
+
+static bool read_mutation(QDataStream& in, quint32 version, Outbox::Mutation& mutation) {
+    quint8 kind = 0;
+    bool has_name = false;
+    QString name;
+    bool has_timestamp = false;
+    quint64 timestamp = 0;
+
+    in >> kind >> mutation.event_id >> has_name >> name >> has_timestamp >> timestamp;
+    if (version >= 2) {
+        in >> mutation.attempts;
+    }
+    if (in.status() != QDataStream::Status::Ok || kind > static_cast<quint8>(Outbox::Kind::Unregister)) {
+        return false;
+    }
+
+    mutation.kind = static_cast<Outbox::Kind>(kind);
+    mutation.name = has_name ? std::optional<QString>(name) : std::nullopt;
+    mutation.timestamp = has_timestamp ? std::optional<quint64>(timestamp) : std::nullopt;
+
+    return true;
+}
+
+// Имеет ли смысл повторить запрос позже.
+// Остальные ошибки -- сервер отказался выполнять изменение,
+// и повтор ничего не даст. 500 сервер отвечает и на правку удаленного
+// или чужого события, так что это тоже отказ. Истекшую сессию (511)
+// повторять бессмысленно, пока нет повторного входа.
+static bool is_transient(int status_code) {
+    return status_code == 0     // Нет связи.
+        || status_code == 408   // Request Timeout
+        || status_code == 429   // Too Many Requests
+        || status_code == 502   // Bad Gateway
+        || status_code == 503   // Service Unavailable
+        || status_code == 504;  // Gateway Timeout
+}
+
+// То же для создания события. POST /event не идемпотентен: если сервер
+// мог его выполнить (ответ потерялся, прокси не дождался), повтор создал
+// бы второе событие. Повторяем, только когда точно ничего не выполнялось.
+static bool is_transient_create(const api::Result& result) {
+    return (result.status_code == 0 && result.not_sent)
+        || result.status_code == 429   // Too Many Requests
+        || result.status_code == 503;  // Service Unavailable: отказ до обработки.
+}
+
+static api::Result send(const Outbox::Mutation& mutation, const QString& token) {
+    switch (mutation.kind) {
+    case Outbox::Kind::Create:
+        return api::request(
+            "event",
+            {"name", "timestamp"},
+            {mutation.name.value_or(QString()), QString::number(mutation.timestamp.value_or(0))},
+            token,
+            api::HttpMethod::Post
+            );
+
+    case Outbox::Kind::Patch: {
+        // Отправляем только поля, которые менялись.
+        QVector<QString> args = {"event_id"};
+        QVector<QString> values = {QString::number(mutation.event_id)};
+        if (mutation.name.has_value()) {
+            args.push_back("name");
+            values.push_back(*mutation.name);
+        }
+        if (mutation.timestamp.has_value()) {
+            args.push_back("timestamp");
+            values.push_back(QString::number(*mutation.timestamp));
+        }
+        return api::request("event", args, values, token, api::HttpMethod::Patch);
+    }
+
+    case Outbox::Kind::Delete:
+        return api::request("event", {"event_id"}, {QString::number(mutation.event_id)}, token, api::HttpMethod::Delete);
+
+    case Outbox::Kind::Unregister:
+        return api::request("event_register", {"event_id"}, {QString::number(mutation.event_id)}, token, api::HttpMethod::Delete);
+    }
+
+    return api::Result();
+}
+
+Outbox::Outbox(const QString& path, const QString& token, QObject* parent)
+    : QObject(parent)
+    , path_(path)
+    , token_(token)
+{
+    flush_timer_.setSingleShot(true);
+    connect(&flush_timer_, &QTimer::timeout, this, &Outbox::flush);
+
+    if (!load()) {
+        qWarning() << "Не удалось прочитать очередь изменений" << path_;
+    }
+}
+
+void Outbox::start() {
+    started_ = true;
+    if (!queue_.isEmpty()) {
+        // Остались изменения с прошлого запуска.
+        flush_timer_.start(0);
+    }
+}
+
+void Outbox::create(const QString& name, quint64 timestamp) {
+    Mutation mutation;
+    mutation.kind = Kind::Create;
+    mutation.name = name;
+    mutation.timestamp = timestamp;
+
+    queue_.push_back(std::move(mutation));
+
+    // Пользователь ждет, когда событие появится в списке.
+    changed(0);
+}
+
+void Outbox::patch(quint64 event_id, std::optional<QString> name, std::optional<quint64> timestamp) {
+    for (Mutation& queued: queue_) {
+        if (queued.event_id != event_id) {
+            continue;
+        }
+
+        if (queued.kind == Kind::Delete || queued.kind == Kind::Unregister) {
+            // Событие все равно пропадет.
+            return;
+        }
+
+        if (queued.kind == Kind::Patch) {
+            // Склеиваем с уже ожидающей правкой.
+            if (name.has_value()) {
+                queued.name = std::move(name);
+            }
+            if (timestamp.has_value()) {
+                queued.timestamp = timestamp;
+            }
+            changed(patch_delay_ms);
+            return;
+        }
+    }
+
+    Mutation mutation;
+    mutation.kind = Kind::Patch;
+    mutation.event_id = event_id;
+    mutation.name = std::move(name);
+    mutation.timestamp = timestamp;
+
+    queue_.push_back(std::move(mutation));
+    changed(patch_delay_ms);
+}
+
+void Outbox::drop(quint64 event_id) {
+    remove(event_id, Kind::Delete);
+}
+
+void Outbox::unregister(quint64 event_id) {
+    remove(event_id, Kind::Unregister);
+}
+
+void Outbox::remove(quint64 event_id, Kind kind) {
+    // Правки удаляемого события отправлять незачем.
+    queue_.removeIf([event_id](const Mutation& queued) {
+        return queued.event_id == event_id && queued.kind == Kind::Patch;
+    });
+
+    for (const Mutation& queued: queue_) {
+        if (queued.event_id == event_id) {
+            // Удаление уже в очереди.
+            changed(0);
+            return;
+        }
+    }
+
+    Mutation mutation;
+    mutation.kind = kind;
+    mutation.event_id = event_id;
+
+    queue_.push_back(std::move(mutation));
+    changed(0);
+}
+
+void Outbox::apply_to(EventStore& events) const {
+    for (const Mutation& mutation: queue_) {
+        switch (mutation.kind) {
+        case Kind::Create:
+            // Появится в списке, когда сервер его создаст.
+            break;
+
+        case Kind::Patch: {
+            Event* event = events.find(mutation.event_id);
+            if (event == nullptr) {
+                break;
+            }
+            if (mutation.name.has_value()) {
+                event->name = *mutation.name;
+            }
+            if (mutation.timestamp.has_value()) {
+                event->timestamp = *mutation.timestamp;
+            }
+            break;
+        }
+
+        case Kind::Delete:
+        case Kind::Unregister:
+            events.remove(mutation.event_id);
+            break;
+        }
+    }
+}
+
+void Outbox::changed(int delay_ms) {
+    if (!save()) {
+        qWarning() << "Не удалось сохранить очередь изменений" << path_;
+    }
+
+    if (!started_) {
+        // Отправит start().
+        return;
+    }
+
+    if (backoff_ms_ > 0) {
+        // Сервер недоступен, ждем окончания паузы, не долбим его.
+        if (!flush_timer_.isActive()) {
+            flush_timer_.start(backoff_ms_);
+        }
+        return;
+    }
+
+    if (!flush_timer_.isActive() || flush_timer_.remainingTime() > delay_ms) {
+        flush_timer_.start(delay_ms);
+    }
+}
+
+void Outbox::requeue_front(Mutation mutation) {
+    if (mutation.kind == Kind::Patch) {
+        // Пока запрос выполнялся, могли прийти новые правки или удаление.
+        // Новые значения полей важнее старых.
+        for (Mutation& queued: queue_) {
+            if (queued.event_id != mutation.event_id) {
+                continue;
+            }
+
+            if (queued.kind == Kind::Patch) {
+                if (!queued.name.has_value()) {
+                    queued.name = std::move(mutation.name);
+                }
+                if (!queued.timestamp.has_value()) {
+                    queued.timestamp = mutation.timestamp;
+                }
+            }
+            return;
+        }
+    }
+
+    queue_.prepend(std::move(mutation));
+}
+
+void Outbox::flush() {
+    // api::request крутит вложенный цикл событий, таймер или новая
+    // правка могут снова позвать flush, пока мы ждем ответа.
+    if (flushing_) {
+        return;
+    }
+    flushing_ = true;
+
+    while (!queue_.isEmpty()) {
+        // Вынимаем из очереди до отправки: новые правки этого события,
+        // пришедшие во время запроса, не должны склеиться с уже отправленной.
+        in_flight_ = queue_.takeFirst();
+        api::Result result = send(*in_flight_, token_);
+        Mutation done = std::move(*in_flight_);
+        in_flight_.reset();
+
+        if (result.success) {
+            backoff_ms_ = 0;
+
+            if (done.kind == Kind::Create) {
+                Event event;
+                QDataStream stream(result.content);
+                stream >> event;
+                emit created(event);
+            }
+
+            save();
+            continue;
+        }
+
+        if (result.status_code != 0) {
+            ++done.attempts;
+        }
+        const bool transient = done.kind == Kind::Create
+            ? is_transient_create(result)
+            : is_transient(result.status_code);
+        if (transient && done.attempts < max_attempts) {
+            requeue_front(std::move(done));
+            save();
+
+            if (backoff_ms_ == 0) {
+                // Сообщаем только о первой неудаче, а не о каждом повторе.
+                emit error(result.status_code == 0
+                    ? QString("Нет связи с сервером, изменения будут отправлены позже.")
+                    : QString(result.content));
+                backoff_ms_ = min_backoff_ms;
+            } else {
+                backoff_ms_ = qMin(backoff_ms_ * 2, max_backoff_ms);
+            }
+            flush_timer_.start(backoff_ms_);
+            break;
+        }
+
+        // Сервер отказался, повторять бессмысленно. Или неизвестно,
+        // создано ли событие, -- тогда повторять нельзя.
+        qWarning() << "Изменение события" << done.event_id << "отброшено, код" << result.status_code
+                   << "после" << done.attempts << "попыток";
+        save();
+        if (done.kind == Kind::Create && is_transient(result.status_code)) {
+            emit error(QString("Не удалось узнать, создано ли событие \"%1\". Обновите список, прежде чем создавать его снова.")
+                           .arg(done.name.value_or(QString())));
+        } else {
+            emit error(QString(result.content));
+        }
+    }
+
+    flushing_ = false;
+}
+
+bool Outbox::load() {
+    QFile file(path_);
+    if (!file.exists()) {
+        return true;
+    }
+    if (!file.open(QFile::OpenModeFlag::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (stream.status() != QDataStream::Status::Ok || magic != file_magic
+        || version < 1 || version > file_version) {
+        return false;
+    }
+
+    QVector<Mutation> loaded;
+    for (quint32 i = 0; i < count; ++i) {
+        Mutation mutation;
+        if (!read_mutation(stream, version, mutation)) {
+            return false;
+        }
+        loaded.push_back(std::move(mutation));
+    }
+
+    queue_ = std::move(loaded);
+
+    return true;
+}
+
+bool Outbox::save() const {
+    // QSaveFile пишет во временный файл и подменяет им старый,
+    // так что при падении посреди записи очередь не испортится.
+    QSaveFile file(path_);
+    if (!file.open(QFile::OpenModeFlag::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+
+    const quint32 count = queue_.size() + (in_flight_.has_value() ? 1 : 0);
+    stream << file_magic << file_version << count;
+
+    // Отправляемое сейчас изменение тоже сохраняем: если приложение
+    // закроют, не дождавшись ответа, его надо будет отправить снова.
+    if (in_flight_.has_value()) {
+        write_mutation(stream, *in_flight_);
+    }
+    for (const Mutation& mutation: queue_) {
+        write_mutation(stream, mutation);
+    }
+
+    return file.commit();
+}
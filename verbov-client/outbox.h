@@ -0,0 +1,91 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <optional>
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+#include "DB/event.h"
+
+class EventStore;
+
+// Очередь изменений, которые еще не дошли до сервера.
+// Хранится в файле, так что правки переживают перезапуск приложения
+// и отсутствие сети. Повторные правки одного события склеиваются,
+// на сервер уходят только измененные поля.
+class Outbox : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Kind : quint8 {
+        Create     = 0,
+        Patch      = 1,
+        Delete     = 2,
+        Unregister = 3,
+    };
+
+    struct Mutation {
+        Kind kind = Kind::Patch;
+        quint64 event_id = 0; // 0 у Create, id еще не известен.
+
+        // Отсутствующее значение -- поле не менялось.
+        std::optional<QString> name;
+        std::optional<quint64> timestamp;
+
+        // Сколько раз сервер ответил временной ошибкой.
+        quint32 attempts = 0;
+    };
+
+public:
+    Outbox(const QString& path, const QString& token, QObject* parent = nullptr);
+
+    void create(const QString& name, quint64 timestamp);
+    void patch(quint64 event_id, std::optional<QString> name, std::optional<quint64> timestamp);
+    void drop(quint64 event_id);
+    void unregister(quint64 event_id);
+
+    // Начинает отправку, в том числе оставшегося с прошлого запуска.
+    // Вызывать, когда получатели created и error уже подключены и
+    // apply_to уже применен: до этого очередь только копится.
+    void start();
+
+    bool is_empty() const { return queue_.isEmpty() && !in_flight_.has_value(); }
+
+    // Применяет еще не отправленные правки к событиям, полученным с сервера.
+    void apply_to(EventStore& events) const;
+
+signals:
+    // Сервер создал событие из очереди.
+    void created(const Event& event);
+    void error(const QString& message);
+
+private slots:
+    void flush();
+
+private:
+    void remove(quint64 event_id, Kind kind);
+    void changed(int delay_ms);
+    void requeue_front(Mutation mutation);
+
+    bool load();
+    bool save() const;
+
+private:
+    const QString path_;
+    const QString token_;
+
+    QVector<Mutation> queue_;
+    // Изменение, запрос для которого сейчас выполняется.
+    std::optional<Mutation> in_flight_;
+
+    QTimer flush_timer_;
+    int backoff_ms_ = 0;
+    bool flushing_ = false;
+    bool started_ = false;
+};
+
+#endif // OUTBOX_H
@@ -2,67 +2,45 @@
 #include "ui_participantsdialog.h"
 
 #include <algorithm>
+#include <functional>
 
 #include <QString>
 #include <QToolTip>
 #include <QTimer>
 
 #include "api.h"
+#include "participantsmodel.h"
 
 ParticipantsDialog::ParticipantsDialog(const QString& token, Event& event, QWidget *parent)
     : token_(token)
     , event_(event)
     , QDialog(parent)
     , ui(new Ui::ParticipantsDialog)
+    , model_(new ParticipantsModel(token, event.get_id(), this))
 {
     ui->setupUi(this);
 
-    ui->tableWidget->resizeColumnsToContents();
-
-    api::Result result = api::request(
-        "event_get_participants",
-        {"event_id"},
-        {QString::number(event_.get_id())},
-        token_
-    );
-
-    if (result.success) {
-        QVector<User> participants;
-
-        QDataStream stream(result.content);
-        stream >> participants;
-
-        participants_ = std::move(participants);
-
-        fill_table();
-    } else {
+    // Первую страницу грузим сами, чтобы при ошибке сразу закрыть окно.
+    // Остальные страницы таблица попросит у модели при прокрутке.
+    QString error_msg;
+    if (!model_->fetch_page(error_msg)) {
         // Покажем ошибку.
         // Без задержки не работает...
-        QTimer::singleShot(std::chrono::milliseconds(500), [result]() {
-            QToolTip::showText(QCursor::pos(), QString(result.content));
+        QTimer::singleShot(std::chrono::milliseconds(500), [error_msg]() {
+            QToolTip::showText(QCursor::pos(), error_msg);
         });
 
-        // qInfo() << QString(result.content);
-
         // Закроем окно.
         reject();
+        return;
     }
-}
-
-void ParticipantsDialog::fill_table() {
-    int num_rows = 0;
-    assert(ui->tableWidget->rowCount() == num_rows);
-
-    for (const auto& participant: participants_) {
-        int row_index = num_rows; // Вставляем в конец.
 
-        ui->tableWidget->insertRow(row_index);
-        ui->tableWidget->setItem(row_index, 0, new QTableWidgetItem(participant.first_name));
-        ui->tableWidget->setItem(row_index, 1, new QTableWidgetItem(participant.last_name));
-        ui->tableWidget->setItem(row_index, 2, new QTableWidgetItem("https://vk.com/id" + QString::number(participant.get_vk_id())));
-    }
+    connect(model_, &ParticipantsModel::error, this, [](const QString& message) {
+        QToolTip::showText(QCursor::pos(), message);
+    });
 
-    ui->tableWidget->resizeColumnsToContents();
+    ui->tableView->setModel(model_);
+    ui->tableView->resizeColumnsToContents();
 }
 
 ParticipantsDialog::~ParticipantsDialog()
@@ -72,37 +50,30 @@ ParticipantsDialog::~ParticipantsDialog()
 
 void ParticipantsDialog::on_pushButton_clicked()
 {
-    QItemSelectionModel *selection = ui->tableWidget->selectionModel();
+    QItemSelectionModel *selection = ui->tableView->selectionModel();
 
-    QVector<size_t> selected_participants;
+    QVector<int> selected_rows;
 
-    for (const QModelIndex& index: selection->selectedIndexes()) {
-        selected_participants.push_back(index.row());
+    for (const QModelIndex& index: selection->selectedRows()) {
+        selected_rows.push_back(index.row());
     }
 
-    std::sort(selected_participants.begin(), selected_participants.end());
-
-    // Мы удаляем элементы массива, индексы сдвигаются на один у всех элементов,
-    // у которых индекс был больше удаляемого.
-    size_t index_shift = 0;
-    for (size_t participant_index: selected_participants) {
-        size_t shifted_index = participant_index - index_shift;
+    // Удаляем с конца, тогда индексы еще не удаленных строк не сдвигаются.
+    std::sort(selected_rows.begin(), selected_rows.end(), std::greater<int>());
 
+    for (int row: selected_rows) {
         api::Result result = api::request(
             "event_delete_participant",
             {"event_id", "user_id"},
-            {QString::number(event_.get_id()), QString::number(participants_[shifted_index].get_vk_id())},
+            {QString::number(event_.get_id()), QString::number(model_->participant(row).vk_id)},
             token_
         );
 
         if (result.success) {
-            participants_.erase(participants_.begin() + shifted_index);
-            ui->tableWidget->removeRow(shifted_index);
-            index_shift += 1;
+            model_->remove_participant(row);
         } else {
             QToolTip::showText(QCursor::pos(), QString(result.content));
             break;
         }
     }
 }
-
@@ -4,7 +4,8 @@
 #include <QDialog>
 
 #include "DB/event.h"
-#include "DB/user.h"
+
+class ParticipantsModel;
 
 namespace Ui {
 class ParticipantsDialog;
@@ -21,16 +22,13 @@ public:
 private slots:
     void on_pushButton_clicked();
 
-private:
-    void fill_table();
-
 private:
     const QString& token_;
     Event& event_;
 
     Ui::ParticipantsDialog *ui;
 
-    QVector<User> participants_;
+    ParticipantsModel* model_;
 };
 
 #endif // PARTICIPANTSDIALOG_H
@@ -0,0 +1,121 @@
+#include "participantsmodel.h"
+
+#include <QDataStream>
+
+#include "api.h"
+
+// Сервер все равно ограничивает размер страницы сверху.
+static const int page_size = 200;
+
+ParticipantsModel::ParticipantsModel(const QString& token, quint64 event_id, QObject* parent)
+    : QAbstractTableModel(parent)
+    , token_(token)
+    , event_id_(event_id)
+{
+}
+
+int ParticipantsModel::rowCount(const QModelIndex& parent) const {
+    if (parent.isValid()) {
+        return 0;
+    }
+    return participants_.size();
+}
+
+int ParticipantsModel::columnCount(const QModelIndex& parent) const {
+    if (parent.isValid()) {
+        return 0;
+    }
+    return 3;
+}
+
+QVariant ParticipantsModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= participants_.size() || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+
+    const UserBrief& participant = participants_[index.row()];
+    switch (index.column()) {
+    case 0: return participant.first_name;
+    case 1: return participant.last_name;
+    case 2: return "https://vk.com/id" + QString::number(participant.vk_id);
+    }
+
+    return QVariant();
+}
+
+QVariant ParticipantsModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QAbstractTableModel::headerData(section, orientation, role);
+    }
+
+    switch (section) {
+    case 0: return QString("Имя");
+    case 1: return QString("Фамилия");
+    case 2: return QString("Профиль ВК");
+    }
+
+    return QVariant();
+}
+
+bool ParticipantsModel::canFetchMore(const QModelIndex& parent) const {
+    return !parent.isValid() && has_more_ && !fetching_;
+}
+
+void ParticipantsModel::fetchMore(const QModelIndex& parent) {
+    if (parent.isValid()) {
+        return;
+    }
+
+    QString error_msg;
+    if (!fetch_page(error_msg)) {
+        emit error(error_msg);
+    }
+}
+
+bool ParticipantsModel::fetch_page(QString& error_msg) {
+    if (fetching_ || !has_more_) {
+        return true;
+    }
+    fetching_ = true;
+
+    // Курсор -- vk_id последнего загруженного участника.
+    const quint64 after_vk_id = participants_.isEmpty() ? 0 : participants_.back().vk_id;
+
+    api::Result result = api::request(
+        "event_get_participants",
+        {"event_id", "after", "limit"},
+        {QString::number(event_id_), QString::number(after_vk_id), QString::number(page_size)},
+        token_
+    );
+
+    fetching_ = false;
+
+    if (!result.success) {
+        // Не будем бесконечно перезапрашивать при каждой прокрутке.
+        has_more_ = false;
+        error_msg = QString(result.content);
+        return false;
+    }
+
+    QVector<UserBrief> page;
+    bool has_more = false;
+
+    QDataStream stream(result.content);
+    stream >> page;
+    stream >> has_more;
+
+    if (!page.isEmpty()) {
+        beginInsertRows(QModelIndex(), participants_.size(), participants_.size() + page.size() - 1);
+        participants_.append(std::move(page));
+        endInsertRows();
+    }
+    has_more_ = has_more;
+
+    return true;
+}
+
+void ParticipantsModel::remove_participant(int row) {
+    beginRemoveRows(QModelIndex(), row, row);
+    participants_.remove(row);
+    endRemoveRows();
+}
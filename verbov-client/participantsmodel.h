@@ -0,0 +1,47 @@
+#ifndef PARTICIPANTSMODEL_H
+#define PARTICIPANTSMODEL_H
+
+#include <QAbstractTableModel>
+#include <QVector>
+
+#include "DB/user.h"
+
+// Участники события. Подгружаются с сервера страницами по мере
+// прокрутки таблицы (canFetchMore/fetchMore вызывает сам QTableView),
+// так что даже огромный список открывается сразу.
+class ParticipantsModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    ParticipantsModel(const QString& token, quint64 event_id, QObject* parent = nullptr);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
+
+    // Загружает следующую страницу. При ошибке в error_msg текст от сервера.
+    bool fetch_page(QString& error_msg);
+
+    const UserBrief& participant(int row) const { return participants_[row]; }
+    void remove_participant(int row);
+
+signals:
+    void error(const QString& message);
+
+private:
+    const QString& token_;
+    const quint64 event_id_;
+
+    QVector<UserBrief> participants_;
+    bool has_more_ = true;
+    // api::request крутит вложенный цикл событий, представление
+    // может еще раз попросить страницу, пока мы ждем ответа.
+    bool fetching_ = false;
+};
+
+#endif // PARTICIPANTSMODEL_H
@@ -5,6 +5,7 @@
 #include <QCryptographicHash>
 #include <QDataStream>
 #include <QSqlError>
+#include <QStringList>
 
 #include <optional>
 #include <random>
@@ -12,7 +13,8 @@
 #include "user.h"
 #include "eventparticipant.h"
 
-const QString Event::table_name = "Events";
+#include "metrics.h"
+#include "trace.h"
 
 #define CHECK(expr) if (!(expr)) { return false; }
 bool Event::run_tests(QSqlDatabase& test_db) {
@@ -20,266 +22,187 @@ bool Event::run_tests(QSqlDatabase& test_db) {
 }
 #undef CHECK
 
-bool Event::unpack_from_query(QSqlQuery& query) {
-    bool right_variant = true;
-    id = query.value("id").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    name = query.value("name").toString();
-
-    creator_user_id = query.value("creator_user_id").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    timestamp = query.value("timestamp").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    refer_str = query.value("refer_str").toString();
-
-    last_notification_level = query.value("last_notification_level").toInt(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    return true;
-}
-
-void Event::pack_into_query(QSqlQuery& query, bool fill_id) const {
-    if (fill_id) {
-        // If we are creating a row, then id is not known, we should not set it.
-        query.bindValue(":id", QVariant::fromValue(id));
-    }
-
-    query.bindValue(":name", name);
-    query.bindValue(":creator_user_id", QVariant::fromValue(creator_user_id));
-    query.bindValue(":timestamp", QVariant::fromValue(timestamp));
-    query.bindValue(":refer_str", QVariant::fromValue(refer_str));
-    query.bindValue(":last_notification_level", QVariant::fromValue(static_cast<quint32>(last_notification_level)));
+bool Event::unpack_from_query(QSqlQuery& query, int first_column) {
+    // Порядок колонок -- как в schema::Table<Event>::fields.
+    return schema::unpack(query, *this, first_column);
 }
 
 bool Event::check_table(QSqlDatabase& db) {
-    // QSqlQuery docs: https://doc.qt.io/qt-6/sql-sqlstatements.html
-    QSqlQuery query(db);
-
-    // SQL LIKE operator. https://www.w3schools.com/sql/sql_like.asp
-    // Turns out ids in sqlite start from 1. That's great.
-    //   https://stackoverflow.com/questions/692856/set-start-value-for-autoincrement-in-sqlite
-    //   The initial value for SQLITE_SEQUENCE.seq must be null or 0. But from tests seems like ids
-    //   start from 1.
-    //   https://stackoverflow.com/a/9053277
-    // We have to write NOT NULL at PRIMARY KEYS of not integer type for sqlite due to a bug.
-    //   https://stackoverflow.com/a/64778551
-    if (!query.prepare(
-        "CREATE TABLE IF NOT EXISTS " + table_name + "("
-        "id                      INTEGER     NOT NULL PRIMARY KEY AUTOINCREMENT CHECK(id >= 1),"
-        "name                    VARCHAR(64) NOT NULL                           CHECK(name != ''),"
-        "refer_str               VARCHAR(9)  NOT NULL UNIQUE                    CHECK(LENGTH(refer_str) = 9),"
-        "creator_user_id         INTEGER     NOT NULL                           CHECK(creator_user_id >= 1),"
-        "timestamp               INTEGER     NOT NULL                           CHECK(timestamp >= 0),"
-        "last_notification_level INTEGER     NOT NULL                           CHECK(last_notification_level >= 0 and last_notification_level <= 6),"
-        "FOREIGN KEY (creator_user_id) REFERENCES " + User::table_name + "(vk_id) ON DELETE RESTRICT"
-    ");")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
+    // Текст CREATE TABLE собирается из schema::Table<Event>.
+    if (!schema::create_table<Event>(db)) {
         return false;
     }
 
-    return true;
+    // Для fetch_due и archive_past: окно по времени, а не вся таблица.
+    static constexpr auto index_sql = schema::sql<
+        "CREATE INDEX IF NOT EXISTS ", schema::FixedString(table_name), "_timestamp ON ",
+        schema::FixedString(table_name), "(timestamp)">;
+    QSqlQuery query(db);
+    return schema::open(query, schema::text<index_sql>(), {});
 }
 
 bool Event::fetch_by_id(QSqlDatabase& db, quint64 id, std::optional<Event>& found_session) {
-    Event event;
-    QSqlQuery query(db);
-
-    if (!query.prepare("SELECT * FROM " + table_name + " WHERE id = :id")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":id", QVariant::fromValue(id));
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    if (!query.first()) {
-        // Haven't found anything. But the query is successful.
-        found_session.reset();
-        return true;
-    }
-
-    if (!event.unpack_from_query(query)) {
-        // Failed to unpack. Treat as a failed query.
-        return false;
-    }
-
-    found_session = std::move(event);
-
-    return true;
+    SQL_TIMER("Event::fetch_by_id");
+    TRACE_SPAN("Event::fetch_by_id", "db");
+    return schema::fetch_one(db, schema::text<schema::select_by_key<Event>>(), {QVariant::fromValue(id)}, found_session);
 }
 
+// Все доступные пользователю события: которые он создал или где он участник.
+// IN operator with a subquery.
+// https://www.geeksforgeeks.org/how-to-use-the-in-operator-with-a-subquery/
+// Параметры позиционные, поэтому user_id привязывается дважды.
+static constexpr auto all_for_user_where = schema::sql<
+    " WHERE creator_user_id = ? OR id IN (SELECT event_id FROM ",
+    schema::FixedString(EventParticipant::table_name), " WHERE user_id = ?)">;
+static constexpr auto all_for_user_select = schema::sql<schema::select<Event>, all_for_user_where>;
+
 // Запрос всех доступных пользователю событий.
 // Которые он создал или где он участник.
 bool Event::fetch_all_for_user(QSqlDatabase& db, quint64 user_id, QVector<Event>& found_events) {
-    QSqlQuery query(db);
-
-    // IN operator with a subquery.
-    // https://www.geeksforgeeks.org/how-to-use-the-in-operator-with-a-subquery/
-    if (!query.prepare(
-        "SELECT * FROM " + table_name + " WHERE creator_user_id = :user_id OR id IN ("
-        "SELECT event_id FROM " + QString(EventParticipant::table_name) + " WHERE user_id = :user_id"
-    ")")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":user_id", QVariant::fromValue(user_id));
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
+    SQL_TIMER("Event::fetch_all_for_user");
+    TRACE_SPAN("Event::fetch_all_for_user", "db");
+    return schema::fetch_all(db, schema::text<all_for_user_select>(), {QVariant::fromValue(user_id), QVariant::fromValue(user_id)}, found_events);
+}
 
-    found_events.clear();
+// То же по архиву (ATTACH ... AS archive), схема там та же. UNION, а не
+// UNION ALL: событие, перенесенное не до конца (сбой между вставкой в архив
+// и удалением), попадет в ответ один раз.
+static constexpr auto history_for_user_select = schema::sql<
+    all_for_user_select, " UNION SELECT ", schema::columns<Event>, " FROM archive.", schema::FixedString(Event::table_name),
+    " WHERE creator_user_id = ? OR id IN (SELECT event_id FROM archive.",
+    schema::FixedString(EventParticipant::table_name), " WHERE user_id = ?)">;
+
+bool Event::fetch_history_for_user(QSqlDatabase& db, quint64 user_id, QVector<Event>& found_events) {
+    SQL_TIMER("Event::fetch_history_for_user");
+    TRACE_SPAN("Event::fetch_history_for_user", "db");
+    const QVariant id = QVariant::fromValue(user_id);
+    return schema::fetch_all(db, schema::text<history_for_user_select>(), {id, id, id, id}, found_events);
+}
 
-    if (query.first()) {
-        do {
-            Event event;
+bool Event::count_all_for_user(QSqlDatabase& db, quint64 user_id, qint64& count) {
+    SQL_TIMER("Event::count_all_for_user");
+    TRACE_SPAN("Event::count_all_for_user", "db");
+    static constexpr auto sql = schema::sql<"SELECT COUNT(*) FROM ", schema::FixedString(table_name), all_for_user_where>;
+    return schema::count(db, schema::text<sql>(), {QVariant::fromValue(user_id), QVariant::fromValue(user_id)}, count);
+}
 
-            if (!event.unpack_from_query(query)) {
-                // Failed to unpack. Treat as a failed query.
-                return false;
-            }
+bool Event::query_all_for_user(QSqlQuery& query, quint64 user_id) {
+    SQL_TIMER("Event::query_all_for_user");
+    TRACE_SPAN("Event::query_all_for_user", "db");
+    return schema::open(query, schema::text<all_for_user_select>(), {QVariant::fromValue(user_id), QVariant::fromValue(user_id)});
+}
 
-            found_events.push_back(std::move(event));
-        } while (query.next());
-    }
+bool Event::fetch_by_refer(QSqlDatabase& db, const QString& refer, std::optional<Event>& found_event) {
+    SQL_TIMER("Event::fetch_by_refer");
+    TRACE_SPAN("Event::fetch_by_refer", "db");
+    static constexpr auto sql = schema::sql<schema::select<Event>, " WHERE refer_str = ?">;
+    return schema::fetch_one(db, schema::text<sql>(), {refer}, found_event);
+}
 
-    return true;
+bool Event::fetch_due(QSqlDatabase& db, int level, quint64 after, quint64 until, int limit, QVector<Event>& found_events) {
+    SQL_TIMER("Event::fetch_due");
+    TRACE_SPAN("Event::fetch_due", "db");
+    static constexpr auto sql = schema::sql<
+        schema::select<Event>, " WHERE last_notification_level < ? AND "
+                               "timestamp  > ? AND "
+                               "timestamp <= ? "
+                               "ORDER BY timestamp, id LIMIT ?">;
+    return schema::fetch_all(db, schema::text<sql>(), {level, QVariant::fromValue(after), QVariant::fromValue(until), limit}, found_events);
 }
 
-bool Event::fetch_by_refer(QSqlDatabase& db, const QString& refer, std::optional<Event>& found_event) {
-    QSqlQuery query(db);
+bool Event::archive_past(QSqlDatabase& db, quint64 before, int limit, qint64& num_archived) {
+    SQL_TIMER("Event::archive_past");
+    TRACE_SPAN("Event::archive_past", "db");
+    num_archived = 0;
 
-    if (!query.prepare("SELECT * FROM " + table_name + " WHERE refer_str = :refer_str")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
+    static constexpr auto ids_sql = schema::sql<
+        "SELECT id FROM ", schema::FixedString(table_name), " WHERE timestamp < ? ORDER BY timestamp LIMIT ?">;
+    QSqlQuery ids_query(db);
+    if (!schema::open(ids_query, schema::text<ids_sql>(), {QVariant::fromValue(before), limit})) {
         return false;
     }
-    query.bindValue(":refer_str", QVariant::fromValue(refer));
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
+    QStringList ids;
+    while (ids_query.next()) {
+        ids.append(QString::number(ids_query.value(0).toULongLong()));
     }
-
-    if (!query.first()) {
-        // Haven't found anything. But the query is successful.
-        found_event.reset();
+    ids_query.finish();
+    if (ids.isEmpty()) {
         return true;
     }
 
-    Event event;
+    // Числа из БД, так что подставляем их в текст прямо. Таблицы архива
+    // созданы тем же CREATE TABLE, порядок колонок совпадает, и SELECT *
+    // переносит строку целиком.
+    const QString in_ids = "(" + ids.join(", ") + ")";
+    const QString events = QString(table_name);
+    const QString participants = QString(EventParticipant::table_name);
+
+    // Транзакция над двумя файлами в режиме WAL не атомарна: после сбоя
+    // удаление из main может остаться, а вставка в архив -- пропасть. Поэтому
+    // два шага, каждый своей транзакцией: сначала копия в архив, потом
+    // удаление. Сбой между ними оставляет событие в обеих БД; следующий
+    // проход повторит перенос (OR REPLACE), а история до того отдаст его
+    // один раз (UNION).
+    auto run = [&db](const QStringList& statements) {
+        if (!db.transaction()) {
+            qCritical() << db.lastError().text();
+            return false;
+        }
+        for (const QString& statement: statements) {
+            QSqlQuery query(db);
+            if (!query.exec(statement)) {
+                qCritical() << query.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+        if (!db.commit()) {
+            qCritical() << db.lastError().text();
+            db.rollback();
+            return false;
+        }
+        return true;
+    };
 
-    if (!event.unpack_from_query(query)) {
-        // Failed to unpack. Treat as a failed query.
+    const bool copied = run({
+        "INSERT OR REPLACE INTO archive." + events + " SELECT * FROM main." + events + " WHERE id IN " + in_ids,
+        "INSERT OR REPLACE INTO archive." + participants + " SELECT * FROM main." + participants + " WHERE event_id IN " + in_ids,
+    });
+    if (!copied) {
+        return false;
+    }
+    const bool deleted = run({
+        "DELETE FROM main." + participants + " WHERE event_id IN " + in_ids,
+        "DELETE FROM main." + events + " WHERE id IN " + in_ids,
+    });
+    if (!deleted) {
         return false;
     }
 
-    found_event = std::move(event);
-
+    num_archived = ids.size();
     return true;
 }
 
 bool Event::create(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
-    if (!query.prepare(
-        "INSERT INTO " + table_name + "(id, name, creator_user_id, timestamp, refer_str, last_notification_level)"
-                                      " VALUES (NULL, :name, :creator_user_id, :timestamp, :refer_str, :last_notification_level)"
-    )) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    };
-    pack_into_query(query);
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    bool right_variant = false;
-    id = query.lastInsertId().toULongLong(&right_variant);
-    if (!right_variant) {
-        // The only other way is to throw an exception..
-        // But then we have to create a custom exception.
-        abort();
-    }
-
-    return true;
+    SQL_TIMER("Event::create");
+    TRACE_SPAN("Event::create", "db");
+    return schema::insert(db, *this);
 }
 
 bool Event::update(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
+    SQL_TIMER("Event::update");
+    TRACE_SPAN("Event::update", "db");
     // По-хорошему, надо запоминать, какие поля обновлялись и их
     //   только обновлять. Чтобы над разными полями можно было
     //   работать параллельно. Или, например, добавлять участников
     //   события параллельно, т.к. это вставка в базу данных участников.
-    if (!query.prepare(
-        "UPDATE " + table_name + " "
-        "SET name = :name, creator_user_id = :creator_user_id, timestamp = :timestamp, refer_str = :refer_str, last_notification_level = :last_notification_level "
-        "WHERE id = :id"
-    )) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    };
-    pack_into_query(query);
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    return true;
+    return schema::update(db, *this);
 }
 
 bool Event::drop(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
-    if (!query.prepare("DELETE FROM " + table_name + " WHERE id = :id")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":id", QVariant::fromValue(id));
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
+    SQL_TIMER("Event::drop");
+    TRACE_SPAN("Event::drop", "db");
+    if (!schema::remove(db, *this)) {
         return false;
     }
 
@@ -289,32 +212,20 @@ bool Event::drop(QSqlDatabase& db) {
 }
 
 bool Event::generate_refer(QSqlDatabase& db) {
+    SQL_TIMER("Event::generate_refer");
+    TRACE_SPAN("Event::generate_refer", "db");
     static const int max_num_iters = 10000;
-    static std::random_device rd;
-    static std::mt19937_64 mt(rd());
-    static constexpr size_t length = 9;
 
     for (int i = 0; i < max_num_iters; ++i) {
-        refer_str.clear();
-        for (size_t i = 0; i < length; ++i) {
-            char added_char = 'a' + mt() % ('z' - 'a' + 1);
-            refer_str.append(added_char);
-        }
+        refer_str = make_refer();
 
-        QSqlQuery query(db);
-        if (!query.prepare("SELECT 1 FROM " + table_name + " WHERE refer_str = (:refer_str);")) {
-            // Failed to execute the query.
-            qCritical() << query.lastError().text();
-            return false;
-        }
-        query.bindValue(":refer_str", refer_str);
-        if (!query.exec()) {
-            // Failed to execute the query.
-            qCritical() << query.lastError().text();
+        static constexpr auto sql = schema::sql<"SELECT 1 FROM ", schema::FixedString(table_name), " WHERE refer_str = ?">;
+        bool taken = false;
+        if (!schema::exists(db, schema::text<sql>(), {refer_str}, taken)) {
             return false;
         }
 
-        if (!query.first()) {
+        if (!taken) {
             // This is an unused refer_str.
             return true;
         }
@@ -323,26 +234,29 @@ bool Event::generate_refer(QSqlDatabase& db) {
     return false;
 }
 
+QString Event::make_refer() {
+    static std::random_device rd;
+    static std::mt19937_64 mt(rd());
+    static constexpr size_t length = 9;
+
+    QString refer;
+    for (size_t i = 0; i < length; ++i) {
+        char added_char = 'a' + mt() % ('z' - 'a' + 1);
+        refer.append(added_char);
+    }
+    return refer;
+}
 
 // ..., аналогично предыдущим моделям
 
 Event::Event() {}
 
 // Хотим уметь посылать такие объекты клиенту.
+// Поля и их порядок -- из schema::Table<Event>.
 QDataStream& operator<<(QDataStream& out, const Event& entry) {
-    out << entry.id;
-    out << entry.name;
-    out << entry.creator_user_id;
-    out << entry.timestamp;
-    out << entry.refer_str;
-    return out;
+    return schema::write(out, entry);
 }
 
 QDataStream& operator>>(QDataStream& in, Event& entry) {
-    in >> entry.id;
-    in >> entry.name;
-    in >> entry.creator_user_id;
-    in >> entry.timestamp;
-    in >> entry.refer_str;
-    return in;
+    return schema::read(in, entry);
 }
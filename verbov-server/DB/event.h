@@ -1,6 +1,8 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#include <functional>
+
 #include <QDataStream>
 #include <QMutex>
 #include <QString>
@@ -8,6 +10,13 @@
 
 #include <QtSql/QSqlQuery>
 
+#include "schema.h"
+#include "user.h"
+
+namespace storage {
+    class Storage;
+}
+
 class Event
 {
 private:
@@ -27,11 +36,13 @@ public:
     // 6 -- notified 20 minutes before the event.
     quint8 last_notification_level = 0;
 public:
-    static const QString table_name;
+    friend struct schema::Table<Event>;
+    static constexpr char table_name[] = "Events";
     static QMutex notification_mutex;
 public:
-    bool unpack_from_query(QSqlQuery& query);
-    void pack_into_query(QSqlQuery& query, bool fill_id = true) const;
+    // Читает строку, выбранную с проекцией schema::columns<Event>, начиная с колонки
+    // first_column (для JOIN, где колонки сущности идут не первыми).
+    bool unpack_from_query(QSqlQuery& query, int first_column = 0);
 
     // Проверяет, что таблица существует. Если нет, создает.
     static bool check_table(QSqlDatabase& db);
@@ -40,11 +51,36 @@ public:
 
     static bool fetch_by_id(QSqlDatabase& db, quint64 id, std::optional<Event>& found_event);
     static bool fetch_all_for_user(QSqlDatabase& db, quint64 user_id, QVector<Event>& found_events);
+    // То же вместе с прошедшими событиями из архива. Архив должен быть
+    // подключен к соединению (storage::attach_archive).
+    static bool fetch_history_for_user(QSqlDatabase& db, quint64 user_id, QVector<Event>& found_events);
+    // То же, но без загрузки в память: число строк и открытый курсор по
+    // строкам (разбирать unpack_from_query). Для потоковой отдачи.
+    static bool count_all_for_user(QSqlDatabase& db, quint64 user_id, qint64& count);
+    static bool query_all_for_user(QSqlQuery& query, quint64 user_id);
     static bool fetch_by_refer(QSqlDatabase& db, const QString& refer_str, std::optional<Event>& found_event);
-
-    static void send_notifications(QSqlDatabase& db);
+    // До limit событий, ждущих уведомления уровня level: last_notification_level < level
+    // и timestamp в (after, until]. Самые близкие первыми.
+    static bool fetch_due(QSqlDatabase& db, int level, quint64 after, quint64 until, int limit, QVector<Event>& found_events);
+
+    // Переносит до limit событий с timestamp < before вместе с участиями в
+    // архив: копия и удаление -- отдельными транзакциями. Самые старые первыми.
+    static bool archive_past(QSqlDatabase& db, quint64 before, int limit, qint64& num_archived);
+
+    // Кладет в очередь уведомления всех уровней, которые пора отправить.
+    static void send_notifications(storage::Storage& storage);
+    // Отправляет готовые сообщения из очереди параллельно, с ограничением
+    // частоты, временные ошибки VK повторяет позже. Не ждет ответов VK.
+    static void deliver_notifications(storage::Storage& storage);
+    // Догоняющий проход после простоя: накопившиеся события пачками по
+    // notifications/catch_up_batch, с паузами для цикла событий. Каждое
+    // событие сразу получает текущий уровень и одно напоминание. done
+    // вызывается, когда ждущих больше нет.
+    static void catch_up_notifications(storage::Storage& storage, std::function<void()> done);
 private:
-    static void send_notifications_of_level(QSqlDatabase& db, quint64 now, int level);
+    // Не больше limit событий. num_pending увеличивается на число найденных
+    // событий, ждущих уведомления. false -- ошибка БД.
+    static bool send_notifications_of_level(storage::Storage& storage, quint64 now, int level, int limit, qint64& num_pending);
 public:
     // Public plain methods.
 
@@ -60,6 +96,8 @@ public:
     bool drop(QSqlDatabase& db);
 
     bool generate_refer(QSqlDatabase& db);
+    // Случайная ссылка, без проверки, что она свободна.
+    static QString make_refer();
 
     bool operator==(const Event& other) const = default;
 
@@ -75,4 +113,23 @@ public:
 QDataStream& operator<<(QDataStream& out, const Event& entry);
 QDataStream& operator>>(QDataStream& in,  Event& entry);
 
+// Порядок полей -- порядок колонок в запросах и порядок в QDataStream,
+// поэтому refer_str идет после timestamp, как его всегда читал клиент.
+template <>
+struct schema::Table<Event> {
+    static constexpr const char* name = Event::table_name;
+    static constexpr auto fields = std::make_tuple(
+        schema::field<&Event::id>                     ("id",                      "INTEGER     NOT NULL PRIMARY KEY AUTOINCREMENT CHECK(id >= 1)", schema::key | schema::auto_increment),
+        schema::field<&Event::name>                   ("name",                    "VARCHAR(64) NOT NULL                           CHECK(name != '')"),
+        schema::field<&Event::creator_user_id>        ("creator_user_id",         "INTEGER     NOT NULL                           CHECK(creator_user_id >= 1)"),
+        schema::field<&Event::timestamp>              ("timestamp",               "INTEGER     NOT NULL                           CHECK(timestamp >= 0)"),
+        schema::field<&Event::refer_str>              ("refer_str",               "VARCHAR(9)  NOT NULL UNIQUE                    CHECK(LENGTH(refer_str) = 9)"),
+        // Служебное поле рассылки, клиенту не передается.
+        schema::field<&Event::last_notification_level>("last_notification_level", "INTEGER     NOT NULL                           CHECK(last_notification_level >= 0 and last_notification_level <= 6)", schema::not_serialized)
+    );
+    static constexpr auto constraints = schema::concat(
+        schema::FixedString("FOREIGN KEY (creator_user_id) REFERENCES "), schema::FixedString(User::table_name),
+        schema::FixedString("(vk_id) ON DELETE RESTRICT"));
+};
+
 #endif // EVENT_H
@@ -8,6 +8,10 @@
 
 #include <QtSql/QSqlQuery>
 
+#include "schema.h"
+#include "event.h"
+#include "user.h"
+
 class EventParticipant
 {
 private:
@@ -17,12 +21,16 @@ public:
     quint64 registered_time = 0; // UTC+0 unix time when the participant was registered onto the event.
     // It is used to not send excessive notification. E.g. user registers the day before the event, we shouldn't notify him twice like
     // "hey, it's less than a week" before the event and then "hey, it's less than a day before the event".
-    // Also this only works if server is up at least every day, so that notification duties don't pile up.
+    // After downtime the startup catch-up pass (Event::catch_up_notifications) moves each event straight to its
+    // current level, so the missed levels are skipped rather than sent one after another.
 public:
-    static const char table_name[];
+    friend struct schema::Table<EventParticipant>;
+    friend struct schema::Access;
+    static constexpr char table_name[] = "EventParticipants";
 public:
-    bool unpack_from_query(QSqlQuery& query);
-    void pack_into_query(QSqlQuery& query) const;
+    // Читает строку, выбранную с проекцией schema::columns<EventParticipant>, начиная с колонки
+    // first_column (для JOIN, где колонки сущности идут не первыми).
+    bool unpack_from_query(QSqlQuery& query, int first_column = 0);
 
     // Проверяет, что таблица существует. Если нет, создает.
     static bool check_table(QSqlDatabase& db);
@@ -31,6 +39,9 @@ public:
 
     static bool fetch(QSqlDatabase& db, quint64 event_id, quint64 user_id, std::optional<EventParticipant>& found_participation);
     static bool fetch_all_for_event(QSqlDatabase& db, quint64 event_id, QVector<EventParticipant>& found_participations);
+    // Участия по возрастанию user_id после after_user_id, не больше limit.
+    // Как User::fetch_page_by_event_id, но без JOIN: для БД без таблицы Users.
+    static bool fetch_page_for_event(QSqlDatabase& db, quint64 event_id, quint64 after_user_id, int limit, QVector<EventParticipant>& found_participations);
     static bool fetch_all_for_user(QSqlDatabase& db, quint64 user_id, QVector<EventParticipant>& found_participations);
 public:
     // Public plain methods.
@@ -46,6 +57,8 @@ public:
     bool create(QSqlDatabase& db);
     bool update(QSqlDatabase& db);
     bool drop(QSqlDatabase& db);
+    // Все участия в событии, при его удалении.
+    static bool drop_all_for_event(QSqlDatabase& db, quint64 event_id);
 
     bool operator==(const EventParticipant& other) const = default;
 
@@ -60,4 +73,20 @@ private:
     EventParticipant();
 };
 
+template <>
+struct schema::Table<EventParticipant> {
+    static constexpr const char* name = EventParticipant::table_name;
+    static constexpr auto fields = std::make_tuple(
+        schema::field<&EventParticipant::event_id>       ("event_id",        "INTEGER    NOT NULL CHECK(event_id >= 1)", schema::key),
+        schema::field<&EventParticipant::user_id>        ("user_id",         "INTEGER    NOT NULL CHECK(user_id >= 1)", schema::key),
+        schema::field<&EventParticipant::registered_time>("registered_time", "INTEGER(8) NOT NULL CHECK(registered_time >= 0)")
+    );
+    static constexpr auto constraints = schema::concat(
+        schema::FixedString("PRIMARY KEY (event_id, user_id), "
+                            "FOREIGN KEY (event_id) REFERENCES "), schema::FixedString(Event::table_name),
+        schema::FixedString("(id) ON DELETE CASCADE, "
+                            "FOREIGN KEY (user_id) REFERENCES "), schema::FixedString(User::table_name),
+        schema::FixedString("(vk_id) ON DELETE RESTRICT"));
+};
+
 #endif // EVENTPARTICIPANT_H
@@ -0,0 +1,702 @@
+#include "memorystorage.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
+#include "trace.h"
+
+namespace storage {
+    // Заголовок файла снимка: "VRBS" и версия формата.
+    static constexpr quint32 snapshot_magic = 0x56524253;
+    // 2 -- с очередью уведомлений, 1 читается как с пустой очередью.
+    static constexpr quint32 snapshot_version = 2;
+
+    MemoryStorage::MemoryStorage(int num_stripes)
+        : users_(num_stripes), sessions_(num_stripes), events_(num_stripes),
+          refers_(num_stripes), user_events_(num_stripes) {}
+
+    bool MemoryStorage::fetch_user(quint64 vk_id, std::optional<User>& found) {
+        STORAGE_TIMER("memory", "fetch_user");
+        find_user(vk_id, found);
+        return true;
+    }
+
+    void MemoryStorage::find_user(quint64 vk_id, std::optional<User>& found) {
+        auto& stripe = users_.of(vk_id);
+        QReadLocker locker(&stripe.lock);
+
+        auto it = stripe.rows.constFind(vk_id);
+        if (it == stripe.rows.constEnd()) {
+            found.reset();
+        } else {
+            found = *it;
+        }
+    }
+
+    bool MemoryStorage::fetch_event_users(quint64 event_id, QVector<User>& found) {
+        STORAGE_TIMER("memory", "fetch_event_users");
+        QList<quint64> user_ids;
+        {
+            auto& stripe = events_.of(event_id);
+            QReadLocker locker(&stripe.lock);
+            auto it = stripe.rows.constFind(event_id);
+            if (it != stripe.rows.constEnd()) {
+                user_ids = it->participants.keys();
+            }
+        }
+
+        found.clear();
+        for (quint64 user_id: user_ids) {
+            std::optional<User> user;
+            find_user(user_id, user);
+            if (user.has_value()) {
+                found.push_back(std::move(*user));
+            }
+        }
+        return true;
+    }
+
+    bool MemoryStorage::fetch_participants_page(quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found) {
+        STORAGE_TIMER("memory", "fetch_participants_page");
+        found.clear();
+
+        auto& stripe = events_.of(event_id);
+        QReadLocker locker(&stripe.lock);
+        auto row = stripe.rows.constFind(event_id);
+        if (row == stripe.rows.constEnd()) {
+            return true;
+        }
+
+        // Как JOIN в SQL: участия без пользователя пропускаются, а не
+        // занимают место на странице.
+        for (auto it = row->participants.upperBound(after_vk_id); it != row->participants.cend() && found.size() < limit; ++it) {
+            std::optional<User> user;
+            find_user(it.key(), user);
+            if (user.has_value()) {
+                found.push_back(UserBrief{user->get_vk_id(), user->first_name, user->last_name});
+            }
+        }
+        return true;
+    }
+
+    bool MemoryStorage::create_user(User& user) {
+        STORAGE_TIMER("memory", "create_user");
+        auto& stripe = users_.of(user.get_vk_id());
+        QWriteLocker locker(&stripe.lock);
+
+        if (stripe.rows.contains(user.get_vk_id())) {
+            qCritical() << "User" << user.get_vk_id() << "already exists";
+            return false;
+        }
+        stripe.rows.insert(user.get_vk_id(), user);
+        return true;
+    }
+
+    bool MemoryStorage::update_user(User& user) {
+        STORAGE_TIMER("memory", "update_user");
+        auto& stripe = users_.of(user.get_vk_id());
+        QWriteLocker locker(&stripe.lock);
+
+        auto it = stripe.rows.find(user.get_vk_id());
+        if (it != stripe.rows.end()) {
+            *it = user;
+        }
+        return true;
+    }
+
+    bool MemoryStorage::fetch_session(QStringView token, std::optional<Session>& found) {
+        STORAGE_TIMER("memory", "fetch_session");
+        const QString key = token.toString();
+        auto& stripe = sessions_.of(key);
+        QReadLocker locker(&stripe.lock);
+
+        auto it = stripe.rows.constFind(key);
+        if (it == stripe.rows.constEnd()) {
+            found.reset();
+        } else {
+            found = *it;
+        }
+        return true;
+    }
+
+    bool MemoryStorage::create_session(Session& session) {
+        STORAGE_TIMER("memory", "create_session");
+        static const int max_num_iters = 1000;
+
+        const bool generate = session.token.isEmpty();
+        for (int i = 0; i < max_num_iters; ++i) {
+            if (generate) {
+                session.token = Session::make_token();
+            }
+
+            auto& stripe = sessions_.of(session.token);
+            QWriteLocker locker(&stripe.lock);
+            if (stripe.rows.contains(session.token)) {
+                if (generate) {
+                    continue;
+                }
+                qCritical() << "Session token already exists";
+                return false;
+            }
+
+            schema::set_auto_increment(session, next_session_id_++);
+            stripe.rows.insert(session.token, session);
+            return true;
+        }
+
+        session.token.clear();
+        return false;
+    }
+
+    bool MemoryStorage::fetch_event(quint64 id, std::optional<Event>& found) {
+        STORAGE_TIMER("memory", "fetch_event");
+        find_event(id, found);
+        return true;
+    }
+
+    void MemoryStorage::find_event(quint64 id, std::optional<Event>& found) {
+        auto& stripe = events_.of(id);
+        QReadLocker locker(&stripe.lock);
+
+        auto it = stripe.rows.constFind(id);
+        if (it == stripe.rows.constEnd()) {
+            found.reset();
+        } else {
+            found = it->event;
+        }
+    }
+
+    bool MemoryStorage::fetch_event_by_refer(const QString& refer, std::optional<Event>& found) {
+        STORAGE_TIMER("memory", "fetch_event_by_refer");
+        quint64 id = 0;
+        {
+            auto& stripe = refers_.of(refer);
+            QReadLocker locker(&stripe.lock);
+            id = stripe.rows.value(refer, 0);
+        }
+        if (id == 0) {
+            found.reset();
+        } else {
+            find_event(id, found);
+        }
+        return true;
+    }
+
+    bool MemoryStorage::fetch_events_for_user(quint64 user_id, QVector<Event>& found) {
+        STORAGE_TIMER("memory", "fetch_events_for_user");
+        QList<quint64> ids;
+        {
+            auto& stripe = user_events_.of(user_id);
+            QReadLocker locker(&stripe.lock);
+            ids = stripe.rows.value(user_id).values();
+        }
+        // SQLite отдает их по порядку rowid.
+        std::sort(ids.begin(), ids.end());
+
+        found.clear();
+        for (quint64 id: ids) {
+            std::optional<Event> event;
+            find_event(id, event);
+            if (event.has_value()) {
+                found.push_back(std::move(*event));
+            }
+        }
+        return true;
+    }
+
+    bool MemoryStorage::fetch_events_history_for_user(quint64 user_id, QVector<Event>& found) {
+        // Архива нет, все события и так вместе.
+        return fetch_events_for_user(user_id, found);
+    }
+
+    bool MemoryStorage::fetch_events_due(int level, quint64 after, quint64 until, int limit, QVector<Event>& found) {
+        STORAGE_TIMER("memory", "fetch_events_due");
+        found.clear();
+        // Индекса по времени нет, как и в SQLite: полный просмотр.
+        for (auto& stripe: events_) {
+            QReadLocker locker(&stripe->lock);
+            for (const EventRow& row: std::as_const(stripe->rows)) {
+                const Event& event = row.event;
+                if (event.last_notification_level < level && event.timestamp > after && event.timestamp <= until) {
+                    found.push_back(event);
+                }
+            }
+        }
+        std::sort(found.begin(), found.end(), [](const Event& a, const Event& b) {
+            return std::make_pair(a.timestamp, a.get_id()) < std::make_pair(b.timestamp, b.get_id());
+        });
+        if (found.size() > limit) {
+            found.resize(limit);
+        }
+        return true;
+    }
+
+    bool MemoryStorage::create_event(Event& event) {
+        STORAGE_TIMER("memory", "create_event");
+        static const int max_num_iters = 10000;
+
+        // Сначала занимаем ссылку: по ней событие ищут, пока его еще нет в
+        // events_, это просто "не нашлось".
+        quint64 id = 0;
+        for (int i = 0; i < max_num_iters && id == 0; ++i) {
+            event.refer_str = Event::make_refer();
+
+            auto& stripe = refers_.of(event.refer_str);
+            QWriteLocker locker(&stripe.lock);
+            if (!stripe.rows.contains(event.refer_str)) {
+                id = next_event_id_++;
+                stripe.rows.insert(event.refer_str, id);
+            }
+        }
+        if (id == 0) {
+            return false;
+        }
+        schema::set_auto_increment(event, id);
+
+        {
+            auto& stripe = events_.of(id);
+            QWriteLocker locker(&stripe.lock);
+            stripe.rows.insert(id, EventRow{event, {}});
+        }
+        {
+            auto& stripe = user_events_.of(event.creator_user_id);
+            QWriteLocker locker(&stripe.lock);
+            stripe.rows[event.creator_user_id].insert(id);
+        }
+        return true;
+    }
+
+    bool MemoryStorage::update_event(Event& event) {
+        STORAGE_TIMER("memory", "update_event");
+        auto& stripe = events_.of(event.get_id());
+        QWriteLocker locker(&stripe.lock);
+
+        auto it = stripe.rows.find(event.get_id());
+        if (it == stripe.rows.end()) {
+            return true;
+        }
+
+        const Event previous = it->event;
+        it->event = event;
+
+        if (previous.refer_str != event.refer_str) {
+            {
+                auto& refer_stripe = refers_.of(previous.refer_str);
+                QWriteLocker refer_locker(&refer_stripe.lock);
+                refer_stripe.rows.remove(previous.refer_str);
+            }
+            auto& refer_stripe = refers_.of(event.refer_str);
+            QWriteLocker refer_locker(&refer_stripe.lock);
+            refer_stripe.rows.insert(event.refer_str, event.get_id());
+        }
+
+        if (previous.creator_user_id != event.creator_user_id) {
+            if (!it->participants.contains(previous.creator_user_id)) {
+                auto& user_stripe = user_events_.of(previous.creator_user_id);
+                QWriteLocker user_locker(&user_stripe.lock);
+                user_stripe.rows[previous.creator_user_id].remove(event.get_id());
+            }
+            auto& user_stripe = user_events_.of(event.creator_user_id);
+            QWriteLocker user_locker(&user_stripe.lock);
+            user_stripe.rows[event.creator_user_id].insert(event.get_id());
+        }
+        return true;
+    }
+
+    bool MemoryStorage::drop_event(Event& event) {
+        STORAGE_TIMER("memory", "drop_event");
+        const quint64 id = event.get_id();
+        auto& stripe = events_.of(id);
+        QWriteLocker locker(&stripe.lock);
+
+        auto it = stripe.rows.find(id);
+        if (it != stripe.rows.end()) {
+            const EventRow row = std::move(*it);
+            stripe.rows.erase(it);
+
+            {
+                auto& refer_stripe = refers_.of(row.event.refer_str);
+                QWriteLocker refer_locker(&refer_stripe.lock);
+                refer_stripe.rows.remove(row.event.refer_str);
+            }
+
+            QList<quint64> user_ids = row.participants.keys();
+            user_ids.append(row.event.creator_user_id);
+            for (quint64 user_id: user_ids) {
+                auto& user_stripe = user_events_.of(user_id);
+                QWriteLocker user_locker(&user_stripe.lock);
+                auto user_it = user_stripe.rows.find(user_id);
+                if (user_it != user_stripe.rows.end()) {
+                    user_it->remove(id);
+                    if (user_it->isEmpty()) {
+                        user_stripe.rows.erase(user_it);
+                    }
+                }
+            }
+        }
+
+        // Как Event::drop: id == 0 -- строки в хранилище нет.
+        schema::set_auto_increment(event, 0);
+        return true;
+    }
+
+    bool MemoryStorage::fetch_participant(quint64 event_id, quint64 user_id, std::optional<EventParticipant>& found) {
+        STORAGE_TIMER("memory", "fetch_participant");
+        auto& stripe = events_.of(event_id);
+        QReadLocker locker(&stripe.lock);
+
+        found.reset();
+        auto row = stripe.rows.constFind(event_id);
+        if (row != stripe.rows.constEnd()) {
+            auto it = row->participants.constFind(user_id);
+            if (it != row->participants.constEnd()) {
+                found = *it;
+            }
+        }
+        return true;
+    }
+
+    bool MemoryStorage::create_participant(EventParticipant& participant) {
+        STORAGE_TIMER("memory", "create_participant");
+        const quint64 event_id = participant.get_event_id();
+        const quint64 user_id = participant.get_user_id();
+        auto& stripe = events_.of(event_id);
+        QWriteLocker locker(&stripe.lock);
+
+        auto row = stripe.rows.find(event_id);
+        if (row == stripe.rows.end()) {
+            // Как FOREIGN KEY: участие только в существующем событии.
+            qCritical() << "Event" << event_id << "does not exist";
+            return false;
+        }
+        if (row->participants.contains(user_id)) {
+            qCritical() << "User" << user_id << "already participates in event" << event_id;
+            return false;
+        }
+        row->participants.insert(user_id, participant);
+
+        auto& user_stripe = user_events_.of(user_id);
+        QWriteLocker user_locker(&user_stripe.lock);
+        user_stripe.rows[user_id].insert(event_id);
+        return true;
+    }
+
+    bool MemoryStorage::drop_participant(EventParticipant& participant) {
+        STORAGE_TIMER("memory", "drop_participant");
+        const quint64 event_id = participant.get_event_id();
+        const quint64 user_id = participant.get_user_id();
+        auto& stripe = events_.of(event_id);
+        QWriteLocker locker(&stripe.lock);
+
+        auto row = stripe.rows.find(event_id);
+        if (row == stripe.rows.end() || row->participants.remove(user_id) == 0) {
+            return true;
+        }
+
+        // Создатель видит событие и без участия.
+        if (row->event.creator_user_id != user_id) {
+            auto& user_stripe = user_events_.of(user_id);
+            QWriteLocker user_locker(&user_stripe.lock);
+            auto user_it = user_stripe.rows.find(user_id);
+            if (user_it != user_stripe.rows.end()) {
+                user_it->remove(event_id);
+                if (user_it->isEmpty()) {
+                    user_stripe.rows.erase(user_it);
+                }
+            }
+        }
+        return true;
+    }
+
+    bool MemoryStorage::enqueue_notifications(Event& event, QVector<Notification>& notifications) {
+        STORAGE_TIMER("memory", "enqueue_notifications");
+        auto& stripe = events_.of(event.get_id());
+        QWriteLocker locker(&stripe.lock);
+        QMutexLocker outbox_locker(&outbox_mutex_);
+
+        auto row = stripe.rows.find(event.get_id());
+        if (row == stripe.rows.end()) {
+            qCritical() << "Event" << event.get_id() << "does not exist";
+            return false;
+        }
+        // Тик меняет только уровень: индексы по ссылке и создателю те же.
+        assert(row->event.refer_str == event.refer_str && row->event.creator_user_id == event.creator_user_id);
+
+        for (Notification& notification: notifications) {
+            const auto key = std::make_tuple(notification.event_id, notification.level, notification.recipient_vk_id);
+            auto old = outbox_keys_.find(key);
+            if (old != outbox_keys_.end()) {
+                // Осталась от прежнего времени события.
+                auto it = outbox_.find(old->second);
+                outbox_ready_.erase({it->next_attempt_at, it->get_id()});
+                outbox_.erase(it);
+            }
+            schema::set_auto_increment(notification, next_notification_id_++);
+            outbox_.insert(notification.get_id(), notification);
+            outbox_ready_.emplace(notification.next_attempt_at, notification.get_id());
+            outbox_keys_[key] = notification.get_id();
+        }
+        row->event = event;
+        return true;
+    }
+
+    bool MemoryStorage::fetch_ready_notifications(quint64 now, int limit, QVector<Notification>& found) {
+        STORAGE_TIMER("memory", "fetch_ready_notifications");
+        QMutexLocker locker(&outbox_mutex_);
+        found.clear();
+        for (auto it = outbox_ready_.begin(); it != outbox_ready_.end() && it->first <= now && found.size() < limit; ++it) {
+            found.push_back(outbox_.value(it->second));
+        }
+        return true;
+    }
+
+    bool MemoryStorage::update_notification(Notification& notification) {
+        STORAGE_TIMER("memory", "update_notification");
+        QMutexLocker locker(&outbox_mutex_);
+        auto it = outbox_.find(notification.get_id());
+        if (it == outbox_.end()) {
+            return true;
+        }
+        // Ключ (event_id, level, recipient_vk_id) у строки не меняется.
+        outbox_ready_.erase({it->next_attempt_at, it->get_id()});
+        *it = notification;
+        outbox_ready_.emplace(it->next_attempt_at, it->get_id());
+        return true;
+    }
+
+    bool MemoryStorage::drop_notification(Notification& notification) {
+        STORAGE_TIMER("memory", "drop_notification");
+        QMutexLocker locker(&outbox_mutex_);
+        auto it = outbox_.find(notification.get_id());
+        if (it != outbox_.end()) {
+            outbox_ready_.erase({it->next_attempt_at, it->get_id()});
+            outbox_keys_.erase({it->event_id, it->level, it->recipient_vk_id});
+            outbox_.erase(it);
+        }
+        schema::set_auto_increment(notification, 0);
+        return true;
+    }
+
+    bool MemoryStorage::purge_expired_sessions(quint64 now, int limit, qint64& num_purged) {
+        STORAGE_TIMER("memory", "purge_expired_sessions");
+        // Индекса по времени нет: просмотр полосы за полосой, каждая под
+        // своей блокировкой, как пачка в SQLite.
+        num_purged = 0;
+        for (auto& stripe: sessions_) {
+            QWriteLocker locker(&stripe->lock);
+            for (auto it = stripe->rows.begin(); it != stripe->rows.end() && num_purged < limit;) {
+                if (it->is_expired(now)) {
+                    it = stripe->rows.erase(it);
+                    ++num_purged;
+                } else {
+                    ++it;
+                }
+            }
+            if (num_purged >= limit) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool MemoryStorage::save(const QString& path) {
+        TRACE_SPAN("MemoryStorage::save", "db");
+        static const metrics::Histogram save_duration = metrics::histogram(
+            "verbov_storage_snapshot_duration_seconds", "Duration of writing an in-memory storage snapshot.");
+        static const metrics::Gauge snapshot_bytes = metrics::gauge(
+            "verbov_storage_snapshot_bytes", "Size of the last in-memory storage snapshot.");
+        metrics::ScopedTimer timer(save_duration);
+
+        QByteArray buffer;
+        {
+            // Порядок блокировок тот же, что у операций: events_ раньше users_.
+            std::vector<std::unique_ptr<QReadLocker>> locks;
+            for (auto& stripe: events_) {
+                locks.push_back(std::make_unique<QReadLocker>(&stripe->lock));
+            }
+            for (auto& stripe: users_) {
+                locks.push_back(std::make_unique<QReadLocker>(&stripe->lock));
+            }
+            for (auto& stripe: sessions_) {
+                locks.push_back(std::make_unique<QReadLocker>(&stripe->lock));
+            }
+            QMutexLocker outbox_locker(&outbox_mutex_);
+
+            QDataStream out(&buffer, QDataStream::OpenModeFlag::WriteOnly);
+            out.setVersion(QDataStream::Qt_6_0);
+            out << snapshot_magic << snapshot_version;
+            out << next_session_id_.load() << next_event_id_.load();
+
+            // Все поля, включая те, что клиенту не передаются.
+            quint64 num_users = 0;
+            for (auto& stripe: users_) {
+                num_users += stripe->rows.size();
+            }
+            out << num_users;
+            for (auto& stripe: users_) {
+                for (const User& user: std::as_const(stripe->rows)) {
+                    schema::write(out, user, 0);
+                }
+            }
+
+            quint64 num_sessions = 0;
+            for (auto& stripe: sessions_) {
+                num_sessions += stripe->rows.size();
+            }
+            out << num_sessions;
+            for (auto& stripe: sessions_) {
+                for (const Session& session: std::as_const(stripe->rows)) {
+                    schema::write(out, session, 0);
+                }
+            }
+
+            quint64 num_events = 0;
+            for (auto& stripe: events_) {
+                num_events += stripe->rows.size();
+            }
+            out << num_events;
+            for (auto& stripe: events_) {
+                for (const EventRow& row: std::as_const(stripe->rows)) {
+                    schema::write(out, row.event, 0);
+                    out << static_cast<quint64>(row.participants.size());
+                    for (const EventParticipant& participant: row.participants) {
+                        schema::write(out, participant, 0);
+                    }
+                }
+            }
+
+            out << next_notification_id_ << static_cast<quint64>(outbox_.size());
+            for (const Notification& notification: std::as_const(outbox_)) {
+                schema::write(out, notification, 0);
+            }
+        }
+
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCritical() << "failed to open snapshot" << path << ":" << file.errorString();
+            return false;
+        }
+        if (file.write(buffer) != buffer.size() || !file.commit()) {
+            qCritical() << "failed to write snapshot" << path << ":" << file.errorString();
+            return false;
+        }
+        snapshot_bytes.set(buffer.size());
+        return true;
+    }
+
+    bool MemoryStorage::load(const QString& path) {
+        TRACE_SPAN("MemoryStorage::load", "db");
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qCritical() << "failed to open snapshot" << path << ":" << file.errorString();
+            return false;
+        }
+
+        QDataStream in(&file);
+        in.setVersion(QDataStream::Qt_6_0);
+        quint32 magic = 0;
+        quint32 version = 0;
+        in >> magic >> version;
+        if (magic != snapshot_magic || version < 1 || version > snapshot_version) {
+            qCritical() << "not a storage snapshot:" << path;
+            return false;
+        }
+
+        quint64 next_session_id = 0;
+        quint64 next_event_id = 0;
+        in >> next_session_id >> next_event_id;
+
+        // Собираем все заново, индексы -- по ходу вставки.
+        MemoryStorage loaded;
+
+        quint64 num_users = 0;
+        in >> num_users;
+        for (quint64 i = 0; i < num_users && in.status() == QDataStream::Ok; ++i) {
+            User user;
+            schema::read(in, user, 0);
+            loaded.users_.of(user.get_vk_id()).rows.insert(user.get_vk_id(), user);
+        }
+
+        quint64 num_sessions = 0;
+        in >> num_sessions;
+        for (quint64 i = 0; i < num_sessions && in.status() == QDataStream::Ok; ++i) {
+            Session session;
+            schema::read(in, session, 0);
+            loaded.sessions_.of(session.token).rows.insert(session.token, session);
+        }
+
+        quint64 num_events = 0;
+        in >> num_events;
+        for (quint64 i = 0; i < num_events && in.status() == QDataStream::Ok; ++i) {
+            EventRow row;
+            schema::read(in, row.event, 0);
+            const quint64 id = row.event.get_id();
+
+            quint64 num_participants = 0;
+            in >> num_participants;
+            for (quint64 j = 0; j < num_participants && in.status() == QDataStream::Ok; ++j) {
+                EventParticipant participant = schema::Access::make<EventParticipant>();
+                schema::read(in, participant, 0);
+                loaded.user_events_.of(participant.get_user_id()).rows[participant.get_user_id()].insert(id);
+                row.participants.insert(participant.get_user_id(), participant);
+            }
+
+            loaded.refers_.of(row.event.refer_str).rows.insert(row.event.refer_str, id);
+            loaded.user_events_.of(row.event.creator_user_id).rows[row.event.creator_user_id].insert(id);
+            loaded.events_.of(id).rows.insert(id, std::move(row));
+        }
+
+        quint64 num_notifications = 0;
+        if (version >= 2) {
+            in >> loaded.next_notification_id_ >> num_notifications;
+        }
+        for (quint64 i = 0; i < num_notifications && in.status() == QDataStream::Ok; ++i) {
+            Notification notification;
+            schema::read(in, notification, 0);
+            loaded.outbox_ready_.emplace(notification.next_attempt_at, notification.get_id());
+            loaded.outbox_keys_[{notification.event_id, notification.level, notification.recipient_vk_id}] = notification.get_id();
+            loaded.outbox_.insert(notification.get_id(), notification);
+        }
+
+        if (in.status() != QDataStream::Ok) {
+            qCritical() << "snapshot is truncated or corrupt:" << path;
+            return false;
+        }
+
+        // Число полос у loaded то же по умолчанию, но может отличаться от
+        // нашего, так что переносим построчно.
+        auto move_rows = [](auto& from, auto& to) {
+            for (auto& stripe: to) {
+                stripe->rows.clear();
+            }
+            for (auto& stripe: from) {
+                for (auto it = stripe->rows.begin(); it != stripe->rows.end(); ++it) {
+                    to.of(it.key()).rows.insert(it.key(), std::move(it.value()));
+                }
+            }
+        };
+        move_rows(loaded.users_, users_);
+        move_rows(loaded.sessions_, sessions_);
+        move_rows(loaded.events_, events_);
+        move_rows(loaded.refers_, refers_);
+        move_rows(loaded.user_events_, user_events_);
+        next_session_id_ = next_session_id;
+        next_event_id_ = next_event_id;
+        {
+            QMutexLocker outbox_locker(&outbox_mutex_);
+            outbox_ = std::move(loaded.outbox_);
+            outbox_ready_ = std::move(loaded.outbox_ready_);
+            outbox_keys_ = std::move(loaded.outbox_keys_);
+            next_notification_id_ = loaded.next_notification_id_;
+        }
+
+        qInfo() << "Loaded snapshot" << path << ":" << num_users << "users," << num_sessions << "sessions," << num_events << "events,"
+                << num_notifications << "queued notifications";
+        return true;
+    }
+}
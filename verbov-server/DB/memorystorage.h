@@ -0,0 +1,130 @@
+#ifndef MEMORYSTORAGE_H
+#define MEMORYSTORAGE_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <tuple>
+#include <vector>
+
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QSet>
+
+#include "storage.h"
+
+namespace storage {
+    // Хранилище в памяти. Для бенчмарков (сколько задержки дает SQLite) и
+    // для стендов, где потеря последних минут данных не страшна.
+    //
+    // Каждая таблица поделена на полосы по хешу ключа, у каждой полосы своя
+    // блокировка чтения-записи, так что операции с разными ключами почти не
+    // мешают друг другу. Операция держит не больше одной полосы каждой
+    // таблицы; вложенные блокировки берутся только в порядке events_ ->
+    // остальные таблицы. Очередь уведомлений под одной блокировкой, она
+    // тоже берется после events_. Между таблицами согласованность как у отдельных
+    // запросов без транзакции.
+    //
+    // Долговечность -- снимками: save() пишет все содержимое в файл, load()
+    // читает его при старте.
+    class MemoryStorage : public Storage {
+    public:
+        explicit MemoryStorage(int num_stripes = 16);
+
+        bool fetch_user(quint64 vk_id, std::optional<User>& found) override;
+        bool fetch_event_users(quint64 event_id, QVector<User>& found) override;
+        bool fetch_participants_page(quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found) override;
+        bool create_user(User& user) override;
+        bool update_user(User& user) override;
+
+        bool fetch_session(QStringView token, std::optional<Session>& found) override;
+        bool create_session(Session& session) override;
+
+        bool fetch_event(quint64 id, std::optional<Event>& found) override;
+        bool fetch_event_by_refer(const QString& refer, std::optional<Event>& found) override;
+        bool fetch_events_for_user(quint64 user_id, QVector<Event>& found) override;
+        bool fetch_events_history_for_user(quint64 user_id, QVector<Event>& found) override;
+        bool fetch_events_due(int level, quint64 after, quint64 until, int limit, QVector<Event>& found) override;
+        bool create_event(Event& event) override;
+        bool update_event(Event& event) override;
+        bool drop_event(Event& event) override;
+
+        bool fetch_participant(quint64 event_id, quint64 user_id, std::optional<EventParticipant>& found) override;
+        bool create_participant(EventParticipant& participant) override;
+        bool drop_participant(EventParticipant& participant) override;
+
+        bool enqueue_notifications(Event& event, QVector<Notification>& notifications) override;
+        bool fetch_ready_notifications(quint64 now, int limit, QVector<Notification>& found) override;
+        bool update_notification(Notification& notification) override;
+        bool drop_notification(Notification& notification) override;
+
+        bool purge_expired_sessions(quint64 now, int limit, qint64& num_purged) override;
+
+        // Пишет снимок во временный файл и переименовывает его в path.
+        // Все полосы на это время блокируются на чтение, но только пока
+        // содержимое копируется в буфер, запись на диск идет без блокировок.
+        bool save(const QString& path);
+        // Заменяет содержимое снимком. Вызывать до начала работы.
+        bool load(const QString& path);
+    private:
+        // Без замера времени: для вызовов изнутри других операций.
+        void find_user(quint64 vk_id, std::optional<User>& found);
+        void find_event(quint64 id, std::optional<Event>& found);
+
+        template <typename Key, typename Value>
+        struct Stripe {
+            QReadWriteLock lock;
+            QHash<Key, Value> rows;
+        };
+
+        template <typename Key, typename Value>
+        class Striped {
+        public:
+            explicit Striped(int num_stripes) {
+                for (int i = 0; i < num_stripes; ++i) {
+                    stripes_.push_back(std::make_unique<Stripe<Key, Value>>());
+                }
+            }
+
+            Stripe<Key, Value>& of(const Key& key) { return *stripes_[qHash(key) % stripes_.size()]; }
+
+            auto begin() { return stripes_.begin(); }
+            auto end() { return stripes_.end(); }
+        private:
+            std::vector<std::unique_ptr<Stripe<Key, Value>>> stripes_;
+        };
+
+        struct EventRow {
+            Event event;
+            // Участия в событии по user_id: по порядку, для страниц участников.
+            QMap<quint64, EventParticipant> participants;
+        };
+
+        Striped<quint64, User> users_;
+        Striped<QString, Session> sessions_;
+        Striped<quint64, EventRow> events_;
+        // Индексы: refer_str -> id события, пользователь -> события, которые
+        // он создал или где он участник.
+        Striped<QString, quint64> refers_;
+        Striped<quint64, QSet<quint64>> user_events_;
+
+        // Очередь уведомлений: небольшая, пишется тиком и циклом отправки,
+        // одной блокировки хватает.
+        QMutex outbox_mutex_;
+        QMap<quint64, Notification> outbox_;
+        // Индексы: (next_attempt_at, id) -- для fetch_ready по порядку,
+        // (event_id, level, recipient_vk_id) -- как UNIQUE в SQLite.
+        std::set<std::pair<quint64, quint64>> outbox_ready_;
+        // (event_id, level, recipient_vk_id) -> id строки.
+        std::map<std::tuple<quint64, quint8, quint64>, quint64> outbox_keys_;
+        quint64 next_notification_id_ = 1;
+
+        std::atomic<quint64> next_session_id_ = 1;
+        std::atomic<quint64> next_event_id_ = 1;
+    };
+}
+
+#endif // MEMORYSTORAGE_H
@@ -0,0 +1,183 @@
+#include "notification.h"
+
+#include <QtSql/QSqlQuery>
+#include <QCryptographicHash>
+#include <QSqlError>
+
+#include <algorithm>
+#include <optional>
+
+#include "metrics.h"
+#include "trace.h"
+
+#define CHECK(expr) if (!(expr)) { return false; }
+bool Notification::run_tests(QSqlDatabase& test_db) {
+    // random_id не зависит от процесса и запуска, но различает четверки:
+    // в том числе напоминания одного уровня о старом и новом времени.
+    CHECK(make_random_id(1, 100, 2, 3) == make_random_id(1, 100, 2, 3));
+    CHECK(make_random_id(1, 100, 2, 3) != make_random_id(1, 100, 3, 3));
+    CHECK(make_random_id(1, 100, 2, 3) != make_random_id(1, 200, 2, 3));
+    CHECK(make_random_id(1, 100, 2, 3) > 0);
+
+    Notification first(1, 100, 2, 3, "");
+    Notification second(2, 100, 2, 3, "");
+    CHECK(make_digest_random_id({first}) == first.random_id);
+    CHECK(make_digest_random_id({first, second}) == make_digest_random_id({second, first}));
+    CHECK(make_digest_random_id({first, second}) != first.random_id);
+    // Повтор сводки: строки уже несут ее random_id.
+    Notification sent_first = first;
+    Notification sent_second = second;
+    sent_first.random_id = sent_second.random_id = make_digest_random_id({first, second});
+    CHECK(make_digest_random_id({sent_first, sent_second}) == sent_first.random_id);
+
+    Notification later(1, 100, 2, 3, "Позже");
+    later.next_attempt_at = 200;
+    CHECK(later.create(test_db));
+    // Второе сообщение того же уровня тому же получателю не встает в очередь.
+    Notification duplicate(1, 100, 2, 3, "Дубль");
+    CHECK(!duplicate.create(test_db));
+    // А после переноса события заменяет прежнее.
+    Notification moved(1, 150, 2, 3, "Перенесено");
+    moved.next_attempt_at = 200;
+    CHECK(moved.replace(test_db));
+    QVector<Notification> replaced;
+    CHECK(fetch_ready(test_db, 200, 10, replaced));
+    CHECK(replaced.size() == 1 && replaced[0] == moved && moved.random_id != later.random_id);
+    CHECK(moved.drop(test_db));
+    later = Notification(1, 100, 2, 3, "Позже");
+    later.next_attempt_at = 200;
+    CHECK(later.create(test_db));
+
+    Notification sooner(1, 100, 2, 4, "Раньше");
+    sooner.next_attempt_at = 100;
+    CHECK(sooner.create(test_db));
+
+    QVector<Notification> ready;
+    CHECK(fetch_ready(test_db, 150, 10, ready));
+    CHECK(ready.size() == 1 && ready[0] == sooner);
+    CHECK(fetch_ready(test_db, 200, 10, ready));
+    CHECK(ready.size() == 2 && ready[0] == sooner && ready[1] == later);
+
+    sooner.attempts = 1;
+    sooner.next_attempt_at = 300;
+    CHECK(sooner.update(test_db));
+    CHECK(fetch_ready(test_db, 200, 10, ready));
+    CHECK(ready.size() == 1 && ready[0] == later);
+
+    CHECK(sooner.drop(test_db));
+    CHECK(later.drop(test_db));
+    CHECK(fetch_ready(test_db, 1000, 10, ready));
+    CHECK(ready.isEmpty());
+
+    return true;
+}
+#undef CHECK
+
+bool Notification::unpack_from_query(QSqlQuery& query, int first_column) {
+    // Порядок колонок -- как в schema::Table<Notification>::fields.
+    return schema::unpack(query, *this, first_column);
+}
+
+bool Notification::check_table(QSqlDatabase& db) {
+    // Текст CREATE TABLE собирается из schema::Table<Notification>.
+    if (!schema::create_table<Notification>(db)) {
+        return false;
+    }
+
+    // Для fetch_ready: очередь читается по времени следующей попытки.
+    static constexpr auto index_sql = schema::sql<
+        "CREATE INDEX IF NOT EXISTS ", schema::FixedString(table_name), "_next_attempt_at ON ",
+        schema::FixedString(table_name), "(next_attempt_at)">;
+    QSqlQuery query(db);
+    return schema::open(query, schema::text<index_sql>(), {});
+}
+
+bool Notification::fetch_ready(QSqlDatabase& db, quint64 now, int limit, QVector<Notification>& found_notifications) {
+    SQL_TIMER("Notification::fetch_ready");
+    TRACE_SPAN("Notification::fetch_ready", "db");
+    static constexpr auto sql = schema::sql<
+        schema::select<Notification>, " WHERE next_attempt_at <= ? ORDER BY next_attempt_at, id LIMIT ?">;
+    return schema::fetch_all(db, schema::text<sql>(), {QVariant::fromValue(now), limit}, found_notifications);
+}
+
+// Положительный int32 из первых байт SHA-256 текста.
+static qint64 random_id_of(const QString& text) {
+    QCryptographicHash hash(QCryptographicHash::Algorithm::Sha256);
+    hash.addData(text.toUtf8());
+    const QByteArray digest = hash.result();
+
+    quint32 value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value = (value << 8) | static_cast<quint8>(digest[i]);
+    }
+    // VK: 0 -- "без random_id", то есть без защиты от повтора.
+    value &= 0x7fffffff;
+    return value == 0 ? 1 : value;
+}
+
+qint64 Notification::make_random_id(quint64 event_id, quint64 event_timestamp, quint8 level, quint64 recipient_vk_id) {
+    return random_id_of(QString("%1:%2:%3:%4").arg(event_id).arg(event_timestamp).arg(level).arg(recipient_vk_id));
+}
+
+qint64 Notification::make_digest_random_id(const QVector<Notification>& digest) {
+    const bool same = std::all_of(digest.begin(), digest.end(), [&digest](const Notification& notification) {
+        return notification.random_id == digest[0].random_id;
+    });
+    if (same) {
+        return digest[0].random_id;
+    }
+
+    QList<qint64> ids;
+    for (const Notification& notification: digest) {
+        ids.push_back(notification.random_id);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    QString text = "digest";
+    for (qint64 id: ids) {
+        text += ":" + QString::number(id);
+    }
+    return random_id_of(text);
+}
+
+bool Notification::create(QSqlDatabase& db) {
+    SQL_TIMER("Notification::create");
+    TRACE_SPAN("Notification::create", "db");
+    return schema::insert(db, *this);
+}
+
+bool Notification::replace(QSqlDatabase& db) {
+    SQL_TIMER("Notification::replace");
+    TRACE_SPAN("Notification::replace", "db");
+    static constexpr auto sql = schema::sql<
+        "DELETE FROM ", schema::FixedString(table_name), " WHERE event_id = ? AND level = ? AND recipient_vk_id = ?">;
+    QSqlQuery query(db);
+    if (!schema::open(query, schema::text<sql>(), {QVariant::fromValue(event_id), static_cast<quint32>(level), QVariant::fromValue(recipient_vk_id)})) {
+        return false;
+    }
+    return create(db);
+}
+
+bool Notification::update(QSqlDatabase& db) {
+    SQL_TIMER("Notification::update");
+    TRACE_SPAN("Notification::update", "db");
+    return schema::update(db, *this);
+}
+
+bool Notification::drop(QSqlDatabase& db) {
+    SQL_TIMER("Notification::drop");
+    TRACE_SPAN("Notification::drop", "db");
+    if (!schema::remove(db, *this)) {
+        return false;
+    }
+
+    id = 0;
+
+    return true;
+}
+
+Notification::Notification(quint64 event_id, quint64 event_timestamp, quint8 level, quint64 recipient_vk_id, const QString& text)
+    : event_id(event_id), level(level), recipient_vk_id(recipient_vk_id), text(text),
+      random_id(make_random_id(event_id, event_timestamp, level, recipient_vk_id)) {}
+
+Notification::Notification() {}
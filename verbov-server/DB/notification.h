@@ -0,0 +1,94 @@
+#ifndef NOTIFICATION_H
+#define NOTIFICATION_H
+
+#include <cstdint>
+
+#include <QString>
+
+#include <QtSql/QSqlQuery>
+
+#include "schema.h"
+#include "event.h"
+
+// Сообщение в очереди на отправку в VK (outbox).
+//
+// Тик уведомлений кладет сообщения в очередь одной транзакцией с новым
+// уровнем события, а отправляет их отдельный цикл. Так сбой посреди
+// рассылки не теряет и не повторяет уровень целиком: в очереди остается
+// ровно то, что еще не ушло, а повтор уже ушедшего VK отбросит по random_id.
+class Notification
+{
+private:
+    quint64 id = 0;
+public:
+    quint64 event_id = 0;
+    quint8 level = 0;
+    quint64 recipient_vk_id = 0;
+    QString text;
+    // random_id для messages.send: один и тот же для (event_id, время
+    // события, level, recipient_vk_id), так что повторная отправка не
+    // дублирует сообщение, а напоминание о новом времени -- уходит.
+    // Перед первой отправкой в сводке сюда записывается random_id сводки.
+    qint64 random_id = 0;
+    quint32 attempts = 0; // Начатых отправок.
+    quint64 next_attempt_at = 0; // UTC+0 unix time, раньше не отправлять.
+public:
+    friend struct schema::Table<Notification>;
+    static constexpr char table_name[] = "NotificationOutbox";
+public:
+    // Читает строку, выбранную с проекцией schema::columns<Notification>, начиная с колонки
+    // first_column (для JOIN, где колонки сущности идут не первыми).
+    bool unpack_from_query(QSqlQuery& query, int first_column = 0);
+
+    // Проверяет, что таблица существует. Если нет, создает.
+    static bool check_table(QSqlDatabase& db);
+
+    static bool run_tests(QSqlDatabase& test_db);
+
+    // До limit сообщений, которые пора отправлять, самые давние первыми.
+    static bool fetch_ready(QSqlDatabase& db, quint64 now, int limit, QVector<Notification>& found_notifications);
+
+    // Стабильный random_id: положительный int32 из хеша четверки.
+    static qint64 make_random_id(quint64 event_id, quint64 event_timestamp, quint8 level, quint64 recipient_vk_id);
+    // random_id сводки нескольких сообщений одному получателю: не зависит
+    // от порядка, для одного сообщения -- его собственный. Если у всех
+    // строк random_id один (их уже отправляли вместе), то он.
+    static qint64 make_digest_random_id(const QVector<Notification>& digest);
+public:
+    // Public plain methods.
+
+    quint64 get_id() const { return id; }
+
+    bool create(QSqlDatabase& db);
+    // Как create, но сначала удаляет строку с тем же (event_id, level,
+    // recipient_vk_id): она осталась от прежнего времени события.
+    bool replace(QSqlDatabase& db);
+    bool update(QSqlDatabase& db);
+    bool drop(QSqlDatabase& db);
+
+    Notification(quint64 event_id, quint64 event_timestamp, quint8 level, quint64 recipient_vk_id, const QString& text);
+    Notification();
+
+    bool operator==(const Notification& other) const = default;
+};
+
+template <>
+struct schema::Table<Notification> {
+    static constexpr const char* name = Notification::table_name;
+    static constexpr auto fields = std::make_tuple(
+        schema::field<&Notification::id>             ("id",              "INTEGER    NOT NULL PRIMARY KEY AUTOINCREMENT CHECK(id >= 1)", schema::key | schema::auto_increment),
+        schema::field<&Notification::event_id>       ("event_id",        "INTEGER    NOT NULL                           CHECK(event_id >= 1)"),
+        schema::field<&Notification::level>          ("level",           "INTEGER    NOT NULL                           CHECK(level >= 1 and level <= 6)"),
+        schema::field<&Notification::recipient_vk_id>("recipient_vk_id", "INTEGER    NOT NULL                           CHECK(recipient_vk_id >= 1)"),
+        schema::field<&Notification::text>           ("text",            "TEXT       NOT NULL"),
+        schema::field<&Notification::random_id>      ("random_id",       "INTEGER    NOT NULL"),
+        schema::field<&Notification::attempts>       ("attempts",        "INTEGER    NOT NULL                           CHECK(attempts >= 0)"),
+        schema::field<&Notification::next_attempt_at>("next_attempt_at", "INTEGER(8) NOT NULL                           CHECK(next_attempt_at >= 0)")
+    );
+    static constexpr auto constraints = schema::concat(
+        schema::FixedString("UNIQUE (event_id, level, recipient_vk_id), "
+                            "FOREIGN KEY (event_id) REFERENCES "), schema::FixedString(Event::table_name),
+        schema::FixedString("(id) ON DELETE CASCADE"));
+};
+
+#endif // NOTIFICATION_H
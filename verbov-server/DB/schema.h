@@ -0,0 +1,581 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <initializer_list>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+
+#include <QDataStream>
+#include <QDebug>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+// Описание таблиц сущностей на этапе компиляции.
+//
+// Для сущности специализируется schema::Table<Entity>: имя таблицы, список
+// полей (указатель на член класса, имя колонки, определение колонки, флаги)
+// и ограничения таблицы. По нему на этапе компиляции собираются тексты
+// запросов (CREATE, SELECT, INSERT, UPDATE, DELETE), а шаблоны ниже
+// привязывают параметры по номеру, разбирают строки результата по номеру
+// колонки и пишут/читают сущность в QDataStream.
+//
+// Порядок полей -- это и порядок колонок в запросах, и порядок в QDataStream,
+// так что менять его нельзя без смены формата обмена с клиентом.
+namespace schema {
+    // Строка фиксированной длины, годится как параметр шаблона.
+    template <std::size_t N>
+    struct FixedString {
+        char data[N] {};
+
+        constexpr FixedString() = default;
+        constexpr FixedString(const char (&text)[N]) {
+            for (std::size_t i = 0; i < N; ++i) {
+                data[i] = text[i];
+            }
+        }
+
+        constexpr std::size_t size() const { return N - 1; }
+    };
+    template <std::size_t N>
+    FixedString(const char (&)[N]) -> FixedString<N>;
+
+    template <std::size_t... N>
+    constexpr auto concat(const FixedString<N>&... parts) {
+        FixedString<(N + ... + 1) - sizeof...(N)> result;
+        std::size_t pos = 0;
+        ([&](const auto& part) {
+            for (std::size_t i = 0; i < part.size(); ++i) {
+                result.data[pos++] = part.data[i];
+            }
+        }(parts), ...);
+        return result;
+    }
+
+    enum FieldFlag : unsigned {
+        key            = 1 << 0, // Входит в первичный ключ.
+        auto_increment = 1 << 1, // Назначается БД при вставке.
+        not_serialized = 1 << 2, // Не передается клиенту.
+    };
+
+    template <auto Member>
+    struct Field {
+        static constexpr auto member = Member;
+
+        const char* name;
+        const char* definition; // Тип и ограничения колонки для CREATE TABLE.
+        unsigned flags;
+
+        constexpr bool has(FieldFlag flag) const { return (flags & flag) != 0; }
+    };
+
+    template <auto Member>
+    constexpr Field<Member> field(const char* name, const char* definition, unsigned flags = 0) {
+        return {name, definition, flags};
+    }
+
+    // Специализируется для каждой сущности, должна быть ее другом:
+    //   static constexpr const char* name;
+    //   static constexpr auto fields = std::make_tuple(schema::field<&Entity::member>(...), ...);
+    //   static constexpr auto constraints = schema::FixedString("...");
+    template <typename Entity>
+    struct Table;
+
+    // Для сущностей с закрытым конструктором по умолчанию.
+    struct Access {
+        template <typename Entity>
+        static Entity make() { return Entity(); }
+    };
+
+    namespace detail {
+        constexpr std::size_t length(const char* text) {
+            std::size_t n = 0;
+            while (text[n] != '\0') {
+                ++n;
+            }
+            return n;
+        }
+
+        template <typename Entity, typename F>
+        constexpr void for_each_field(F&& f) {
+            std::apply([&](const auto&... fields) { (f(fields), ...); }, Table<Entity>::fields);
+        }
+
+        // Генератор пишет текст дважды: сначала считает длину, потом
+        // заполняет строку этой длины.
+        struct Counter {
+            std::size_t size = 0;
+            constexpr void put(const char* text) { size += length(text); }
+        };
+
+        template <std::size_t N>
+        struct Sink {
+            FixedString<N> result;
+            std::size_t pos = 0;
+            constexpr void put(const char* text) {
+                while (*text != '\0') {
+                    result.data[pos++] = *text++;
+                }
+            }
+        };
+
+        template <typename Generator>
+        constexpr std::size_t generated_size() {
+            Counter counter;
+            Generator::write(counter);
+            return counter.size;
+        }
+
+        template <typename Generator>
+        constexpr auto generate() {
+            Sink<generated_size<Generator>() + 1> sink;
+            Generator::write(sink);
+            return sink.result;
+        }
+
+        // Имена колонок через запятую. Поля с skip_flags пропускаются.
+        template <typename Entity, typename Out>
+        constexpr void put_names(Out& out, unsigned skip_flags, const char* suffix, const char* separator) {
+            bool first = true;
+            for_each_field<Entity>([&](const auto& field) {
+                if ((field.flags & skip_flags) != 0) {
+                    return;
+                }
+                if (!first) {
+                    out.put(separator);
+                }
+                first = false;
+                out.put(field.name);
+                out.put(suffix);
+            });
+        }
+
+        // Условие по первичному ключу: "a = ? AND b = ?".
+        template <typename Entity, typename Out>
+        constexpr void put_key_condition(Out& out) {
+            bool first = true;
+            for_each_field<Entity>([&](const auto& field) {
+                if (!field.has(key)) {
+                    return;
+                }
+                if (!first) {
+                    out.put(" AND ");
+                }
+                first = false;
+                out.put(field.name);
+                out.put(" = ?");
+            });
+        }
+
+        template <typename Entity>
+        struct Columns {
+            template <typename Out>
+            static constexpr void write(Out& out) {
+                put_names<Entity>(out, 0, "", ", ");
+            }
+        };
+
+        template <typename Entity>
+        struct Select {
+            template <typename Out>
+            static constexpr void write(Out& out) {
+                out.put("SELECT ");
+                put_names<Entity>(out, 0, "", ", ");
+                out.put(" FROM ");
+                out.put(Table<Entity>::name);
+            }
+        };
+
+        template <typename Entity>
+        struct SelectByKey {
+            template <typename Out>
+            static constexpr void write(Out& out) {
+                Select<Entity>::write(out);
+                out.put(" WHERE ");
+                put_key_condition<Entity>(out);
+            }
+        };
+
+        // skip_flags -- колонки, которые назначает БД.
+        template <typename Entity, unsigned skip_flags = auto_increment>
+        struct Insert {
+            template <typename Out>
+            static constexpr void write(Out& out) {
+                out.put("INSERT INTO ");
+                out.put(Table<Entity>::name);
+                out.put("(");
+                put_names<Entity>(out, skip_flags, "", ", ");
+                out.put(") VALUES (");
+                bool first = true;
+                for_each_field<Entity>([&](const auto& field) {
+                    if ((field.flags & skip_flags) != 0) {
+                        return;
+                    }
+                    out.put(first ? "?" : ", ?");
+                    first = false;
+                });
+                out.put(")");
+            }
+        };
+
+        template <typename Entity>
+        struct Update {
+            template <typename Out>
+            static constexpr void write(Out& out) {
+                out.put("UPDATE ");
+                out.put(Table<Entity>::name);
+                out.put(" SET ");
+                put_names<Entity>(out, key, " = ?", ", ");
+                out.put(" WHERE ");
+                put_key_condition<Entity>(out);
+            }
+        };
+
+        template <typename Entity>
+        struct Delete {
+            template <typename Out>
+            static constexpr void write(Out& out) {
+                out.put("DELETE FROM ");
+                out.put(Table<Entity>::name);
+                out.put(" WHERE ");
+                put_key_condition<Entity>(out);
+            }
+        };
+
+        template <typename Entity>
+        struct Create {
+            template <typename Out>
+            static constexpr void write(Out& out) {
+                out.put("CREATE TABLE IF NOT EXISTS ");
+                out.put(Table<Entity>::name);
+                out.put("(");
+                bool first = true;
+                for_each_field<Entity>([&](const auto& field) {
+                    if (!first) {
+                        out.put(", ");
+                    }
+                    first = false;
+                    out.put(field.name);
+                    out.put(" ");
+                    out.put(field.definition);
+                });
+                if (Table<Entity>::constraints.size() > 0) {
+                    out.put(", ");
+                    out.put(Table<Entity>::constraints.data);
+                }
+                out.put(")");
+            }
+        };
+
+        template <typename T>
+        QVariant to_variant(const T& value) {
+            if constexpr (std::is_same_v<T, quint8>) {
+                // QVariant не хранит quint8 как число для драйвера SQL.
+                return QVariant::fromValue(static_cast<quint32>(value));
+            } else {
+                return QVariant::fromValue(value);
+            }
+        }
+
+        template <typename T>
+        bool from_variant(const QVariant& value, T& out) {
+            if constexpr (std::is_same_v<T, QString>) {
+                out = value.toString();
+                return true;
+            } else if constexpr (std::is_same_v<T, bool>) {
+                out = value.toBool();
+                return true;
+            } else if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T>) {
+                bool right_variant = false;
+                out = static_cast<T>(value.toULongLong(&right_variant));
+                return right_variant;
+            } else {
+                static_assert(std::is_integral_v<T>, "unsupported column type");
+                bool right_variant = false;
+                out = static_cast<T>(value.toLongLong(&right_variant));
+                return right_variant;
+            }
+        }
+
+        inline bool prepare(QSqlQuery& query, const QString& sql) {
+            if (!query.prepare(sql)) {
+                // Failed to prepare the query.
+                qCritical() << query.lastError().text();
+                return false;
+            }
+            return true;
+        }
+
+        inline bool exec(QSqlQuery& query) {
+            if (!query.exec()) {
+                // Failed to execute the query.
+                qCritical() << query.lastError().text();
+                return false;
+            }
+            return true;
+        }
+
+        inline void bind(QSqlQuery& query, std::initializer_list<QVariant> values) {
+            int pos = 0;
+            for (const QVariant& value: values) {
+                query.bindValue(pos++, value);
+            }
+        }
+    }
+
+    // Тексты запросов, собранные при компиляции.
+    template <typename Entity> inline constexpr auto columns        = detail::generate<detail::Columns<Entity>>();
+    template <typename Entity> inline constexpr auto select         = detail::generate<detail::Select<Entity>>();
+    template <typename Entity> inline constexpr auto select_by_key  = detail::generate<detail::SelectByKey<Entity>>();
+    template <typename Entity> inline constexpr auto insert_sql     = detail::generate<detail::Insert<Entity>>();
+    template <typename Entity> inline constexpr auto insert_all_sql = detail::generate<detail::Insert<Entity, 0>>();
+    template <typename Entity> inline constexpr auto update_sql     = detail::generate<detail::Update<Entity>>();
+    template <typename Entity> inline constexpr auto delete_sql     = detail::generate<detail::Delete<Entity>>();
+    template <typename Entity> inline constexpr auto create_sql     = detail::generate<detail::Create<Entity>>();
+
+    // Склейка при компиляции: schema::sql<schema::select<Event>, " WHERE refer_str = ?">.
+    template <FixedString... Parts>
+    inline constexpr auto sql = concat(Parts...);
+
+    // QString с текстом запроса, один на запрос на весь процесс.
+    template <const auto& Sql>
+    const QString& text() {
+        static const QString instance = QString::fromUtf8(Sql.data, static_cast<qsizetype>(Sql.size()));
+        return instance;
+    }
+
+    // Разбор текущей строки, выбранной с проекцией columns<Entity>, начиная с first_column.
+    // Колонки берутся по номеру, а не по имени: поиск имени в записи на
+    // каждой строке заметно дороже самого разбора.
+    template <typename Entity>
+    bool unpack(QSqlQuery& query, Entity& entity, int first_column = 0) {
+        int column = first_column;
+        bool right_variant = true;
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            right_variant = right_variant && detail::from_variant(query.value(column++), entity.*F::member);
+        });
+        return right_variant;
+    }
+
+    // Поля с флагами из skip пропускаются. По умолчанию -- формат для
+    // клиента; skip = 0 пишет все поля (снимки хранилища в памяти).
+    template <typename Entity>
+    QDataStream& write(QDataStream& out, const Entity& entity, unsigned skip = not_serialized) {
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            if ((field.flags & skip) == 0) {
+                out << entity.*F::member;
+            }
+        });
+        return out;
+    }
+
+    template <typename Entity>
+    QDataStream& read(QDataStream& in, Entity& entity, unsigned skip = not_serialized) {
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            if ((field.flags & skip) == 0) {
+                in >> entity.*F::member;
+            }
+        });
+        return in;
+    }
+
+    // Назначает поля auto_increment, когда их назначает не БД, а само
+    // хранилище (хранилище в памяти, шарды).
+    template <typename Entity>
+    void set_auto_increment(Entity& entity, quint64 value) {
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            if constexpr (std::is_integral_v<std::remove_reference_t<decltype(entity.*F::member)>>) {
+                if (field.has(auto_increment)) {
+                    entity.*F::member = value;
+                }
+            }
+        });
+    }
+
+    template <typename Entity>
+    bool create_table(QSqlDatabase& db) {
+        QSqlQuery query(db);
+        return detail::prepare(query, text<create_sql<Entity>>()) && detail::exec(query);
+    }
+
+    // Вставляет строку. Поля auto_increment получают значение от БД.
+    template <typename Entity>
+    bool insert(QSqlDatabase& db, Entity& entity) {
+        QSqlQuery query(db);
+        if (!detail::prepare(query, text<insert_sql<Entity>>())) {
+            return false;
+        }
+
+        int pos = 0;
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            if (!field.has(auto_increment)) {
+                query.bindValue(pos++, detail::to_variant(entity.*F::member));
+            }
+        });
+
+        if (!detail::exec(query)) {
+            return false;
+        }
+
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            if (field.has(auto_increment)) {
+                if (!detail::from_variant(query.lastInsertId(), entity.*F::member)) {
+                    // The only other way is to throw an exception..
+                    // But then we have to create a custom exception.
+                    abort();
+                }
+            }
+        });
+
+        return true;
+    }
+
+    // Вставляет строку вместе с полями auto_increment: их значения назначил
+    // не БД, а вызывающий (общая нумерация на несколько файлов БД).
+    template <typename Entity>
+    bool insert_all(QSqlDatabase& db, const Entity& entity) {
+        QSqlQuery query(db);
+        if (!detail::prepare(query, text<insert_all_sql<Entity>>())) {
+            return false;
+        }
+
+        int pos = 0;
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            query.bindValue(pos++, detail::to_variant(entity.*F::member));
+        });
+
+        return detail::exec(query);
+    }
+
+    // Если объекта нет в БД, то update и remove вернут успех, ничего не сделав.
+    template <typename Entity>
+    bool update(QSqlDatabase& db, const Entity& entity) {
+        QSqlQuery query(db);
+        if (!detail::prepare(query, text<update_sql<Entity>>())) {
+            return false;
+        }
+
+        // Сначала SET, потом WHERE.
+        int pos = 0;
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            if (!field.has(key)) {
+                query.bindValue(pos++, detail::to_variant(entity.*F::member));
+            }
+        });
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            if (field.has(key)) {
+                query.bindValue(pos++, detail::to_variant(entity.*F::member));
+            }
+        });
+
+        return detail::exec(query);
+    }
+
+    template <typename Entity>
+    bool remove(QSqlDatabase& db, const Entity& entity) {
+        QSqlQuery query(db);
+        if (!detail::prepare(query, text<delete_sql<Entity>>())) {
+            return false;
+        }
+
+        int pos = 0;
+        detail::for_each_field<Entity>([&](const auto& field) {
+            using F = std::decay_t<decltype(field)>;
+            if (field.has(key)) {
+                query.bindValue(pos++, detail::to_variant(entity.*F::member));
+            }
+        });
+
+        return detail::exec(query);
+    }
+
+    // Выполняет запрос на чтение: курсор только вперед, параметры по порядку.
+    // Строки потом читаются query.next() и unpack.
+    inline bool open(QSqlQuery& query, const QString& sql, std::initializer_list<QVariant> binds) {
+        query.setForwardOnly(true);
+        if (!detail::prepare(query, sql)) {
+            return false;
+        }
+        detail::bind(query, binds);
+        return detail::exec(query);
+    }
+
+    // Одна строка по запросу с проекцией columns<Entity>. Не нашлось -- found пуст, это успех.
+    template <typename Entity>
+    bool fetch_one(QSqlDatabase& db, const QString& sql, std::initializer_list<QVariant> binds, std::optional<Entity>& found) {
+        QSqlQuery query(db);
+        if (!open(query, sql, binds)) {
+            return false;
+        }
+
+        if (!query.next()) {
+            // Haven't found anything. But the query is successful.
+            found.reset();
+            return true;
+        }
+
+        Entity entity = Access::make<Entity>();
+        if (!unpack(query, entity)) {
+            // Failed to unpack. Treat as a failed query.
+            return false;
+        }
+        found = std::move(entity);
+        return true;
+    }
+
+    // Все строки по запросу с проекцией columns<Entity>.
+    template <typename Entity>
+    bool fetch_all(QSqlDatabase& db, const QString& sql, std::initializer_list<QVariant> binds, QVector<Entity>& found) {
+        QSqlQuery query(db);
+        if (!open(query, sql, binds)) {
+            return false;
+        }
+
+        found.clear();
+        while (query.next()) {
+            Entity entity = Access::make<Entity>();
+            if (!unpack(query, entity)) {
+                // Failed to unpack. Treat as a failed query.
+                return false;
+            }
+            found.push_back(std::move(entity));
+        }
+        return true;
+    }
+
+    // Есть ли хоть одна строка. Для проверки уникальности.
+    inline bool exists(QSqlDatabase& db, const QString& sql, std::initializer_list<QVariant> binds, bool& found) {
+        QSqlQuery query(db);
+        if (!open(query, sql, binds)) {
+            return false;
+        }
+        found = query.next();
+        return true;
+    }
+
+    // Значение первой колонки первой строки, для SELECT COUNT(*).
+    inline bool count(QSqlDatabase& db, const QString& sql, std::initializer_list<QVariant> binds, qint64& found) {
+        QSqlQuery query(db);
+        if (!open(query, sql, binds) || !query.next()) {
+            return false;
+        }
+        return detail::from_variant(query.value(0), found);
+    }
+}
+
+#endif // SCHEMA_H
@@ -3,7 +3,6 @@
 #include <QtSql/QSqlTableModel>
 #include <QtSql/QSqlQuery>
 #include <QCryptographicHash>
-#include <QDateTime>
 #include <QSqlError>
 
 #include <random>
@@ -11,7 +10,9 @@
 
 #include "user.h"
 
-const QString Session::table_name = "Sessions";
+#include "metrics.h"
+#include "timesource.h"
+#include "trace.h"
 
 #define CHECK(expr) if (!(expr)) { return false; }
 bool Session::run_tests(QSqlDatabase& test_db) {
@@ -28,6 +29,18 @@ bool Session::run_tests(QSqlDatabase& test_db) {
     CHECK(session1.generate_token(test_db));
     session1.set_time_started();
     CHECK(!session1.is_expired());
+    CHECK(session1.is_expired(session1.start_time + max_duration_sec + 1));
+    {
+        // Истечение по подмененным часам, без ожидания.
+        timesource::Manual clock(1000);
+        Session timed;
+        timed.set_time_started();
+        CHECK(timed.start_time == 1000);
+        clock.advance(max_duration_sec);
+        CHECK(!timed.is_expired());
+        clock.advance(1);
+        CHECK(timed.is_expired());
+    }
 
     // Test CRUD.
 
@@ -67,217 +80,100 @@ bool Session::run_tests(QSqlDatabase& test_db) {
     CHECK(fetch_by_token(test_db, session1.token, nonexistent_session_from_db)); // ID was set to zero, so let's use token.
     CHECK(!nonexistent_session_from_db.has_value());
 
+    // Purge: удаляется только истекшая сессия.
+    Session stale;
+    stale.user_id = user1.get_vk_id();
+    CHECK(stale.generate_token(test_db));
+    stale.start_time = 1;
+    CHECK(stale.create(test_db));
+    Session fresh;
+    fresh.user_id = user1.get_vk_id();
+    CHECK(fresh.generate_token(test_db));
+    fresh.set_time_started();
+    CHECK(fresh.create(test_db));
+
+    qint64 num_deleted = 0;
+    CHECK(purge_expired(test_db, timesource::now(), 100, num_deleted));
+    CHECK(num_deleted == 1);
+    CHECK(fetch_by_id(test_db, stale.id, nonexistent_session_from_db));
+    CHECK(!nonexistent_session_from_db.has_value());
+    CHECK(fetch_by_id(test_db, fresh.id, session1_from_db));
+    CHECK(session1_from_db.has_value());
+    CHECK(fresh.drop(test_db));
+
     CHECK(user1.drop(test_db));
 
     return true;
 }
 #undef CHECK
 
-bool Session::unpack_from_query(QSqlQuery& query) {
-    bool right_variant = true;
-    id = query.value("id").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    user_id = query.value("user_id").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    token = query.value("token").toString();
-
-    start_time = query.value("start_time").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    return true;
-}
-
-void Session::pack_into_query(QSqlQuery& query, bool fill_id) const {
-    if (fill_id) {
-        // If we are creating a row, then id is not known, we should not set it.
-        query.bindValue(":id", QVariant::fromValue(id));
-    }
-
-    query.bindValue(":user_id", QVariant::fromValue(user_id));
-    query.bindValue(":token", token);
-    query.bindValue(":start_time", QVariant::fromValue(start_time));
+bool Session::unpack_from_query(QSqlQuery& query, int first_column) {
+    // Порядок колонок -- как в schema::Table<Session>::fields.
+    return schema::unpack(query, *this, first_column);
 }
 
 bool Session::check_table(QSqlDatabase& db) {
-    // QSqlQuery docs: https://doc.qt.io/qt-6/sql-sqlstatements.html
-    QSqlQuery query(db);
-
-    // SQL LIKE operator. https://www.w3schools.com/sql/sql_like.asp
-    // Turns out ids in sqlite start from 1. That's great.
-    //   https://stackoverflow.com/questions/692856/set-start-value-for-autoincrement-in-sqlite
-    //   The initial value for SQLITE_SEQUENCE.seq must be null or 0. But from tests seems like ids
-    //   start from 1.
-    //   https://stackoverflow.com/a/9053277
-    // We have to write NOT NULL at PRIMARY KEYS of not integer type for sqlite due to a bug.
-    //   https://stackoverflow.com/a/64778551
-    if (!query.prepare(
-        "CREATE TABLE IF NOT EXISTS " + table_name + "("
-        "id INTEGER                NOT NULL PRIMARY KEY AUTOINCREMENT CHECK(id >= 1),"
-        "user_id INTEGER           NOT NULL                           CHECK(user_id >= 1),"
-        "token VARCHAR(64)         NOT NULL UNIQUE                    CHECK(LENGTH(token) = 64),"
-        "start_time INTEGER(8)     NOT NULL                           CHECK(start_time >= 0),"
-        "FOREIGN KEY (user_id) REFERENCES " + User::table_name + "(vk_id) ON DELETE RESTRICT"
-    ");")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
+    // Текст CREATE TABLE собирается из schema::Table<Session>.
+    if (!schema::create_table<Session>(db)) {
         return false;
     }
 
-    return true;
+    // Для purge_expired: истекшие сессии находятся по индексу, а не
+    // просмотром всей таблицы на каждую пачку.
+    static constexpr auto index_sql = schema::sql<
+        "CREATE INDEX IF NOT EXISTS ", schema::FixedString(table_name), "_start_time ON ",
+        schema::FixedString(table_name), "(start_time)">;
+    QSqlQuery query(db);
+    return schema::open(query, schema::text<index_sql>(), {});
 }
 
 bool Session::fetch_by_id(QSqlDatabase& db, quint64 id, std::optional<Session>& found_session) {
-    Session session;
-    QSqlQuery query(db);
-
-    if (!query.prepare("SELECT * FROM " + table_name + " WHERE id = :id")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":id", QVariant::fromValue(id));
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    if (!query.first()) {
-        // Haven't found anything. But the query is successful.
-        found_session.reset();
-        return true;
-    }
-
-    if (!session.unpack_from_query(query)) {
-        // Failed to unpack. Treat as a failed query.
-        return false;
-    }
-
-    found_session = std::move(session);
-
-    return true;
+    SQL_TIMER("Session::fetch_by_id");
+    TRACE_SPAN("Session::fetch_by_id", "db");
+    return schema::fetch_one(db, schema::text<schema::select_by_key<Session>>(), {QVariant::fromValue(id)}, found_session);
 }
 
 bool Session::fetch_by_token(QSqlDatabase& db, const QStringView token, std::optional<Session>& found_session) {
-    // Almost ctrl-c + ctrl-v from code for retrieval by id.
-    // Query one row by an unique column.
+    SQL_TIMER("Session::fetch_by_token");
+    TRACE_SPAN("Session::fetch_by_token", "db");
+    // Кэша сессий пока нет, каждый поиск идет в БД. Считаем исходы поиска,
+    // кэш потом будет отчитываться в тот же ряд.
+    static const metrics::Counter lookups_found = metrics::counter(
+        "verbov_session_lookups_total", "Session token lookups by outcome.", {{"result", "found"}});
+    static const metrics::Counter lookups_missing = metrics::counter(
+        "verbov_session_lookups_total", "Session token lookups by outcome.", {{"result", "missing"}});
 
-    Session session;
-    QSqlQuery query(db);
-
-    if (!query.prepare("SELECT * FROM " + table_name + " WHERE token = :token")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":token", token.toString());
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
+    // Query one row by an unique column.
+    static constexpr auto sql = schema::sql<schema::select<Session>, " WHERE token = ?">;
+    if (!schema::fetch_one(db, schema::text<sql>(), {token.toString()}, found_session)) {
         return false;
     }
 
-    if (!query.first()) {
-        // Haven't found anything. But the query is successful.
-        found_session.reset();
-        return true;
-    }
-
-    if (!session.unpack_from_query(query)) {
-        // Failed to unpack. Treat as a failed query.
-        return false;
+    if (found_session.has_value()) {
+        lookups_found.inc();
+    } else {
+        lookups_missing.inc();
     }
 
-    found_session = std::move(session);
-
     return true;
 }
 
 bool Session::create(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
-    if (!query.prepare(
-        "INSERT INTO " + table_name + "(user_id, token, start_time)"
-                                      " VALUES (:user_id, :token, :start_time)"
-    )) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    pack_into_query(query, false);
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    bool right_variant = false;
-    id = query.lastInsertId().toULongLong(&right_variant);
-    if (!right_variant) {
-        // The only other way is to throw an exception..
-        // But then we have to create a custom exception.
-        abort();
-    }
-
-    return true;
+    SQL_TIMER("Session::create");
+    TRACE_SPAN("Session::create", "db");
+    return schema::insert(db, *this);
 }
 
 bool Session::update(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
-    if (!query.prepare(
-        "UPDATE " + table_name + " " +
-        "SET user_id = :user_id, token = :token, start_time = :start_time "
-        "WHERE id = :id"
-    )) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    pack_into_query(query);
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    return true;
+    SQL_TIMER("Session::update");
+    TRACE_SPAN("Session::update", "db");
+    return schema::update(db, *this);
 }
 
 bool Session::drop(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
-    if (!query.prepare("DELETE FROM " + table_name + " WHERE id = :id")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":id", QVariant::fromValue(id));
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
+    SQL_TIMER("Session::drop");
+    TRACE_SPAN("Session::drop", "db");
+    if (!schema::remove(db, *this)) {
         return false;
     }
 
@@ -287,38 +183,25 @@ bool Session::drop(QSqlDatabase& db) {
 }
 
 bool Session::generate_token(QSqlDatabase& db) {
+    SQL_TIMER("Session::generate_token");
+    TRACE_SPAN("Session::generate_token", "db");
     if (!token.isEmpty()) {
         // Токен уже есть, генерировать не надо.
         return true;
     }
 
     static const int max_num_iters = 1000;
-    static std::random_device rd;
-    static std::mt19937_64 mt(rd());
 
     for (int i = 0; i < max_num_iters; ++i) {
-        quint64 value = mt();
-
-        // QCryptographicHash docs: https://doc.qt.io/qt-5/qcryptographichash.html
-        QCryptographicHash hash(QCryptographicHash::Algorithm::Sha3_256);
-        auto bytes = QByteArray::fromRawData(reinterpret_cast<char*>(&value), sizeof(value));
-        hash.addData(bytes);
-        token = hash.result().toHex();
-
-        QSqlQuery query(db);
-        if (!query.prepare("SELECT 1 FROM " + table_name + " WHERE token = (:token);")) {
-            // Failed to execute the query.
-            qCritical() << query.lastError().text();
-            return false;
-        }
-        query.bindValue(":token", token);
-        if (!query.exec()) {
-            // Failed to execute the query.
-            qCritical() << query.lastError().text();
+        token = make_token();
+
+        static constexpr auto sql = schema::sql<"SELECT 1 FROM ", schema::FixedString(table_name), " WHERE token = ?">;
+        bool taken = false;
+        if (!schema::exists(db, schema::text<sql>(), {token}, taken)) {
             return false;
         }
 
-        if (!query.first()) {
+        if (!taken) {
             // This is an unused token.
             return true;
         }
@@ -327,14 +210,49 @@ bool Session::generate_token(QSqlDatabase& db) {
     return false;
 }
 
+QString Session::make_token() {
+    static std::random_device rd;
+    static std::mt19937_64 mt(rd());
+
+    quint64 value = mt();
+
+    // QCryptographicHash docs: https://doc.qt.io/qt-5/qcryptographichash.html
+    QCryptographicHash hash(QCryptographicHash::Algorithm::Sha3_256);
+    auto bytes = QByteArray::fromRawData(reinterpret_cast<char*>(&value), sizeof(value));
+    hash.addData(bytes);
+    return hash.result().toHex();
+}
+
 void Session::set_time_started() {
     // https://stackoverflow.com/a/4460647
-    // There is also QDateTime::currentSecsSinceEpoch().
-    start_time = QDateTime::currentSecsSinceEpoch();
+    // Время берется из timesource, чтобы тесты могли его подменить.
+    start_time = timesource::now();
+}
+
+bool Session::is_expired() const {
+    return is_expired(timesource::now());
 }
 
-bool Session::is_expired() {
-    return start_time > QDateTime::currentSecsSinceEpoch() + max_duration_sec;
+bool Session::is_expired(quint64 now) const {
+    return start_time + max_duration_sec < now;
+}
+
+bool Session::purge_expired(QSqlDatabase& db, quint64 now, int limit, qint64& num_deleted) {
+    SQL_TIMER("Session::purge_expired");
+    TRACE_SPAN("Session::purge_expired", "db");
+    // Самые старые сначала. Один запрос -- одна короткая транзакция, так что
+    // писатели между пачками не ждут.
+    static constexpr auto sql = schema::sql<
+        "DELETE FROM ", schema::FixedString(table_name), " WHERE id IN (SELECT id FROM ", schema::FixedString(table_name),
+        " WHERE start_time < ? ORDER BY start_time LIMIT ?)">;
+    // Как is_expired, но условие только на колонку: иначе индекс не работает.
+    const quint64 started_before = now > max_duration_sec ? now - max_duration_sec : 0;
+    QSqlQuery query(db);
+    if (!schema::open(query, schema::text<sql>(), {QVariant::fromValue(started_before), limit})) {
+        return false;
+    }
+    num_deleted = query.numRowsAffected();
+    return true;
 }
 
 
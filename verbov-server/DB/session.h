@@ -8,6 +8,9 @@
 
 #include <QtSql/QSqlQuery>
 
+#include "schema.h"
+#include "user.h"
+
 class Session
 {
 private:
@@ -18,13 +21,15 @@ public:
     QString token;
     quint64 start_time = 0;
 private:
-    static const QString table_name;
+    friend struct schema::Table<Session>;
+    static constexpr char table_name[] = "Sessions";
     static const quint64 max_duration_sec = 5 * 24 * 60 * 60;
 public:
     // Public static methods.
 
-    bool unpack_from_query(QSqlQuery& query);
-    void pack_into_query(QSqlQuery& query, bool fill_id = true) const;
+    // Читает строку, выбранную с проекцией schema::columns<Session>, начиная с колонки
+    // first_column (для JOIN, где колонки сущности идут не первыми).
+    bool unpack_from_query(QSqlQuery& query, int first_column = 0);
 
     // Проверяет, что таблица существует. Если нет, создает.
     static bool check_table(QSqlDatabase& db);
@@ -33,6 +38,8 @@ public:
 
     static bool fetch_by_id(QSqlDatabase& db, quint64 id, std::optional<Session>& found_session);
     static bool fetch_by_token(QSqlDatabase& db, const QStringView token, std::optional<Session>& found_session);
+    // Удаляет до limit сессий, истекших к now, самые старые первыми.
+    static bool purge_expired(QSqlDatabase& db, quint64 now, int limit, qint64& num_deleted);
 public:
     // Public plain methods.
 
@@ -48,12 +55,29 @@ public:
     bool drop(QSqlDatabase& db);
 
     bool generate_token(QSqlDatabase& db);
+    // Случайный токен, без проверки, что он свободен.
+    static QString make_token();
     void set_time_started();
-    bool is_expired();
+    bool is_expired() const;
+    bool is_expired(quint64 now) const;
 
     Session();
 
     bool operator==(const Session& other) const = default;
 };
 
+template <>
+struct schema::Table<Session> {
+    static constexpr const char* name = Session::table_name;
+    static constexpr auto fields = std::make_tuple(
+        schema::field<&Session::id>        ("id",         "INTEGER    NOT NULL PRIMARY KEY AUTOINCREMENT CHECK(id >= 1)", schema::key | schema::auto_increment),
+        schema::field<&Session::user_id>   ("user_id",    "INTEGER    NOT NULL                           CHECK(user_id >= 1)"),
+        schema::field<&Session::token>     ("token",      "VARCHAR(64) NOT NULL UNIQUE                   CHECK(LENGTH(token) = 64)"),
+        schema::field<&Session::start_time>("start_time", "INTEGER(8) NOT NULL                           CHECK(start_time >= 0)")
+    );
+    static constexpr auto constraints = schema::concat(
+        schema::FixedString("FOREIGN KEY (user_id) REFERENCES "), schema::FixedString(User::table_name),
+        schema::FixedString("(vk_id) ON DELETE RESTRICT"));
+};
+
 #endif // SESSION_H
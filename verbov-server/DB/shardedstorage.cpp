@@ -0,0 +1,412 @@
+#include "shardedstorage.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include "trace.h"
+
+namespace storage {
+    // Запрос без параметров вне методов сущностей: начало и конец транзакции.
+    static bool exec_plain(QSqlDatabase& db, const QString& sql) {
+        QSqlQuery query(db);
+        if (!query.exec(sql)) {
+            qCritical() << query.lastError().text();
+            return false;
+        }
+        return true;
+    }
+
+    static void sort_by_id(QVector<Event>& events) {
+        std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.get_id() < b.get_id(); });
+    }
+
+    static void sort_by_timestamp(QVector<Event>& events) {
+        std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+            return std::make_pair(a.timestamp, a.get_id()) < std::make_pair(b.timestamp, b.get_id());
+        });
+    }
+
+    ShardedStorage::ShardedStorage(QSqlDatabase& main_db, std::vector<QSqlDatabase> shards)
+        : main_db_(main_db), shards_(std::move(shards)) {
+        assert(!shards_.empty());
+    }
+
+    bool ShardedStorage::open_shards(const QString& main_path, int num_shards, std::vector<QSqlDatabase>& shards) {
+        shards.clear();
+        for (int i = 0; i < num_shards; ++i) {
+            const QString path = sibling_path(main_path, "shard" + QString::number(i));
+            // У каждого шарда свое соединение, имя -- путь к файлу.
+            QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", path);
+            db.setDatabaseName(path);
+            if (!db.open()) {
+                qCritical() << "failed to open shard" << path << ":" << db.lastError().text();
+                return false;
+            }
+
+            exec_plain(db, "PRAGMA journal_mode=WAL");
+            if (!prepare_incremental_vacuum(db)) {
+                qCritical() << "failed to check auto-vacuum mode of shard" << path;
+            }
+            if (!Session::check_table(db) || !Event::check_table(db) || !EventParticipant::check_table(db) ||
+                !Notification::check_table(db)) {
+                return false;
+            }
+            // У каждого шарда свой архив: db.shard0.archive.sqlite3, ...
+            if (!attach_archive(db, sibling_path(path, "archive"))) {
+                return false;
+            }
+            shards.push_back(db);
+        }
+        return true;
+    }
+
+    int ShardedStorage::shard_of(QStringView text) const {
+        quint64 value = 0;
+        for (qsizetype i = 0; i < std::min<qsizetype>(text.size(), 4); ++i) {
+            value = value * 31 + text[i].unicode();
+        }
+        return value % shards_.size();
+    }
+
+    bool ShardedStorage::fetch_user(quint64 vk_id, std::optional<User>& found) {
+        STORAGE_TIMER("sharded", "fetch_user");
+        return User::fetch_by_vk_id(main_db_, vk_id, found);
+    }
+
+    bool ShardedStorage::fetch_event_users(quint64 event_id, QVector<User>& found) {
+        STORAGE_TIMER("sharded", "fetch_event_users");
+        QVector<EventParticipant> participations;
+        if (!EventParticipant::fetch_all_for_event(shard(event_id), event_id, participations)) {
+            return false;
+        }
+
+        // Пользователи в другом файле, JOIN не сделать.
+        found.clear();
+        for (const EventParticipant& participation: participations) {
+            std::optional<User> user;
+            if (!User::fetch_by_vk_id(main_db_, participation.get_user_id(), user)) {
+                return false;
+            }
+            if (user.has_value()) {
+                found.push_back(std::move(*user));
+            }
+        }
+        return true;
+    }
+
+    bool ShardedStorage::fetch_participants_page(quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found) {
+        STORAGE_TIMER("sharded", "fetch_participants_page");
+        QVector<EventParticipant> participations;
+        if (!EventParticipant::fetch_page_for_event(shard(event_id), event_id, after_vk_id, limit, participations)) {
+            return false;
+        }
+
+        found.clear();
+        for (const EventParticipant& participation: participations) {
+            std::optional<User> user;
+            if (!User::fetch_by_vk_id(main_db_, participation.get_user_id(), user)) {
+                return false;
+            }
+            if (user.has_value()) {
+                found.push_back(UserBrief{user->get_vk_id(), user->first_name, user->last_name});
+            }
+        }
+        return true;
+    }
+
+    bool ShardedStorage::create_user(User& user) {
+        STORAGE_TIMER("sharded", "create_user");
+        return user.create(main_db_);
+    }
+
+    bool ShardedStorage::update_user(User& user) {
+        STORAGE_TIMER("sharded", "update_user");
+        return user.update(main_db_);
+    }
+
+    bool ShardedStorage::fetch_session(QStringView token, std::optional<Session>& found) {
+        STORAGE_TIMER("sharded", "fetch_session");
+        return Session::fetch_by_token(shards_[shard_of(token)], token, found);
+    }
+
+    bool ShardedStorage::create_session(Session& session) {
+        STORAGE_TIMER("sharded", "create_session");
+        static const int max_num_iters = 10000;
+
+        // Токен подбираем так, чтобы он указывал на шард пользователя:
+        // в среднем N попыток, дешевле, чем искать токен во всех шардах.
+        const int target = session.user_id % shards_.size();
+        QSqlDatabase& db = shards_[target];
+        for (int i = 0; i < max_num_iters; ++i) {
+            const QString token = Session::make_token();
+            if (shard_of(token) != target) {
+                continue;
+            }
+
+            std::optional<Session> existing;
+            if (!Session::fetch_by_token(db, token, existing)) {
+                return false;
+            }
+            if (!existing.has_value()) {
+                session.token = token;
+                return session.create(db);
+            }
+        }
+        return false;
+    }
+
+    bool ShardedStorage::fetch_event(quint64 id, std::optional<Event>& found) {
+        STORAGE_TIMER("sharded", "fetch_event");
+        return Event::fetch_by_id(shard(id), id, found);
+    }
+
+    bool ShardedStorage::fetch_event_by_refer(const QString& refer, std::optional<Event>& found) {
+        STORAGE_TIMER("sharded", "fetch_event_by_refer");
+        return Event::fetch_by_refer(shards_[shard_of(refer)], refer, found);
+    }
+
+    bool ShardedStorage::fetch_events_for_user(quint64 user_id, QVector<Event>& found) {
+        STORAGE_TIMER("sharded", "fetch_events_for_user");
+        TRACE_SPAN("ShardedStorage::fetch_events_for_user", "db");
+        // Пользователь может создать событие или участвовать в нем в любом
+        // шарде: спрашиваем все. Участия лежат рядом со своими событиями,
+        // так что запрос в каждом шарде тот же, что и без шардов.
+        found.clear();
+        for (QSqlDatabase& db: shards_) {
+            QVector<Event> events;
+            if (!Event::fetch_all_for_user(db, user_id, events)) {
+                return false;
+            }
+            found.append(std::move(events));
+        }
+        sort_by_id(found);
+        return true;
+    }
+
+    bool ShardedStorage::fetch_events_history_for_user(quint64 user_id, QVector<Event>& found) {
+        STORAGE_TIMER("sharded", "fetch_events_history_for_user");
+        found.clear();
+        for (QSqlDatabase& db: shards_) {
+            QVector<Event> events;
+            if (!Event::fetch_history_for_user(db, user_id, events)) {
+                return false;
+            }
+            found.append(std::move(events));
+        }
+        sort_by_id(found);
+        return true;
+    }
+
+    bool ShardedStorage::fetch_events_due(int level, quint64 after, quint64 until, int limit, QVector<Event>& found) {
+        STORAGE_TIMER("sharded", "fetch_events_due");
+        // Из каждого шарда до limit самых близких, из них -- limit общих.
+        found.clear();
+        for (QSqlDatabase& db: shards_) {
+            QVector<Event> events;
+            if (!Event::fetch_due(db, level, after, until, limit, events)) {
+                return false;
+            }
+            found.append(std::move(events));
+        }
+        sort_by_timestamp(found);
+        if (found.size() > limit) {
+            found.resize(limit);
+        }
+        return true;
+    }
+
+    bool ShardedStorage::create_event(Event& event) {
+        STORAGE_TIMER("sharded", "create_event");
+        static const int max_num_iters = 10000;
+
+        // События раскладываются по шардам по кругу.
+        const int target = next_shard_++ % shards_.size();
+        QSqlDatabase& db = shards_[target];
+
+        // Ссылку и id выбираем сами под IMMEDIATE: другой процесс не займет
+        // их, пока мы не вставили строку.
+        if (!exec_plain(db, "BEGIN IMMEDIATE")) {
+            return false;
+        }
+
+        bool found_refer = false;
+        for (int i = 0; i < max_num_iters && !found_refer; ++i) {
+            event.refer_str = Event::make_refer();
+            if (shard_of(event.refer_str) != target) {
+                continue;
+            }
+
+            std::optional<Event> existing;
+            if (!Event::fetch_by_refer(db, event.refer_str, existing)) {
+                break;
+            }
+            found_refer = !existing.has_value();
+        }
+
+        // id -- следующий после последнего выданного в этом шарде
+        // (sqlite_sequence, удаленные id не переиспользуются) с остатком target.
+        static constexpr auto sequence_sql = schema::sql<
+            "SELECT COALESCE(MAX(seq), 0) FROM sqlite_sequence WHERE name = '", schema::FixedString(Event::table_name), "'">;
+        qint64 last_id = 0;
+        if (!found_refer || !schema::count(db, schema::text<sequence_sql>(), {}, last_id)) {
+            exec_plain(db, "ROLLBACK");
+            event.refer_str.clear();
+            return false;
+        }
+
+        const quint64 num_shards = shards_.size();
+        const quint64 next = last_id + 1;
+        schema::set_auto_increment(event, next + (target + num_shards - next % num_shards) % num_shards);
+
+        if (!schema::insert_all(db, event) || !exec_plain(db, "COMMIT")) {
+            exec_plain(db, "ROLLBACK");
+            schema::set_auto_increment(event, 0);
+            return false;
+        }
+        return true;
+    }
+
+    bool ShardedStorage::update_event(Event& event) {
+        STORAGE_TIMER("sharded", "update_event");
+        // Ссылку менять нельзя: по ней вычисляется шард.
+        return event.update(shard(event.get_id()));
+    }
+
+    bool ShardedStorage::drop_event(Event& event) {
+        STORAGE_TIMER("sharded", "drop_event");
+        // Участия лежат в шарде события, удаляем их той же транзакцией
+        // (ON DELETE CASCADE без PRAGMA foreign_keys не работает).
+        QSqlDatabase& db = shard(event.get_id());
+        if (!db.transaction()) {
+            qCritical() << db.lastError().text();
+            return false;
+        }
+        if (!EventParticipant::drop_all_for_event(db, event.get_id()) || !event.drop(db) || !db.commit()) {
+            qCritical() << db.lastError().text();
+            db.rollback();
+            return false;
+        }
+        return true;
+    }
+
+    bool ShardedStorage::fetch_participant(quint64 event_id, quint64 user_id, std::optional<EventParticipant>& found) {
+        STORAGE_TIMER("sharded", "fetch_participant");
+        return EventParticipant::fetch(shard(event_id), event_id, user_id, found);
+    }
+
+    bool ShardedStorage::create_participant(EventParticipant& participant) {
+        STORAGE_TIMER("sharded", "create_participant");
+        return participant.create(shard(participant.get_event_id()));
+    }
+
+    bool ShardedStorage::drop_participant(EventParticipant& participant) {
+        STORAGE_TIMER("sharded", "drop_participant");
+        return participant.drop(shard(participant.get_event_id()));
+    }
+
+    bool ShardedStorage::enqueue_notifications(Event& event, QVector<Notification>& notifications) {
+        STORAGE_TIMER("sharded", "enqueue_notifications");
+        // Очередь лежит в шарде события: одна транзакция вместе с уровнем.
+        QSqlDatabase& db = shard(event.get_id());
+        if (!db.transaction()) {
+            qCritical() << db.lastError().text();
+            return false;
+        }
+        for (Notification& notification: notifications) {
+            assert(notification.event_id == event.get_id());
+            if (!notification.replace(db)) {
+                db.rollback();
+                return false;
+            }
+        }
+        if (!event.update(db) || !db.commit()) {
+            qCritical() << db.lastError().text();
+            db.rollback();
+            return false;
+        }
+        return true;
+    }
+
+    bool ShardedStorage::fetch_ready_notifications(quint64 now, int limit, QVector<Notification>& found) {
+        STORAGE_TIMER("sharded", "fetch_ready_notifications");
+        // Из каждого шарда до limit самых давних, из них -- limit общих.
+        found.clear();
+        for (QSqlDatabase& db: shards_) {
+            QVector<Notification> notifications;
+            if (!Notification::fetch_ready(db, now, limit, notifications)) {
+                return false;
+            }
+            found.append(std::move(notifications));
+        }
+        std::sort(found.begin(), found.end(), [](const Notification& a, const Notification& b) {
+            return a.next_attempt_at < b.next_attempt_at;
+        });
+        if (found.size() > limit) {
+            found.resize(limit);
+        }
+        return true;
+    }
+
+    bool ShardedStorage::update_notification(Notification& notification) {
+        STORAGE_TIMER("sharded", "update_notification");
+        return notification.update(shard(notification.event_id));
+    }
+
+    bool ShardedStorage::drop_notification(Notification& notification) {
+        STORAGE_TIMER("sharded", "drop_notification");
+        return notification.drop(shard(notification.event_id));
+    }
+
+    bool ShardedStorage::purge_expired_sessions(quint64 now, int limit, qint64& num_purged) {
+        STORAGE_TIMER("sharded", "purge_expired_sessions");
+        // По шардам по очереди, всего не больше limit.
+        num_purged = 0;
+        for (QSqlDatabase& db: shards_) {
+            if (num_purged >= limit) {
+                break;
+            }
+            qint64 num_deleted = 0;
+            if (!Session::purge_expired(db, now, limit - num_purged, num_deleted)) {
+                return false;
+            }
+            num_purged += num_deleted;
+        }
+        return true;
+    }
+
+    bool ShardedStorage::archive_events(quint64 before, int limit, qint64& num_archived) {
+        STORAGE_TIMER("sharded", "archive_events");
+        num_archived = 0;
+        for (QSqlDatabase& db: shards_) {
+            if (num_archived >= limit) {
+                break;
+            }
+            qint64 num_shard_archived = 0;
+            if (!Event::archive_past(db, before, limit - num_archived, num_shard_archived)) {
+                return false;
+            }
+            num_archived += num_shard_archived;
+        }
+        return true;
+    }
+
+    bool ShardedStorage::vacuum(int max_pages, qint64& num_freed) {
+        STORAGE_TIMER("sharded", "vacuum");
+        num_freed = 0;
+        if (!incremental_vacuum(main_db_, max_pages, num_freed)) {
+            return false;
+        }
+        for (QSqlDatabase& db: shards_) {
+            qint64 num_shard_freed = 0;
+            if (!incremental_vacuum(db, max_pages, num_shard_freed)) {
+                return false;
+            }
+            num_freed += num_shard_freed;
+        }
+        return true;
+    }
+}
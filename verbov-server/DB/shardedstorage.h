@@ -0,0 +1,73 @@
+#ifndef SHARDEDSTORAGE_H
+#define SHARDEDSTORAGE_H
+
+#include <atomic>
+#include <vector>
+
+#include "storage.h"
+
+namespace storage {
+    // Хранилище в нескольких файлах SQLite. У каждого файла свой писатель,
+    // так что процессы (server/workers) пишут в разные шарды одновременно.
+    //
+    // Пользователи -- в основном файле. События и участия -- в шарде
+    // id % N, сессии -- в шарде user_id % N. Ссылка на событие и токен
+    // сессии выбираются так, чтобы по ним самим вычислялся тот же шард:
+    // поиск по ним идет в один файл, а не во все.
+    //
+    // id событий общие на все шарды: шард s выдает только id с остатком s,
+    // поэтому число шардов после создания менять нельзя.
+    class ShardedStorage : public Storage {
+    public:
+        // Соединения должны быть открыты, таблицы созданы, и жить они
+        // должны дольше хранилища.
+        ShardedStorage(QSqlDatabase& main_db, std::vector<QSqlDatabase> shards);
+
+        bool fetch_user(quint64 vk_id, std::optional<User>& found) override;
+        bool fetch_event_users(quint64 event_id, QVector<User>& found) override;
+        bool fetch_participants_page(quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found) override;
+        bool create_user(User& user) override;
+        bool update_user(User& user) override;
+
+        bool fetch_session(QStringView token, std::optional<Session>& found) override;
+        bool create_session(Session& session) override;
+
+        bool fetch_event(quint64 id, std::optional<Event>& found) override;
+        bool fetch_event_by_refer(const QString& refer, std::optional<Event>& found) override;
+        bool fetch_events_for_user(quint64 user_id, QVector<Event>& found) override;
+        bool fetch_events_history_for_user(quint64 user_id, QVector<Event>& found) override;
+        bool fetch_events_due(int level, quint64 after, quint64 until, int limit, QVector<Event>& found) override;
+        bool create_event(Event& event) override;
+        bool update_event(Event& event) override;
+        bool drop_event(Event& event) override;
+
+        bool fetch_participant(quint64 event_id, quint64 user_id, std::optional<EventParticipant>& found) override;
+        bool create_participant(EventParticipant& participant) override;
+        bool drop_participant(EventParticipant& participant) override;
+
+        bool enqueue_notifications(Event& event, QVector<Notification>& notifications) override;
+        bool fetch_ready_notifications(quint64 now, int limit, QVector<Notification>& found) override;
+        bool update_notification(Notification& notification) override;
+        bool drop_notification(Notification& notification) override;
+
+        bool purge_expired_sessions(quint64 now, int limit, qint64& num_purged) override;
+        bool archive_events(quint64 before, int limit, qint64& num_archived) override;
+        bool vacuum(int max_pages, qint64& num_freed) override;
+
+        // Открывает шарды рядом с основным файлом: db.sqlite3 ->
+        // db.shard0.sqlite3, db.shard1.sqlite3, ... и создает в них таблицы.
+        static bool open_shards(const QString& main_path, int num_shards, std::vector<QSqlDatabase>& shards);
+    private:
+        QSqlDatabase& shard(quint64 id) { return shards_[id % shards_.size()]; }
+        // Шард по первым символам строки: у ссылок -- буквы, у токенов --
+        // шестнадцатеричные цифры.
+        int shard_of(QStringView text) const;
+
+        QSqlDatabase& main_db_;
+        std::vector<QSqlDatabase> shards_;
+        // Шард для следующего события.
+        std::atomic<quint64> next_shard_ = 0;
+    };
+}
+
+#endif // SHARDEDSTORAGE_H
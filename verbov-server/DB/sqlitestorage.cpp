@@ -0,0 +1,158 @@
+#include "sqlitestorage.h"
+
+#include <QDebug>
+#include <QSqlError>
+
+namespace storage {
+    bool SqliteStorage::fetch_user(quint64 vk_id, std::optional<User>& found) {
+        STORAGE_TIMER("sqlite", "fetch_user");
+        return User::fetch_by_vk_id(db_, vk_id, found);
+    }
+
+    bool SqliteStorage::fetch_event_users(quint64 event_id, QVector<User>& found) {
+        STORAGE_TIMER("sqlite", "fetch_event_users");
+        return User::fetch_by_event_id(db_, event_id, found);
+    }
+
+    bool SqliteStorage::fetch_participants_page(quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found) {
+        STORAGE_TIMER("sqlite", "fetch_participants_page");
+        return User::fetch_page_by_event_id(db_, event_id, after_vk_id, limit, found);
+    }
+
+    bool SqliteStorage::create_user(User& user) {
+        STORAGE_TIMER("sqlite", "create_user");
+        return user.create(db_);
+    }
+
+    bool SqliteStorage::update_user(User& user) {
+        STORAGE_TIMER("sqlite", "update_user");
+        return user.update(db_);
+    }
+
+    bool SqliteStorage::fetch_session(QStringView token, std::optional<Session>& found) {
+        STORAGE_TIMER("sqlite", "fetch_session");
+        return Session::fetch_by_token(db_, token, found);
+    }
+
+    bool SqliteStorage::create_session(Session& session) {
+        STORAGE_TIMER("sqlite", "create_session");
+        return session.generate_token(db_) && session.create(db_);
+    }
+
+    bool SqliteStorage::fetch_event(quint64 id, std::optional<Event>& found) {
+        STORAGE_TIMER("sqlite", "fetch_event");
+        return Event::fetch_by_id(db_, id, found);
+    }
+
+    bool SqliteStorage::fetch_event_by_refer(const QString& refer, std::optional<Event>& found) {
+        STORAGE_TIMER("sqlite", "fetch_event_by_refer");
+        return Event::fetch_by_refer(db_, refer, found);
+    }
+
+    bool SqliteStorage::fetch_events_for_user(quint64 user_id, QVector<Event>& found) {
+        STORAGE_TIMER("sqlite", "fetch_events_for_user");
+        return Event::fetch_all_for_user(db_, user_id, found);
+    }
+
+    bool SqliteStorage::fetch_events_history_for_user(quint64 user_id, QVector<Event>& found) {
+        STORAGE_TIMER("sqlite", "fetch_events_history_for_user");
+        return Event::fetch_history_for_user(db_, user_id, found);
+    }
+
+    bool SqliteStorage::fetch_events_due(int level, quint64 after, quint64 until, int limit, QVector<Event>& found) {
+        STORAGE_TIMER("sqlite", "fetch_events_due");
+        return Event::fetch_due(db_, level, after, until, limit, found);
+    }
+
+    bool SqliteStorage::create_event(Event& event) {
+        STORAGE_TIMER("sqlite", "create_event");
+        return event.generate_refer(db_) && event.create(db_);
+    }
+
+    bool SqliteStorage::update_event(Event& event) {
+        STORAGE_TIMER("sqlite", "update_event");
+        return event.update(db_);
+    }
+
+    bool SqliteStorage::drop_event(Event& event) {
+        STORAGE_TIMER("sqlite", "drop_event");
+        // Участия удаляем сами: PRAGMA foreign_keys нигде не включен, так что
+        // ON DELETE CASCADE не срабатывает. Строки очереди уведомлений
+        // отправка выбросит сама, не найдя события.
+        if (!db_.transaction()) {
+            qCritical() << db_.lastError().text();
+            return false;
+        }
+        if (!EventParticipant::drop_all_for_event(db_, event.get_id()) || !event.drop(db_) || !db_.commit()) {
+            qCritical() << db_.lastError().text();
+            db_.rollback();
+            return false;
+        }
+        return true;
+    }
+
+    bool SqliteStorage::fetch_participant(quint64 event_id, quint64 user_id, std::optional<EventParticipant>& found) {
+        STORAGE_TIMER("sqlite", "fetch_participant");
+        return EventParticipant::fetch(db_, event_id, user_id, found);
+    }
+
+    bool SqliteStorage::create_participant(EventParticipant& participant) {
+        STORAGE_TIMER("sqlite", "create_participant");
+        return participant.create(db_);
+    }
+
+    bool SqliteStorage::drop_participant(EventParticipant& participant) {
+        STORAGE_TIMER("sqlite", "drop_participant");
+        return participant.drop(db_);
+    }
+
+    bool SqliteStorage::enqueue_notifications(Event& event, QVector<Notification>& notifications) {
+        STORAGE_TIMER("sqlite", "enqueue_notifications");
+        if (!db_.transaction()) {
+            qCritical() << db_.lastError().text();
+            return false;
+        }
+        for (Notification& notification: notifications) {
+            if (!notification.replace(db_)) {
+                db_.rollback();
+                return false;
+            }
+        }
+        if (!event.update(db_) || !db_.commit()) {
+            qCritical() << db_.lastError().text();
+            db_.rollback();
+            return false;
+        }
+        return true;
+    }
+
+    bool SqliteStorage::fetch_ready_notifications(quint64 now, int limit, QVector<Notification>& found) {
+        STORAGE_TIMER("sqlite", "fetch_ready_notifications");
+        return Notification::fetch_ready(db_, now, limit, found);
+    }
+
+    bool SqliteStorage::update_notification(Notification& notification) {
+        STORAGE_TIMER("sqlite", "update_notification");
+        return notification.update(db_);
+    }
+
+    bool SqliteStorage::drop_notification(Notification& notification) {
+        STORAGE_TIMER("sqlite", "drop_notification");
+        return notification.drop(db_);
+    }
+
+    bool SqliteStorage::purge_expired_sessions(quint64 now, int limit, qint64& num_purged) {
+        STORAGE_TIMER("sqlite", "purge_expired_sessions");
+        return Session::purge_expired(db_, now, limit, num_purged);
+    }
+
+    bool SqliteStorage::archive_events(quint64 before, int limit, qint64& num_archived) {
+        STORAGE_TIMER("sqlite", "archive_events");
+        return Event::archive_past(db_, before, limit, num_archived);
+    }
+
+    bool SqliteStorage::vacuum(int max_pages, qint64& num_freed) {
+        STORAGE_TIMER("sqlite", "vacuum");
+        return incremental_vacuum(db_, max_pages, num_freed);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef SQLITESTORAGE_H
+#define SQLITESTORAGE_H
+
+#include "storage.h"
+
+namespace storage {
+    // Хранилище в SQLite: обертка над методами сущностей.
+    class SqliteStorage : public Storage {
+    public:
+        // Соединение должно жить дольше хранилища. К нему должен быть
+        // подключен архив (attach_archive).
+        explicit SqliteStorage(QSqlDatabase& db)
+            : db_(db) {}
+
+        bool fetch_user(quint64 vk_id, std::optional<User>& found) override;
+        bool fetch_event_users(quint64 event_id, QVector<User>& found) override;
+        bool fetch_participants_page(quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found) override;
+        bool create_user(User& user) override;
+        bool update_user(User& user) override;
+
+        bool fetch_session(QStringView token, std::optional<Session>& found) override;
+        bool create_session(Session& session) override;
+
+        bool fetch_event(quint64 id, std::optional<Event>& found) override;
+        bool fetch_event_by_refer(const QString& refer, std::optional<Event>& found) override;
+        bool fetch_events_for_user(quint64 user_id, QVector<Event>& found) override;
+        bool fetch_events_history_for_user(quint64 user_id, QVector<Event>& found) override;
+        bool fetch_events_due(int level, quint64 after, quint64 until, int limit, QVector<Event>& found) override;
+        bool create_event(Event& event) override;
+        bool update_event(Event& event) override;
+        bool drop_event(Event& event) override;
+
+        bool fetch_participant(quint64 event_id, quint64 user_id, std::optional<EventParticipant>& found) override;
+        bool create_participant(EventParticipant& participant) override;
+        bool drop_participant(EventParticipant& participant) override;
+
+        bool enqueue_notifications(Event& event, QVector<Notification>& notifications) override;
+        bool fetch_ready_notifications(quint64 now, int limit, QVector<Notification>& found) override;
+        bool update_notification(Notification& notification) override;
+        bool drop_notification(Notification& notification) override;
+
+        bool purge_expired_sessions(quint64 now, int limit, qint64& num_purged) override;
+        bool archive_events(quint64 before, int limit, qint64& num_archived) override;
+        bool vacuum(int max_pages, qint64& num_freed) override;
+
+        QSqlDatabase* sql() override { return &db_; }
+    private:
+        QSqlDatabase& db_;
+    };
+}
+
+#endif // SQLITESTORAGE_H
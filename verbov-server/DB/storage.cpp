@@ -0,0 +1,294 @@
+#include "storage.h"
+
+#include <algorithm>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSqlError>
+#include <QSqlQuery>
+
+QString storage::sibling_path(const QString& path, const QString& tag) {
+    const QFileInfo info(path);
+    return info.dir().filePath(info.completeBaseName() + "." + tag + "." + info.suffix());
+}
+
+bool storage::attach_archive(QSqlDatabase& db, const QString& archive_path) {
+    {
+        // Таблицы создаем отдельным соединением: CREATE TABLE без имени
+        // базы в db создал бы их в main.
+        QSqlDatabase archive = QSqlDatabase::addDatabase("QSQLITE", archive_path);
+        archive.setDatabaseName(archive_path);
+        if (!archive.open()) {
+            qCritical() << "failed to open archive" << archive_path << ":" << archive.lastError().text();
+            return false;
+        }
+        QSqlQuery wal_query(archive);
+        if (!wal_query.exec("PRAGMA journal_mode=WAL")) {
+            qCritical() << wal_query.lastError().text();
+        }
+        wal_query.finish();
+        const bool ok = Event::check_table(archive) && EventParticipant::check_table(archive);
+        archive.close();
+        if (!ok) {
+            return false;
+        }
+    }
+    QSqlDatabase::removeDatabase(archive_path);
+
+    QSqlQuery query(db);
+    return schema::open(query, "ATTACH DATABASE ? AS archive", {archive_path});
+}
+
+bool storage::prepare_incremental_vacuum(QSqlDatabase& db) {
+    qint64 mode = 0;
+    qint64 num_tables = 0;
+    if (!schema::count(db, "PRAGMA auto_vacuum", {}, mode)
+        || !schema::count(db, "SELECT COUNT(*) FROM sqlite_master", {}, num_tables)) {
+        return false;
+    }
+    // 2 -- INCREMENTAL.
+    if (mode == 2) {
+        return true;
+    }
+
+    if (num_tables == 0) {
+        // В пустом файле режим меняется сразу, без VACUUM.
+        QSqlQuery query(db);
+        if (!query.exec("PRAGMA auto_vacuum = INCREMENTAL")) {
+            qCritical() << query.lastError().text();
+            return false;
+        }
+        return true;
+    }
+
+    qWarning() << db.databaseName() << "is not in incremental auto-vacuum mode, freed pages stay in the file."
+               << "Stop the server and run verbov-server --enable-incremental-vacuum once.";
+    return true;
+}
+
+bool storage::enable_incremental_vacuum(QSqlDatabase& db) {
+    qint64 mode = 0;
+    if (!schema::count(db, "PRAGMA auto_vacuum", {}, mode)) {
+        return false;
+    }
+    // 2 -- INCREMENTAL.
+    if (mode == 2) {
+        qInfo() << db.databaseName() << "is already in incremental auto-vacuum mode";
+        return true;
+    }
+
+    // Режим меняется только вместе с VACUUM: файл переписывается целиком.
+    qInfo() << "Switching" << db.databaseName() << "to incremental auto-vacuum";
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA auto_vacuum = INCREMENTAL") || !query.exec("VACUUM")) {
+        qCritical() << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool storage::incremental_vacuum(QSqlDatabase& db, int max_pages, qint64& num_freed) {
+    qint64 free_before = 0;
+    qint64 free_after = 0;
+    if (!schema::count(db, "PRAGMA freelist_count", {}, free_before)) {
+        return false;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA incremental_vacuum(" + QString::number(max_pages) + ")")) {
+        qCritical() << query.lastError().text();
+        return false;
+    }
+
+    if (!schema::count(db, "PRAGMA freelist_count", {}, free_after)) {
+        return false;
+    }
+    num_freed = std::max<qint64>(free_before - free_after, 0);
+    return true;
+}
+
+#define CHECK(expr) if (!(expr)) { return false; }
+bool storage::run_tests(Storage& storage) {
+    User host(11);
+    host.first_name = "Ярослав";
+    host.last_name = "Вербов";
+    host.set_password(QString("234"));
+    CHECK(storage.create_user(host));
+    CHECK(!storage.create_user(host));
+
+    User guest(12);
+    guest.first_name = "Гость";
+    guest.last_name = "Гостев";
+    guest.set_password(QString("345"));
+    CHECK(storage.create_user(guest));
+
+    std::optional<User> user_from_storage;
+    CHECK(storage.fetch_user(host.get_vk_id(), user_from_storage));
+    CHECK(user_from_storage.has_value() && user_from_storage.value() == host);
+
+    host.reg_confirmed = true;
+    CHECK(storage.update_user(host));
+    CHECK(storage.fetch_user(host.get_vk_id(), user_from_storage));
+    CHECK(user_from_storage.value() == host);
+
+    // Сессия получает токен и id от хранилища.
+    Session session;
+    session.user_id = host.get_vk_id();
+    session.set_time_started();
+    CHECK(storage.create_session(session));
+    CHECK(session.get_id() != 0 && session.token.size() == 64);
+
+    std::optional<Session> session_from_storage;
+    CHECK(storage.fetch_session(session.token, session_from_storage));
+    CHECK(session_from_storage.has_value() && session_from_storage.value() == session);
+    CHECK(storage.fetch_session(QString("hehe№haha?"), session_from_storage));
+    CHECK(!session_from_storage.has_value());
+
+    // Истекшая сессия удаляется, живая остается.
+    Session stale;
+    stale.user_id = host.get_vk_id();
+    stale.start_time = 1;
+    CHECK(storage.create_session(stale));
+    qint64 num_purged = 0;
+    CHECK(storage.purge_expired_sessions(QDateTime::currentSecsSinceEpoch(), 100, num_purged));
+    CHECK(num_purged == 1);
+    CHECK(storage.fetch_session(stale.token, session_from_storage));
+    CHECK(!session_from_storage.has_value());
+    CHECK(storage.fetch_session(session.token, session_from_storage));
+    CHECK(session_from_storage.has_value());
+
+    // Событие получает ссылку и id от хранилища.
+    const quint64 now = QDateTime::currentSecsSinceEpoch();
+    Event event;
+    event.name = "Тест";
+    event.creator_user_id = host.get_vk_id();
+    event.timestamp = now + 60 * 60;
+    CHECK(storage.create_event(event));
+    CHECK(event.get_id() != 0 && event.refer_str.size() == 9);
+
+    std::optional<Event> event_from_storage;
+    CHECK(storage.fetch_event_by_refer(event.refer_str, event_from_storage));
+    CHECK(event_from_storage.has_value() && event_from_storage.value() == event);
+
+    EventParticipant participant(event.get_id(), guest.get_vk_id());
+    participant.registered_time = now;
+    CHECK(storage.create_participant(participant));
+    CHECK(!storage.create_participant(participant));
+
+    std::optional<EventParticipant> participant_from_storage;
+    CHECK(storage.fetch_participant(event.get_id(), guest.get_vk_id(), participant_from_storage));
+    CHECK(participant_from_storage.has_value() && participant_from_storage.value() == participant);
+
+    QVector<Event> events;
+    CHECK(storage.fetch_events_for_user(guest.get_vk_id(), events));
+    CHECK(events.size() == 1 && events[0] == event);
+    CHECK(storage.fetch_events_for_user(host.get_vk_id(), events));
+    CHECK(events.size() == 1);
+
+    QVector<UserBrief> page;
+    CHECK(storage.fetch_participants_page(event.get_id(), 0, 10, page));
+    CHECK(page.size() == 1 && page[0].vk_id == guest.get_vk_id() && page[0].first_name == guest.first_name);
+    CHECK(storage.fetch_participants_page(event.get_id(), guest.get_vk_id(), 10, page));
+    CHECK(page.isEmpty());
+
+    QVector<User> users;
+    CHECK(storage.fetch_event_users(event.get_id(), users));
+    CHECK(users.size() == 1 && users[0] == guest);
+
+    // Уведомление "остался час": событие в (now + 20 минут, now + час].
+    CHECK(storage.fetch_events_due(5, now + 20 * 60, now + 60 * 60, 10, events));
+    CHECK(events.size() == 1);
+    // Самые близкие первыми, не больше limit.
+    Event sooner;
+    sooner.name = "Скоро";
+    sooner.creator_user_id = host.get_vk_id();
+    sooner.timestamp = now + 30 * 60;
+    CHECK(storage.create_event(sooner));
+    CHECK(storage.fetch_events_due(5, now + 20 * 60, now + 60 * 60, 10, events));
+    CHECK(events.size() == 2 && events[0] == sooner && events[1] == event);
+    CHECK(storage.fetch_events_due(5, now + 20 * 60, now + 60 * 60, 1, events));
+    CHECK(events.size() == 1 && events[0] == sooner);
+    CHECK(storage.drop_event(sooner));
+    event.last_notification_level = 5;
+    CHECK(storage.update_event(event));
+    CHECK(storage.fetch_events_due(5, now + 20 * 60, now + 60 * 60, 10, events));
+    CHECK(events.isEmpty());
+
+    // Очередь уведомлений: сообщения и новый уровень сохраняются вместе.
+    QVector<Notification> outbox = {
+        Notification(event.get_id(), event.timestamp, 6, host.get_vk_id(), "Начинается"),
+        Notification(event.get_id(), event.timestamp, 6, guest.get_vk_id(), "Начинается"),
+    };
+    outbox[0].next_attempt_at = now;
+    outbox[1].next_attempt_at = now + 10;
+    event.last_notification_level = 6;
+    CHECK(storage.enqueue_notifications(event, outbox));
+    CHECK(outbox[0].get_id() != 0 && outbox[1].get_id() != 0);
+    CHECK(storage.fetch_event(event.get_id(), event_from_storage));
+    CHECK(event_from_storage.has_value() && event_from_storage->last_notification_level == 6);
+    // Событие перенесли: напоминание того же уровня о новом времени
+    // заменяет прежнее и уходит с другим random_id.
+    event.timestamp += 60;
+    QVector<Notification> moved = {Notification(event.get_id(), event.timestamp, 6, host.get_vk_id(), "Перенесено")};
+    moved[0].next_attempt_at = now;
+    CHECK(storage.enqueue_notifications(event, moved));
+    CHECK(moved[0].get_id() != outbox[0].get_id() && moved[0].random_id != outbox[0].random_id);
+    outbox[0] = moved[0];
+
+    QVector<Notification> ready;
+    CHECK(storage.fetch_ready_notifications(now, 10, ready));
+    CHECK(ready.size() == 1 && ready[0] == outbox[0]);
+    CHECK(storage.fetch_ready_notifications(now + 10, 1, ready));
+    CHECK(ready.size() == 1 && ready[0] == outbox[0]);
+
+    outbox[0].attempts = 1;
+    outbox[0].next_attempt_at = now + 20;
+    CHECK(storage.update_notification(outbox[0]));
+    CHECK(storage.fetch_ready_notifications(now + 20, 10, ready));
+    CHECK(ready.size() == 2 && ready[0] == outbox[1] && ready[1] == outbox[0]);
+
+    CHECK(storage.drop_notification(outbox[0]));
+    CHECK(storage.drop_notification(outbox[1]));
+    CHECK(outbox[0].get_id() == 0);
+    CHECK(storage.fetch_ready_notifications(now + 20, 10, ready));
+    CHECK(ready.isEmpty());
+
+    CHECK(storage.drop_participant(participant));
+    CHECK(storage.fetch_events_for_user(guest.get_vk_id(), events));
+    CHECK(events.isEmpty());
+
+    // Событие удаляется вместе с участиями.
+    CHECK(storage.create_participant(participant));
+    const quint64 dropped_id = event.get_id();
+    CHECK(storage.drop_event(event));
+    CHECK(event.get_id() == 0);
+    CHECK(storage.fetch_event_by_refer(event.refer_str, event_from_storage));
+    CHECK(!event_from_storage.has_value());
+    CHECK(storage.fetch_participant(dropped_id, guest.get_vk_id(), participant_from_storage));
+    CHECK(!participant_from_storage.has_value());
+
+    // Прошедшее событие уходит в архив и видно только в истории.
+    Event past;
+    past.name = "Было";
+    past.creator_user_id = host.get_vk_id();
+    past.timestamp = now - 60 * 60;
+    CHECK(storage.create_event(past));
+    EventParticipant past_participant(past.get_id(), guest.get_vk_id());
+    past_participant.registered_time = now - 2 * 60 * 60;
+    CHECK(storage.create_participant(past_participant));
+
+    qint64 num_archived = 0;
+    CHECK(storage.archive_events(now, 100, num_archived));
+    CHECK(storage.fetch_events_history_for_user(guest.get_vk_id(), events));
+    CHECK(events.size() == 1 && events[0] == past);
+    CHECK(storage.fetch_events_for_user(guest.get_vk_id(), events));
+    // Хранилище без архива ничего не переносит.
+    CHECK(events.size() == (num_archived == 1 ? 0 : 1));
+    CHECK(storage.archive_events(now, 100, num_archived));
+    CHECK(num_archived == 0);
+
+    return true;
+}
+#undef CHECK
@@ -0,0 +1,120 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <optional>
+
+#include <QString>
+#include <QStringView>
+#include <QVector>
+#include <QtSql/QSqlDatabase>
+
+#include "event.h"
+#include "eventparticipant.h"
+#include "notification.h"
+#include "session.h"
+#include "user.h"
+
+#include "metrics.h"
+
+// Хранилище сущностей: все, что обработчикам и рассылке нужно от БД.
+//
+// SqliteStorage ходит в SQLite через методы сущностей, MemoryStorage
+// держит все в памяти. Семантика та же, что у SQL: не нашлось -- found
+// пуст и это успех, update несуществующей строки -- успех без изменений,
+// create существующей -- ошибка.
+namespace storage {
+    class Storage {
+    public:
+        virtual ~Storage() = default;
+
+        // Пользователи.
+        virtual bool fetch_user(quint64 vk_id, std::optional<User>& found) = 0;
+        // Участники события целиком, для рассылки.
+        virtual bool fetch_event_users(quint64 event_id, QVector<User>& found) = 0;
+        // Страница участников события по возрастанию vk_id после after_vk_id.
+        virtual bool fetch_participants_page(quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found) = 0;
+        virtual bool create_user(User& user) = 0;
+        virtual bool update_user(User& user) = 0;
+
+        // Сессии. create_session генерирует свободный токен, если его еще
+        // нет, и назначает id.
+        virtual bool fetch_session(QStringView token, std::optional<Session>& found) = 0;
+        virtual bool create_session(Session& session) = 0;
+
+        // События. create_event генерирует свободный refer_str и назначает id.
+        virtual bool fetch_event(quint64 id, std::optional<Event>& found) = 0;
+        virtual bool fetch_event_by_refer(const QString& refer, std::optional<Event>& found) = 0;
+        // Которые пользователь создал или где он участник. Только еще не
+        // перенесенные в архив.
+        virtual bool fetch_events_for_user(quint64 user_id, QVector<Event>& found) = 0;
+        // То же вместе с архивом.
+        virtual bool fetch_events_history_for_user(quint64 user_id, QVector<Event>& found) = 0;
+        // До limit ждущих уведомления уровня level: last_notification_level < level
+        // и timestamp в (after, until], по возрастанию timestamp, затем id.
+        virtual bool fetch_events_due(int level, quint64 after, quint64 until, int limit, QVector<Event>& found) = 0;
+        virtual bool create_event(Event& event) = 0;
+        virtual bool update_event(Event& event) = 0;
+        // Вместе с участиями в событии.
+        virtual bool drop_event(Event& event) = 0;
+
+        // Участия в событиях.
+        virtual bool fetch_participant(quint64 event_id, quint64 user_id, std::optional<EventParticipant>& found) = 0;
+        virtual bool create_participant(EventParticipant& participant) = 0;
+        virtual bool drop_participant(EventParticipant& participant) = 0;
+
+        // Очередь уведомлений. enqueue_notifications атомарно кладет
+        // сообщения в очередь (назначая им id) и сохраняет событие с новым
+        // last_notification_level: либо и то и другое, либо ничего.
+        // Строка с тем же (event_id, level, recipient_vk_id), оставшаяся от
+        // прежнего времени события, заменяется новой.
+        virtual bool enqueue_notifications(Event& event, QVector<Notification>& notifications) = 0;
+        // До limit сообщений с next_attempt_at <= now по возрастанию next_attempt_at.
+        virtual bool fetch_ready_notifications(quint64 now, int limit, QVector<Notification>& found) = 0;
+        virtual bool update_notification(Notification& notification) = 0;
+        virtual bool drop_notification(Notification& notification) = 0;
+
+        // Обслуживание. Удаляет до limit сессий, истекших к now.
+        virtual bool purge_expired_sessions(quint64 now, int limit, qint64& num_purged) = 0;
+        // Переносит до limit событий с timestamp < before в архив. Хранилище
+        // без архива держит все события вместе.
+        virtual bool archive_events(quint64 before, int limit, qint64& num_archived) { num_archived = 0; return true; }
+        // Отдает ОС до max_pages свободных страниц файлов БД. Хранилищу
+        // без файлов нечего отдавать.
+        virtual bool vacuum(int max_pages, qint64& num_freed) { num_freed = 0; return true; }
+
+        // Соединение SQLite для потоковой отдачи из снимка БД.
+        // nullptr, если хранилище не SQLite: тогда списки отдаются целиком.
+        virtual QSqlDatabase* sql() { return nullptr; }
+    };
+
+    // Файл рядом с path: db.sqlite3, "archive" -> db.archive.sqlite3.
+    QString sibling_path(const QString& path, const QString& tag);
+    // Создает в archive_path таблицы событий и участий той же схемы и
+    // подключает файл к db как archive.
+    bool attach_archive(QSqlDatabase& db, const QString& archive_path);
+
+    // При открытии: новый пустой файл сразу переводит в auto_vacuum=INCREMENTAL,
+    // чтобы vacuum мог возвращать свободные страницы. Про старый файл в другом
+    // режиме только предупреждает -- его перевод переписывает файл целиком.
+    bool prepare_incremental_vacuum(QSqlDatabase& db);
+    // Переводит файл в auto_vacuum=INCREMENTAL через VACUUM. Долго для большого
+    // файла и мешает другим соединениям, так что только отдельной командой
+    // (verbov-server --enable-incremental-vacuum) при остановленном сервере.
+    bool enable_incremental_vacuum(QSqlDatabase& db);
+    // PRAGMA incremental_vacuum: до max_pages страниц, num_freed -- сколько вышло.
+    bool incremental_vacuum(QSqlDatabase& db, int max_pages, qint64& num_freed);
+
+    // Проверки, общие для всех реализаций. Хранилище должно быть пустым.
+    bool run_tests(Storage& storage);
+}
+
+// Время операции хранилища, например STORAGE_TIMER("memory", "fetch_user").
+// Рядом с verbov_sql_duration_seconds показывает, сколько занимает само
+// хранилище, а сколько -- разбор строк и остальное.
+#define STORAGE_TIMER(engine, operation) \
+    static const metrics::Histogram storage_duration_histogram = metrics::histogram( \
+        "verbov_storage_duration_seconds", "Storage operation duration by engine and operation.", \
+        {{"engine", engine}, {"operation", operation}}); \
+    metrics::ScopedTimer storage_duration_timer(storage_duration_histogram)
+
+#endif // STORAGE_H
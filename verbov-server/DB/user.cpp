@@ -9,7 +9,8 @@
 
 #include "eventparticipant.h"
 
-const char User::table_name[] = "Users";
+#include "metrics.h"
+#include "trace.h"
 
 // Shouldn't use QString here.
 // clazy complains it's a global static non-POD objeect.
@@ -74,6 +75,7 @@ bool User::run_tests(QSqlDatabase& test_db) {
 #undef CHECK
 
 static QString hash_password(const QStringView password) {
+    TRACE_SPAN("User::hash_password", "crypto");
     // QCryptographicHash docs: https://doc.qt.io/qt-5/qcryptographichash.html
     QCryptographicHash hash(QCryptographicHash::Algorithm::Sha3_256);
     hash.addData(password.toUtf8());
@@ -81,146 +83,66 @@ static QString hash_password(const QStringView password) {
     return hash.result().toHex();
 }
 
-bool User::unpack_from_query(QSqlQuery& query) {
-    // Unpack a returned user. First row is extracted.
-    bool right_variant = true;
-    vk_id = query.value("vk_id").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    first_name = query.value("first_name").toString();
-    last_name = query.value("last_name").toString();
-
-    right_variant = true;
-    vk_id = query.value("vk_id").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    reg_confirmed = query.value("reg_confirmed").toBool();
-
-    right_variant = true;
-    reg_code = query.value("reg_code").toULongLong(&right_variant);
-    if (!right_variant) {
-        // Some programming or db error, treat as a failed query.
-        return false;
-    }
-
-    password_hash = query.value("password_hash").toString();
-
-    return true;
-}
-void User::pack_into_query(QSqlQuery& query) const {
-    query.bindValue(":first_name", first_name);
-    query.bindValue(":last_name", last_name);
-    query.bindValue(":vk_id", vk_id);
-    query.bindValue(":reg_confirmed", reg_confirmed);
-    query.bindValue(":reg_code", reg_code);
-    query.bindValue(":password_hash", password_hash);
+bool User::unpack_from_query(QSqlQuery& query, int first_column) {
+    // Unpack a returned user. Current row is extracted.
+    // Порядок колонок -- как в schema::Table<User>::fields.
+    return schema::unpack(query, *this, first_column);
 }
 
 bool User::check_table(QSqlDatabase& db) {
-    // QSqlQuery docs: https://doc.qt.io/qt-6/sql-sqlstatements.html
-    QSqlQuery query(db);
-
-    // SQL LIKE operator. https://www.w3schools.com/sql/sql_like.asp
-    // Turns out ids in sqlite start from 1. That's great.
-    //   https://stackoverflow.com/questions/692856/set-start-value-for-autoincrement-in-sqlite
-    //   The initial value for SQLITE_SEQUENCE.seq must be null or 0. But from tests seems like ids
-    //   start from 1.
-    //   https://stackoverflow.com/a/9053277
-    // We have to write NOT NULL at PRIMARY KEYS of not integer type for sqlite due to a bug.
-    //   https://stackoverflow.com/a/64778551
-    if (!query.prepare(
-        "CREATE TABLE IF NOT EXISTS " + QString(table_name) + "("
-        "vk_id         INTEGER     NOT NULL PRIMARY KEY CHECK(vk_id >= 1),"
-        "first_name    VARCHAR(64) NOT NULL             CHECK(first_name != ''),"
-        "last_name     VARCHAR(64) NOT NULL             CHECK(last_name != ''),"
-        "reg_confirmed BOOL        NOT NULL,"
-        "reg_code      INTEGER     NOT NULL             CHECK(reg_code >= 0),"
-        "password_hash VARCHAR(64) NOT NULL             CHECK(LENGTH(password_hash) = 64)"
-    ");")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    return true;
+    // Текст CREATE TABLE собирается из schema::Table<User>.
+    return schema::create_table<User>(db);
 }
 
 bool User::fetch_by_vk_id(QSqlDatabase& db, quint64 vk_id, std::optional<User>& found_user) {
-    // Almost ctrl-c + ctrl-v from code for retrieval by id.
+    SQL_TIMER("User::fetch_by_vk_id");
+    TRACE_SPAN("User::fetch_by_vk_id", "db");
     // Query one row by an unique column.
+    return schema::fetch_one(db, schema::text<schema::select_by_key<User>>(), {QVariant::fromValue(vk_id)}, found_user);
+}
 
-    User user;
-    QSqlQuery query(db);
-
-    if (!query.prepare("SELECT * FROM " + QString(table_name) + " WHERE vk_id = :vk_id")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":vk_id", vk_id);
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
+bool User::fetch_by_event_id(QSqlDatabase& db, quint64 event_id, QVector<User>& found_users) {
+    SQL_TIMER("User::fetch_by_event_id");
+    TRACE_SPAN("User::fetch_by_event_id", "db");
+    static constexpr auto sql = schema::sql<
+        schema::select<User>, " WHERE vk_id IN (SELECT user_id FROM ",
+        schema::FixedString(EventParticipant::table_name), " WHERE event_id = ?)">;
+    return schema::fetch_all(db, schema::text<sql>(), {QVariant::fromValue(event_id)}, found_users);
+}
 
-    if (!query.first()) {
-        // Haven't found anything. But the query is successful.
-        found_user.reset();
-        return true;
-    }
+// Страница участников: JOIN по первичному ключу участий, без OFFSET.
+static constexpr auto page_by_event_from = schema::sql<
+    " FROM ", schema::FixedString(EventParticipant::table_name), " p "
+    "JOIN ", schema::FixedString(User::table_name), " u ON u.vk_id = p.user_id "
+    "WHERE p.event_id = ? AND p.user_id > ? "
+    "ORDER BY p.user_id "
+    "LIMIT ?">;
 
-    if (!user.unpack_from_query(query)) {
-        // Failed to unpack. Treat as a failed query.
+bool UserBrief::unpack_from_query(QSqlQuery& query) {
+    bool right_variant = true;
+    vk_id = query.value(0).toULongLong(&right_variant);
+    if (!right_variant) {
+        // Some programming or db error, treat as a failed query.
         return false;
     }
-
-    found_user = std::move(user);
+    first_name = query.value(1).toString();
+    last_name = query.value(2).toString();
 
     return true;
 }
 
-bool User::fetch_by_event_id(QSqlDatabase& db, quint64 event_id, QVector<User>& found_users) {
+bool User::fetch_page_by_event_id(QSqlDatabase& db, quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found_users) {
+    SQL_TIMER("User::fetch_page_by_event_id");
+    TRACE_SPAN("User::fetch_page_by_event_id", "db");
     QSqlQuery query(db);
-
-    if (!query.prepare(
-        "SELECT * FROM " + QString(table_name) + " WHERE vk_id IN ("
-        "SELECT user_id FROM " + EventParticipant::table_name + " WHERE event_id = :event_id"
-    ")")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":event_id", event_id);
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
+    if (!query_page_by_event_id(query, event_id, after_vk_id, limit)) {
         return false;
     }
 
     found_users.clear();
 
-    if (!query.first()) {
-        // Haven't found anything. But the query is successful.
-        return true;
-    }
-
-    do {
-        User user;
+    while (query.next()) {
+        UserBrief user;
 
         if (!user.unpack_from_query(query)) {
             // Failed to unpack. Treat as a failed query.
@@ -228,74 +150,39 @@ bool User::fetch_by_event_id(QSqlDatabase& db, quint64 event_id, QVector<User>&
         }
 
         found_users.push_back(std::move(user));
-    } while (query.next());
+    }
 
     return true;
 }
 
-bool User::create(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
-    if (!query.prepare(
-        "INSERT INTO " + QString(table_name) + "(first_name, last_name, vk_id, reg_confirmed, reg_code, password_hash)"
-        " VALUES (:first_name, :last_name, :vk_id, :reg_confirmed, :reg_code, :password_hash)"
-    )) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    pack_into_query(query);
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }    
+bool User::count_page_by_event_id(QSqlDatabase& db, quint64 event_id, quint64 after_vk_id, int limit, qint64& count) {
+    SQL_TIMER("User::count_page_by_event_id");
+    TRACE_SPAN("User::count_page_by_event_id", "db");
+    static constexpr auto sql = schema::sql<"SELECT COUNT(*) FROM (SELECT 1", page_by_event_from, ")">;
+    return schema::count(db, schema::text<sql>(), {QVariant::fromValue(event_id), QVariant::fromValue(after_vk_id), limit}, count);
+}
 
-    return true;
+bool User::query_page_by_event_id(QSqlQuery& query, quint64 event_id, quint64 after_vk_id, int limit) {
+    static constexpr auto sql = schema::sql<"SELECT u.vk_id, u.first_name, u.last_name", page_by_event_from>;
+    return schema::open(query, schema::text<sql>(), {QVariant::fromValue(event_id), QVariant::fromValue(after_vk_id), limit});
 }
 
+bool User::create(QSqlDatabase& db) {
+    SQL_TIMER("User::create");
+    TRACE_SPAN("User::create", "db");
+    return schema::insert(db, *this);
+}
 
 bool User::update(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
-    if (!query.prepare(
-        "UPDATE " + QString(table_name) + " " +
-        "SET first_name = :first_name, last_name = :last_name, vk_id = :vk_id, reg_confirmed = :reg_confirmed, reg_code = :reg_code, password_hash = :password_hash "
-        "WHERE vk_id = :vk_id"
-    )) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    pack_into_query(query);
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    return true;
+    SQL_TIMER("User::update");
+    TRACE_SPAN("User::update", "db");
+    return schema::update(db, *this);
 }
 
 bool User::drop(QSqlDatabase& db) {
-    QSqlQuery query(db);
-
-    if (!query.prepare("DELETE FROM " + QString(table_name) + " WHERE vk_id = :vk_id")) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-    query.bindValue(":vk_id", QVariant::fromValue(vk_id));
-
-    if (!query.exec()) {
-        // Failed to execute the query.
-        qCritical() << query.lastError().text();
-        return false;
-    }
-
-    return true;
+    SQL_TIMER("User::drop");
+    TRACE_SPAN("User::drop", "db");
+    return schema::remove(db, *this);
 }
 
 void User::set_password(const QStringView password) {
@@ -308,22 +195,27 @@ bool User::check_password(const QStringView input_password) const {
 
 // Хотим уметь посылать клиенту информацию о пользователе.
 
+// Поля и их порядок -- из schema::Table<User>, хеш пароля не передается.
 QDataStream& operator<<(QDataStream& out, const User& entry) {
+    return schema::write(out, entry);
+}
+
+QDataStream& operator>>(QDataStream& in,  User& entry) {
+    return schema::read(in, entry);
+}
+
+QDataStream& operator<<(QDataStream& out, const UserBrief& entry) {
     out << entry.vk_id;
     out << entry.first_name;
     out << entry.last_name;
-    out << entry.reg_confirmed;
-    out << entry.reg_code;
 
     return out;
 }
 
-QDataStream& operator>>(QDataStream& in,  User& entry) {
+QDataStream& operator>>(QDataStream& in,  UserBrief& entry) {
     in >> entry.vk_id;
     in >> entry.first_name;
     in >> entry.last_name;
-    in >> entry.reg_confirmed;
-    in >> entry.reg_code;
 
     return in;
 }
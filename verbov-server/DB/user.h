@@ -3,13 +3,32 @@
 
 #include <cstdint>
 
+#include <QDataStream>
 #include <QString>
 #include <QStringView>
 
 #include <QtSql/QSqlQuery>
 
+#include "schema.h"
+
 class Event;
 
+// Участник события в списке участников: только то, что показывает клиент.
+// Без хеша пароля и кода подтверждения, их незачем читать из БД.
+struct UserBrief {
+    quint64 vk_id = 0;
+    QString first_name;
+    QString last_name;
+
+    // Строка из User::query_page_by_event_id.
+    bool unpack_from_query(QSqlQuery& query);
+
+    bool operator==(const UserBrief& other) const = default;
+};
+
+QDataStream& operator<<(QDataStream& out, const UserBrief& entry);
+QDataStream& operator>>(QDataStream& in,  UserBrief& entry);
+
 class User
 {
 private:
@@ -23,12 +42,14 @@ public:
     QString password_hash;
 public:
     friend class Session; // Needs table_name from here.
-    static const char table_name[];
+    friend struct schema::Table<User>;
+    static constexpr char table_name[] = "Users";
 public:
     // Public static methods.
 
-    bool unpack_from_query(QSqlQuery& query);
-    void pack_into_query(QSqlQuery& query) const;
+    // Читает строку, выбранную с проекцией schema::columns<User>, начиная с колонки
+    // first_column (для JOIN, где колонки сущности идут не первыми).
+    bool unpack_from_query(QSqlQuery& query, int first_column = 0);
 
     // Проверяет, что таблица существует. Если нет, создает.
     static bool check_table(QSqlDatabase& db);
@@ -36,6 +57,14 @@ public:
     static bool run_tests(QSqlDatabase& test_db);
 
     static bool fetch_by_event_id(QSqlDatabase& db, quint64 event_id, QVector<User>& found_users);
+    // Страница участников события по возрастанию vk_id, начиная после after_vk_id.
+    // Keyset-пагинация: идет по индексу первичного ключа (event_id, user_id)
+    // без OFFSET, так что любая страница стоит одинаково.
+    static bool fetch_page_by_event_id(QSqlDatabase& db, quint64 event_id, quint64 after_vk_id, int limit, QVector<UserBrief>& found_users);
+    // Та же страница без загрузки в память: число строк и открытый курсор
+    // (разбирать UserBrief::unpack_from_query). Для потоковой отдачи.
+    static bool count_page_by_event_id(QSqlDatabase& db, quint64 event_id, quint64 after_vk_id, int limit, qint64& count);
+    static bool query_page_by_event_id(QSqlQuery& query, quint64 event_id, quint64 after_vk_id, int limit);
     static bool fetch_by_vk_id(QSqlDatabase& db, quint64 vk_id, std::optional<User>& found_user);
 public:
     // Public plain methods.
@@ -66,5 +95,25 @@ public:
 QDataStream& operator<<(QDataStream& out, const User& entry);
 QDataStream& operator>>(QDataStream& in,  User& entry);
 
+// Порядок полей -- порядок колонок в запросах и порядок в QDataStream.
+// Turns out ids in sqlite start from 1. That's great.
+//   https://stackoverflow.com/questions/692856/set-start-value-for-autoincrement-in-sqlite
+// We have to write NOT NULL at PRIMARY KEYS of not integer type for sqlite due to a bug.
+//   https://stackoverflow.com/a/64778551
+template <>
+struct schema::Table<User> {
+    static constexpr const char* name = User::table_name;
+    static constexpr auto fields = std::make_tuple(
+        schema::field<&User::vk_id>        ("vk_id",         "INTEGER     NOT NULL PRIMARY KEY CHECK(vk_id >= 1)", schema::key),
+        schema::field<&User::first_name>   ("first_name",    "VARCHAR(64) NOT NULL             CHECK(first_name != '')"),
+        schema::field<&User::last_name>    ("last_name",     "VARCHAR(64) NOT NULL             CHECK(last_name != '')"),
+        schema::field<&User::reg_confirmed>("reg_confirmed", "BOOL        NOT NULL"),
+        schema::field<&User::reg_code>     ("reg_code",      "INTEGER     NOT NULL             CHECK(reg_code >= 0)"),
+        // Хеш пароля клиенту не отдаем.
+        schema::field<&User::password_hash>("password_hash", "VARCHAR(64) NOT NULL             CHECK(LENGTH(password_hash) = 64)", schema::not_serialized)
+    );
+    static constexpr auto constraints = schema::FixedString("");
+};
+
 
 #endif // USER_H
@@ -0,0 +1,224 @@
+#include "compression.h"
+
+#include <QDebug>
+#include <QList>
+
+#include <zlib.h>
+#ifdef VERBOV_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "config.h"
+
+namespace compression {
+    // Сколько сжатых байт добавлять в out за один шаг.
+    static constexpr qsizetype out_step = 16 * 1024;
+
+    Encoding negotiate(QByteArrayView accept_encoding) {
+        // Accept-Encoding: gzip;q=0.8, deflate, zstd;q=0, *;q=0.1
+        Encoding best = Encoding::Identity;
+        double best_q = 0;
+
+        // Чем больше, тем лучше при равных q.
+        auto rank = [](Encoding encoding) {
+            switch (encoding) {
+            case Encoding::Zstd:    return 3;
+            case Encoding::Gzip:    return 2;
+            case Encoding::Deflate: return 1;
+            default:                return 0;
+            }
+        };
+
+        auto consider = [&](Encoding encoding, double q) {
+            if (q <= 0) {
+                return;
+            }
+            if (q > best_q || (q == best_q && rank(encoding) > rank(best))) {
+                best = encoding;
+                best_q = q;
+            }
+        };
+
+        for (const QByteArray& item: accept_encoding.toByteArray().split(',')) {
+            const QList<QByteArray> parts = item.split(';');
+            const QByteArray coding = parts[0].trimmed().toLower();
+
+            double q = 1;
+            for (qsizetype i = 1; i < parts.size(); ++i) {
+                const QByteArray param = parts[i].trimmed();
+                if (param.startsWith("q=")) {
+                    bool is_double = false;
+                    q = param.mid(2).toDouble(&is_double);
+                    if (!is_double) {
+                        q = 0;
+                    }
+                }
+            }
+
+            if (coding == "gzip" || coding == "x-gzip") {
+                consider(Encoding::Gzip, q);
+            } else if (coding == "deflate") {
+                consider(Encoding::Deflate, q);
+#ifdef VERBOV_HAVE_ZSTD
+            } else if (coding == "zstd") {
+                consider(Encoding::Zstd, q);
+#endif
+            } else if (coding == "*") {
+                consider(Encoding::Gzip, q);
+            }
+        }
+
+        return best;
+    }
+
+    const char* name(Encoding encoding) {
+        switch (encoding) {
+        case Encoding::Deflate: return "deflate";
+        case Encoding::Gzip:    return "gzip";
+        case Encoding::Zstd:    return "zstd";
+        default:                return "identity";
+        }
+    }
+
+    int level() {
+        // Для zlib 1-9, для zstd 1-19. Быстрые уровни почти не уступают
+        // в размере на наших данных: строки UTF-16 и hex-токены.
+        static const int value = config::integer("compression/level", 6);
+        return value;
+    }
+
+    qint64 min_size() {
+        // Меньше этого заголовки и время на сжатие не окупаются.
+        static const qint64 value = config::integer("compression/min_size", 1024);
+        return value;
+    }
+
+    struct Encoder::State {
+        Encoding encoding = Encoding::Identity;
+        bool ok = false;
+        bool finished = false;
+        bool zlib_initialized = false;
+        z_stream zlib {};
+#ifdef VERBOV_HAVE_ZSTD
+        ZSTD_CCtx* zstd = nullptr;
+#endif
+    };
+
+    Encoder::Encoder(Encoding encoding, int level)
+        : state_(std::make_unique<State>()) {
+        state_->encoding = encoding;
+
+        switch (encoding) {
+        case Encoding::Deflate:
+        case Encoding::Gzip: {
+            // deflate в HTTP -- это поток zlib (RFC 1950), gzip -- заголовок gzip.
+            // https://www.zlib.net/manual.html#Advanced
+            const int window_bits = encoding == Encoding::Gzip ? 15 + 16 : 15;
+            state_->zlib_initialized = deflateInit2(&state_->zlib, qBound(1, level, 9), Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            state_->ok = state_->zlib_initialized;
+            break;
+        }
+#ifdef VERBOV_HAVE_ZSTD
+        case Encoding::Zstd: {
+            state_->zstd = ZSTD_createCCtx();
+            state_->ok = state_->zstd != nullptr
+                && !ZSTD_isError(ZSTD_CCtx_setParameter(state_->zstd, ZSTD_c_compressionLevel, qBound(1, level, 19)));
+            break;
+        }
+#endif
+        default:
+            state_->ok = false;
+            break;
+        }
+
+        if (!state_->ok) {
+            qCritical() << "failed to init" << name(encoding) << "encoder";
+        }
+    }
+
+    Encoder::~Encoder() {
+        switch (state_->encoding) {
+        case Encoding::Deflate:
+        case Encoding::Gzip:
+            if (state_->zlib_initialized) {
+                deflateEnd(&state_->zlib);
+            }
+            break;
+#ifdef VERBOV_HAVE_ZSTD
+        case Encoding::Zstd:
+            ZSTD_freeCCtx(state_->zstd);
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+
+    bool Encoder::push(const char* data, qsizetype size, bool finish, QByteArray& out) {
+        if (!state_->ok || state_->finished) {
+            return false;
+        }
+
+        switch (state_->encoding) {
+        case Encoding::Deflate:
+        case Encoding::Gzip: {
+            z_stream& zlib = state_->zlib;
+            zlib.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            zlib.avail_in = static_cast<uInt>(size);
+
+            // Пока zlib заполняет выходной кусок целиком, у него есть еще что отдать.
+            int result = Z_OK;
+            do {
+                const qsizetype used = out.size();
+                out.resize(used + out_step);
+                zlib.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+                zlib.avail_out = static_cast<uInt>(out_step);
+                result = deflate(&zlib, finish ? Z_FINISH : Z_NO_FLUSH);
+                out.resize(used + out_step - zlib.avail_out);
+                if (result == Z_STREAM_ERROR) {
+                    state_->ok = false;
+                    return false;
+                }
+            } while (zlib.avail_out == 0);
+
+            if (finish) {
+                state_->finished = result == Z_STREAM_END;
+                state_->ok = state_->finished;
+            }
+            return state_->ok;
+        }
+#ifdef VERBOV_HAVE_ZSTD
+        case Encoding::Zstd: {
+            ZSTD_inBuffer input {data, static_cast<size_t>(size), 0};
+            size_t remaining = 0;
+            do {
+                const qsizetype used = out.size();
+                out.resize(used + out_step);
+                ZSTD_outBuffer output {out.data() + used, static_cast<size_t>(out_step), 0};
+                remaining = ZSTD_compressStream2(state_->zstd, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+                out.resize(used + static_cast<qsizetype>(output.pos));
+                if (ZSTD_isError(remaining)) {
+                    state_->ok = false;
+                    return false;
+                }
+            } while (finish ? remaining != 0 : input.pos < input.size);
+
+            state_->finished = finish;
+            return true;
+        }
+#endif
+        default:
+            return false;
+        }
+    }
+
+    QByteArray compress(const QByteArray& data, Encoding encoding, int level) {
+        Encoder encoder(encoding, level);
+        QByteArray out;
+        out.reserve(data.size() / 4 + 64);
+        if (!encoder.push(data.constData(), data.size(), true, out)) {
+            return QByteArray();
+        }
+        return out;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <memory>
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+// Сжатие ответов по Accept-Encoding.
+// gzip и deflate -- через zlib, zstd -- если сервер собран с libzstd
+// (VERBOV_HAVE_ZSTD). Настройки в секции [compression]: level (0 -- не
+// сжимать) и min_size (ответы меньше отдаются как есть).
+namespace compression {
+    enum class Encoding {
+        Identity,
+        Deflate,
+        Gzip,
+        Zstd,
+    };
+
+    // Лучшая из поддерживаемых кодировок, которые принимает клиент.
+    // При равных q предпочтение zstd, потом gzip, потом deflate.
+    Encoding negotiate(QByteArrayView accept_encoding);
+
+    // Значение для заголовка Content-Encoding.
+    const char* name(Encoding encoding);
+
+    int level();
+    qint64 min_size();
+
+    // Потоковое сжатие: куски подаются по порядку, последний с finish.
+    class Encoder {
+    public:
+        Encoder(Encoding encoding, int level);
+        ~Encoder();
+
+        // Сжимает size байт из data и дописывает результат в out.
+        bool push(const char* data, qsizetype size, bool finish, QByteArray& out);
+    private:
+        struct State;
+        std::unique_ptr<State> state_;
+    };
+
+    // Весь ответ за раз. Пустой результат -- ошибка сжатия.
+    QByteArray compress(const QByteArray& data, Encoding encoding, int level);
+}
+
+#endif // COMPRESSION_H
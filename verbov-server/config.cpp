@@ -0,0 +1,97 @@
+#include "config.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QSettings>
+
+namespace {
+
+QHash<QString, QString>& values() {
+    static QHash<QString, QString> instance;
+    return instance;
+}
+
+QString env_name(const QString& key) {
+    QString name = "VERBOV_" + key.toUpper();
+    name.replace('/', '_');
+    name.replace('.', '_');
+    return name;
+}
+
+// Значение из окружения, иначе из файла.
+bool lookup(const QString& key, QString& value) {
+    const QByteArray env = qgetenv(env_name(key).toUtf8().constData());
+    if (!env.isNull()) {
+        value = QString::fromUtf8(env);
+        return true;
+    }
+
+    auto found = values().constFind(key);
+    if (found == values().constEnd()) {
+        return false;
+    }
+    value = *found;
+    return true;
+}
+
+} // namespace
+
+bool config::load(const QString& path) {
+    values().clear();
+
+    if (!QFile::exists(path)) {
+        qInfo() << "config" << path << "not found, using defaults";
+        return true;
+    }
+
+    QSettings settings(path, QSettings::Format::IniFormat);
+    if (settings.status() != QSettings::Status::NoError) {
+        qCritical() << "failed to read config" << path;
+        return false;
+    }
+
+    for (const QString& key: settings.allKeys()) {
+        values().insert(key, settings.value(key).toString());
+    }
+
+    return true;
+}
+
+QString config::string(const QString& key, const QString& default_value) {
+    QString value;
+    if (!lookup(key, value)) {
+        return default_value;
+    }
+    return value;
+}
+
+qint64 config::integer(const QString& key, qint64 default_value) {
+    QString value;
+    if (!lookup(key, value)) {
+        return default_value;
+    }
+
+    bool is_integer = false;
+    const qint64 result = value.toLongLong(&is_integer);
+    if (!is_integer) {
+        qWarning() << "config" << key << "is not an integer:" << value;
+        return default_value;
+    }
+    return result;
+}
+
+double config::real(const QString& key, double default_value) {
+    QString value;
+    if (!lookup(key, value)) {
+        return default_value;
+    }
+
+    bool is_double = false;
+    const double result = value.toDouble(&is_double);
+    if (!is_double) {
+        qWarning() << "config" << key << "is not a number:" << value;
+        return default_value;
+    }
+    return result;
+}
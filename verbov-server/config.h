@@ -0,0 +1,21 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <QString>
+
+// Настройки сервера.
+// Читаются один раз при старте из INI-файла (путь в VERBOV_CONFIG, по
+// умолчанию verbov-server.ini в рабочей папке, файла может и не быть).
+// Ключ вида "section/key" переопределяется переменной окружения
+// VERBOV_SECTION_KEY, например vk/api_url -- VERBOV_VK_API_URL.
+//
+// После load() только читаются, так что безопасны из любого потока.
+namespace config {
+    bool load(const QString& path);
+
+    QString string(const QString& key, const QString& default_value);
+    qint64 integer(const QString& key, qint64 default_value);
+    double real(const QString& key, double default_value);
+}
+
+#endif // CONFIG_H
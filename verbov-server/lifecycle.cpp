@@ -0,0 +1,247 @@
+#include "lifecycle.h"
+
+#include <atomic>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QHostAddress>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QSocketNotifier>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace lifecycle {
+    static std::atomic<bool> stop_requested = false;
+    static std::atomic<qint64> busy_count = 0;
+
+    bool stopping() {
+        return stop_requested.load();
+    }
+
+    void stop() {
+        stop_requested = true;
+    }
+
+    Busy::Busy() {
+        ++busy_count;
+    }
+
+    Busy::~Busy() {
+        --busy_count;
+    }
+
+    qint64 busy() {
+        return busy_count.load();
+    }
+
+#ifdef Q_OS_UNIX
+    static int signal_pipe[2] = {-1, -1};
+
+    static void on_signal(int signal) {
+        // В обработчике сигнала можно только async-signal-safe вызовы.
+        const int saved_errno = errno;
+        const char code = signal == SIGUSR2 ? 'h' : 't';
+        [[maybe_unused]] const ssize_t written = ::write(signal_pipe[1], &code, 1);
+        errno = saved_errno;
+    }
+
+    static bool set_cloexec(int fd, bool enabled) {
+        const int flags = ::fcntl(fd, F_GETFD);
+        if (flags < 0) {
+            return false;
+        }
+        return ::fcntl(fd, F_SETFD, enabled ? flags | FD_CLOEXEC : flags & ~FD_CLOEXEC) == 0;
+    }
+
+    bool watch_signals(std::function<void(Signal)> handler) {
+        if (::pipe(signal_pipe) != 0) {
+            qCritical() << "failed to create signal pipe:" << strerror(errno);
+            return false;
+        }
+        for (int fd: signal_pipe) {
+            set_cloexec(fd, true);
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+
+        // Живет до конца процесса, как и обработчики сигналов.
+        auto* notifier = new QSocketNotifier(signal_pipe[0], QSocketNotifier::Read, QCoreApplication::instance());
+        QObject::connect(notifier, &QSocketNotifier::activated, notifier, [handler = std::move(handler)]() {
+            char codes[16];
+            ssize_t n = 0;
+            while ((n = ::read(signal_pipe[0], codes, sizeof(codes))) > 0) {
+                for (ssize_t i = 0; i < n; ++i) {
+                    handler(codes[i] == 'h' ? Signal::Handoff : Signal::Terminate);
+                }
+            }
+        });
+
+        struct sigaction action {};
+        action.sa_handler = on_signal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        for (int signal: {SIGTERM, SIGINT, SIGUSR2}) {
+            if (::sigaction(signal, &action, nullptr) != 0) {
+                qCritical() << "failed to install handler for signal" << signal << ":" << strerror(errno);
+                return false;
+            }
+        }
+        return true;
+    }
+#else
+    bool watch_signals(std::function<void(Signal)>) {
+        // Без POSIX-сигналов остается обычное завершение процесса.
+        return true;
+    }
+#endif
+
+#ifdef Q_OS_UNIX
+    // QTcpServer не дает выставить опции до bind, так что сокет создаем сами.
+    static int listen_reuse_port(const QString& host, quint16 port) {
+        const QHostAddress address(host);
+        sockaddr_storage storage {};
+        socklen_t length = 0;
+        if (address.protocol() == QAbstractSocket::IPv6Protocol) {
+            auto* in6 = reinterpret_cast<sockaddr_in6*>(&storage);
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(port);
+            const Q_IPV6ADDR ip = address.toIPv6Address();
+            memcpy(&in6->sin6_addr, &ip, sizeof(ip));
+            length = sizeof(*in6);
+        } else if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+            auto* in4 = reinterpret_cast<sockaddr_in*>(&storage);
+            in4->sin_family = AF_INET;
+            in4->sin_port = htons(port);
+            in4->sin_addr.s_addr = htonl(address.toIPv4Address());
+            length = sizeof(*in4);
+        } else {
+            qCritical() << "not an IP address:" << host;
+            return -1;
+        }
+
+        const int fd = ::socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            qCritical() << "failed to create socket:" << strerror(errno);
+            return -1;
+        }
+        const int enabled = 1;
+        if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled)) != 0
+            || ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled)) != 0
+            || ::bind(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0
+            || ::listen(fd, SOMAXCONN) != 0) {
+            qCritical() << "failed to listen on" << host << port << ":" << strerror(errno);
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+#endif
+
+    QTcpServer* listen(const QString& host, quint16 port, bool reuse_port) {
+        auto* listener = new QTcpServer();
+
+#ifdef Q_OS_UNIX
+        const QString inherited = qEnvironmentVariable("VERBOV_LISTEN_FD");
+        if (!inherited.isEmpty()) {
+            // Дальше передаем свой сокет заново, старое значение не нужно.
+            qunsetenv("VERBOV_LISTEN_FD");
+
+            bool is_integer = false;
+            const int fd = inherited.toInt(&is_integer);
+            if (is_integer && listener->setSocketDescriptor(fd)) {
+                set_cloexec(fd, true);
+                qInfo() << "Took over listening socket" << fd;
+                return listener;
+            }
+            // Не вышло -- слушаем сами. Пока старый экземпляр держит порт,
+            // это тоже не выйдет, и он продолжит работать.
+            qCritical() << "failed to take over socket" << inherited << ":" << listener->errorString();
+        }
+
+        if (reuse_port) {
+            const int fd = listen_reuse_port(host, port);
+            if (fd < 0 || !listener->setSocketDescriptor(fd)) {
+                if (fd >= 0) {
+                    qCritical() << "failed to adopt socket:" << listener->errorString();
+                    ::close(fd);
+                }
+                delete listener;
+                return nullptr;
+            }
+            return listener;
+        }
+#endif
+
+        if (!listener->listen(QHostAddress(host), port)) {
+            qCritical() << "failed to listen on" << host << port << ":" << listener->errorString();
+            delete listener;
+            return nullptr;
+        }
+        return listener;
+    }
+
+#ifdef Q_OS_UNIX
+    bool hand_off(QTcpServer* listener) {
+        const int fd = static_cast<int>(listener->socketDescriptor());
+        if (fd < 0 || !set_cloexec(fd, false)) {
+            qCritical() << "failed to prepare listening socket for hand-off";
+            return false;
+        }
+
+        QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+        environment.insert("VERBOV_LISTEN_FD", QString::number(fd));
+        environment.insert("VERBOV_HANDOFF_PID", QString::number(::getpid()));
+
+        QProcess process;
+        process.setProgram(QCoreApplication::applicationFilePath());
+        process.setArguments(QCoreApplication::arguments().mid(1));
+        process.setProcessEnvironment(environment);
+        process.setWorkingDirectory(QDir::currentPath());
+
+        qint64 pid = 0;
+        // startDetached возвращается после exec в дочернем процессе, так
+        // что флаг можно вернуть сразу.
+        const bool started = process.startDetached(&pid);
+        set_cloexec(fd, true);
+
+        if (!started) {
+            qCritical() << "failed to start new instance:" << process.errorString();
+            return false;
+        }
+        qInfo() << "Handing off listening socket to" << pid;
+        return true;
+    }
+
+    void release_predecessor() {
+        const QString predecessor = qEnvironmentVariable("VERBOV_HANDOFF_PID");
+        if (predecessor.isEmpty()) {
+            return;
+        }
+        qunsetenv("VERBOV_HANDOFF_PID");
+
+        bool is_integer = false;
+        const qint64 pid = predecessor.toLongLong(&is_integer);
+        if (is_integer && pid > 0 && ::kill(static_cast<pid_t>(pid), SIGTERM) != 0) {
+            qCritical() << "failed to stop previous instance" << pid << ":" << strerror(errno);
+        }
+    }
+#else
+    bool hand_off(QTcpServer*) {
+        qCritical() << "socket hand-off is not supported on this platform";
+        return false;
+    }
+
+    void release_predecessor() {
+    }
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef LIFECYCLE_H
+#define LIFECYCLE_H
+
+#include <functional>
+
+#include <QString>
+#include <QTcpServer>
+
+// Остановка и перезапуск сервера без потери запросов.
+//
+// SIGTERM (и SIGINT): перестаем принимать соединения, новые запросы на
+// открытых соединениях получают 503, ждем, пока доделается начатое
+// (обработчики, потоковые ответы, тик уведомлений), закрываем БД.
+// Тик уведомлений останавливается на границе события: уведомление ушло и
+// уровень события сохранен, так что после перезапуска дублей не будет.
+//
+// SIGUSR2: запускаем новый экземпляр сервера (тот же бинарник, те же
+// аргументы) и передаем ему слушающий сокет. Новый, открыв БД и начав
+// принимать соединения на этом же сокете, шлет старому SIGTERM. Сокет все
+// время открыт, так что соединения не отвергаются.
+namespace lifecycle {
+    enum class Signal {
+        Terminate,
+        Handoff,
+    };
+
+    // Сигналы доставляются в главный поток: обработчик сигнала только пишет
+    // байт в pipe, а QSocketNotifier на другом его конце вызывает handler
+    // из цикла событий.
+    bool watch_signals(std::function<void(Signal)> handler);
+
+    // Выход запрошен.
+    bool stopping();
+    void stop();
+
+    // Начатая работа, которую нужно доделать до выхода.
+    class Busy {
+    public:
+        Busy();
+        ~Busy();
+
+        Busy(const Busy&) = delete;
+        Busy& operator=(const Busy&) = delete;
+    };
+    qint64 busy();
+
+    // Слушающий сокет: переданный предыдущим экземпляром (VERBOV_LISTEN_FD)
+    // или новый на host:port. reuse_port -- порт могут слушать и другие
+    // процессы (SO_REUSEPORT), ядро делит соединения между ними.
+    // nullptr при ошибке.
+    QTcpServer* listen(const QString& host, quint16 port, bool reuse_port = false);
+
+    // Запускает новый экземпляр и передает ему сокет listener.
+    bool hand_off(QTcpServer* listener);
+
+    // Если нас запустил hand_off, сообщает предыдущему экземпляру, что он
+    // может уходить. Вызывать, когда уже принимаем соединения.
+    void release_predecessor();
+}
+
+#endif // LIFECYCLE_H
@@ -1,16 +1,35 @@
 #include <random>
 
 #include <QCoreApplication>
+#include <QDeadlineTimer>
 #include <QtSql/QSqlDatabase>
 #include <QHttpServer>
 #include <QFile>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTcpServer>
 #include <QTimer>
+#include <QUrlQuery>
 
 #include "DB/session.h"
 #include "DB/user.h"
 #include "DB/event.h"
 #include "DB/eventparticipant.h"
-
+#include "DB/notification.h"
+#include "DB/memorystorage.h"
+#include "DB/shardedstorage.h"
+#include "DB/sqlitestorage.h"
+
+#include "compression.h"
+#include "config.h"
+#include "lifecycle.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "stream.h"
+#include "supervisor.h"
+#include "sweeper.h"
+#include "timesource.h"
+#include "trace.h"
 #include "vk.h"
 
 #define CHECK(expr) if (!(expr)) { return false; }
@@ -19,16 +38,19 @@ static bool check_tables(QSqlDatabase& db) {
     CHECK(Session::check_table(db));
     CHECK(Event::check_table(db));
     CHECK(EventParticipant::check_table(db));
+    CHECK(Notification::check_table(db));
 
     return true;
 }
 
 static bool run_tests() {
     const QString db_path = "test_db.sqlite3";
-    if (QFile().exists(db_path)) {
-        // Удалим БД с прошлого раза, чтобы не ловить ошибки из-за незавершившихся
-        // полностью тестов.
-        CHECK(QFile().remove(db_path));
+    for (const QString& path: {db_path, storage::sibling_path(db_path, "archive")}) {
+        if (QFile().exists(path)) {
+            // Удалим БД с прошлого раза, чтобы не ловить ошибки из-за незавершившихся
+            // полностью тестов.
+            CHECK(QFile().remove(path));
+        }
     }
 
     // https://stackoverflow.com/a/27844918
@@ -37,26 +59,48 @@ static bool run_tests() {
     CHECK(test_db.open());
 
     CHECK(check_tables(test_db));
+    CHECK(storage::attach_archive(test_db, storage::sibling_path(db_path, "archive")));
 
     CHECK(User::run_tests(test_db));
     CHECK(Session::run_tests(test_db));
+    CHECK(Notification::run_tests(test_db));
+
+    // Одни и те же проверки для всех движков хранилища.
+    storage::SqliteStorage sqlite_storage(test_db);
+    CHECK(storage::run_tests(sqlite_storage));
+    storage::MemoryStorage memory_storage;
+    CHECK(storage::run_tests(memory_storage));
+
+    // Шардам -- свои файлы: пользователи из проверок выше уже есть в test_db.
+    const QString sharded_path = "test_db.sharded.sqlite3";
+    for (const QString& path: {sharded_path,
+                               QString("test_db.sharded.shard0.sqlite3"), QString("test_db.sharded.shard0.archive.sqlite3"),
+                               QString("test_db.sharded.shard1.sqlite3"), QString("test_db.sharded.shard1.archive.sqlite3")}) {
+        if (QFile().exists(path)) {
+            CHECK(QFile().remove(path));
+        }
+    }
+    QSqlDatabase sharded_db = QSqlDatabase::addDatabase("QSQLITE", sharded_path);
+    sharded_db.setDatabaseName(sharded_path);
+    CHECK(sharded_db.open());
+    CHECK(check_tables(sharded_db));
+    std::vector<QSqlDatabase> test_shards;
+    CHECK(storage::ShardedStorage::open_shards(sharded_path, 2, test_shards));
+    storage::ShardedStorage sharded_storage(sharded_db, test_shards);
+    CHECK(storage::run_tests(sharded_storage));
 
     return true;
 }
 #undef CHECK
 
-static bool create_session(QSqlDatabase& db, const User& user, std::optional<Session>& new_session) {
+static bool create_session(storage::Storage& storage, const User& user, std::optional<Session>& new_session) {
     Session session;
 
     session.user_id = user.get_vk_id();
-
-    if (!session.generate_token(db)) {
-        return false;
-    }
-
     session.set_time_started();
 
-    if (!session.create(db)) {
+    // Токен выдает хранилище.
+    if (!storage.create_session(session)) {
         return false;
     }
     new_session = std::move(session);
@@ -65,7 +109,9 @@ static bool create_session(QSqlDatabase& db, const User& user, std::optional<Ses
 }
 
 static QString make_confirmation_link(const User& user) {
-    return "http://127.0.0.1:8080/reg_confirm?vk_id=" +
+    // Адрес, по которому сервер видят пользователи.
+    static const QString public_url = config::string("server/public_url", "http://127.0.0.1:8080");
+    return public_url + "/reg_confirm?vk_id=" +
            QString::number(user.get_vk_id()) + "&reg_code=" +
            QString::number(user.reg_code);
 }
@@ -120,6 +166,10 @@ static QString generate_event_refer() {
     return result;
 }
 
+// Размер страницы списка участников события.
+static constexpr int participants_page_default = 200;
+static constexpr int participants_page_max = 1000;
+
 static QString basic_html(const QString& text) {
     return "<!DOCTYPE html><html><meta charset=\"utf-8\">"
            "<title>Планировщик событий</title><head></head><body>" +
@@ -127,22 +177,385 @@ static QString basic_html(const QString& text) {
            "</body></html>";
 }
 
+static const char* method_name(QHttpServerRequest::Method method) {
+    switch (method) {
+    case QHttpServerRequest::Method::Get:     return "GET";
+    case QHttpServerRequest::Method::Put:     return "PUT";
+    case QHttpServerRequest::Method::Delete:  return "DELETE";
+    case QHttpServerRequest::Method::Post:    return "POST";
+    case QHttpServerRequest::Method::Head:    return "HEAD";
+    case QHttpServerRequest::Method::Options: return "OPTIONS";
+    case QHttpServerRequest::Method::Patch:   return "PATCH";
+    default:                                  return "OTHER";
+    }
+}
+
+// Потоковая отдача (QHttpServerResponder в обработчике маршрута и запись
+// тела из QIODevice кусками) -- начиная с Qt 6.8. На старых версиях
+// списки отдаются как раньше, целиком.
+#define VERBOV_STREAMING (QT_VERSION >= QT_VERSION_CHECK(6, 8, 0))
+
+// Списки от stream_min_rows строк отдаются потоком из снимка БД.
+static qint64 stream_min_rows() {
+    static const qint64 value = config::integer("server/stream_min_rows", 256);
+    return value;
+}
+
+// Ответ маршрута со списком: готовый QHttpServerResponse или тело,
+// которое пишется в сокет по мере того, как сокет его забирает.
+struct Reply {
+    Reply(QHttpServerResponse&& response)
+        : response(std::move(response)) {}
+    Reply(std::unique_ptr<stream::RowStream> body)
+        : response(QHttpServerResponse::StatusCode::Ok), body(std::move(body)) {}
+
+    QHttpServerResponse response;
+    std::unique_ptr<stream::RowStream> body;
+};
+
+// Кодировка ответа по Accept-Encoding запроса. Identity, если сжатие выключено.
+static compression::Encoding response_encoding(const QHttpServerRequest& request) {
+    if (compression::level() <= 0) {
+        return compression::Encoding::Identity;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+    return compression::negotiate(request.headers().combinedValue(QHttpHeaders::WellKnownHeader::AcceptEncoding));
+#else
+    return compression::negotiate(request.value("Accept-Encoding"));
+#endif
+}
+
+// Служебные маршруты (/metrics, /debug/trace). Если задан server/admin_token,
+// нужен заголовок "Authorization: Bearer <token>", иначе -- запрос с
+// loopback: server/host может быть и внешним адресом.
+static bool admin_allowed(const QHttpServerRequest& request) {
+    static const QByteArray token = config::string("server/admin_token", "").toUtf8();
+    if (token.isEmpty()) {
+        return request.remoteAddress().isLoopback();
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+    const QByteArray authorization = request.headers().combinedValue(QHttpHeaders::WellKnownHeader::Authorization);
+#else
+    const QByteArray authorization = request.value("Authorization");
+#endif
+    const QByteArray expected = "Bearer " + token;
+    if (authorization.size() != expected.size()) {
+        return false;
+    }
+    // Без раннего выхода: время сравнения не выдает совпавший префикс.
+    char difference = 0;
+    for (qsizetype i = 0; i < expected.size(); ++i) {
+        difference |= authorization[i] ^ expected[i];
+    }
+    return difference == 0;
+}
+
+static QHttpServerResponse admin_forbidden() {
+    return QHttpServerResponse(
+        "Нет доступа.",
+        QHttpServerResponse::StatusCode::Forbidden
+        );
+}
+
+// Сжимает тело ответа, если клиент это принимает и тело не меньше min_size.
+static QHttpServerResponse compressed(const QHttpServerRequest& request, QHttpServerResponse&& response) {
+    static const metrics::Counter bytes_in = metrics::counter(
+        "verbov_http_compression_bytes_total", "Bytes of response bodies before and after compression.", {{"stage", "before"}});
+    static const metrics::Counter bytes_out = metrics::counter(
+        "verbov_http_compression_bytes_total", "Bytes of response bodies before and after compression.", {{"stage", "after"}});
+
+    if (response.data().size() < compression::min_size()) {
+        return std::move(response);
+    }
+
+    const compression::Encoding encoding = response_encoding(request);
+    if (encoding == compression::Encoding::Identity) {
+        return std::move(response);
+    }
+
+    const QByteArray body = compression::compress(response.data(), encoding, compression::level());
+    if (body.isEmpty() || body.size() >= response.data().size()) {
+        return std::move(response);
+    }
+
+    bytes_in.inc(response.data().size());
+    bytes_out.inc(body.size());
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+    QHttpHeaders headers = response.headers();
+    headers.append(QHttpHeaders::WellKnownHeader::ContentEncoding, compression::name(encoding));
+    headers.append(QHttpHeaders::WellKnownHeader::Vary, "Accept-Encoding");
+    QHttpServerResponse result(body, response.statusCode());
+    result.setHeaders(std::move(headers));
+#else
+    QHttpServerResponse result(response.mimeType(), body, response.statusCode());
+    result.addHeader("Content-Encoding", compression::name(encoding));
+    result.addHeader("Vary", "Accept-Encoding");
+#endif
+    return result;
+}
+
+static void count_request(const char* route, const QHttpServerRequest& request, QHttpServerResponse::StatusCode status) {
+    metrics::counter(
+        "verbov_http_requests_total", "HTTP requests by route, method and status code.",
+        {
+            {"route", route},
+            {"method", method_name(request.method())},
+            {"status", QString::number(static_cast<int>(status))},
+        }
+    ).inc();
+}
+
+// Быстрый отказ до обработчика: 503 при перегрузке, 429, если у клиента
+// кончились токены. Пустой результат -- запрос можно обрабатывать.
+static std::optional<QHttpServerResponse> admission(const char* route, const QHttpServerRequest& request) {
+    auto reject = [route](const char* reason, QHttpServerResponse::StatusCode status, qint64 retry_after_ms) {
+        metrics::counter(
+            "verbov_http_rejected_total", "Requests rejected before handling by route and reason.",
+            {{"route", route}, {"reason", reason}}
+        ).inc();
+
+        const QByteArray retry_after = QByteArray::number(std::max<qint64>(1, (retry_after_ms + 999) / 1000));
+        const QByteArray text = status == QHttpServerResponse::StatusCode::TooManyRequests
+            ? QByteArray("Слишком много запросов, повторите позже.")
+            : QByteArray("Сервер перегружен, повторите позже.");
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+        QHttpServerResponse response(text, status);
+        QHttpHeaders headers = response.headers();
+        headers.append(QHttpHeaders::WellKnownHeader::RetryAfter, retry_after);
+        response.setHeaders(std::move(headers));
+#else
+        QHttpServerResponse response(text, status);
+        response.addHeader("Retry-After", retry_after);
+#endif
+        return std::optional<QHttpServerResponse>(std::move(response));
+    };
+
+    // Сервер останавливается. Соединение клиент откроет заново, и его
+    // примет новый экземпляр.
+    if (lifecycle::stopping()) {
+        return reject("shutdown", QHttpServerResponse::StatusCode::ServiceUnavailable, 1000);
+    }
+
+    // Перегрузку проверяем первой: отказ по ней не тратит токены клиента.
+    if (ratelimit::overloaded()) {
+        return reject("overload", QHttpServerResponse::StatusCode::ServiceUnavailable, 1000);
+    }
+
+    // С loopback по IP не ограничиваем: за обратным прокси на той же машине
+    // так приходят все клиенты сразу, а verbov-bench -- вся нагрузка.
+    qint64 retry_after_ms = 0;
+    if (!request.remoteAddress().isLoopback()
+        && !ratelimit::by_ip().take(request.remoteAddress().toString(), retry_after_ms)) {
+        return reject("ip", QHttpServerResponse::StatusCode::TooManyRequests, retry_after_ms);
+    }
+
+    const QUrlQuery query = request.query();
+    if (query.hasQueryItem("token")
+        && !ratelimit::by_token().take(query.queryItemValue("token"), retry_after_ms)) {
+        return reject("token", QHttpServerResponse::StatusCode::TooManyRequests, retry_after_ms);
+    }
+    // VK не различает регистр в коротких именах, так что и мы не различаем.
+    if (query.hasQueryItem("vk_profile")
+        && !ratelimit::by_profile().take(query.queryItemValue("vk_profile").trimmed().toLower(), retry_after_ms)) {
+        return reject("vk_profile", QHttpServerResponse::StatusCode::TooManyRequests, retry_after_ms);
+    }
+
+    return std::nullopt;
+}
+
+// Оборачивает обработчик маршрута: пропускает запрос через admission,
+// замеряет время обработки, считает запросы по методу и коду ответа,
+// открывает корневой спан трассировки.
+// Для потоковых ответов время -- до начала отдачи, а не до последнего байта.
+template <typename Handler>
+static auto instrumented(const char* route, Handler handler) {
+    const metrics::Histogram duration = metrics::histogram(
+        "verbov_http_request_duration_seconds", "HTTP request handling duration by route.", {{"route", route}});
+
+    if constexpr (std::is_same_v<std::invoke_result_t<Handler&, const QHttpServerRequest&>, Reply>) {
+#if VERBOV_STREAMING
+        return [route, duration, handler = std::move(handler)](const QHttpServerRequest& request, QHttpServerResponder& responder) {
+            if (std::optional<QHttpServerResponse> rejected = admission(route, request)) {
+                count_request(route, request, rejected->statusCode());
+                responder.sendResponse(std::move(*rejected));
+                return;
+            }
+
+            Reply reply = [&]() {
+                lifecycle::Busy busy;
+                ratelimit::InFlight in_flight;
+                metrics::ScopedTimer timer(duration);
+                trace::Span span(route, "http", trace::Span::Kind::Root);
+                return handler(request);
+            }();
+
+            count_request(route, request, reply.response.statusCode());
+
+            if (reply.body) {
+                QHttpHeaders headers;
+                headers.append(QHttpHeaders::WellKnownHeader::ContentType, "application/octet-stream");
+                // Потоковое тело большое по построению, min_size не проверяем.
+                const compression::Encoding encoding = response_encoding(request);
+                if (encoding != compression::Encoding::Identity) {
+                    reply.body->encode(encoding, compression::level());
+                    headers.append(QHttpHeaders::WellKnownHeader::ContentEncoding, compression::name(encoding));
+                    headers.append(QHttpHeaders::WellKnownHeader::Vary, "Accept-Encoding");
+                }
+                // Responder забирает устройство себе и читает его кусками,
+                // следующий кусок -- когда предыдущий ушел в сокет.
+                responder.write(reply.body.release(), headers);
+            } else {
+                responder.sendResponse(compressed(request, std::move(reply.response)));
+            }
+        };
+#else
+        return [route, duration, handler = std::move(handler)](const QHttpServerRequest& request) {
+            if (std::optional<QHttpServerResponse> rejected = admission(route, request)) {
+                count_request(route, request, rejected->statusCode());
+                return std::move(*rejected);
+            }
+
+            Reply reply = [&]() {
+                lifecycle::Busy busy;
+                ratelimit::InFlight in_flight;
+                metrics::ScopedTimer timer(duration);
+                trace::Span span(route, "http", trace::Span::Kind::Root);
+                return handler(request);
+            }();
+
+            count_request(route, request, reply.response.statusCode());
+
+            return compressed(request, std::move(reply.response));
+        };
+#endif
+    } else {
+        return [route, duration, handler = std::move(handler)](const QHttpServerRequest& request) {
+            if (std::optional<QHttpServerResponse> rejected = admission(route, request)) {
+                count_request(route, request, rejected->statusCode());
+                return std::move(*rejected);
+            }
+
+            QHttpServerResponse response = [&]() {
+                lifecycle::Busy busy;
+                ratelimit::InFlight in_flight;
+                metrics::ScopedTimer timer(duration);
+                trace::Span span(route, "http", trace::Span::Kind::Root);
+                return handler(request);
+            }();
+
+            count_request(route, request, response.statusCode());
+
+            return compressed(request, std::move(response));
+        };
+    }
+}
+
+#if VERBOV_STREAMING
+// Список в формате QDataStream << QVector<T>: число строк (quint32, как
+// его пишет QDataStream для контейнеров), строки, затем tail.
+static std::unique_ptr<stream::RowStream> stream_rows(std::unique_ptr<stream::Snapshot> snapshot, qint64 num_rows,
+                                              stream::RowStream::RowWriter write_row, QByteArray tail = {}) {
+    QByteArray head;
+    {
+        QDataStream out(&head, QDataStream::OpenModeFlag::WriteOnly);
+        out << static_cast<quint32>(num_rows);
+    }
+
+    // Больше строк, чем обещано в начале, не пишем, иначе клиент собьется.
+    auto limited = [write_row = std::move(write_row), remaining = num_rows](QDataStream& out) mutable {
+        if (remaining == 0 || !write_row(out)) {
+            if (remaining != 0) {
+                // Снимок не меняется, так что сюда попадаем только при ошибке.
+                qCritical() << "Streamed list ended early," << remaining << "rows missing";
+            }
+            return false;
+        }
+        --remaining;
+        return true;
+    };
+
+    return std::make_unique<stream::RowStream>(std::move(snapshot), std::move(head), std::move(limited), std::move(tail));
+}
+#endif
+
 static int run_server(QCoreApplication& app) {
-    const QString db_path = "db.sqlite3";
-    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
-    db.setDatabaseName(db_path);
-    if (!db.open()) {
+    const QString db_path = config::string("server/db_path", "db.sqlite3");
+    // sqlite -- файл db_path; sharded -- пользователи в db_path, остальное
+    // в storage/shards файлах рядом; memory -- все в памяти, на диск только снимки.
+    const QString engine = config::string("storage/engine", "sqlite");
+    const QString snapshot_path = config::string("storage/snapshot_path", "db.snapshot");
+
+    QSqlDatabase db;
+    std::vector<QSqlDatabase> shards;
+    std::unique_ptr<storage::Storage> storage_engine;
+    storage::MemoryStorage* memory = nullptr;
+    if (engine == "memory") {
+        auto memory_engine = std::make_unique<storage::MemoryStorage>();
+        if (QFile::exists(snapshot_path) && !memory_engine->load(snapshot_path)) {
+            // Пустое хранилище перезаписало бы снимок при первом сохранении.
+            return -2;
+        }
+        memory = memory_engine.get();
+        storage_engine = std::move(memory_engine);
+    } else if (engine == "sqlite" || engine == "sharded") {
+        db = QSqlDatabase::addDatabase("QSQLITE");
+        db.setDatabaseName(db_path);
+        if (!db.open()) {
+            return -2;
+        }
+
+        // WAL: снимки для потоковой отдачи читают, не блокируя запись.
+        QSqlQuery wal_query(db);
+        if (!wal_query.exec("PRAGMA journal_mode=WAL")) {
+            qCritical() << wal_query.lastError().text();
+        }
+
+        // Страницы от удаленных строк (сессии) возвращаются ОС понемногу.
+        if (!storage::prepare_incremental_vacuum(db)) {
+            qCritical() << "failed to check auto-vacuum mode of" << db_path;
+        }
+
+        if (!check_tables(db)) {
+            qFatal("Failed to prepare tables");
+            return -3;
+        }
+        if (engine == "sharded") {
+            if (!storage::ShardedStorage::open_shards(db_path, std::max<qint64>(config::integer("storage/shards", 4), 1), shards)) {
+                qFatal("Failed to prepare shards");
+                return -3;
+            }
+            storage_engine = std::make_unique<storage::ShardedStorage>(db, shards);
+        } else {
+            // Прошедшие события переносит в архив уборка (sweeper/archive_after_days).
+            if (!storage::attach_archive(db, storage::sibling_path(db_path, "archive"))) {
+                qFatal("Failed to prepare the archive");
+                return -3;
+            }
+            storage_engine = std::make_unique<storage::SqliteStorage>(db);
+        }
+    } else {
+        qCritical() << "Unknown storage/engine" << engine;
         return -2;
     }
-
-    if (!check_tables(db)) {
-        qFatal("Failed to prepare tables");
-        return -3;
+    storage::Storage& storage = *storage_engine;
+
+    QTimer snapshot_timer;
+    if (memory != nullptr) {
+        snapshot_timer.setInterval(config::integer("storage/snapshot_interval_ms", 60 * 1000));
+        snapshot_timer.connect(&snapshot_timer, &QTimer::timeout, [memory, snapshot_path]() {
+            memory->save(snapshot_path);
+        });
+        snapshot_timer.start();
     }
 
+    // По умолчанию пишем 1% запросов.
+    trace::set_sample_rate(config::real("trace/sample_rate", 0.01));
+
     QHttpServer server;
     // https://doc.qt.io/qt-6/qhttpserver.html#route
-    server.route("/register", [&db](const QHttpServerRequest& request) {
+    server.route("/register", instrumented("/register", [&storage](const QHttpServerRequest& request) {
         // POST как бы лучше для этого, но ладно..
         QString vk_profile = request.query().queryItemValue("vk_profile");
 
@@ -169,7 +582,7 @@ static int run_server(QCoreApplication& app) {
         }
 
         std::optional<User> maybe_user;
-        if (!User::fetch_by_vk_id(db, vk_id, maybe_user)) {
+        if (!storage.fetch_user(vk_id, maybe_user)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (1)",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -219,7 +632,7 @@ static int run_server(QCoreApplication& app) {
             user.reg_code = std::mt19937(std::random_device()())() % 1000000;
             user.reg_confirmed = false;
 
-            if (!user.create(db)) {
+            if (!storage.create_user(user)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (2)",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -255,9 +668,9 @@ static int run_server(QCoreApplication& app) {
                 QHttpServerResponse::StatusCode::Ok
                 );
         }
-    });
+    }));
     // Возвращает сообщение для пользователя, которое он увидит в браузере.
-    server.route("/reg_confirm", [&db](const QHttpServerRequest& request) {
+    server.route("/reg_confirm", instrumented("/reg_confirm", [&storage](const QHttpServerRequest& request) {
         // POST как бы лучше для этого, но ладно..
         QString vk_id_str = request.query().queryItemValue("vk_id");
 
@@ -282,7 +695,7 @@ static int run_server(QCoreApplication& app) {
         }
 
         std::optional<User> maybe_user;
-        if (!User::fetch_by_vk_id(db, vk_id, maybe_user)) {
+        if (!storage.fetch_user(vk_id, maybe_user)) {
             return QHttpServerResponse(
                 basic_html("Внутренняя ошибка (1)."),
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -297,7 +710,7 @@ static int run_server(QCoreApplication& app) {
 
         maybe_user->reg_confirmed = true;
 
-        if (!maybe_user->update(db)) {
+        if (!storage.update_user(*maybe_user)) {
             return QHttpServerResponse(
                 basic_html("Внутренняя ошибка (2)."),
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -308,9 +721,9 @@ static int run_server(QCoreApplication& app) {
             basic_html("Вы подтвердили аккаунт. Теперь смело возвращайтесь в приложение."),
             QHttpServerResponse::StatusCode::Accepted
         );
-    });
+    }));
     // Возвращает токен или сообщение об ошибке, которое нужно отобразить.
-    server.route("/login", [&db](const QHttpServerRequest& request) {
+    server.route("/login", instrumented("/login", [&storage](const QHttpServerRequest& request) {
         // POST как бы лучше для этого, но ладно..
         QString vk_profile = request.query().queryItemValue("vk_profile");
 
@@ -340,7 +753,7 @@ static int run_server(QCoreApplication& app) {
 
         std::optional<User> maybe_user;
 
-        if (!User::fetch_by_vk_id(db, vk_id, maybe_user)) {
+        if (!storage.fetch_user(vk_id, maybe_user)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (1).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -351,7 +764,7 @@ static int run_server(QCoreApplication& app) {
             User user = std::move(maybe_user.value());
             std::optional<Session> maybe_session;
 
-            if (create_session(db, user, maybe_session)) {
+            if (create_session(storage, user, maybe_session)) {
                 assert(maybe_session.has_value());
 
                 const QString& token = maybe_session->token;
@@ -370,12 +783,12 @@ static int run_server(QCoreApplication& app) {
             "Не удалось войти, проверьте название профиля и пароль",
             QHttpServerResponse::StatusCode::NotFound
         );
-    });
-    server.route("/event", [&db](const QHttpServerRequest& request) {
+    }));
+    server.route("/event", instrumented("/event", [&storage](const QHttpServerRequest& request) -> Reply {
         QString token = request.query().queryItemValue("token");
 
         std::optional<Session> maybe_session;
-        if (!Session::fetch_by_token(db, token, maybe_session)) {
+        if (!storage.fetch_session(token, maybe_session)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (1).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -390,9 +803,81 @@ static int run_server(QCoreApplication& app) {
         }
 
         if (request.method() == QHttpServerRequest::Method::Get && !request.query().hasQueryItem("event_id")) {
-            // Запрос всех доступных пользователю событий.
+            // Запрос всех доступных пользователю событий. С history=1 --
+            // вместе с перенесенными в архив прошедшими.
+            const bool history = request.query().queryItemValue("history") == "1";
+#if VERBOV_STREAMING
+            // Потоком отдает только SQLite: снимок -- это транзакция чтения.
+            // Историю -- целиком, она нужна редко.
+            QSqlDatabase* db = history ? nullptr : storage.sql();
+            if (db != nullptr) {
+                // Читаем не больше stream_min_rows строк. Короткий список на
+                // этом кончается и уходит целиком, без COUNT и без снимка.
+                QVector<Event> events;
+                bool more = false;
+                {
+                    QSqlQuery head(*db);
+                    if (!Event::query_all_for_user(head, maybe_session->user_id)) {
+                        return QHttpServerResponse(
+                            "Внутренняя ошибка (2).",
+                            QHttpServerResponse::StatusCode::InternalServerError
+                            );
+                    }
+                    while (!more && head.next()) {
+                        Event event;
+                        if (!event.unpack_from_query(head)) {
+                            return QHttpServerResponse(
+                                "Внутренняя ошибка (2).",
+                                QHttpServerResponse::StatusCode::InternalServerError
+                                );
+                        }
+                        events.push_back(std::move(event));
+                        more = events.size() >= stream_min_rows();
+                    }
+                }
+
+                if (!more) {
+                    QByteArray result;
+                    QDataStream stream(&result, QDataStream::OpenModeFlag::ReadWrite);
+                    stream << events;
+                    return QHttpServerResponse(
+                        result,
+                        QHttpServerResponse::StatusCode::Ok
+                        );
+                }
+
+                // Большой список отдаем потоком из снимка, не собирая в памяти.
+                // Число строк -- в том же снимке, что и строки.
+                qint64 num_events = 0;
+                std::unique_ptr<stream::Snapshot> snapshot = stream::Snapshot::open(*db);
+                auto rows = snapshot ? std::make_shared<QSqlQuery>(snapshot->db()) : nullptr;
+                if (!rows
+                    || !Event::count_all_for_user(snapshot->db(), maybe_session->user_id, num_events)
+                    || !Event::query_all_for_user(*rows, maybe_session->user_id)) {
+                    return QHttpServerResponse(
+                        "Внутренняя ошибка (2).",
+                        QHttpServerResponse::StatusCode::InternalServerError
+                        );
+                }
+
+                return stream_rows(std::move(snapshot), num_events, [rows](QDataStream& out) {
+                    if (!rows->next()) {
+                        return false;
+                    }
+                    Event event;
+                    if (!event.unpack_from_query(*rows)) {
+                        return false;
+                    }
+                    out << event;
+                    return true;
+                });
+            }
+#endif
             QVector<Event> events;
-            if (!Event::fetch_all_for_user(db, maybe_session->user_id, events)) {
+            const bool fetched = history
+                ? storage.fetch_events_history_for_user(maybe_session->user_id, events)
+                : storage.fetch_events_for_user(maybe_session->user_id, events);
+            if (!fetched) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (2).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -426,14 +911,8 @@ static int run_server(QCoreApplication& app) {
             event.name = name;
             event.creator_user_id = creator_user_id;
             event.timestamp = timestamp;
-            if (!event.generate_refer(db)) {
-                return QHttpServerResponse(
-                    "Не удалось создать ссылку для приглашения на событие.",
-                    QHttpServerResponse::StatusCode::InternalServerError
-                    );
-            }
-
-            if (!event.create(db)) {
+            // Ссылку для приглашения выдает хранилище.
+            if (!storage.create_event(event)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (3).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -460,7 +939,7 @@ static int run_server(QCoreApplication& app) {
         QMutexLocker locker(&Event::notification_mutex);
 
         std::optional<Event> maybe_event;
-        if (!Event::fetch_by_id(db, event_id, maybe_event)) {
+        if (!storage.fetch_event(event_id, maybe_event)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (3).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -502,7 +981,7 @@ static int run_server(QCoreApplication& app) {
                 // Уведомления надо выслать заново.
                 maybe_event->last_notification_level = 0;
             }
-            if (!maybe_event->update(db)) {
+            if (!storage.update_event(*maybe_event)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (4).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -515,7 +994,7 @@ static int run_server(QCoreApplication& app) {
         case QHttpServerRequest::Method::Delete: {
             // Только владелец.
 
-            if (!maybe_event->drop(db)) {
+            if (!storage.drop_event(*maybe_event)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (5).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -533,12 +1012,12 @@ static int run_server(QCoreApplication& app) {
         }
 
         }
-    });
-    server.route("/get_me", [&db](const QHttpServerRequest& request) {
+    }));
+    server.route("/get_me", instrumented("/get_me", [&storage](const QHttpServerRequest& request) {
         QString token = request.query().queryItemValue("token");
 
         std::optional<Session> maybe_session;
-        if (!Session::fetch_by_token(db, token, maybe_session)) {
+        if (!storage.fetch_session(token, maybe_session)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (1).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -553,7 +1032,7 @@ static int run_server(QCoreApplication& app) {
         }
 
         std::optional<User> maybe_user;
-        if (!User::fetch_by_vk_id(db, maybe_session->user_id, maybe_user)) {
+        if (!storage.fetch_user(maybe_session->user_id, maybe_user)) {
             // В схеме таблицы стоит ON DELETE RESTRICT на foreign key.
             // Такое случаться не должно.
             return QHttpServerResponse(
@@ -579,7 +1058,7 @@ static int run_server(QCoreApplication& app) {
             maybe_user->last_name = last_name;
 
             // Если не получилось обновить, вернем все как было, выдадим пользователю.
-            if (!maybe_user->update(db)) {
+            if (!storage.update_user(*maybe_user)) {
                 maybe_user->first_name = old_first_name;
                 maybe_user->last_name = old_last_name;
             }
@@ -592,12 +1071,12 @@ static int run_server(QCoreApplication& app) {
             result,
             QHttpServerResponse::StatusCode::Ok
             );
-    });
-    server.route("/event_get_host", [&db](const QHttpServerRequest& request) {
+    }));
+    server.route("/event_get_host", instrumented("/event_get_host", [&storage](const QHttpServerRequest& request) {
         QString token = request.query().queryItemValue("token");
 
         std::optional<Session> maybe_session;
-        if (!Session::fetch_by_token(db, token, maybe_session)) {
+        if (!storage.fetch_session(token, maybe_session)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (1).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -631,7 +1110,7 @@ static int run_server(QCoreApplication& app) {
 
         std::optional<Event> maybe_event;
 
-        if (!Event::fetch_by_id(db, event_id, maybe_event)) {
+        if (!storage.fetch_event(event_id, maybe_event)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (2).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -646,7 +1125,7 @@ static int run_server(QCoreApplication& app) {
         }
 
         std::optional<User> maybe_user;
-        if (!User::fetch_by_vk_id(db, maybe_session->user_id, maybe_user)) {
+        if (!storage.fetch_user(maybe_session->user_id, maybe_user)) {
             // В схеме таблицы стоит ON DELETE RESTRICT на foreign key.
             // Такое случаться не должно.
             return QHttpServerResponse(
@@ -664,12 +1143,12 @@ static int run_server(QCoreApplication& app) {
             );
 
         return QHttpServerResponse(result);
-    });
-    server.route("/event_get_participants", [&db](const QHttpServerRequest& request) {
+    }));
+    server.route("/event_get_participants", instrumented("/event_get_participants", [&storage](const QHttpServerRequest& request) -> Reply {
         QString token = request.query().queryItemValue("token");
 
         std::optional<Session> maybe_session;
-        if (!Session::fetch_by_token(db, token, maybe_session)) {
+        if (!storage.fetch_session(token, maybe_session)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (1).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -694,7 +1173,7 @@ static int run_server(QCoreApplication& app) {
 
         std::optional<Event> maybe_event;
 
-        if (!Event::fetch_by_id(db, event_id, maybe_event)) {
+        if (!storage.fetch_event(event_id, maybe_event)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (2).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -708,24 +1187,93 @@ static int run_server(QCoreApplication& app) {
                 );
         }
 
-        QVector<User> users;
-        if (!User::fetch_by_event_id(db, maybe_event->get_id(), users)) {
+        // Список отдается страницами: after -- vk_id последнего участника
+        // предыдущей страницы (0 для первой), limit -- размер страницы.
+        quint64 after_vk_id = 0;
+        if (request.query().hasQueryItem("after")) {
+            after_vk_id = request.query().queryItemValue("after").toULongLong(&is_integer);
+            if (!is_integer) {
+                return QHttpServerResponse(
+                    "Недопустимый курсор страницы.",
+                    QHttpServerResponse::StatusCode::NotAcceptable
+                    );
+            }
+        }
+
+        int limit = participants_page_default;
+        if (request.query().hasQueryItem("limit")) {
+            limit = request.query().queryItemValue("limit").toInt(&is_integer);
+            if (!is_integer || limit <= 0) {
+                return QHttpServerResponse(
+                    "Недопустимый размер страницы.",
+                    QHttpServerResponse::StatusCode::NotAcceptable
+                    );
+            }
+            limit = std::min(limit, participants_page_max);
+        }
+
+#if VERBOV_STREAMING
+        if (storage.sql() != nullptr && limit >= stream_min_rows()) {
+            // Большую страницу отдаем потоком из снимка, не собирая в памяти.
+            // Считаем на одну строку больше, чтобы знать, есть ли следующая страница.
+            std::unique_ptr<stream::Snapshot> snapshot = stream::Snapshot::open(*storage.sql());
+            auto rows = snapshot ? std::make_shared<QSqlQuery>(snapshot->db()) : nullptr;
+            qint64 num_users = 0;
+            if (!rows
+                || !User::count_page_by_event_id(snapshot->db(), maybe_event->get_id(), after_vk_id, limit + 1, num_users)
+                || !User::query_page_by_event_id(*rows, maybe_event->get_id(), after_vk_id, limit)) {
+                return QHttpServerResponse(
+                    "Внутренняя ошибка (3).",
+                    QHttpServerResponse::StatusCode::InternalServerError
+                    );
+            }
+
+            const bool has_more = num_users > limit;
+            QByteArray tail;
+            {
+                QDataStream out(&tail, QDataStream::OpenModeFlag::WriteOnly);
+                out << has_more;
+            }
+
+            return stream_rows(std::move(snapshot), std::min<qint64>(num_users, limit), [rows](QDataStream& out) {
+                if (!rows->next()) {
+                    return false;
+                }
+                UserBrief user;
+                if (!user.unpack_from_query(*rows)) {
+                    return false;
+                }
+                out << user;
+                return true;
+            }, std::move(tail));
+        }
+#endif
+
+        // Берем на одного больше, чтобы знать, есть ли следующая страница.
+        QVector<UserBrief> users;
+        if (!storage.fetch_participants_page(maybe_event->get_id(), after_vk_id, limit + 1, users)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (3).",
                 QHttpServerResponse::StatusCode::InternalServerError
                 );
         }
 
+        const bool has_more = users.size() > limit;
+        if (has_more) {
+            users.resize(limit);
+        }
+
         QByteArray result;
         QDataStream stream(&result, QDataStream::OpenModeFlag::WriteOnly);
         stream << users;
+        stream << has_more;
         return QHttpServerResponse(result);
-    });
-    server.route("/event_delete_participant", [&db](const QHttpServerRequest& request) {
+    }));
+    server.route("/event_delete_participant", instrumented("/event_delete_participant", [&storage](const QHttpServerRequest& request) {
         QString token = request.query().queryItemValue("token");
 
         std::optional<Session> maybe_session;
-        if (!Session::fetch_by_token(db, token, maybe_session)) {
+        if (!storage.fetch_session(token, maybe_session)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (1).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -759,7 +1307,7 @@ static int run_server(QCoreApplication& app) {
 
         std::optional<Event> maybe_event;
 
-        if (!Event::fetch_by_id(db, event_id, maybe_event)) {
+        if (!storage.fetch_event(event_id, maybe_event)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (2).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -775,14 +1323,14 @@ static int run_server(QCoreApplication& app) {
 
         std::optional<EventParticipant> maybe_participant;
 
-        if (!EventParticipant::fetch(db, event_id, user_id, maybe_participant)) {
+        if (!storage.fetch_participant(event_id, user_id, maybe_participant)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (3).",
                 QHttpServerResponse::StatusCode::InternalServerError
                 );
         }
 
-        if (!maybe_participant->drop(db)) {
+        if (!storage.drop_participant(*maybe_participant)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (4).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -790,12 +1338,12 @@ static int run_server(QCoreApplication& app) {
         }
 
         return QHttpServerResponse(QHttpServerResponse::StatusCode::Ok);
-    });
-    server.route("/event_register", [&db](const QHttpServerRequest& request) {
+    }));
+    server.route("/event_register", instrumented("/event_register", [&storage](const QHttpServerRequest& request) {
         QString token = request.query().queryItemValue("token");
 
         std::optional<Session> maybe_session;
-        if (!Session::fetch_by_token(db, token, maybe_session)) {
+        if (!storage.fetch_session(token, maybe_session)) {
             return QHttpServerResponse(
                 "Внутренняя ошибка (1).",
                 QHttpServerResponse::StatusCode::InternalServerError
@@ -818,7 +1366,7 @@ static int run_server(QCoreApplication& app) {
 
             std::optional<Event> maybe_event;
 
-            if (!Event::fetch_by_refer(db, event_refer, maybe_event)) {
+            if (!storage.fetch_event_by_refer(event_refer, maybe_event)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (2).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -833,7 +1381,7 @@ static int run_server(QCoreApplication& app) {
             }
 
             std::optional<EventParticipant> maybe_participant;
-            if (!EventParticipant::fetch(db, maybe_event->get_id(), user_id, maybe_participant)) {
+            if (!storage.fetch_participant(maybe_event->get_id(), user_id, maybe_participant)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (3).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -849,9 +1397,9 @@ static int run_server(QCoreApplication& app) {
             }
 
             EventParticipant participant(maybe_event->get_id(), user_id);
-            participant.registered_time = QDateTime::currentSecsSinceEpoch();
+            participant.registered_time = timesource::now();
 
-            if (!participant.create(db)) {
+            if (!storage.create_participant(participant)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (3).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -882,7 +1430,7 @@ static int run_server(QCoreApplication& app) {
 
             std::optional<Event> maybe_event;
 
-            if (!Event::fetch_by_id(db, event_id, maybe_event)) {
+            if (!storage.fetch_event(event_id, maybe_event)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (2).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -904,7 +1452,7 @@ static int run_server(QCoreApplication& app) {
             }
 
             std::optional<EventParticipant> maybe_participant;
-            if (!EventParticipant::fetch(db, maybe_event->get_id(), user_id, maybe_participant)) {
+            if (!storage.fetch_participant(maybe_event->get_id(), user_id, maybe_participant)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (3).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -918,7 +1466,7 @@ static int run_server(QCoreApplication& app) {
                     );
             }
 
-            if (!maybe_participant->drop(db)) {
+            if (!storage.drop_participant(*maybe_participant)) {
                 return QHttpServerResponse(
                     "Внутренняя ошибка (4).",
                     QHttpServerResponse::StatusCode::InternalServerError
@@ -935,32 +1483,259 @@ static int run_server(QCoreApplication& app) {
                 );
         }
         }
+    }));
+    // Метрики для Prometheus.
+    server.route("/metrics", [](const QHttpServerRequest& request) {
+        if (!admin_allowed(request)) {
+            return admin_forbidden();
+        }
+        return QHttpServerResponse(QByteArray("text/plain; version=0.0.4"), metrics::render());
     });
 
+    // Трассировка в формате Chrome trace-event, открывается в Perfetto.
+    // GET выгружает буферы. POST ?sample_rate=0.1 меняет долю записываемых
+    // запросов, POST ?clear=1 выгружает и очищает буферы.
+    server.route("/debug/trace", [](const QHttpServerRequest& request) {
+        if (!admin_allowed(request)) {
+            return admin_forbidden();
+        }
+
+        if (request.method() == QHttpServerRequest::Method::Get) {
+            return QHttpServerResponse(QByteArray("application/json"), trace::dump_chrome_json());
+        }
+        if (request.method() != QHttpServerRequest::Method::Post) {
+            return QHttpServerResponse(
+                "Method is not supported",
+                QHttpServerResponse::StatusCode::MethodNotAllowed
+                );
+        }
 
-    quint16 port = server.listen(QHostAddress("127.0.0.1"), 8080);
+        if (request.query().hasQueryItem("sample_rate")) {
+            bool is_double = false;
+            const double rate = request.query().queryItemValue("sample_rate").toDouble(&is_double);
+            if (!is_double || rate < 0 || rate > 1) {
+                return QHttpServerResponse(
+                    "Доля должна быть от 0 до 1.",
+                    QHttpServerResponse::StatusCode::NotAcceptable
+                    );
+            }
+
+            trace::set_sample_rate(rate);
+            return QHttpServerResponse(QHttpServerResponse::StatusCode::Ok);
+        }
+
+        if (request.query().hasQueryItem("clear")) {
+            QHttpServerResponse response(QByteArray("application/json"), trace::dump_chrome_json());
+            trace::clear();
+            return response;
+        }
+        return QHttpServerResponse(
+            "Нужен sample_rate или clear.",
+            QHttpServerResponse::StatusCode::BadRequest
+            );
+    });
+
+    const QString host = config::string("server/host", "127.0.0.1");
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    // Сокет создаем сами, чтобы его можно было закрыть при остановке и
+    // передать новому экземпляру. Владельцем станет server.
+    // Копии под надзирателем слушают порт вместе, каждая своим сокетом.
+    QTcpServer* listener = lifecycle::listen(host, config::integer("server/port", 8080), supervisor::is_worker());
+    if (listener == nullptr) {
+        return -1;
+    }
+    const quint16 port = listener->serverPort();
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+    if (!server.bind(listener)) {
+        qInfo() << "failed to bind listening socket";
+        return -1;
+    }
+#else
+    server.bind(listener);
+#endif
+#else
+    QTcpServer* listener = nullptr;
+    const quint16 port = server.listen(QHostAddress(host), config::integer("server/port", 8080));
     if (port == 0) {
         qInfo() << "failed to listen on port";
         return -1;
     }
+#endif
 
+    // Уведомления рассылает один процесс из всех, работающих с этой БД:
+    // копии под надзирателем или старый и новый экземпляр при передаче сокета.
+    supervisor::Leader notification_leader(db_path + "-notify.lock");
     QTimer notification_timer;
     notification_timer.setInterval(60 * 1000);
-    notification_timer.connect(&notification_timer, &QTimer::timeout, [&db]() {
-        Event::send_notifications(db);
+    notification_timer.connect(&notification_timer, &QTimer::timeout, [&storage, &notification_leader]() {
+        if (notification_leader.acquire()) {
+            Event::send_notifications(storage);
+        }
+    });
+    // После простоя сначала догоняем накопившееся пачками, потом -- обычные тики.
+    if (notification_leader.acquire()) {
+        Event::catch_up_notifications(storage, [&notification_timer]() {
+            notification_timer.start();
+        });
+    } else {
+        notification_timer.start();
+    }
+
+    // Очередь уведомлений разбирает тот же процесс.
+    QTimer deliver_timer;
+    deliver_timer.setInterval(config::integer("notifications/deliver_interval_ms", 1000));
+    deliver_timer.connect(&deliver_timer, &QTimer::timeout, [&storage, &notification_leader]() {
+        if (notification_leader.acquire()) {
+            Event::deliver_notifications(storage);
+        }
+    });
+    deliver_timer.start();
+
+    // Уборка -- тоже в одном процессе.
+    QTimer sweeper_timer;
+    sweeper_timer.setInterval(config::integer("sweeper/interval_ms", 5 * 60 * 1000));
+    sweeper_timer.connect(&sweeper_timer, &QTimer::timeout, [&storage, &notification_leader]() {
+        if (notification_leader.acquire()) {
+            sweeper::run(storage);
+        }
+    });
+    sweeper_timer.start();
+
+    // После SIGTERM ждем, пока доделается начатое, но не дольше drain_timeout_ms.
+    QTimer drain_timer;
+    drain_timer.setInterval(50);
+    QDeadlineTimer drain_deadline;
+    drain_timer.connect(&drain_timer, &QTimer::timeout, [&app, &drain_deadline]() {
+        if (lifecycle::busy() == 0) {
+            app.quit();
+        } else if (drain_deadline.hasExpired()) {
+            qCritical() << "Drain timed out," << lifecycle::busy() << "tasks still running";
+            app.quit();
+        }
+    });
+
+    lifecycle::watch_signals([&](lifecycle::Signal signal) {
+        if (signal == lifecycle::Signal::Handoff) {
+            // Под надзирателем копии перезапускает он, сокет не передается.
+            if (supervisor::is_worker() || listener == nullptr || lifecycle::stopping() || !lifecycle::hand_off(listener)) {
+                qCritical() << "Socket hand-off is not possible, still serving";
+            }
+            return;
+        }
+
+        if (lifecycle::stopping()) {
+            return;
+        }
+        qInfo() << "Shutting down," << lifecycle::busy() << "tasks to finish";
+        lifecycle::stop();
+        notification_timer.stop();
+        deliver_timer.stop();
+        sweeper_timer.stop();
+        if (listener != nullptr) {
+            // Новые соединения идут в очередь сокета у нового экземпляра,
+            // если он есть, иначе отвергаются.
+            listener->close();
+        }
+        drain_deadline.setRemainingTime(config::integer("server/drain_timeout_ms", 10000));
+        drain_timer.start();
     });
-    notification_timer.start();
 
-    // Maybe graceful shutdown later..
-    qInfo() << "Server is up on 127.0.0.1:8080";
-    return app.exec();
+    qInfo() << "Server is up on" << host << port;
+    lifecycle::release_predecessor();
+    const int exit_code = app.exec();
+
+    if (memory != nullptr) {
+        // Все, что пришло после последнего снимка.
+        snapshot_timer.stop();
+        if (!memory->save(snapshot_path)) {
+            qCritical() << "Failed to save the final snapshot";
+        }
+    } else {
+        // Переносим WAL в основной файл: следующему процессу не придется
+        // его разбирать.
+        shards.push_back(db);
+        for (QSqlDatabase& file: shards) {
+            QSqlQuery checkpoint(file);
+            if (!checkpoint.exec("PRAGMA wal_checkpoint(TRUNCATE)")) {
+                qCritical() << checkpoint.lastError().text();
+            }
+        }
+    }
+    storage_engine.reset();
+    for (QSqlDatabase& file: shards) {
+        file.close();
+    }
+    if (db.isOpen()) {
+        db.close();
+    }
+    qInfo() << "Server stopped";
+    return exit_code;
+}
+
+// verbov-server --enable-incremental-vacuum: разовый перевод БД (и шардов)
+// в auto_vacuum=INCREMENTAL. VACUUM переписывает файл целиком и мешает
+// остальным соединениям, так что запускать при остановленном сервере.
+static int enable_incremental_vacuum_command() {
+    const QString db_path = config::string("server/db_path", "db.sqlite3");
+    QStringList paths = {db_path};
+    if (config::string("storage/engine", "sqlite") == "sharded") {
+        const qint64 num_shards = std::max<qint64>(config::integer("storage/shards", 4), 1);
+        for (qint64 i = 0; i < num_shards; ++i) {
+            paths.append(storage::sibling_path(db_path, "shard" + QString::number(i)));
+        }
+    }
+
+    bool ok = true;
+    for (const QString& path: paths) {
+        if (!QFile::exists(path)) {
+            continue;
+        }
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", path);
+            db.setDatabaseName(path);
+            if (!db.open()) {
+                qCritical() << "failed to open" << path << ":" << db.lastError().text();
+                ok = false;
+            } else {
+                ok = storage::enable_incremental_vacuum(db) && ok;
+                db.close();
+            }
+        }
+        QSqlDatabase::removeDatabase(path);
+    }
+    return ok ? 0 : -2;
 }
 
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
 
-    qInfo() << "run_tests: " << run_tests();
+    if (!config::load(qEnvironmentVariable("VERBOV_CONFIG", "verbov-server.ini"))) {
+        return -4;
+    }
+
+    if (app.arguments().contains("--enable-incremental-vacuum")) {
+        return enable_incremental_vacuum_command();
+    }
+
+    // Копии не трогают тестовую БД: она одна на всех.
+    if (!supervisor::is_worker()) {
+        qInfo() << "run_tests: " << run_tests();
+    }
+
+    qint64 workers = config::integer("server/workers", 1);
+    if (workers > 1 && config::string("storage/engine", "sqlite") == "memory") {
+        // У каждой копии было бы свое содержимое.
+        qCritical() << "storage/engine=memory works in a single process, ignoring server/workers";
+        workers = 1;
+    }
+    if (workers > 1 && !supervisor::is_worker()) {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0) && defined(Q_OS_UNIX)
+        return supervisor::run(app, workers);
+#else
+        qCritical() << "server/workers needs Qt 6.4+ on a Unix system, running a single process";
+#endif
+    }
 
     // int error_code = 0;
     // QString error_msg;
@@ -0,0 +1,302 @@
+#include "metrics.h"
+
+#include <atomic>
+#include <iterator>
+#include <vector>
+
+#include <QDebug>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+namespace {
+
+enum class Kind {
+    Counter,
+    Gauge,
+    Histogram,
+};
+
+// Слотов на поток. По 8 байт, 128 КиБ на поток, потоков у нас немного.
+constexpr quint32 max_slots = 16384;
+constexpr quint32 max_gauges = 1024;
+constexpr quint32 invalid_index = ~quint32(0);
+
+// Границы корзин гистограмм длительностей, в секундах.
+constexpr double bucket_bounds[] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+constexpr quint32 num_bounds = std::size(bucket_bounds);
+// Корзины (последняя -- +Inf), сумма в наносекундах, количество.
+constexpr quint32 sum_offset = num_bounds + 1;
+constexpr quint32 count_offset = num_bounds + 2;
+constexpr quint32 histogram_width = num_bounds + 3;
+
+struct Shard {
+    std::atomic<quint64> slots[max_slots] {};
+};
+
+struct Series {
+    QByteArray labels; // Уже в виде a="b",c="d".
+    quint32 index;
+};
+
+struct Family {
+    QByteArray name;
+    QByteArray help;
+    Kind kind;
+    QList<Series> series;
+};
+
+struct Registry {
+    QMutex mutex;
+
+    QList<Family> families;
+    QHash<QByteArray, qsizetype> family_index;
+    // Ключ -- имя и метки: name{a="b"}.
+    QHash<QByteArray, quint32> series_index;
+
+    quint32 next_slot = 0;
+    quint32 next_gauge = 0;
+
+    // Массивы слотов всех потоков. Не освобождаются и после завершения
+    // потока: счетчики Prometheus не должны уменьшаться.
+    std::vector<Shard*> shards;
+
+    std::atomic<qint64> gauges[max_gauges] {};
+};
+
+Registry& registry() {
+    // Создается при первом обращении, порядок инициализации
+    // глобальных объектов нам не важен.
+    static Registry instance;
+    return instance;
+}
+
+Shard& local_shard() {
+    thread_local Shard* shard = nullptr;
+    if (shard == nullptr) {
+        shard = new Shard();
+
+        Registry& r = registry();
+        QMutexLocker locker(&r.mutex);
+        r.shards.push_back(shard);
+    }
+    return *shard;
+}
+
+QByteArray escape_label_value(const QString& value) {
+    QByteArray escaped;
+    for (char c: value.toUtf8()) {
+        switch (c) {
+        case '\\': escaped += "\\\\"; break;
+        case '"':  escaped += "\\\""; break;
+        case '\n': escaped += "\\n";  break;
+        default:   escaped += c;
+        }
+    }
+    return escaped;
+}
+
+QByteArray render_labels(const metrics::Labels& labels) {
+    QByteArray rendered;
+    for (const auto& [name, value]: labels) {
+        if (!rendered.isEmpty()) {
+            rendered += ',';
+        }
+        rendered += name.toUtf8() + "=\"" + escape_label_value(value) + '"';
+    }
+    return rendered;
+}
+
+const char* kind_name(Kind kind) {
+    switch (kind) {
+    case Kind::Counter:   return "counter";
+    case Kind::Gauge:     return "gauge";
+    case Kind::Histogram: return "histogram";
+    }
+    return "untyped";
+}
+
+quint32 register_series(const char* name, const char* help, Kind kind, const metrics::Labels& labels) {
+    const QByteArray rendered = render_labels(labels);
+    const QByteArray key = QByteArray(name) + '{' + rendered + '}';
+
+    // Ряды с метками из запроса (маршрут, код ответа) регистрируются на
+    // каждый вызов. Повторно находим их в кэше потока, без блокировки.
+    thread_local QHash<QByteArray, quint32> cache;
+    auto cached = cache.constFind(key);
+    if (cached != cache.constEnd()) {
+        return *cached;
+    }
+
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+
+    quint32 index = invalid_index;
+
+    auto found = r.series_index.constFind(key);
+    if (found != r.series_index.constEnd()) {
+        index = *found;
+    } else {
+        auto family_it = r.family_index.constFind(QByteArray(name));
+        if (family_it == r.family_index.constEnd()) {
+            r.families.push_back(Family{name, help, kind, {}});
+            family_it = r.family_index.insert(QByteArray(name), r.families.size() - 1);
+        }
+        Family& family = r.families[*family_it];
+
+        if (family.kind != kind) {
+            // Ошибка программиста: одно имя у метрик разных типов.
+            qCritical() << "metric" << name << "registered with different types";
+            return invalid_index;
+        }
+
+        if (kind == Kind::Gauge) {
+            if (r.next_gauge < max_gauges) {
+                index = r.next_gauge++;
+            }
+        } else {
+            const quint32 width = kind == Kind::Histogram ? histogram_width : 1;
+            if (r.next_slot + width <= max_slots) {
+                index = r.next_slot;
+                r.next_slot += width;
+            }
+        }
+
+        if (index == invalid_index) {
+            // Ряд просто не будет считаться, сервер продолжит работать.
+            qWarning() << "out of metric slots, dropping" << key;
+        } else {
+            family.series.push_back(Series{rendered, index});
+        }
+        r.series_index.insert(key, index);
+    }
+
+    locker.unlock();
+    cache.insert(key, index);
+
+    return index;
+}
+
+quint64 sum_slot(const Registry& r, quint32 slot) {
+    quint64 sum = 0;
+    for (const Shard* shard: r.shards) {
+        sum += shard->slots[slot].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+QByteArray with_labels(const QByteArray& labels, const QByteArray& extra = QByteArray()) {
+    if (labels.isEmpty() && extra.isEmpty()) {
+        return QByteArray();
+    }
+    if (labels.isEmpty()) {
+        return '{' + extra + '}';
+    }
+    if (extra.isEmpty()) {
+        return '{' + labels + '}';
+    }
+    return '{' + labels + ',' + extra + '}';
+}
+
+} // namespace
+
+void metrics::Counter::inc(quint64 value) const {
+    if (slot_ == invalid_index) {
+        return;
+    }
+    local_shard().slots[slot_].fetch_add(value, std::memory_order_relaxed);
+}
+
+void metrics::Gauge::set(qint64 value) const {
+    if (index_ == invalid_index) {
+        return;
+    }
+    registry().gauges[index_].store(value, std::memory_order_relaxed);
+}
+
+void metrics::Gauge::add(qint64 value) const {
+    if (index_ == invalid_index) {
+        return;
+    }
+    registry().gauges[index_].fetch_add(value, std::memory_order_relaxed);
+}
+
+void metrics::Histogram::observe(double seconds) const {
+    if (first_slot_ == invalid_index) {
+        return;
+    }
+    if (seconds < 0) {
+        seconds = 0;
+    }
+
+    quint32 bucket = 0;
+    while (bucket < num_bounds && seconds > bucket_bounds[bucket]) {
+        ++bucket;
+    }
+
+    Shard& shard = local_shard();
+    shard.slots[first_slot_ + bucket].fetch_add(1, std::memory_order_relaxed);
+    shard.slots[first_slot_ + sum_offset].fetch_add(static_cast<quint64>(seconds * 1e9), std::memory_order_relaxed);
+    shard.slots[first_slot_ + count_offset].fetch_add(1, std::memory_order_relaxed);
+}
+
+metrics::Counter metrics::counter(const char* name, const char* help, const Labels& labels) {
+    return Counter(register_series(name, help, Kind::Counter, labels));
+}
+
+metrics::Gauge metrics::gauge(const char* name, const char* help, const Labels& labels) {
+    return Gauge(register_series(name, help, Kind::Gauge, labels));
+}
+
+metrics::Histogram metrics::histogram(const char* name, const char* help, const Labels& labels) {
+    return Histogram(register_series(name, help, Kind::Histogram, labels));
+}
+
+QByteArray metrics::render() {
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+
+    QByteArray out;
+    for (const Family& family: r.families) {
+        out += "# HELP " + family.name + ' ' + family.help + '\n';
+        out += "# TYPE " + family.name + ' ' + kind_name(family.kind) + '\n';
+
+        for (const Series& series: family.series) {
+            switch (family.kind) {
+            case Kind::Counter:
+                out += family.name + with_labels(series.labels) + ' '
+                     + QByteArray::number(sum_slot(r, series.index)) + '\n';
+                break;
+
+            case Kind::Gauge:
+                out += family.name + with_labels(series.labels) + ' '
+                     + QByteArray::number(r.gauges[series.index].load(std::memory_order_relaxed)) + '\n';
+                break;
+
+            case Kind::Histogram: {
+                // В формате Prometheus корзины накопительные.
+                quint64 cumulative = 0;
+                for (quint32 bucket = 0; bucket <= num_bounds; ++bucket) {
+                    cumulative += sum_slot(r, series.index + bucket);
+                    const QByteArray le = bucket < num_bounds
+                        ? QByteArray::number(bucket_bounds[bucket], 'g', 6)
+                        : QByteArray("+Inf");
+                    out += family.name + "_bucket" + with_labels(series.labels, "le=\"" + le + '"') + ' '
+                         + QByteArray::number(cumulative) + '\n';
+                }
+
+                const double sum_seconds = sum_slot(r, series.index + sum_offset) / 1e9;
+                out += family.name + "_sum" + with_labels(series.labels) + ' '
+                     + QByteArray::number(sum_seconds, 'f', 9) + '\n';
+                out += family.name + "_count" + with_labels(series.labels) + ' '
+                     + QByteArray::number(sum_slot(r, series.index + count_offset)) + '\n';
+                break;
+            }
+            }
+        }
+    }
+
+    return out;
+}
@@ -0,0 +1,91 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <utility>
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+// Метрики в текстовом формате Prometheus.
+// https://prometheus.io/docs/instrumenting/exposition_formats/
+//
+// Значения счетчиков и гистограмм лежат в слотах, у каждого потока свой
+// массив слотов. Поток пишет только в свой массив атомарным relaxed
+// сложением, без блокировок. При выдаче /metrics массивы всех потоков
+// складываются. Блокировка берется только при регистрации ряда и при выдаче.
+//
+// Регистрация ряда (metrics::counter(...) и т.п.) дороже записи, на горячем
+// пути ее лучше делать один раз, например в static переменной.
+namespace metrics {
+    using Labels = QList<std::pair<QString, QString>>;
+
+    class Counter {
+    public:
+        Counter() = default;
+        void inc(quint64 value = 1) const;
+        // Обычно создается через metrics::counter().
+        explicit Counter(quint32 slot) : slot_(slot) {}
+    private:
+        quint32 slot_ = ~quint32(0);
+    };
+
+    // В отличие от счетчиков, одно значение на процесс, не складывается по потокам.
+    class Gauge {
+    public:
+        Gauge() = default;
+        void set(qint64 value) const;
+        void add(qint64 value) const;
+        // Обычно создается через metrics::gauge().
+        explicit Gauge(quint32 index) : index_(index) {}
+    private:
+        quint32 index_ = ~quint32(0);
+    };
+
+    // Гистограмма длительностей в секундах с фиксированными границами корзин.
+    class Histogram {
+    public:
+        Histogram() = default;
+        void observe(double seconds) const;
+        // Обычно создается через metrics::histogram().
+        explicit Histogram(quint32 first_slot) : first_slot_(first_slot) {}
+    private:
+        quint32 first_slot_ = ~quint32(0);
+    };
+
+    Counter counter(const char* name, const char* help, const Labels& labels = {});
+    Gauge gauge(const char* name, const char* help, const Labels& labels = {});
+    Histogram histogram(const char* name, const char* help, const Labels& labels = {});
+
+    // Все зарегистрированные ряды в текстовом формате Prometheus.
+    QByteArray render();
+
+    // Замеряет время жизни объекта.
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(const Histogram& histogram)
+            : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() {
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+            histogram_.observe(elapsed.count());
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+    private:
+        // Копия, а не ссылка: хендл маленький, а таймер часто
+        // создают от временного объекта.
+        const Histogram histogram_;
+        std::chrono::steady_clock::time_point start_;
+    };
+}
+
+// Время SQL-запросов метода сущности, например SQL_TIMER("User::create").
+// Ряд регистрируется один раз, при первом вызове метода.
+#define SQL_TIMER(method) \
+    static const metrics::Histogram sql_duration_histogram = metrics::histogram( \
+        "verbov_sql_duration_seconds", "SQL statement duration by entity method.", {{"method", method}}); \
+    metrics::ScopedTimer sql_duration_timer(sql_duration_histogram)
+
+#endif // METRICS_H
@@ -1,29 +1,34 @@
 #include "DB/event.h"
 
-#include <QSqlError>
-#include <QSqlQuery>
+#include <algorithm>
+#include <limits>
+#include <memory>
+
 #include <QTimeZone>
 #include <QDateTime>
+#include <QQueue>
+#include <QSet>
+#include <QTimer>
 
+#include "DB/notification.h"
+#include "DB/storage.h"
 #include "DB/user.h"
+#include "config.h"
+#include "lifecycle.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "timesource.h"
+#include "trace.h"
 #include "vk.h"
 
 QMutex Event::notification_mutex;
 
-void Event::send_notifications_of_level(QSqlDatabase& db, quint64 now, int level) {
+bool Event::send_notifications_of_level(storage::Storage& storage, quint64 now, int level, int limit, qint64& num_pending) {
     assert(level >= 1 && level <= 6);
 
-    QSqlQuery pending_events;
-    if (!pending_events.prepare(
-            "SELECT * FROM " + table_name + " WHERE last_notification_level < :level AND "
-                                            "timestamp  > :now AND "
-                                            "timestamp <= :now + :level_time_advance AND "
-                                            "timestamp  > :now + :next_level_time_advance"
-            )) {
-        // Failed to execute the query.
-        qCritical() << pending_events.lastError().text();
-        return;
-    }
+    const metrics::Counter messages_enqueued = metrics::counter(
+        "verbov_notification_enqueued_total", "Notification messages put into the outbox by level.",
+        {{"level", QString::number(level)}});
 
     // 0 -- never notified
     // 1 -- notified week before the event (if between event creation and it's occurence there is a week)
@@ -55,25 +60,16 @@ void Event::send_notifications_of_level(QSqlDatabase& db, quint64 now, int level
         "осталось менее 20 минут"
     };
 
-    pending_events.bindValue(":level", level);
-    pending_events.bindValue(":now", now);
-    pending_events.bindValue(":level_time_advance", level_time_advances[level]);
-    pending_events.bindValue(":next_level_time_advance", level_time_advances[level + 1]);
-
-    if (!pending_events.exec()) {
-        // Failed to execute the query.
-        qCritical() << pending_events.lastError().text();
-        return;
+    // Параметры: уровень, сейчас + отступ следующего уровня, сейчас + отступ уровня.
+    // Отступ следующего уровня не меньше нуля, так что прошедшие события
+    // не попадают.
+    QVector<Event> pending_events;
+    if (!storage.fetch_events_due(level, now + level_time_advances[level + 1], now + level_time_advances[level], limit, pending_events)) {
+        return false;
     }
 
-    // https://doc.qt.io/qt-6/qsqlquery.html#next
-    while (pending_events.next()) {
-        Event event;
-
-        if (!event.unpack_from_query(pending_events)) {
-            // Failed to unpack. Treat as a failed query.
-            break;
-        }
+    for (Event& event: pending_events) {
+        ++num_pending;
 
         assert(event.last_notification_level < level);
 
@@ -90,46 +86,35 @@ void Event::send_notifications_of_level(QSqlDatabase& db, quint64 now, int level
             "До события \"" + event.name + "\" (" + event_dt.toString()
             + ") " + level_description[level] + ".";
 
-        // Отсылаем сообщение создателю события.
-
-        std::optional<User> maybe_user;
-        if (!User::fetch_by_vk_id(db, event.creator_user_id, maybe_user)) {
-            // Какая-то ошибка с БД. Выходим. Многим событиям
-            // не будет доставлено уведомление, зато мы увидим
-            // ошибку быстро.
-            break;
-        }
-
-        // Ну, это всегда должно выполняться.
-        // ON DELETE RESTRICT же на creator_user_id стоит в БД.
-        // Если это не так, узнаем в отладочной версии.
-        assert(maybe_user.has_value());
-        if (maybe_user.has_value()) {
-            int vk_error_code = 0;
-            QString vk_error_msg;
-            if (!vk::send_message(maybe_user->get_vk_id(), msg_text, 0, vk_error_code, vk_error_msg)) {
-                qInfo() << "Ошибка VK api при отправке уведомлений. " << vk_error_code << vk_error_msg;
-            }
-        }
-
+        // Получатели: создатель и участники, каждый по разу (создатель
+        // может и сам участвовать в своем событии).
         QVector<User> participants;
-        if (!User::fetch_by_event_id(db, event.get_id(), participants)) {
+        if (!storage.fetch_event_users(event.get_id(), participants)) {
             // Какая-то ошибка с БД. Выходим. Многим событиям
             // не будет доставлено уведомление, зато мы увидим
             // ошибку быстро.
-            break;
+            return false;
         }
 
+        QVector<Notification> notifications;
+        QSet<quint64> recipients;
+        recipients.insert(event.creator_user_id);
+        notifications.push_back(Notification(event.get_id(), event.timestamp, level, event.creator_user_id, msg_text));
         for (const User& user: participants) {
-            int vk_error_code = 0;
-            QString vk_error_msg;
-            if (!vk::send_message(maybe_user->get_vk_id(), msg_text, 0, vk_error_code, vk_error_msg)) {
-                qInfo() << "Ошибка VK api при отправке уведомлений. " << vk_error_code << vk_error_msg;
+            if (!recipients.contains(user.get_vk_id())) {
+                recipients.insert(user.get_vk_id());
+                notifications.push_back(Notification(event.get_id(), event.timestamp, level, user.get_vk_id(), msg_text));
             }
         }
+        for (Notification& notification: notifications) {
+            notification.next_attempt_at = now;
+        }
 
+        // Сообщения и новый уровень -- одной транзакцией. Отправляет их
+        // deliver_notifications, так что сбой здесь ничего не теряет и
+        // не отправляет дважды.
         event.last_notification_level = level;
-        if (!event.update(db)) {
+        if (!storage.enqueue_notifications(event, notifications)) {
             // Failed to save new notification level.
             // Stop for now..
             // This way any problem is easy to see:
@@ -142,19 +127,332 @@ void Event::send_notifications_of_level(QSqlDatabase& db, quint64 now, int level
             // Зато в целом работает... Нет, давайте лучше
             // все ловить проблемы, т.к. при нормальной
             // работе их здесь не должно быть вообще.
+            return false;
+        }
+        messages_enqueued.inc(notifications.size());
+
+        // Сервер останавливается. Уровень этого события уже сохранен,
+        // остальные события дождутся следующего тика после перезапуска.
+        if (lifecycle::stopping()) {
             break;
         }
     }
+    return true;
 }
 
-void Event::send_notifications(QSqlDatabase& db) {
+void Event::send_notifications(storage::Storage& storage) {
     QMutexLocker locker(&Event::notification_mutex);
 
     // Фиксируем текущее время. Так проще рассуждать о корректности
     // (должно быть).
-    const quint64 now = QDateTime::currentSecsSinceEpoch();
+    const quint64 now = timesource::now();
+
+    static const metrics::Histogram tick_duration = metrics::histogram(
+        "verbov_notification_tick_duration_seconds", "Duration of one notification tick.");
+    static const metrics::Gauge backlog = metrics::gauge(
+        "verbov_notification_backlog_events", "Events due for a notification at the start of the last tick.");
+    metrics::ScopedTimer timer(tick_duration);
+    trace::Span span("notifications::tick", "notifications", trace::Span::Kind::Root);
+    // Тик только пишет в БД, но остановка все равно дождется его конца.
+    lifecycle::Busy busy;
+
+    qint64 num_pending = 0;
+    for (int level = 1; level <= 6 && !lifecycle::stopping(); ++level) {
+        Event::send_notifications_of_level(storage, now, level, std::numeric_limits<int>::max(), num_pending);
+    }
+    backlog.set(num_pending);
+}
+
+void Event::catch_up_notifications(storage::Storage& storage, std::function<void()> done) {
+    static const int batch_size = std::max<int>(config::integer("notifications/catch_up_batch", 200), 1);
+    static const int pause_ms = config::integer("notifications/catch_up_pause_ms", 100);
+    static const metrics::Counter caught_up = metrics::counter(
+        "verbov_notification_catch_up_events_total", "Events queued by the startup catch-up pass.");
 
-    for (int level = 1; level <= 6; ++level) {
-        Event::send_notifications_of_level(db, now, level);
+    if (lifecycle::stopping()) {
+        return;
+    }
+
+    qint64 num_pending = 0;
+    bool ok = true;
+    {
+        QMutexLocker locker(&Event::notification_mutex);
+        const quint64 now = timesource::now();
+        trace::Span span("notifications::catch_up", "notifications", trace::Span::Kind::Root);
+        lifecycle::Busy busy;
+
+        // Окна уровней не пересекаются, так что событие попадает ровно в
+        // одно -- текущего уровня, пропущенные уровни не отправляются.
+        // Сначала самые срочные.
+        for (int level = 6; level >= 1 && ok && num_pending < batch_size && !lifecycle::stopping(); --level) {
+            ok = Event::send_notifications_of_level(storage, now, level, batch_size - num_pending, num_pending);
+        }
+    }
+    caught_up.inc(num_pending);
+
+    // Неполная пачка -- накопившееся кончилось. При ошибке БД дальше
+    // работают обычные тики: каждые 60 секунд, а не каждые pause_ms.
+    if (!ok || num_pending < batch_size) {
+        qInfo() << "Notification catch-up done";
+        done();
+        return;
     }
+
+    // Между пачками цикл событий обслуживает запросы.
+    QTimer::singleShot(pause_ms, [&storage, done = std::move(done)]() mutable {
+        Event::catch_up_notifications(storage, std::move(done));
+    });
+}
+
+// Итог отправки одного сообщения для verbov_notification_messages_total.
+static void count_message(quint8 level, const char* result) {
+    metrics::counter(
+        "verbov_notification_messages_total", "Notification messages by level and outcome.",
+        {{"level", QString::number(level)}, {"result", result}}
+    ).inc();
+}
+
+// Отправка из очереди. Сообщения уходят параллельно: до
+// notifications/max_in_flight вызовов messages.send одновременно, все в
+// главном потоке -- ответов ждет цикл событий, а не поток. Соединения
+// QSqlDatabase все равно привязаны к своему потоку.
+//
+// Строка очереди, взятая в работу, остается в БД до ответа VK, так что
+// id взятых хранятся в taken: повторная выборка их пропускает.
+namespace {
+    struct Delivery {
+        QQueue<Notification> queue;
+        QSet<quint64> taken;
+        int in_flight = 0;
+        // Ждем токена в ведре.
+        bool pump_scheduled = false;
+    };
+}
+static Delivery delivery;
+
+static ratelimit::Limiter& vk_limiter() {
+    // Ограничения VK для сообщества -- около 20 сообщений в секунду.
+    // Ведро одно на процесс: рассылает только лидер.
+    static ratelimit::Limiter limiter(
+        config::real("notifications/rate_per_second", 20),
+        config::real("notifications/burst", 20),
+        1);
+    return limiter;
+}
+
+static const metrics::Gauge& in_flight_gauge() {
+    static const metrics::Gauge gauge = metrics::gauge(
+        "verbov_notification_in_flight", "messages.send calls waiting for VK.");
+    return gauge;
+}
+
+static void pump(storage::Storage& storage);
+
+// Ответ VK на сводку: все ее строки очереди разделяют судьбу.
+static void finish(storage::Storage& storage, QVector<Notification> digest, int vk_error_code, const QString& vk_error_msg) {
+    static const quint32 max_attempts = config::integer("notifications/max_attempts", 8);
+    static const quint64 retry_base_s = config::integer("notifications/retry_base_s", 30);
+    static const quint64 retry_max_s = config::integer("notifications/retry_max_s", 60 * 60);
+
+    --delivery.in_flight;
+    in_flight_gauge().set(delivery.in_flight);
+
+    if (vk_error_code != 0) {
+        qInfo() << "Ошибка VK api при отправке уведомлений. " << vk_error_code << vk_error_msg;
+    }
+    const quint64 now = timesource::now();
+    for (Notification& notification: digest) {
+        delivery.taken.remove(notification.get_id());
+
+        if (vk_error_code == 0) {
+            // Если упадем до удаления, повтор VK отбросит по random_id.
+            if (storage.drop_notification(notification)) {
+                count_message(notification.level, "sent");
+            }
+            continue;
+        }
+
+        // attempts уже увеличил pump перед отправкой.
+        if (vk::is_transient_error(vk_error_code) && notification.attempts < max_attempts) {
+            // Экспоненциально: base, 2 * base, 4 * base, ... но не больше max.
+            // У строк одной сводки время одно и то же, так что и в следующий
+            // раз они, скорее всего, будут выбраны вместе.
+            const quint64 delay = std::min(retry_base_s << std::min<quint32>(notification.attempts - 1, 20), retry_max_s);
+            notification.next_attempt_at = now + delay;
+            if (storage.update_notification(notification)) {
+                count_message(notification.level, "retried");
+            }
+        } else if (storage.drop_notification(notification)) {
+            // Пользователь запретил сообщения и т.п.: повтор не поможет.
+            count_message(notification.level, "failed");
+        }
+    }
+
+    // Освободилось место.
+    pump(storage);
+}
+
+// Строка очереди еще актуальна: событие могли удалить или перенести, пока
+// сообщение ждало. Неактуальная удаляется. false -- ошибка БД.
+static bool check_current(storage::Storage& storage, const Notification& notification, bool& current) {
+    std::optional<Event> event;
+    if (!storage.fetch_event(notification.event_id, event)) {
+        return false;
+    }
+    current = event.has_value() && event->last_notification_level >= notification.level;
+    if (!current) {
+        Notification stale = notification;
+        delivery.taken.remove(stale.get_id());
+        if (storage.drop_notification(stale)) {
+            count_message(stale.level, "dropped");
+        }
+    }
+    return true;
+}
+
+// Забирает из delivery.queue сводку для получателя первой строки: все его
+// строки в очереди, пока текст не длиннее notifications/digest_max_chars.
+// Уже отправлявшиеся строки (attempts > 0) собираются только с теми, с
+// кем уходили, -- по общему random_id: ответ VK мог потеряться, и повтор
+// должен прийти с тем же random_id, иначе сообщение придет дважды.
+// Пустая сводка и true -- очередь кончилась, false -- ошибка БД.
+static bool take_digest(storage::Storage& storage, QVector<Notification>& digest, QString& text) {
+    static const qsizetype max_chars = config::integer("notifications/digest_max_chars", 4000);
+
+    digest.clear();
+    text.clear();
+    while (digest.isEmpty() && !delivery.queue.isEmpty()) {
+        bool current = false;
+        if (!check_current(storage, delivery.queue.head(), current)) {
+            return false;
+        }
+        Notification notification = delivery.queue.dequeue();
+        if (current) {
+            text = notification.text;
+            digest.push_back(std::move(notification));
+        }
+    }
+    if (digest.isEmpty()) {
+        return true;
+    }
+
+    const quint64 recipient_vk_id = digest[0].recipient_vk_id;
+    const bool resend = digest[0].attempts > 0;
+    const qint64 random_id = digest[0].random_id;
+    for (qsizetype i = 0; i < delivery.queue.size();) {
+        const Notification& notification = delivery.queue[i];
+        const bool fits = resend
+            ? notification.attempts > 0 && notification.random_id == random_id
+            : notification.attempts == 0 && text.size() + 1 + notification.text.size() <= max_chars;
+        if (notification.recipient_vk_id != recipient_vk_id || !fits) {
+            ++i;
+            continue;
+        }
+
+        bool current = false;
+        if (!check_current(storage, notification, current)) {
+            return false;
+        }
+        if (current) {
+            text += "\n" + notification.text;
+            digest.push_back(notification);
+        }
+        delivery.queue.removeAt(i);
+    }
+    return true;
+}
+
+// Отправляет из delivery.queue, пока есть место и токены. Один вызов
+// messages.send на получателя, а не на каждое его событие.
+static void pump(storage::Storage& storage) {
+    static const int max_in_flight = std::max<int>(config::integer("notifications/max_in_flight", 8), 1);
+    // Вместе с verbov_notification_messages_total показывает, сколько
+    // строк очереди в среднем уходит одним сообщением.
+    static const metrics::Counter digests_started = metrics::counter(
+        "verbov_notification_digests_total", "VK messages started for outbox digests.");
+    static const metrics::Counter digest_rows = metrics::counter(
+        "verbov_notification_digest_rows_total", "Outbox rows put into VK messages.");
+
+    while (!lifecycle::stopping() && delivery.in_flight < max_in_flight && !delivery.queue.isEmpty()) {
+        // Токен берем до сборки сводки, чтобы не собирать ее зря.
+        qint64 retry_after_ms = 0;
+        if (vk_limiter().enabled() && !vk_limiter().take("vk", retry_after_ms)) {
+            if (!delivery.pump_scheduled) {
+                delivery.pump_scheduled = true;
+                QTimer::singleShot(static_cast<int>(std::max<qint64>(retry_after_ms, 1)), [&storage]() {
+                    delivery.pump_scheduled = false;
+                    pump(storage);
+                });
+            }
+            break;
+        }
+
+        QVector<Notification> digest;
+        QString text;
+        if (!take_digest(storage, digest, text)) {
+            // Ошибка БД. Остаток очереди попробуем на следующем тике.
+            break;
+        }
+        if (digest.isEmpty()) {
+            break;
+        }
+
+        // Сначала сохраняем в строках random_id сводки и попытку: если
+        // упадем, не дождавшись ответа, повтор соберет ту же сводку.
+        const qint64 random_id = Notification::make_digest_random_id(digest);
+        bool saved = true;
+        for (Notification& notification: digest) {
+            notification.random_id = random_id;
+            ++notification.attempts;
+            saved = saved && storage.update_notification(notification);
+        }
+        if (!saved) {
+            // Ошибка БД. Строки выберем снова на следующем тике.
+            for (const Notification& notification: std::as_const(digest)) {
+                delivery.taken.remove(notification.get_id());
+            }
+            break;
+        }
+        digests_started.inc();
+        digest_rows.inc(digest.size());
+
+        ++delivery.in_flight;
+        in_flight_gauge().set(delivery.in_flight);
+        // Остановка сервера дождется ответа.
+        auto busy = std::make_shared<lifecycle::Busy>();
+        vk::send_message_async(
+            digest[0].recipient_vk_id, text, random_id,
+            [&storage, digest, busy](int vk_error_code, const QString& vk_error_msg) {
+                finish(storage, digest, vk_error_code, vk_error_msg);
+            });
+    }
+}
+
+void Event::deliver_notifications(storage::Storage& storage) {
+    static const int batch_size = config::integer("notifications/batch", 100);
+
+    if (lifecycle::stopping()) {
+        return;
+    }
+
+    // Добираем очередь до пачки. Взятые в работу строки еще в БД, поэтому
+    // выбираем с запасом на них.
+    if (delivery.queue.size() < batch_size) {
+        TRACE_SPAN("notifications::deliver", "notifications");
+        QVector<Notification> ready;
+        if (!storage.fetch_ready_notifications(timesource::now(), batch_size + delivery.taken.size(), ready)) {
+            return;
+        }
+        for (const Notification& notification: ready) {
+            if (delivery.queue.size() >= batch_size) {
+                break;
+            }
+            if (!delivery.taken.contains(notification.get_id())) {
+                delivery.taken.insert(notification.get_id());
+                delivery.queue.enqueue(notification);
+            }
+        }
+    }
+
+    pump(storage);
 }
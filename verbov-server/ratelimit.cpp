@@ -0,0 +1,125 @@
+#include "ratelimit.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "config.h"
+#include "metrics.h"
+
+namespace ratelimit {
+    Limiter::Limiter(double rate, double burst, qsizetype max_keys)
+        : rate_(rate), burst_(std::max(burst, 1.0)), max_keys_(std::max<qsizetype>(max_keys, 1)) {
+        clock_.start();
+    }
+
+    bool Limiter::take(const QString& key, qint64& retry_after_ms) {
+        if (!enabled()) {
+            return true;
+        }
+
+        QMutexLocker locker(&mutex_);
+        const qint64 now_ms = clock_.elapsed();
+
+        if (buckets_.size() >= max_keys_ && !buckets_.contains(key)) {
+            evict_full(now_ms);
+        }
+
+        auto it = buckets_.find(key);
+        if (it == buckets_.end()) {
+            it = buckets_.insert(key, Bucket{burst_, now_ms});
+        } else {
+            it->tokens = std::min(burst_, it->tokens + (now_ms - it->updated_ms) * rate_ / 1000);
+            it->updated_ms = now_ms;
+        }
+
+        if (it->tokens < 1) {
+            retry_after_ms = static_cast<qint64>(std::ceil((1 - it->tokens) * 1000 / rate_));
+            return false;
+        }
+
+        it->tokens -= 1;
+        return true;
+    }
+
+    void Limiter::evict_full(qint64 now_ms) {
+        // Ведро наполняется за burst / rate секунд.
+        const qint64 refill_ms = static_cast<qint64>(burst_ * 1000 / rate_);
+        for (auto it = buckets_.begin(); it != buckets_.end();) {
+            if (now_ms - it->updated_ms >= refill_ms) {
+                it = buckets_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (buckets_.size() >= max_keys_) {
+            // Все ведра свежие: ключей слишком много, например при переборе.
+            // Забываем всех, это лишь на время ослабляет ограничение.
+            buckets_.clear();
+        }
+    }
+
+    // rate -- запросов в секунду на ключ, burst -- сколько можно сразу.
+    Limiter& by_ip() {
+        static Limiter limiter(
+            config::real("ratelimit/ip_rate", 5), config::real("ratelimit/ip_burst", 20),
+            config::integer("ratelimit/max_keys", 100000));
+        return limiter;
+    }
+
+    Limiter& by_token() {
+        static Limiter limiter(
+            config::real("ratelimit/token_rate", 10), config::real("ratelimit/token_burst", 30),
+            config::integer("ratelimit/max_keys", 100000));
+        return limiter;
+    }
+
+    Limiter& by_profile() {
+        // Каждый запрос с vk_profile -- вызов VK API, так что ведро маленькое.
+        static Limiter limiter(
+            config::real("ratelimit/profile_rate", 0.2), config::real("ratelimit/profile_burst", 3),
+            config::integer("ratelimit/max_keys", 100000));
+        return limiter;
+    }
+
+    static std::atomic<qint64> in_flight = 0;
+    // Скользящее среднее времени обработки, мкс.
+    static std::atomic<qint64> average_us = 0;
+
+    static const metrics::Gauge& in_flight_gauge() {
+        static const metrics::Gauge gauge = metrics::gauge(
+            "verbov_http_requests_in_flight", "HTTP requests currently being handled.");
+        return gauge;
+    }
+
+    InFlight::InFlight() {
+        ++in_flight;
+        in_flight_gauge().add(1);
+        timer_.start();
+    }
+
+    InFlight::~InFlight() {
+        // Вес нового замера 1/8: пара медленных запросов не включает сброс,
+        // а долгая медленная полоса включает за несколько запросов.
+        const qint64 elapsed_us = timer_.nsecsElapsed() / 1000;
+        const qint64 average = average_us.load(std::memory_order_relaxed);
+        average_us.store(average + (elapsed_us - average) / 8, std::memory_order_relaxed);
+
+        --in_flight;
+        in_flight_gauge().add(-1);
+    }
+
+    bool overloaded() {
+        static const qint64 max_in_flight = config::integer("ratelimit/max_in_flight", 64);
+        static const qint64 max_latency_ms = config::integer("ratelimit/max_latency_ms", 2000);
+
+        const qint64 depth = in_flight.load();
+        if (max_in_flight > 0 && depth >= max_in_flight) {
+            return true;
+        }
+        // Среднее обновляется только завершенными запросами. Без запросов в
+        // обработке пропускаем: иначе после всплеска его некому обновить.
+        return max_latency_ms > 0 && depth > 0
+            && average_us.load(std::memory_order_relaxed) > max_latency_ms * 1000;
+    }
+}
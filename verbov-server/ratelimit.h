@@ -0,0 +1,70 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+// Ограничение частоты запросов и сброс нагрузки.
+//
+// /register и /login на каждый запрос ходят в VK API и пишут в БД, так что
+// поток мусорных запросов съедает и квоту VK, и время настоящих
+// пользователей. Перед обработчиком маршрута запрос проходит:
+// 1. Ведра токенов по IP клиента, по токену сессии и по vk_profile.
+//    Пустое ведро -- сразу 429 с Retry-After.
+// 2. Проверку перегрузки: слишком много запросов в обработке (обработчики
+//    ждут VK во вложенном цикле событий, и новые запросы копятся) или
+//    среднее время обработки выше порога -- сразу 503.
+// Настройки в секции [ratelimit], rate 0 выключает ведро.
+namespace ratelimit {
+    // Набор ведер токенов, по одному на ключ: rate токенов в секунду,
+    // не больше burst в запасе. Новый ключ начинает с полным ведром.
+    class Limiter {
+    public:
+        Limiter(double rate, double burst, qsizetype max_keys);
+
+        // Забирает токен. false -- ведро пусто, retry_after_ms -- когда
+        // появится следующий токен.
+        bool take(const QString& key, qint64& retry_after_ms);
+
+        bool enabled() const { return rate_ > 0; }
+    private:
+        struct Bucket {
+            double tokens = 0;
+            qint64 updated_ms = 0;
+        };
+
+        // Выкидывает ведра, которые уже успели наполниться: они ничем не
+        // отличаются от нового.
+        void evict_full(qint64 now_ms);
+
+        const double rate_;
+        const double burst_;
+        const qsizetype max_keys_;
+        QElapsedTimer clock_;
+        QMutex mutex_;
+        QHash<QString, Bucket> buckets_;
+    };
+
+    Limiter& by_ip();
+    Limiter& by_token();
+    Limiter& by_profile();
+
+    // Запрос в обработке: считает глубину очереди и время обработки.
+    class InFlight {
+    public:
+        InFlight();
+        ~InFlight();
+
+        InFlight(const InFlight&) = delete;
+        InFlight& operator=(const InFlight&) = delete;
+    private:
+        QElapsedTimer timer_;
+    };
+
+    // Сервер перегружен и новый запрос лучше сразу отклонить.
+    bool overloaded();
+}
+
+#endif // RATELIMIT_H
@@ -0,0 +1,149 @@
+#include "stream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <QDebug>
+#include <QSqlError>
+
+#include "metrics.h"
+
+namespace stream {
+    static const metrics::Gauge& active_streams() {
+        static const metrics::Gauge gauge = metrics::gauge(
+            "verbov_http_streams_active", "Responses currently streamed from a database snapshot.");
+        return gauge;
+    }
+
+    static const metrics::Counter& streamed_rows() {
+        static const metrics::Counter counter = metrics::counter(
+            "verbov_http_streamed_rows_total", "Rows written into streamed responses.");
+        return counter;
+    }
+
+    Snapshot::~Snapshot() {
+        if (db_.isOpen()) {
+            // Транзакция только читала, откат ничего не теряет.
+            db_.rollback();
+            db_.close();
+        }
+        // removeDatabase ругается, если на соединение еще есть ссылки.
+        db_ = QSqlDatabase();
+        QSqlDatabase::removeDatabase(name_);
+    }
+
+    std::unique_ptr<Snapshot> Snapshot::open(const QSqlDatabase& source) {
+        static std::atomic<quint64> next_id = 0;
+
+        std::unique_ptr<Snapshot> snapshot(new Snapshot());
+        snapshot->name_ = QString("verbov-stream-%1").arg(next_id++);
+        snapshot->db_ = QSqlDatabase::cloneDatabase(source, snapshot->name_);
+        if (!snapshot->db_.open()) {
+            // Failed to open the connection.
+            qCritical() << snapshot->db_.lastError().text();
+            return nullptr;
+        }
+        // Транзакция отложенная: снимок фиксируется первым чтением.
+        if (!snapshot->db_.transaction()) {
+            // Failed to begin the transaction.
+            qCritical() << snapshot->db_.lastError().text();
+            return nullptr;
+        }
+
+        return snapshot;
+    }
+
+    RowStream::RowStream(std::unique_ptr<Snapshot> snapshot, QByteArray head, RowWriter write_row, QByteArray tail)
+        : snapshot_(std::move(snapshot)), write_row_(std::move(write_row)), tail_(std::move(tail)), raw_(std::move(head)) {
+        sink_.setBuffer(&raw_);
+        sink_.open(QIODevice::WriteOnly | QIODevice::Append);
+        out_.setDevice(&sink_);
+        open(QIODevice::ReadOnly);
+        active_streams().add(1);
+    }
+
+    void RowStream::encode(compression::Encoding encoding, int level) {
+        Q_ASSERT(buffer_.isEmpty() && offset_ == 0);
+        encoder_ = std::make_unique<compression::Encoder>(encoding, level);
+    }
+
+    RowStream::~RowStream() {
+        // Курсор в write_row_ держит соединение снимка, закрываем его первым.
+        write_row_ = nullptr;
+        snapshot_.reset();
+        active_streams().add(-1);
+    }
+
+    qint64 RowStream::bytesAvailable() const {
+        // Пока строки не кончились, данные "есть": они будут сериализованы
+        // при чтении. Иначе передача ждала бы readyRead, которого не будет.
+        const qint64 buffered = buffer_.size() - offset_;
+        return buffered + (rows_done_ ? 0 : 1) + QIODevice::bytesAvailable();
+    }
+
+    bool RowStream::atEnd() const {
+        return rows_done_ && offset_ == buffer_.size() && QIODevice::atEnd();
+    }
+
+    void RowStream::fill(qint64 wanted) {
+        // Строки копятся в raw_ и уходят в buffer_ кусками такого размера.
+        static constexpr qsizetype raw_step = 16 * 1024;
+
+        if (offset_ > 0) {
+            // Прочитанное больше не нужно, буфер не растет дальше одного куска.
+            buffer_.remove(0, offset_);
+            offset_ = 0;
+        }
+
+        qint64 rows = 0;
+        while (!rows_done_ && buffer_.size() < wanted) {
+            while (!rows_done_ && raw_.size() < raw_step) {
+                if (write_row_(out_)) {
+                    ++rows;
+                    continue;
+                }
+
+                rows_done_ = true;
+                out_.writeRawData(tail_.constData(), tail_.size());
+                tail_.clear();
+                // Соединение снимка больше не нужно, не держим его до конца передачи.
+                write_row_ = nullptr;
+                snapshot_.reset();
+            }
+            flush_raw(rows_done_);
+        }
+        streamed_rows().inc(rows);
+    }
+
+    void RowStream::flush_raw(bool finish) {
+        if (encoder_) {
+            if (!encoder_->push(raw_.constData(), raw_.size(), finish, buffer_)) {
+                // Тело уже частично отдано, остается только оборвать его.
+                qCritical() << "Failed to compress streamed response";
+                rows_done_ = true;
+                write_row_ = nullptr;
+                snapshot_.reset();
+            }
+        } else {
+            buffer_.append(raw_);
+        }
+        raw_.clear();
+        sink_.seek(0);
+    }
+
+    qint64 RowStream::readData(char* data, qint64 max_size) {
+        if (buffer_.size() - offset_ < max_size) {
+            fill(max_size);
+        }
+
+        const qint64 n = std::min<qint64>(max_size, buffer_.size() - offset_);
+        memcpy(data, buffer_.constData() + offset_, n);
+        offset_ += n;
+        return n;
+    }
+
+    qint64 RowStream::writeData(const char*, qint64) {
+        return -1;
+    }
+}
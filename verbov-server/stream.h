@@ -0,0 +1,86 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <functional>
+#include <memory>
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QDataStream>
+#include <QIODevice>
+#include <QString>
+#include <QtSql/QSqlDatabase>
+
+#include "compression.h"
+#include "lifecycle.h"
+
+// Потоковая отдача больших списков.
+//
+// Обычный ответ собирается целиком в QByteArray, так что пик памяти равен
+// размеру ответа, а первый байт уходит только после разбора последней
+// строки. Здесь строки сериализуются из курсора БД по мере того, как
+// Qt забирает следующий кусок тела для сокета.
+namespace stream {
+    // Отдельное соединение с той же БД, открытое в читающей транзакции.
+    // В режиме WAL снимок не меняется, пока идет отдача, так что число
+    // строк, записанное в начало ответа, совпадает с числом строк в теле.
+    // Запись через основное соединение при этом не блокируется.
+    class Snapshot {
+    public:
+        ~Snapshot();
+
+        // nullptr, если не удалось открыть соединение или транзакцию.
+        static std::unique_ptr<Snapshot> open(const QSqlDatabase& source);
+
+        QSqlDatabase& db() { return db_; }
+    private:
+        Snapshot() = default;
+
+        QString name_;
+        QSqlDatabase db_;
+    };
+
+    // Тело ответа: head, затем строки от write_row, затем tail.
+    // Последовательное устройство только для чтения; в памяти держится
+    // примерно один запрошенный кусок, а не весь ответ.
+    class RowStream : public QIODevice {
+    public:
+        // Пишет следующую строку и возвращает true; false -- строк больше нет.
+        using RowWriter = std::function<bool(QDataStream& out)>;
+
+        RowStream(std::unique_ptr<Snapshot> snapshot, QByteArray head, RowWriter write_row, QByteArray tail);
+        ~RowStream() override;
+
+        // Сжимать тело. Вызывать до первого чтения.
+        void encode(compression::Encoding encoding, int level);
+
+        bool isSequential() const override { return true; }
+        qint64 bytesAvailable() const override;
+        bool atEnd() const override;
+    protected:
+        qint64 readData(char* data, qint64 max_size) override;
+        qint64 writeData(const char* data, qint64 max_size) override;
+    private:
+        // Дописывает строки в buffer_, пока в нем меньше wanted байт.
+        void fill(qint64 wanted);
+        // Переносит накопленное в raw_ в buffer_, сжимая, если надо.
+        void flush_raw(bool finish);
+
+        std::unique_ptr<Snapshot> snapshot_;
+        RowWriter write_row_;
+        QByteArray tail_;
+
+        QByteArray raw_;       // Сериализованные строки, еще не перенесенные в buffer_.
+        QBuffer sink_;         // Пишет в конец raw_.
+        QDataStream out_;
+        std::unique_ptr<compression::Encoder> encoder_;
+
+        QByteArray buffer_;    // Готовое к отдаче тело.
+        qsizetype offset_ = 0; // Уже прочитанная часть buffer_.
+        bool rows_done_ = false;
+
+        lifecycle::Busy busy_; // При остановке сервера ответ дописывается до конца.
+    };
+}
+
+#endif // STREAM_H
@@ -0,0 +1,222 @@
+#include "supervisor.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QTimer>
+#include <QVector>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "lifecycle.h"
+#include "metrics.h"
+
+namespace supervisor {
+    static const char* const worker_variable = "VERBOV_WORKER";
+
+    bool is_worker() {
+        return qEnvironmentVariableIsSet(worker_variable);
+    }
+
+    // Копии и их перезапуск. Все вызовы -- из главного потока.
+    class Workers {
+    public:
+        Workers(QCoreApplication& app, int count)
+            : app_(app), processes_(count, nullptr) {}
+
+        void start_all() {
+            for (int index = 0; index < processes_.size(); ++index) {
+                start(index, 0);
+            }
+        }
+
+        // Каждая новая копия, начав слушать порт, сама останавливает старую
+        // (VERBOV_HANDOFF_PID, как при передаче сокета). Старые копии до
+        // своего завершения лежат в retiring_.
+        void restart_all() {
+            for (int index = 0; index < processes_.size(); ++index) {
+                QProcess* previous = processes_[index];
+                qint64 previous_pid = 0;
+                if (previous != nullptr) {
+                    previous_pid = previous->processId();
+                    retiring_.append({index, previous});
+                    processes_[index] = nullptr;
+                }
+                start(index, previous_pid);
+            }
+        }
+
+        void stop_all() {
+            stopping_ = true;
+            for (QProcess* process: processes_) {
+                if (process != nullptr) {
+                    process->terminate();
+                }
+            }
+            for (const Retiring& old: retiring_) {
+                old.process->terminate();
+            }
+            quit_if_done();
+        }
+    private:
+        struct Retiring {
+            int index;
+            QProcess* process;
+        };
+
+        void start(int index, qint64 previous_pid) {
+            QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+            environment.insert(worker_variable, QString::number(index));
+            if (previous_pid > 0) {
+                environment.insert("VERBOV_HANDOFF_PID", QString::number(previous_pid));
+            }
+
+            auto* process = new QProcess(&app_);
+            process->setProgram(QCoreApplication::applicationFilePath());
+            process->setArguments(QCoreApplication::arguments().mid(1));
+            process->setProcessEnvironment(environment);
+            process->setWorkingDirectory(QDir::currentPath());
+            // Логи копий идут туда же, куда и логи надзирателя.
+            process->setProcessChannelMode(QProcess::ForwardedChannels);
+
+            QObject::connect(process, &QProcess::finished, process, [this, index, process](int exit_code, QProcess::ExitStatus status) {
+                process->deleteLater();
+                if (processes_[index] != process) {
+                    // Старая копия после перезапуска, ее место уже занято.
+                    for (qsizetype i = 0; i < retiring_.size(); ++i) {
+                        if (retiring_[i].process == process) {
+                            retiring_.remove(i);
+                            break;
+                        }
+                    }
+                    if (stopping_) {
+                        quit_if_done();
+                    }
+                    return;
+                }
+                processes_[index] = nullptr;
+
+                if (stopping_) {
+                    quit_if_done();
+                    return;
+                }
+
+                qCritical() << "Worker" << index << "exited with code" << exit_code
+                            << (status == QProcess::CrashExit ? "(crash)" : "") << ", restarting";
+                // Замена упала, не успев остановить старую копию: останавливаем
+                // ее сами. VERBOV_HANDOFF_PID при повторном запуске не передаем --
+                // к тому времени этот pid может принадлежать чужому процессу.
+                for (const Retiring& old: retiring_) {
+                    if (old.index == index) {
+                        old.process->terminate();
+                    }
+                }
+                // Пауза, чтобы копия, падающая сразу при старте, не крутилась в цикле.
+                QTimer::singleShot(1000, &app_, [this, index]() {
+                    if (!stopping_ && processes_[index] == nullptr) {
+                        start(index, 0);
+                    }
+                });
+            });
+
+            processes_[index] = process;
+            process->start();
+        }
+
+        void quit_if_done() {
+            if (!retiring_.isEmpty()) {
+                return;
+            }
+            for (QProcess* process: processes_) {
+                if (process != nullptr) {
+                    return;
+                }
+            }
+            app_.quit();
+        }
+
+        QCoreApplication& app_;
+        QVector<QProcess*> processes_;
+        QVector<Retiring> retiring_;
+        bool stopping_ = false;
+    };
+
+    int run(QCoreApplication& app, int workers) {
+        Workers children(app, workers);
+
+        lifecycle::watch_signals([&children](lifecycle::Signal signal) {
+            if (signal == lifecycle::Signal::Handoff) {
+                qInfo() << "Restarting workers";
+                children.restart_all();
+                return;
+            }
+            if (lifecycle::stopping()) {
+                return;
+            }
+            qInfo() << "Stopping workers";
+            lifecycle::stop();
+            children.stop_all();
+        });
+
+        children.start_all();
+        qInfo() << "Supervisor is up with" << workers << "workers";
+        return app.exec();
+    }
+
+#ifdef Q_OS_UNIX
+    Leader::Leader(const QString& lock_path)
+        : lock_path_(lock_path) {
+        fd_ = ::open(QFile::encodeName(lock_path).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            qCritical() << "failed to open lock file" << lock_path << ":" << strerror(errno);
+        }
+    }
+
+    Leader::~Leader() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool Leader::acquire() {
+        static const metrics::Gauge leader = metrics::gauge(
+            "verbov_notification_leader", "1 if this process sends notifications.");
+
+        if (held_) {
+            return true;
+        }
+        if (fd_ < 0) {
+            return false;
+        }
+        if (::flock(fd_, LOCK_EX | LOCK_NB) != 0) {
+            if (errno != EWOULDBLOCK) {
+                qCritical() << "failed to lock" << lock_path_ << ":" << strerror(errno);
+            }
+            return false;
+        }
+
+        held_ = true;
+        leader.set(1);
+        qInfo() << "This process now sends notifications";
+        return true;
+    }
+#else
+    Leader::Leader(const QString& lock_path)
+        : lock_path_(lock_path) {}
+
+    Leader::~Leader() {}
+
+    bool Leader::acquire() {
+        // Без flock несколько процессов не запускаем, так что ведущий -- мы.
+        return true;
+    }
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <QCoreApplication>
+#include <QString>
+
+// Несколько процессов-обработчиков на одном порту.
+//
+// При server/workers > 1 запущенный процесс становится надзирателем: сам
+// запросы не обрабатывает, а запускает workers копий себя (VERBOV_WORKER
+// -- номер копии) и перезапускает упавшие. Каждая копия слушает тот же
+// host:port с SO_REUSEPORT, и ядро распределяет соединения между ними.
+// БД у всех одна, в режиме WAL читатели не мешают писателю.
+//
+// SIGTERM надзирателю останавливает все копии (каждая доделывает начатое),
+// SIGUSR2 перезапускает их: замены запускаются сразу для всех копий, и
+// каждая, начав слушать порт, останавливает свою старую копию. Порт не
+// остается без слушателя, но на время перезапуска процессов вдвое больше.
+namespace supervisor {
+    // Этот процесс запущен надзирателем.
+    bool is_worker();
+
+    // Работает, пока не остановят. Возвращает код выхода.
+    int run(QCoreApplication& app, int workers);
+
+    // Ровно один процесс из тех, что работают с одной БД, рассылает
+    // уведомления. Ведущий держит flock на файле блокировки; если он
+    // завершился, блокировку освобождает ядро, и ее забирает следующий,
+    // кто спросит.
+    class Leader {
+    public:
+        explicit Leader(const QString& lock_path);
+        ~Leader();
+
+        // true, если ведущий -- этот процесс. Захватывает свободную блокировку.
+        bool acquire();
+
+        Leader(const Leader&) = delete;
+        Leader& operator=(const Leader&) = delete;
+    private:
+        QString lock_path_;
+        int fd_ = -1;
+        bool held_ = false;
+    };
+}
+
+#endif // SUPERVISOR_H
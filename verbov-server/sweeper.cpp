@@ -0,0 +1,81 @@
+#include "sweeper.h"
+
+#include <algorithm>
+
+#include <QElapsedTimer>
+
+#include "DB/storage.h"
+#include "config.h"
+#include "lifecycle.h"
+#include "metrics.h"
+#include "timesource.h"
+#include "trace.h"
+
+void sweeper::run(storage::Storage& storage) {
+    static const metrics::Counter sessions_purged = metrics::counter(
+        "verbov_sessions_purged_total", "Expired sessions deleted by the sweeper.");
+    static const metrics::Counter purge_batches = metrics::counter(
+        "verbov_session_purge_batches_total", "Session purge batches (one transaction each).");
+    static const metrics::Counter budget_exhausted = metrics::counter(
+        "verbov_sweeper_budget_exhausted_total", "Sweeper runs that stopped on the time budget with work left.");
+    static const metrics::Counter events_archived = metrics::counter(
+        "verbov_events_archived_total", "Past events moved to the archive by the sweeper.");
+    static const metrics::Counter pages_freed = metrics::counter(
+        "verbov_vacuum_pages_freed_total", "Database pages returned to the OS by incremental vacuum.");
+    static const metrics::Histogram run_duration = metrics::histogram(
+        "verbov_sweeper_run_duration_seconds", "Duration of one sweeper run.");
+
+    static const int batch_size = std::max<qint64>(config::integer("sweeper/batch_size", 500), 1);
+    static const qint64 budget_ms = config::integer("sweeper/budget_ms", 50);
+    static const int vacuum_pages = config::integer("sweeper/vacuum_pages", 256);
+    static const quint64 archive_after_days = std::max<qint64>(config::integer("sweeper/archive_after_days", 30), 0);
+
+    metrics::ScopedTimer timer(run_duration);
+    trace::Span span("sweeper::run", "sweeper", trace::Span::Kind::Root);
+    lifecycle::Busy busy;
+
+    const quint64 now = timesource::now();
+    QElapsedTimer elapsed;
+    elapsed.start();
+    bool out_of_budget = false;
+
+    // Неполная пачка -- истекших больше нет.
+    qint64 num_purged = batch_size;
+    while (num_purged == batch_size && !lifecycle::stopping()) {
+        if (elapsed.elapsed() >= budget_ms) {
+            out_of_budget = true;
+            break;
+        }
+        if (!storage.purge_expired_sessions(now, batch_size, num_purged)) {
+            break;
+        }
+        purge_batches.inc();
+        sessions_purged.inc(num_purged);
+    }
+
+    // Прошедшие события -- в архив, тем же бюджетом времени: горячая
+    // таблица остается размером с предстоящие события.
+    const quint64 horizon = archive_after_days * 24 * 60 * 60;
+    qint64 num_archived = batch_size;
+    while (archive_after_days > 0 && now > horizon && num_archived == batch_size && !lifecycle::stopping()) {
+        if (elapsed.elapsed() >= budget_ms) {
+            out_of_budget = true;
+            break;
+        }
+        if (!storage.archive_events(now - horizon, batch_size, num_archived)) {
+            break;
+        }
+        events_archived.inc(num_archived);
+    }
+
+    if (out_of_budget) {
+        budget_exhausted.inc();
+    }
+
+    if (vacuum_pages > 0 && !lifecycle::stopping()) {
+        qint64 num_freed = 0;
+        if (storage.vacuum(vacuum_pages, num_freed)) {
+            pages_freed.inc(num_freed);
+        }
+    }
+}
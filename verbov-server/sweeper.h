@@ -0,0 +1,21 @@
+#ifndef SWEEPER_H
+#define SWEEPER_H
+
+namespace storage {
+    class Storage;
+}
+
+// Фоновая уборка: истекшие сессии, прошедшие события и свободные страницы
+// файлов БД.
+//
+// /login добавляет сессию на каждый вход, а истекшие сессии сами не
+// удаляются. Уборка удаляет их пачками по sweeper/batch_size: каждая пачка
+// -- своя короткая транзакция, так что запросы между пачками не ждут.
+// Так же, пачками, события старше sweeper/archive_after_days переносятся в
+// архив. Проход длится не дольше sweeper/budget_ms, остальное -- в следующий
+// раз. Затем до sweeper/vacuum_pages освободившихся страниц отдаются ОС.
+namespace sweeper {
+    void run(storage::Storage& storage);
+}
+
+#endif // SWEEPER_H
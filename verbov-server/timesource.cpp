@@ -0,0 +1,31 @@
+#include "timesource.h"
+
+#include <QDateTime>
+
+namespace timesource {
+    static std::function<quint64()>& source() {
+        static std::function<quint64()> instance;
+        return instance;
+    }
+
+    quint64 now() {
+        const std::function<quint64()>& current = source();
+        if (current) {
+            return current();
+        }
+        return QDateTime::currentSecsSinceEpoch();
+    }
+
+    void set(std::function<quint64()> new_source) {
+        source() = std::move(new_source);
+    }
+
+    Manual::Manual(quint64 start)
+        : now_(start) {
+        timesource::set([this]() { return now_.load(); });
+    }
+
+    Manual::~Manual() {
+        timesource::set(nullptr);
+    }
+}
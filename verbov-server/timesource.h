@@ -0,0 +1,41 @@
+#ifndef TIMESOURCE_H
+#define TIMESOURCE_H
+
+#include <atomic>
+#include <functional>
+
+#include <QtGlobal>
+
+// Текущее время для логики, которая от него зависит: истечение сессий,
+// уровни уведомлений, время регистрации. По умолчанию -- системные часы,
+// в тестах и бенчмарках их можно подменить и гнать время вперед.
+//
+// Замеры длительности (QElapsedTimer, метрики) сюда не относятся: они
+// всегда в настоящем времени.
+namespace timesource {
+    // UTC+0 unix time, секунды.
+    quint64 now();
+
+    // Подменяет источник времени; пустой -- снова системные часы. Менять
+    // только до запуска таймеров и потоков, которые читают now().
+    void set(std::function<quint64()> source);
+
+    // Часы, которые идут только по команде. Пока объект жив, now()
+    // берет время из него.
+    class Manual {
+    public:
+        explicit Manual(quint64 start);
+        ~Manual();
+
+        Manual(const Manual&) = delete;
+        Manual& operator=(const Manual&) = delete;
+
+        quint64 current() const { return now_.load(); }
+        void set(quint64 now) { now_ = now; }
+        void advance(quint64 seconds) { now_ += seconds; }
+    private:
+        std::atomic<quint64> now_;
+    };
+}
+
+#endif // TIMESOURCE_H
@@ -0,0 +1,191 @@
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+
+namespace {
+
+// Спанов на поток. Старые перезаписываются.
+constexpr size_t buffer_capacity = 16384;
+
+struct Record {
+    const char* name = nullptr;
+    const char* category = nullptr;
+    QByteArray detail;
+    qint64 start_ns = 0;
+    qint64 duration_ns = 0;
+};
+
+// Буфер пишет только его поток. Мьютекс нужен на время выгрузки,
+// в остальное время он никем не захвачен и стоит дешево.
+struct Buffer {
+    QMutex mutex;
+    qint64 tid = 0;
+    std::vector<Record> records = std::vector<Record>(buffer_capacity);
+    size_t next = 0;
+    bool wrapped = false;
+};
+
+struct Registry {
+    QMutex mutex;
+    // Не освобождаются: спаны завершившихся потоков тоже интересны.
+    std::vector<Buffer*> buffers;
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+std::atomic<double> current_sample_rate {0.0};
+
+// Сэмплирован ли корневой спан, внутри которого мы сейчас находимся.
+thread_local bool thread_sampled = false;
+
+Buffer& local_buffer() {
+    thread_local Buffer* buffer = nullptr;
+    if (buffer == nullptr) {
+        buffer = new Buffer();
+
+        Registry& r = registry();
+        QMutexLocker locker(&r.mutex);
+        buffer->tid = static_cast<qint64>(r.buffers.size()) + 1;
+        r.buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+qint64 now_ns() {
+    // Отсчитываем от первого вызова, в трассировке нужны только разности.
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool should_sample() {
+    const double rate = current_sample_rate.load(std::memory_order_relaxed);
+    if (rate <= 0) {
+        return false;
+    }
+    if (rate >= 1) {
+        return true;
+    }
+
+    thread_local std::mt19937 generator(std::random_device{}());
+    return std::uniform_real_distribution<double>(0.0, 1.0)(generator) < rate;
+}
+
+} // namespace
+
+void trace::set_sample_rate(double rate) {
+    current_sample_rate.store(rate, std::memory_order_relaxed);
+}
+
+double trace::sample_rate() {
+    return current_sample_rate.load(std::memory_order_relaxed);
+}
+
+trace::Span::Span(const char* name, const char* category, Kind kind, QByteArray detail)
+    : name_(name)
+    , category_(category)
+    , detail_(std::move(detail))
+    , root_(kind == Kind::Root)
+{
+    if (root_) {
+        // Вложенный цикл событий (ожидание ответа VK) может начать
+        // обработку другого запроса внутри текущего. Запомним решение
+        // внешнего запроса и вернем его в деструкторе.
+        previous_sampled_ = thread_sampled;
+        thread_sampled = should_sample();
+    }
+
+    recording_ = thread_sampled;
+    if (recording_) {
+        start_ns_ = now_ns();
+    }
+}
+
+trace::Span::~Span() {
+    if (recording_) {
+        const qint64 end_ns = now_ns();
+
+        Buffer& buffer = local_buffer();
+        QMutexLocker locker(&buffer.mutex);
+
+        Record& record = buffer.records[buffer.next];
+        record.name = name_;
+        record.category = category_;
+        record.detail = std::move(detail_);
+        record.start_ns = start_ns_;
+        record.duration_ns = end_ns - start_ns_;
+
+        buffer.next = (buffer.next + 1) % buffer_capacity;
+        if (buffer.next == 0) {
+            buffer.wrapped = true;
+        }
+    }
+
+    if (root_) {
+        thread_sampled = previous_sampled_;
+    }
+}
+
+QByteArray trace::dump_chrome_json() {
+    const qint64 pid = QCoreApplication::applicationPid();
+
+    QJsonArray events;
+
+    Registry& r = registry();
+    QMutexLocker registry_locker(&r.mutex);
+
+    for (Buffer* buffer: r.buffers) {
+        QMutexLocker buffer_locker(&buffer->mutex);
+
+        const size_t first = buffer->wrapped ? buffer->next : 0;
+        const size_t count = buffer->wrapped ? buffer_capacity : buffer->next;
+
+        for (size_t i = 0; i < count; ++i) {
+            const Record& record = buffer->records[(first + i) % buffer_capacity];
+
+            // Complete event ("X"), время в микросекундах.
+            QJsonObject event;
+            event["name"] = record.name;
+            event["cat"] = record.category;
+            event["ph"] = "X";
+            event["ts"] = record.start_ns / 1000.0;
+            event["dur"] = record.duration_ns / 1000.0;
+            event["pid"] = pid;
+            event["tid"] = buffer->tid;
+            if (!record.detail.isEmpty()) {
+                event["args"] = QJsonObject{{"detail", QString::fromUtf8(record.detail)}};
+            }
+
+            events.append(event);
+        }
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+
+    return QJsonDocument(root).toJson(QJsonDocument::JsonFormat::Compact);
+}
+
+void trace::clear() {
+    Registry& r = registry();
+    QMutexLocker registry_locker(&r.mutex);
+
+    for (Buffer* buffer: r.buffers) {
+        QMutexLocker buffer_locker(&buffer->mutex);
+        buffer->next = 0;
+        buffer->wrapped = false;
+    }
+}
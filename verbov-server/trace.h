@@ -0,0 +1,55 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QByteArray>
+
+// Легковесная трассировка запросов.
+// Спаны пишутся в кольцевой буфер своего потока и по запросу выгружаются
+// в формате Chrome trace-event JSON. Его открывают https://ui.perfetto.dev
+// и chrome://tracing.
+// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+//
+// Пишется только доля корневых спанов (обработчиков запросов, тиков
+// уведомлений), заданная set_sample_rate(), вместе со всеми вложенными.
+// Для остальных запросов спан стоит чтения thread_local флага, так что
+// трассировку можно держать включенной в продакшене.
+namespace trace {
+    // 0 -- ничего не пишем, 1 -- пишем все.
+    void set_sample_rate(double rate);
+    double sample_rate();
+
+    class Span {
+    public:
+        enum class Kind {
+            Child,
+            Root,
+        };
+
+        // name и category должны жить до выгрузки, обычно это строковые литералы.
+        Span(const char* name, const char* category, Kind kind = Kind::Child, QByteArray detail = QByteArray());
+        ~Span();
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* name_;
+        const char* category_;
+        QByteArray detail_;
+        qint64 start_ns_ = 0;
+        bool recording_ = false;
+        bool root_ = false;
+        bool previous_sampled_ = false;
+    };
+
+    // Все спаны из буферов всех потоков, от старых к новым.
+    QByteArray dump_chrome_json();
+    void clear();
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Спан до конца текущей области видимости.
+#define TRACE_SPAN(name, category) trace::Span TRACE_CONCAT(trace_span_, __LINE__)(name, category)
+
+#endif // TRACE_H
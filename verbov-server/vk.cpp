@@ -1,6 +1,10 @@
 #include "vk.h"
 
+#include <functional>
+#include <memory>
+
 #include <QEventLoop>
+#include <QHash>
 #include <QJsonDocument>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
@@ -9,16 +13,50 @@
 #include <QUrlQuery>
 #include <QVector>
 
+#include "config.h"
+#include "metrics.h"
+#include "trace.h"
+
 // Group token. Should have messages permission.
-static const QString vk_group_token = "vk1.a.VEl3FFS-HyX3Go3_OYQm1IdiOBNLLcEbY9PDlPhg32zGjJAnoKospAt-iqbeWSwfB252g5i3H6w6MXbSiDkCEqIp0DrX5NTZwVum3D-k64lzj6dUvqm-4VENwXx5xp-ukJDRim5Go-ERSJO5iwIuy0CuL38xTvuKYarhM9yqaK-9dhtdj-xDqghDBUCulTmoNV05cWFlAvf_UeGiDB7a7w";
+// Используется, если в конфигурации не задан vk/token.
+static const QString default_vk_group_token = "vk1.a.VEl3FFS-HyX3Go3_OYQm1IdiOBNLLcEbY9PDlPhg32zGjJAnoKospAt-iqbeWSwfB252g5i3H6w6MXbSiDkCEqIp0DrX5NTZwVum3D-k64lzj6dUvqm-4VENwXx5xp-ukJDRim5Go-ERSJO5iwIuy0CuL38xTvuKYarhM9yqaK-9dhtdj-xDqghDBUCulTmoNV05cWFlAvf_UeGiDB7a7w";
+
+static void count_vkapi_error(const QString& method, int error_code) {
+    metrics::counter(
+        "verbov_vk_api_errors_total", "VK API errors by method and VK error code.",
+        {{"method", method}, {"code", QString::number(error_code)}}
+    ).inc();
+}
 
-static QJsonDocument do_vkapi_request(const QString& method, const QVector<QString>& args, const QVector<QString>& values) {
+// Вызов VK API, который сейчас выполняется. Пока обработчик ждет ответа во
+// вложенном цикле событий, сервер принимает другие запросы, и они могут
+// спросить у VK то же самое. Такие запросы ждут этот же вызов.
+struct Flight {
+    // Свой менеджер на вызов, он и владеет ответом.
+    QScopedPointer<QNetworkAccessManager> netmanager;
+    QJsonDocument result;
+    bool done = false;
+    // Циклы событий тех, кто ждет ответа. Могут быть вложены друг в друга
+    // в любом порядке, так что ответ разбирается в обработчике finished,
+    // а не после exec() первого: иначе вложенные позже ждали бы вечно.
+    QVector<QEventLoop*> waiting;
+    // Вызывается после ответа, если вызов начат без ожидания.
+    std::function<void()> on_done;
+};
+
+// Ключ -- метод и аргументы. Только для идемпотентных чтений.
+// Обработчики маршрутов выполняются в главном потоке, так что без блокировок.
+static QHash<QString, std::shared_ptr<Flight>> flights;
+
+static std::shared_ptr<Flight> start_vkapi_request(const QString& method, const QVector<QString>& args, const QVector<QString>& values) {
     // https://dev.vk.com/ru/api/api-requests
     // https://stackoverflow.com/questions/46943134/how-do-i-write-a-qt-http-get-request
 
+    auto flight = std::make_shared<Flight>();
+
     // Не выделяем на стеке, т.к. объект может быть большой.
     // Выделяем на куче, даем владеть умному указателю, который сам освободит.
-    QScopedPointer<QNetworkAccessManager> netmanager(new QNetworkAccessManager());
+    flight->netmanager.reset(new QNetworkAccessManager());
 
     // Этот выделяют на стеке. Видимо, он не такой уж и большой.
     // Заходим внутрь и видим, что внутри много методов и лишь один
@@ -26,10 +64,15 @@ static QJsonDocument do_vkapi_request(const QString& method, const QVector<QStri
     QNetworkRequest request;
 
     // https://forum.qt.io/topic/137547/sending-parameters-by-get-method-to-rest-api/6
-    QUrl url("https://api.vk.ru/method/" + method);
+    // vk/api_url можно направить на локальный симулятор (verbov-vksim),
+    // например http://127.0.0.1:8090/method/
+    static const QString api_url = config::string("vk/api_url", "https://api.vk.ru/method/");
+    static const QString token = config::string("vk/token", default_vk_group_token);
+
+    QUrl url(api_url + method);
     QUrlQuery query;
     query.addQueryItem("v", "5.199"); // API version, developed for version 5.199.
-    query.addQueryItem("access_token", vk_group_token);
+    query.addQueryItem("access_token", token);
     qInfo() << "args = " << args;
     qInfo() << "values = " << values;
     Q_ASSERT(args.size() == values.size());
@@ -39,32 +82,106 @@ static QJsonDocument do_vkapi_request(const QString& method, const QVector<QStri
     url.setQuery(query);
 
     request.setUrl(url);
+    // Зависший вызов иначе держал бы место в notifications/max_in_flight
+    // (или обработчик запроса) до перезапуска. По истечении ответ приходит
+    // пустым, и это ошибка -1, то есть повторяемая.
+    static const int timeout_ms = config::integer("vk/timeout_ms", 10000);
+    request.setTransferTimeout(timeout_ms);
 
     // Родителем этого объекта должен быть QNetworkManager, по идее, потому
     // с ним освободиться. Не мы выделяли, не мы освобождаем.
-    QNetworkReply* reply = netmanager->get(request);
+    QNetworkReply* reply = flight->netmanager->get(request);
 
-    // Ничего по сути не хранит, просто QObject с методами, которые ждут
-    // события -- завершения запроса в интернет.
-    QEventLoop loop;
-    QObject::connect(netmanager.get(), &QNetworkAccessManager::finished, &loop, &QEventLoop::quit);
-    loop.exec();
+    // Время самого вызова, без ожидания в очереди за другими.
+    auto timer = std::make_shared<metrics::ScopedTimer>(metrics::histogram(
+        "verbov_vk_api_duration_seconds", "VK API call duration by method.", {{"method", method}}
+    ));
 
-    QByteArray result = reply->read(20480);
-    qInfo() << result;
-    QJsonDocument json = QJsonDocument::fromJson(result);
+    Flight* raw = flight.get();
+    QObject::connect(reply, &QNetworkReply::finished, flight->netmanager.get(), [raw, reply, timer]() mutable {
+        timer.reset();
 
-    // Похоже, что у vk api все коды ошибок положительные. Судя по
-    // https://dev.vk.com/ru/method/messages.send
-    // Детально не разбирался.
-    // int code = json["response"].toInt(-1);
-    // Может быть не только код, но и массивы объектов.
-    // Потому просто вернем результат.
+        QByteArray result = reply->read(20480);
+        qInfo() << result;
+        raw->result = QJsonDocument::fromJson(result);
+        raw->done = true;
+
+        // Похоже, что у vk api все коды ошибок положительные. Судя по
+        // https://dev.vk.com/ru/method/messages.send
+        // Детально не разбирался.
+        // int code = json["response"].toInt(-1);
+        // Может быть не только код, но и массивы объектов.
+        // Потому просто вернем результат.
+
+        for (QEventLoop* loop: raw->waiting) {
+            loop->quit();
+        }
+
+        // on_done держит сам вызов, так что забираем его отсюда: после него
+        // raw может быть уже удален.
+        std::function<void()> on_done = std::move(raw->on_done);
+        raw->on_done = nullptr;
+        if (on_done) {
+            on_done();
+        }
+    });
+
+    return flight;
+}
 
-    return json;
+// Ждет ответа во вложенном цикле событий.
+static QJsonDocument wait_vkapi_request(const std::shared_ptr<Flight>& flight) {
+    if (!flight->done) {
+        // Ничего по сути не хранит, просто QObject с методами, которые ждут
+        // события -- завершения запроса в интернет.
+        QEventLoop loop;
+        flight->waiting.append(&loop);
+        loop.exec();
+        flight->waiting.removeOne(&loop);
+    }
+    return flight->result;
+}
+
+// shared -- вызов можно разделить с такими же, уже идущими. Только для
+// чтений: отправка сообщения дважды должна уйти дважды.
+static QJsonDocument do_vkapi_request(const QString& method, const QVector<QString>& args, const QVector<QString>& values, bool shared = false) {
+    trace::Span span("vk::do_vkapi_request", "vk", trace::Span::Kind::Child, method.toUtf8());
+
+    if (!shared) {
+        return wait_vkapi_request(start_vkapi_request(method, args, values));
+    }
+
+    QString key = method;
+    for (const QString& value: values) {
+        key += QChar(0) + value;
+    }
+
+    auto it = flights.constFind(key);
+    if (it != flights.constEnd()) {
+        // Такой же вызов уже идет, ждем его ответа.
+        trace::Span wait_span("vk::wait_shared", "vk", trace::Span::Kind::Child, key.toUtf8());
+        metrics::counter(
+            "verbov_vk_api_shared_total", "VK API calls served by an identical call already in flight, by method.",
+            {{"method", method}}
+        ).inc();
+        metrics::ScopedTimer timer(metrics::histogram(
+            "verbov_vk_api_shared_wait_seconds", "Time spent waiting for an identical VK API call in flight, by method.",
+            {{"method", method}}
+        ));
+        // Копия указателя: запись в flights удалит первый дождавшийся.
+        const std::shared_ptr<Flight> flight = it.value();
+        return wait_vkapi_request(flight);
+    }
+
+    const std::shared_ptr<Flight> flight = start_vkapi_request(method, args, values);
+    flights.insert(key, flight);
+    QJsonDocument result = wait_vkapi_request(flight);
+    // Следующий такой же запрос пойдет в VK заново: кэша здесь нет.
+    flights.remove(key);
+    return result;
 }
 
-static bool vkapi_returned_error(QJsonDocument& document, int& error_code, QString& error_msg) {
+static bool vkapi_returned_error(const QString& method, QJsonDocument& document, int& error_code, QString& error_msg) {
     bool has_error = false;
 
     qInfo() << document["error"]["error_code"].toInt(2);
@@ -79,20 +196,28 @@ static bool vkapi_returned_error(QJsonDocument& document, int& error_code, QStri
         error_msg = document["error"]["error_msg"].toString("no description of error");
     }
 
+    if (has_error) {
+        count_vkapi_error(method, error_code);
+    }
+
     return has_error;
 }
 
 bool vk::get_user(const QString& vk_profile, QString& first_name, QString& last_name, qint64& vk_id, int& error_code, QString& error_msg) {
+    TRACE_SPAN("vk::get_user", "vk");
+
+    // Одновременные /login и /register с одним профилем ждут один вызов.
     QJsonDocument user_id_response = do_vkapi_request(
         "users.get",
         {"user_ids"},
-        {vk_profile}
+        {vk_profile},
+        true
         );
 
     error_code = 0; // 0 is no error for us, -1 is unknown error.
     error_msg.clear();
 
-    if (vkapi_returned_error(user_id_response, error_code, error_msg)) {
+    if (vkapi_returned_error("users.get", user_id_response, error_code, error_msg)) {
         return false;
     }
 
@@ -106,6 +231,29 @@ bool vk::get_user(const QString& vk_profile, QString& first_name, QString& last_
         // это вряд ли, если ответ корректный, все равно будем считать ошибкой).
         error_code = -1;
         error_msg = "unknown error";
+        count_vkapi_error("users.get", error_code);
+        return false;
+    }
+
+    return true;
+}
+
+// Разбор ответа messages.send.
+static bool send_message_succeeded(QJsonDocument& send_msg_response, int& error_code, QString& error_msg) {
+    error_code = 0; // 0 is no error for us, -1 is unknown error.
+    error_msg.clear();
+
+    if (vkapi_returned_error("messages.send", send_msg_response, error_code, error_msg)) {
+        qInfo() << error_code << error_msg;
+        return false;
+    }
+
+    // Нет ни ошибки, ни id сообщения: ответ не дошел или не разобрался.
+    // Ушло ли сообщение, неизвестно, повтор с тем же random_id безопасен.
+    if (send_msg_response["response"].isUndefined()) {
+        error_code = -1;
+        error_msg = "no response";
+        count_vkapi_error("messages.send", error_code);
         return false;
     }
 
@@ -113,6 +261,8 @@ bool vk::get_user(const QString& vk_profile, QString& first_name, QString& last_
 }
 
 bool vk::send_message(qint64 vk_id, const QString& content, qint64 uniqueness_id, int& error_code, QString& error_msg) {
+    TRACE_SPAN("vk::send_message", "vk");
+
     // https://dev.vk.com/ru/method/users.get
     // https://dev.vk.com/ru/method/messages.send
 
@@ -122,13 +272,40 @@ bool vk::send_message(qint64 vk_id, const QString& content, qint64 uniqueness_id
         {QString::number(vk_id), content, QString::number(uniqueness_id)}
     );
 
-    error_code = 0; // 0 is no error for us, -1 is unknown error.
-    error_msg.clear();
+    return send_message_succeeded(send_msg_response, error_code, error_msg);
+}
 
-    if (vkapi_returned_error(send_msg_response, error_code, error_msg)) {
-        qInfo() << error_code << error_msg;
+void vk::send_message_async(qint64 vk_id, const QString& content, qint64 uniqueness_id, std::function<void(int error_code, const QString& error_msg)> done) {
+    std::shared_ptr<Flight> flight = start_vkapi_request(
+        "messages.send",
+        {"user_id", "message", "random_id"},
+        {QString::number(vk_id), content, QString::number(uniqueness_id)}
+    );
+
+    // Вызов живет, пока жив on_done, то есть до ответа.
+    flight->on_done = [flight, done = std::move(done)]() {
+        int error_code = 0;
+        QString error_msg;
+        send_message_succeeded(flight->result, error_code, error_msg);
+        // Мы внутри сигнала ответа, владелец которого -- менеджер.
+        // Удалять его сейчас нельзя.
+        flight->netmanager.take()->deleteLater();
+        done(error_code, error_msg);
+    };
+}
+
+bool vk::is_transient_error(int error_code) {
+    // https://dev.vk.com/ru/reference/errors
+    // 1 -- неизвестная ошибка, 6 -- слишком много запросов в секунду,
+    // 9 -- слишком много однотипных действий, 10 -- внутренняя ошибка сервера.
+    switch (error_code) {
+    case -1:
+    case 1:
+    case 6:
+    case 9:
+    case 10:
+        return true;
+    default:
         return false;
     }
-
-    return true;
 }
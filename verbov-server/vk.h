@@ -1,11 +1,23 @@
 #ifndef VK_H
 #define VK_H
 
+#include <functional>
+
 #include <QString>
 
 namespace vk {
     bool get_user(const QString& vk_profile, QString& first_name, QString& last_name, qint64& vk_id, int& error_code, QString& error_msg);
+    // uniqueness_id -- random_id VK: повтор с тем же значением не
+    // доставляется второй раз. 0 -- без такой защиты.
     bool send_message(qint64 vk_id, const QString& content, qint64 uniqueness_id, int& error_code, QString& error_msg);
+    // То же без ожидания: done вызывается из цикла событий, когда VK
+    // ответит. error_code 0 -- сообщение отправлено.
+    void send_message_async(qint64 vk_id, const QString& content, qint64 uniqueness_id,
+                            std::function<void(int error_code, const QString& error_msg)> done);
+
+    // Ошибка, после которой стоит повторить позже: сеть (-1), внутренняя
+    // ошибка VK, слишком частые запросы.
+    bool is_transient_error(int error_code);
 }
 
 #endif // VK_H
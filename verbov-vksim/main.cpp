@@ -0,0 +1,121 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QHttpServer>
+#include <QThreadPool>
+
+#include "simulator.h"
+
+// "18=0.01,113=0.001"
+static bool parse_error_rates(const QString& spec, QMap<int, double>& rates) {
+    for (const QString& item: spec.split(',', Qt::SkipEmptyParts)) {
+        const QStringList parts = item.split('=');
+        bool is_integer = false;
+        bool is_double = false;
+        const int code = parts.size() == 2 ? parts[0].trimmed().toInt(&is_integer) : 0;
+        const double rate = parts.size() == 2 ? parts[1].trimmed().toDouble(&is_double) : 0;
+
+        if (!is_integer || !is_double || rate < 0 || rate > 1) {
+            qCritical() << "Bad error rate" << item;
+            return false;
+        }
+        rates[code] = rate;
+    }
+    return true;
+}
+
+static bool parse_method_options(const QCommandLineParser& parser,
+                                 const QCommandLineOption& latency_option,
+                                 const QCommandLineOption& errors_option,
+                                 const QCommandLineOption& rate_option,
+                                 vksim::MethodOptions& options) {
+    if (!vksim::Latency::parse(parser.value(latency_option), options.latency)) {
+        qCritical() << "Bad latency" << parser.value(latency_option);
+        return false;
+    }
+    if (!parse_error_rates(parser.value(errors_option), options.error_rates)) {
+        return false;
+    }
+
+    bool is_double = false;
+    options.rate_limit = parser.value(rate_option).toDouble(&is_double);
+    if (!is_double || options.rate_limit < 0) {
+        qCritical() << "Bad rate limit" << parser.value(rate_option);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("verbov-vksim");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Local VK API stand-in (users.get, messages.send) for benchmarks.\n"
+        "Point the server at it with VERBOV_VK_API_URL=http://127.0.0.1:8090/method/\n"
+        "Latency: fixed:MS, uniform:MIN:MAX, normal:MEAN:SD, lognormal:MEDIAN:SIGMA.\n"
+        "Errors: CODE=PROBABILITY,... (VK codes such as 18, 30, 113, 901, 10).");
+    parser.addHelpOption();
+
+    QCommandLineOption host_option("host", "Address to listen on.", "host", "127.0.0.1");
+    QCommandLineOption port_option("port", "Port to listen on.", "port", "8090");
+    QCommandLineOption seed_option("seed", "Random seed.", "n", "1");
+    QCommandLineOption token_option("token", "Accept only this access_token.", "token");
+    QCommandLineOption threads_option("threads", "Max responses waiting for their latency at once.", "n", "256");
+    QCommandLineOption max_messages_option("max-messages", "Messages kept for /sim/messages.", "n", "100000");
+
+    QCommandLineOption users_latency_option("users-get-latency", "users.get latency.", "spec", "fixed:0");
+    QCommandLineOption users_errors_option("users-get-errors", "users.get injected errors.", "spec", "");
+    QCommandLineOption users_rate_option("users-get-rate", "users.get requests per second, 0 = unlimited.", "rps", "0");
+
+    QCommandLineOption send_latency_option("messages-send-latency", "messages.send latency.", "spec", "fixed:0");
+    QCommandLineOption send_errors_option("messages-send-errors", "messages.send injected errors.", "spec", "");
+    QCommandLineOption send_rate_option("messages-send-rate", "messages.send requests per second, 0 = unlimited.", "rps", "0");
+
+    parser.addOptions({host_option, port_option, seed_option, token_option, threads_option, max_messages_option,
+                       users_latency_option, users_errors_option, users_rate_option,
+                       send_latency_option, send_errors_option, send_rate_option});
+    parser.process(app);
+
+    vksim::Options options;
+
+    bool is_integer = false;
+    options.seed = parser.value(seed_option).toUInt(&is_integer);
+    if (!is_integer) {
+        qCritical() << "Bad seed" << parser.value(seed_option);
+        return 1;
+    }
+    options.max_messages = parser.value(max_messages_option).toInt(&is_integer);
+    if (!is_integer || options.max_messages <= 0) {
+        qCritical() << "Bad max messages" << parser.value(max_messages_option);
+        return 1;
+    }
+    options.token = parser.value(token_option);
+
+    if (!parse_method_options(parser, users_latency_option, users_errors_option, users_rate_option, options.users_get) ||
+        !parse_method_options(parser, send_latency_option, send_errors_option, send_rate_option, options.messages_send)) {
+        return 1;
+    }
+
+    const int threads = parser.value(threads_option).toInt(&is_integer);
+    if (!is_integer || threads <= 0) {
+        qCritical() << "Bad threads" << parser.value(threads_option);
+        return 1;
+    }
+    QThreadPool::globalInstance()->setMaxThreadCount(threads);
+
+    vksim::Simulator simulator(options);
+
+    QHttpServer server;
+    simulator.install(server);
+
+    const quint16 port = server.listen(QHostAddress(parser.value(host_option)), parser.value(port_option).toUShort());
+    if (port == 0) {
+        qCritical() << "failed to listen on port";
+        return -1;
+    }
+
+    qInfo() << "VK simulator is up on" << parser.value(host_option) << port;
+    return app.exec();
+}
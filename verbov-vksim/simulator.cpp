@@ -0,0 +1,359 @@
+#include "simulator.h"
+
+#include <cmath>
+
+#include <QDateTime>
+#include <QHttpServer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QThread>
+#include <QtConcurrent>
+
+using namespace vksim;
+
+// https://dev.vk.com/ru/reference/errors
+static QString error_description(int error_code) {
+    switch (error_code) {
+    case 5:   return "User authorization failed: invalid access_token.";
+    case 6:   return "Too many requests per second";
+    case 9:   return "Flood control";
+    case 10:  return "Internal server error";
+    case 18:  return "User was deleted or banned";
+    case 30:  return "This profile is private";
+    case 100: return "One of the parameters specified was missing or invalid";
+    case 113: return "Invalid user id";
+    case 901: return "Can't send messages for users without permission";
+    default:  return "Unknown error occurred";
+    }
+}
+
+// FNV-1a, стабилен между запусками, в отличие от qHash.
+static quint64 stable_hash(const QByteArray& data) {
+    quint64 hash = 14695981039346656037ull;
+    for (char c: data) {
+        hash ^= static_cast<quint8>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static QString random_id_key(qint64 user_id, qint64 random_id) {
+    return QString::number(user_id) + ':' + QString::number(random_id);
+}
+
+bool Latency::parse(const QString& spec, Latency& latency) {
+    const QStringList parts = spec.split(':');
+    if (parts.isEmpty()) {
+        return false;
+    }
+
+    int num_params = 0;
+    if (parts[0] == "fixed") {
+        latency.kind = Kind::Fixed;
+        num_params = 1;
+    } else if (parts[0] == "uniform") {
+        latency.kind = Kind::Uniform;
+        num_params = 2;
+    } else if (parts[0] == "normal") {
+        latency.kind = Kind::Normal;
+        num_params = 2;
+    } else if (parts[0] == "lognormal") {
+        latency.kind = Kind::LogNormal;
+        num_params = 2;
+    } else {
+        return false;
+    }
+
+    if (parts.size() != num_params + 1) {
+        return false;
+    }
+
+    bool is_double = false;
+    latency.a = parts[1].toDouble(&is_double);
+    if (!is_double || latency.a < 0) {
+        return false;
+    }
+    latency.b = 0;
+    if (num_params == 2) {
+        latency.b = parts[2].toDouble(&is_double);
+        if (!is_double || latency.b < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Simulator::Simulator(Options options)
+    : options_(std::move(options))
+    , generator_(options_.seed)
+{
+    clock_.start();
+
+    // Ведро изначально полное.
+    users_get_bucket_.tokens = options_.users_get.rate_limit;
+    messages_send_bucket_.tokens = options_.messages_send.rate_limit;
+
+    messages_.resize(options_.max_messages);
+}
+
+int Simulator::sample_delay_ms(const Latency& latency) {
+    double delay = 0;
+    switch (latency.kind) {
+    case Latency::Kind::Fixed:
+        delay = latency.a;
+        break;
+    case Latency::Kind::Uniform:
+        delay = std::uniform_real_distribution<double>(latency.a, std::max(latency.a, latency.b))(generator_);
+        break;
+    case Latency::Kind::Normal:
+        delay = std::normal_distribution<double>(latency.a, latency.b)(generator_);
+        break;
+    case Latency::Kind::LogNormal:
+        // Медиана логнормального распределения -- exp(mu).
+        delay = latency.a > 0
+            ? std::lognormal_distribution<double>(std::log(latency.a), latency.b)(generator_)
+            : 0;
+        break;
+    }
+    return static_cast<int>(std::max(0.0, delay));
+}
+
+int Simulator::injected_error(const QString& method, const MethodOptions& options, Bucket& bucket, const QUrlQuery& query) {
+    if (!options_.token.isEmpty() && query.queryItemValue("access_token") != options_.token) {
+        return 5;
+    }
+
+    if (options.rate_limit > 0) {
+        // Token bucket емкостью в секунду запросов.
+        const qint64 now_ns = clock_.nsecsElapsed();
+        bucket.tokens = std::min(options.rate_limit, bucket.tokens + (now_ns - bucket.last_ns) / 1e9 * options.rate_limit);
+        bucket.last_ns = now_ns;
+
+        if (bucket.tokens < 1) {
+            return 6;
+        }
+        bucket.tokens -= 1;
+    }
+
+    // Каждую ошибку разыгрываем независимо, в порядке кодов.
+    for (auto it = options.error_rates.constBegin(); it != options.error_rates.constEnd(); ++it) {
+        if (std::uniform_real_distribution<double>(0.0, 1.0)(generator_) < it.value()) {
+            return it.key();
+        }
+    }
+
+    Q_UNUSED(method);
+    return 0;
+}
+
+QByteArray Simulator::error_body(const QString& method, int error_code, const QUrlQuery& query) {
+    stats_[method].errors[error_code] += 1;
+
+    QJsonArray params;
+    params.append(QJsonObject{{"key", "method"}, {"value", method}});
+    for (const auto& [key, value]: query.queryItems(QUrl::ComponentFormattingOption::FullyDecoded)) {
+        if (key != "access_token") {
+            params.append(QJsonObject{{"key", key}, {"value", value}});
+        }
+    }
+
+    QJsonObject error;
+    error["error_code"] = error_code;
+    error["error_msg"] = error_description(error_code);
+    error["request_params"] = params;
+
+    return QJsonDocument(QJsonObject{{"error", error}}).toJson(QJsonDocument::JsonFormat::Compact);
+}
+
+Simulator::Outcome Simulator::users_get(const QUrlQuery& query) {
+    const QString method = "users.get";
+
+    Outcome outcome;
+    outcome.delay_ms = sample_delay_ms(options_.users_get.latency);
+
+    if (const int error_code = injected_error(method, options_.users_get, users_get_bucket_, query)) {
+        outcome.body = error_body(method, error_code, query);
+        return outcome;
+    }
+
+    static const QRegularExpression valid_profile("^[A-Za-z0-9_.]+$");
+    static const QRegularExpression numeric_profile("^(?:id)?([0-9]{1,15})$");
+
+    QJsonArray users;
+    for (const QString& profile: query.queryItemValue("user_ids").split(',')) {
+        if (!valid_profile.match(profile).hasMatch()) {
+            outcome.body = error_body(method, 113, query);
+            return outcome;
+        }
+        if (profile.startsWith("deleted")) {
+            outcome.body = error_body(method, 18, query);
+            return outcome;
+        }
+        if (profile.startsWith("private")) {
+            outcome.body = error_body(method, 30, query);
+            return outcome;
+        }
+
+        qint64 id = 0;
+        const QRegularExpressionMatch numeric = numeric_profile.match(profile);
+        if (numeric.hasMatch()) {
+            id = numeric.captured(1).toLongLong();
+        } else {
+            // Выше диапазона явных id из тестов, чтобы не пересекаться.
+            id = 1000000000 + static_cast<qint64>(stable_hash(profile.toUtf8()) % 1000000000);
+        }
+        if (id == 0) {
+            outcome.body = error_body(method, 113, query);
+            return outcome;
+        }
+
+        if (profile.startsWith("closed")) {
+            closed_ids_.insert(id);
+        }
+
+        QJsonObject user;
+        user["id"] = id;
+        user["first_name"] = "User";
+        user["last_name"] = QString::number(id);
+        user["can_access_closed"] = true;
+        user["is_closed"] = false;
+        users.append(user);
+    }
+
+    stats_[method].ok += 1;
+    outcome.body = QJsonDocument(QJsonObject{{"response", users}}).toJson(QJsonDocument::JsonFormat::Compact);
+    return outcome;
+}
+
+Simulator::Outcome Simulator::messages_send(const QUrlQuery& query) {
+    const QString method = "messages.send";
+
+    Outcome outcome;
+    outcome.delay_ms = sample_delay_ms(options_.messages_send.latency);
+
+    if (const int error_code = injected_error(method, options_.messages_send, messages_send_bucket_, query)) {
+        outcome.body = error_body(method, error_code, query);
+        return outcome;
+    }
+
+    bool is_integer = false;
+    const QString user_id_str = query.hasQueryItem("user_id") ? query.queryItemValue("user_id") : query.queryItemValue("peer_id");
+    const qint64 user_id = user_id_str.toLongLong(&is_integer);
+    if (!is_integer || user_id <= 0 || !query.hasQueryItem("random_id")) {
+        outcome.body = error_body(method, 100, query);
+        return outcome;
+    }
+    const qint64 random_id = query.queryItemValue("random_id").toLongLong();
+
+    if (closed_ids_.contains(user_id)) {
+        outcome.body = error_body(method, 901, query);
+        return outcome;
+    }
+
+    // Повтор с тем же random_id не отправляется, возвращается id первого сообщения.
+    if (random_id != 0) {
+        auto found = sent_random_ids_.constFind(random_id_key(user_id, random_id));
+        if (found != sent_random_ids_.constEnd()) {
+            stats_[method].ok += 1;
+            outcome.body = QJsonDocument(QJsonObject{{"response", *found}}).toJson(QJsonDocument::JsonFormat::Compact);
+            return outcome;
+        }
+    }
+
+    Message& message = messages_[messages_next_];
+    if (message.id != 0 && message.random_id != 0) {
+        sent_random_ids_.remove(random_id_key(message.user_id, message.random_id));
+    }
+    message.id = ++last_message_id_;
+    message.user_id = user_id;
+    message.random_id = random_id;
+    message.text = query.queryItemValue("message", QUrl::ComponentFormattingOption::FullyDecoded);
+    message.time_ms = QDateTime::currentMSecsSinceEpoch();
+    messages_next_ = (messages_next_ + 1) % messages_.size();
+
+    if (random_id != 0) {
+        sent_random_ids_.insert(random_id_key(user_id, random_id), message.id);
+    }
+
+    stats_[method].ok += 1;
+    outcome.body = QJsonDocument(QJsonObject{{"response", message.id}}).toJson(QJsonDocument::JsonFormat::Compact);
+    return outcome;
+}
+
+QByteArray Simulator::messages_json(const QUrlQuery& query) const {
+    bool filter = query.hasQueryItem("user_id");
+    const qint64 user_id = query.queryItemValue("user_id").toLongLong();
+
+    QJsonArray result;
+    // От старых к новым.
+    for (qsizetype i = 0; i < messages_.size(); ++i) {
+        const Message& message = messages_[(messages_next_ + i) % messages_.size()];
+        if (message.id == 0 || (filter && message.user_id != user_id)) {
+            continue;
+        }
+
+        QJsonObject entry;
+        entry["id"] = message.id;
+        entry["user_id"] = message.user_id;
+        entry["random_id"] = message.random_id;
+        entry["message"] = message.text;
+        entry["time_ms"] = message.time_ms;
+        result.append(entry);
+    }
+
+    return QJsonDocument(result).toJson(QJsonDocument::JsonFormat::Compact);
+}
+
+QByteArray Simulator::stats_json() const {
+    QJsonObject result;
+    for (auto it = stats_.constBegin(); it != stats_.constEnd(); ++it) {
+        QJsonObject errors;
+        for (auto error = it->errors.constBegin(); error != it->errors.constEnd(); ++error) {
+            errors[QString::number(error.key())] = error.value();
+        }
+        result[it.key()] = QJsonObject{{"ok", it->ok}, {"errors", errors}};
+    }
+    result["messages_stored"] = qMin<qint64>(last_message_id_, messages_.size());
+    return QJsonDocument(result).toJson(QJsonDocument::JsonFormat::Compact);
+}
+
+// Ответ после задержки. Поток пула спит, пока ждет, так что число
+// одновременно ожидающих ответов ограничено размером пула.
+static QFuture<QHttpServerResponse> respond_later(QByteArray body, int delay_ms) {
+    return QtConcurrent::run([body = std::move(body), delay_ms]() {
+        if (delay_ms > 0) {
+            QThread::msleep(delay_ms);
+        }
+        return QHttpServerResponse(QByteArray("application/json"), body);
+    });
+}
+
+void Simulator::install(QHttpServer& server) {
+    server.route("/method/users.get", [this](const QHttpServerRequest& request) {
+        Outcome outcome = users_get(request.query());
+        return respond_later(std::move(outcome.body), outcome.delay_ms);
+    });
+    server.route("/method/messages.send", [this](const QHttpServerRequest& request) {
+        Outcome outcome = messages_send(request.query());
+        return respond_later(std::move(outcome.body), outcome.delay_ms);
+    });
+
+    // Отправленные сообщения: ?user_id= фильтрует, ?clear=1 очищает после выдачи.
+    // Так бенчмарк достает ссылки подтверждения регистрации.
+    server.route("/sim/messages", [this](const QHttpServerRequest& request) {
+        QHttpServerResponse response(QByteArray("application/json"), messages_json(request.query()));
+        if (request.query().hasQueryItem("clear")) {
+            for (Message& message: messages_) {
+                message = Message();
+            }
+            messages_next_ = 0;
+            sent_random_ids_.clear();
+        }
+        return response;
+    });
+    server.route("/sim/stats", [this]() {
+        return QHttpServerResponse(QByteArray("application/json"), stats_json());
+    });
+}
@@ -0,0 +1,131 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <random>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QUrlQuery>
+#include <QVector>
+
+class QHttpServer;
+
+// Локальная замена VK API: users.get и messages.send в том же формате
+// ответа, что и https://api.vk.ru/method/, с настраиваемыми задержками,
+// ошибками и ограничением частоты. Сервер направляется сюда через vk/api_url.
+//
+// Профили в users.get:
+//   id123 или 123  -- пользователь с этим id;
+//   deleted...     -- ошибка 18 (страница удалена или заблокирована);
+//   private...     -- ошибка 30 (профиль приватный);
+//   closed...      -- пользователь есть, но messages.send ему дает 901;
+//   не [A-Za-z0-9_.] или пусто -- ошибка 113;
+//   остальные      -- пользователь с id из хеша имени.
+namespace vksim {
+    // Распределение задержки ответа, в миллисекундах.
+    struct Latency {
+        enum class Kind {
+            Fixed,     // a
+            Uniform,   // от a до b
+            Normal,    // среднее a, отклонение b
+            LogNormal, // медиана a, sigma b
+        };
+
+        Kind kind = Kind::Fixed;
+        double a = 0;
+        double b = 0;
+
+        // "fixed:5", "uniform:10:50", "normal:40:10", "lognormal:40:0.5".
+        static bool parse(const QString& spec, Latency& latency);
+    };
+
+    struct MethodOptions {
+        Latency latency;
+        // Код ошибки VK -> вероятность ответить ей на любой запрос.
+        QMap<int, double> error_rates;
+        // Запросов в секунду, сверх -- ошибка 6. 0 -- без ограничения.
+        double rate_limit = 0;
+    };
+
+    struct Options {
+        quint32 seed = 1;
+        // Если задан, запросы с другим access_token получают ошибку 5.
+        QString token;
+
+        MethodOptions users_get;
+        MethodOptions messages_send;
+
+        // Сколько последних сообщений хранить для /sim/messages.
+        int max_messages = 100000;
+    };
+
+    struct Message {
+        qint64 id = 0;
+        qint64 user_id = 0;
+        qint64 random_id = 0;
+        QString text;
+        qint64 time_ms = 0;
+    };
+
+    // Все решения (ошибка, задержка, учет сообщения) принимаются в потоке
+    // сервера, так что при одном и том же seed и порядке запросов ответы
+    // одинаковые. Ждут задержку ответы в пуле потоков.
+    class Simulator {
+    public:
+        explicit Simulator(Options options);
+
+        void install(QHttpServer& server);
+
+    private:
+        struct Outcome {
+            QByteArray body;
+            int delay_ms = 0;
+        };
+
+        struct Bucket {
+            double tokens = 0;
+            qint64 last_ns = 0;
+        };
+
+        struct MethodStats {
+            qint64 ok = 0;
+            QMap<int, qint64> errors;
+        };
+
+        Outcome users_get(const QUrlQuery& query);
+        Outcome messages_send(const QUrlQuery& query);
+
+        // Общие проверки: токен, ограничение частоты, случайные ошибки.
+        // Возвращает код ошибки или 0.
+        int injected_error(const QString& method, const MethodOptions& options, Bucket& bucket, const QUrlQuery& query);
+        int sample_delay_ms(const Latency& latency);
+        QByteArray error_body(const QString& method, int error_code, const QUrlQuery& query);
+
+        QByteArray messages_json(const QUrlQuery& query) const;
+        QByteArray stats_json() const;
+
+    private:
+        Options options_;
+        std::mt19937 generator_;
+        QElapsedTimer clock_;
+
+        Bucket users_get_bucket_;
+        Bucket messages_send_bucket_;
+
+        QHash<QString, MethodStats> stats_;
+
+        // id пользователей из профилей closed..., им нельзя писать.
+        QSet<qint64> closed_ids_;
+
+        QVector<Message> messages_; // Кольцевой буфер.
+        qsizetype messages_next_ = 0;
+        qint64 last_message_id_ = 0;
+        // (user_id, random_id) -> id сообщения, как дедупликация в VK.
+        QHash<QString, qint64> sent_random_ids_;
+    };
+}
+
+#endif // SIMULATOR_H